@@ -2,6 +2,10 @@
 
 #include <Arduino.h>
 #include "config.hpp"
+#include "memory_budget.hpp"
+#include "playlist.hpp"
+#include "shuffle.hpp"
+#include "track_library.hpp"
 
 // Centralized application state
 // Step 3: Aggregate scattered global variables into a single structure
@@ -15,12 +19,17 @@ struct AppState {
   bool isPlaying = true;
   bool stopped = false;               // stoped (keeping original spelling for compatibility)
   PlaybackMode playMode = PlaybackMode::Sequential;
+  String playScope = "";              // Folder the folder browser played from: next/previous/random stay below it
   
   // UI state
   bool screenOff = false;
   int savedBrightness = 2;
   bool showDeleteDialog = false;
   bool showID3Page = false;
+  bool showBrowsePage = false;       // Artist/album/genre/year views ('b')
+  bool showFolderPage = false;       // Directory tree, one folder at a time ('o')
+  bool showSearchPage = false;       // Type-to-search (Tab), takes all letter keys while open
+  bool showPlaylistPage = false;     // Entries of the Playlist opened on the folder page
   
   // Battery and time
   int batteryPercent = 0;
@@ -62,16 +71,109 @@ struct AppState {
   // Track switching
   int nextS = 0;  // Request to switch tracks
   bool volUp = false;
+
+  // Play position, published by Task_Audio for the state journal
+  uint32_t playFilePos = 0;
+  uint32_t playTimeSec = 0;
+
+  // Seeking: Task_TFT accumulates key presses and hands the merged offset to Task_Audio
+  int seekAccumSec = 0;              // Not handed over yet
+  unsigned long seekLastInput = 0;
+  unsigned long seekHoldStart = 0;   // 0 = no seek key held
+  unsigned long seekLastStep = 0;
+  int seekRequestSec = 0;            // Valid while seekRequested is set
+  bool seekRequested = false;        // Cleared by Task_Audio once the seek is applied
   
   // File list
-  String audioFiles[MAX_FILES];
-  int fileCount = 0;
+  TrackLibrary tracks;
+
+  // Held while an index is turned into the track to play (Task_Audio) and while the library is renumbered
+  // (rebuild, compaction), so a track change never reads an index of the old numbering and a path of the new
+  SemaphoreHandle_t indexMutex = xSemaphoreCreateMutex();
   
   // Helper methods
   int getBrightness() const {
     return BRIGHTNESS_VALUES[brightnessIndex];
   }
+
+  void lockIndexes() {
+    xSemaphoreTake(indexMutex, portMAX_DELAY);
+  }
+
+  void unlockIndexes() {
+    xSemaphoreGive(indexMutex);
+  }
+
+  // Offset not yet reflected in the playback time (for the time/progress preview while scrubbing)
+  int pendingSeekSec() const {
+    return seekAccumSec + (seekRequested ? seekRequestSec : 0);
+  }
   
+  // Tracks next/previous/random pick from: those below playScope, the whole library without one
+  void scopeRange(int& first, int& count) const {
+    count = 0;
+    if (playScope.length()) tracks.dirRange(playScope, first, count);
+    if (count == 0) {
+      first = 0;
+      count = tracks.count();
+    }
+  }
+
+  // Track step places after index in [first, first + count), wrapping around (a track outside moves to
+  // the start); deleted tracks not compacted yet are stepped over
+  int stepInRange(int first, int count, int index, int step) const {
+    if (count == 0) return 0;
+    int i = index;
+    if (i < first || i >= first + count) {
+      i = first;
+      if (!tracks.deleted(i)) return i;
+    }
+    for (int n = 0; n < count; n++) {
+      i = first + ((i - first + step) % count + count) % count;
+      if (!tracks.deleted(i)) return i;
+    }
+    return index;
+  }
+
+  // Track step places after index in the whole list
+  int stepInList(int index, int step) const {
+    return stepInRange(0, tracks.count(), index, step);
+  }
+
+  // Track step places after index within the scope
+  int stepInScope(int index, int step) const {
+    int first, count;
+    scopeRange(first, count);
+    return stepInRange(first, count, index, step);
+  }
+
+  // Random track of the scope, other than avoid if there is a choice
+  int randomInScope(int avoid) const {
+    int first, count;
+    scopeRange(first, count);
+    if (count <= 1) return first;
+    int index;
+    do {
+      index = random(first, first + count);
+    } while (index == avoid);
+    return tracks.deleted(index) ? stepInRange(first, count, index, 1) : index;
+  }
+
+  // Track next/previous go to (step 1 or -1): the playlist's next entry while one is playing, else the next
+  // track of the scope after from; in Random mode the next or previous one of the shuffle order
+  int nextTrack(int from, int step) const {
+    const bool shuffle = playMode == PlaybackMode::Random;
+    if (Playlist::active()) {
+      int track = Playlist::next(tracks, step, shuffle);
+      if (track >= 0) return track;
+    }
+    if (!shuffle) return stepInScope(from, step);
+    int first, count;
+    scopeRange(first, count);
+    int track = Shuffle::step(tracks, currentPlayingIndex, step, first, count);
+    return track >= 0 ? track : randomInScope(currentPlayingIndex);
+  }
+
   void resetID3Metadata() {
     id3Title = "";
     id3Artist = "";
@@ -81,7 +183,7 @@ struct AppState {
     id3CoverPos = 0;
     id3CoverLen = 0;
     if (id3CoverBuf) {
-      heap_caps_free(id3CoverBuf);
+      MemoryBudget::deallocate(MemoryBudget::Pool::CoverArt, id3CoverBuf, id3CoverSize);
       id3CoverBuf = nullptr;
       id3CoverSize = 0;
     }
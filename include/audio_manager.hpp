@@ -20,12 +20,16 @@ class Audio* getAudioInstance();
 // Returns true if initialization successful
 bool initialize(AppState& appState);
 
-// Connect to audio file on SD card
-void connectToFile(fs::FS& fs, const char* path);
+// Connect to audio file on SD card, optionally resuming at a file position (see Audio::stopSong())
+void connectToFile(fs::FS& fs, const char* path, uint32_t resumeFilePos = 0);
 
 // Stop current playback
 void stop();
 
+// Seek relative to the current position (negative rewinds), call in Task_Audio.
+// Output resumes once SEEK_PREFILL_BYTES are buffered from the new position.
+bool seekBy(int seconds);
+
 // Main audio loop (call in Task_Audio)
 void loop(AppState& appState, bool codecInitialized);
 
@@ -50,6 +54,23 @@ uint32_t getCurrentTime();
 // Get total file duration in seconds
 uint32_t getFileDuration();
 
+// Heap state, to watch fragmentation over long sessions (decoder buffers are kept between tracks)
+struct HeapStats {
+  uint32_t freeInternal;
+  uint32_t largestInternal;    // Largest allocatable block
+  uint32_t minFreeInternal;    // Low-water mark since boot
+  uint32_t freePsram;
+  uint32_t largestPsram;
+  uint8_t fragmentation;       // 0..100 %, 100 - largest block / free
+};
+HeapStats getHeapStats();
+
+// Log getHeapStats() to the serial console
+void logHeapStats(const char* context);
+
+// Log the SD read-ahead counters (read latency, throughput, underruns) to the serial console
+void logReadStats();
+
 // ID3 metadata callback (called by ESP32-audioI2S library)
 void onID3Data(const char* info, AppState& appState);
 
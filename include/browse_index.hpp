@@ -0,0 +1,52 @@
+#pragma once
+
+#include <Arduino.h>
+#include <FS.h>
+#include "track_library.hpp"
+
+// BrowseIndex: tag based views of the library (artist -> album -> track, albums, genres, years)
+// Built from the MetadataDb on its background task into one file of sorted fixed-size entries and a
+// name pool. The browse page reads only the entries of the visible rows, so memory and render time
+// do not grow with the library. Neither does the build: the track rows are spilled to the card and
+// sorted in passes of bounded size, only the artist/album/genre/year names and groups stay in memory.
+// Names are collated case and accent insensitive, with Hangul, kana (hiragana and katakana folded)
+// and CJK ideographs after the Latin names, in that order.
+
+namespace BrowseIndex {
+
+struct Row {
+  String label;
+  uint32_t count = 0;     // Albums or tracks below a group, 0 for a track
+  bool isTrack = false;
+  int track = -1;         // Library index of a track row, -1 if it is no longer in the library
+};
+
+// Write BROWSE_INDEX_FILE for tracks (blocking, background task). Skipped if the file was built from the
+// same library and force is false.
+bool build(fs::FS& fs, const TrackLibrary& tracks, bool force);
+
+// Navigation of the browse page, called from Task_TFT. The page starts at the category level and goes
+// back there whenever the index was rebuilt.
+void refresh(fs::FS& fs);  // Once per frame before the calls below: picks up a rebuilt index
+void reset();
+int depth();             // 0 = categories
+String title();          // Name of the entered group (category name on the first level)
+int rowCount();
+int selected();
+void move(int delta);    // Wraps around
+
+// Open the selected row: a group is entered (returns false); a track returns true and its library index
+bool enter(fs::FS& fs, const TrackLibrary& tracks, int& trackIndex);
+
+// One level up; false at the category level
+bool back();
+
+// Rows [first, first + count) of the current level; returns how many were filled.
+// The last rows read are cached, calling this on every frame only reads the card when the rows change.
+int rows(fs::FS& fs, const TrackLibrary& tracks, int first, int count, Row* out);
+
+// Text helpers of the collation, also used by the SearchIndex
+uint32_t nextCodepoint(const uint8_t*& p);  // Decode one UTF-8 character and advance p
+uint32_t foldCodepoint(uint32_t cp);        // Lower case, fullwidth to ASCII, no Latin-1 accents, katakana to hiragana
+
+}  // namespace BrowseIndex
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <cstddef>  // for size_t
+#include <cstdint>
 
 // Configuration constants and placeholders
 // Step 1: Extract constants and magic numbers from M5mp3.cpp
@@ -29,6 +30,24 @@ constexpr int CARDPUTER_STD_I2S_BCLK = 41;
 constexpr int CARDPUTER_STD_I2S_LRCK = 43;
 constexpr int CARDPUTER_STD_I2S_DOUT = 42;
 
+// microSD card (SPI)
+constexpr int SD_SPI_SCK = 40;
+constexpr int SD_SPI_MISO = 39;
+constexpr int SD_SPI_MOSI = 14;
+constexpr int SD_SPI_CS = 12;
+// Clocks tried in order until the card mounts; slow cards and long traces end up on a lower one
+constexpr uint32_t SD_SPI_CLOCKS_HZ[] = {40000000UL, 26666667UL, 20000000UL, 10000000UL, 4000000UL};
+constexpr uint8_t SD_MAX_OPEN_FILES = 8;                 // Audio, cover, seek index builder, caches
+// Startup self-benchmark (reads an existing audio file, nothing is written); build with
+// -DSTORAGE_BENCHMARK_ON_BOOT=1 to log card throughput, it delays every boot otherwise
+#ifndef STORAGE_BENCHMARK_ON_BOOT
+#define STORAGE_BENCHMARK_ON_BOOT 0
+#endif
+constexpr uint32_t STORAGE_BENCH_SEQ_BYTES = 256 * 1024;
+constexpr uint32_t STORAGE_BENCH_SEQ_CHUNK = 32 * 1024;
+constexpr int STORAGE_BENCH_RANDOM_READS = 32;
+constexpr uint32_t STORAGE_BENCH_RANDOM_SIZE = 4096;
+
 // I2C device addresses and clocks
 constexpr uint8_t ES8311_ADDR = 0x18;
 constexpr uint8_t AW88298_ADDR = 0x36;
@@ -83,13 +102,26 @@ constexpr int ID3_ICON_NEXT_X = ID3_ICON_PLAY_X + ID3_ICON_SIZE + ID3_ICON_GAP;
 constexpr int MODE_X = 150;
 constexpr int MODE_Y = 63;
 
-// File limits
-constexpr int MAX_FILES = 100;
+// File limits (the track library is bounded by the TrackList memory pool well before MAX_FILES)
+constexpr int MAX_FILES = 20000;
+constexpr uint8_t MAX_DIR_DEPTH = 8;  // Subdirectory levels listed below /music
 
 // Cover image scanning
 constexpr size_t COVER_SCAN_MAX = 4096;  // 4KB scan limit
+constexpr size_t COVER_SCAN_READ_SIZE = 1024;  // Bytes per read while scanning for an image signature
+constexpr size_t COVER_APIC_HEADER_MAX = 320;  // Picture frame header (MIME type, description) parsed directly
 constexpr size_t JPEG_SCAN_MAX = 4096;
 constexpr size_t COVER_HEADER_BUF_SIZE = 32;
+constexpr size_t FILE_RANGE_BLOCK_SIZE = 2048;   // Cover art is read through an LRU of blocks this size
+constexpr size_t FILE_RANGE_CACHE_BLOCKS = 8;    // Fewer if the cover art memory budget is smaller
+constexpr uint32_t COVER_CACHE_TASK_STACK = 8192;  // Decodes the cover once per track into a thumbnail
+constexpr int COVER_CACHE_TASK_PRIORITY = 1;        // Below Task_TFT (2) and Task_Audio (3)
+constexpr unsigned long COVER_CACHE_CLEAR_WAIT_MS = 1000;  // clear() waits this long for a running decode
+constexpr unsigned long COVER_PREFILL_IDLE_MS = 5000;      // Thumbnails of other tracks are made after this idle time
+constexpr unsigned long COVER_PREFILL_INTERVAL_MS = 500;   // Pause between tracks, leaves the card to the audio reads
+// Folder art used for tracks without an embedded cover, in order of preference (any case, .jpg/.jpeg/.png)
+constexpr const char* FOLDER_ART_NAMES[] = {"cover", "folder", "front", "album"};
+constexpr size_t JPEG_THUMB_WORKSPACE = 4096;            // TJpgDec work area for the scaled cover decode
 
 // Timing intervals (ms)
 constexpr unsigned long BATTERY_UPDATE_INTERVAL = 30000;
@@ -102,11 +134,111 @@ constexpr unsigned long ID3_SCROLL_DELAY = 1000;
 // Placeholder texts
 constexpr const char* PLACEHOLDER_UNKNOWN_ARTIST = "Unknown Artist";
 constexpr const char* PLACEHOLDER_UNKNOWN_ALBUM = "Unknown Album";
+constexpr const char* PLACEHOLDER_UNKNOWN_GENRE = "Unknown Genre";
+constexpr const char* PLACEHOLDER_UNKNOWN_YEAR = "Unknown Year";
 constexpr const char* PLACEHOLDER_NO_COVER = "No Cover";
 
 // SD card paths
 constexpr const char* MUSIC_DIR = "/music";
 constexpr const char* SCREEN_DIR = "/screen";
+constexpr const char* APP_DATA_DIR = "/.mp3adv";        // Caches and indexes written by the player
+constexpr const char* SEEK_INDEX_FILE = "/.mp3adv/index.bin";
+constexpr const char* THUMB_DIR = "/.mp3adv/thumbs";     // Decoded covers, one raw RGB565 file per track
+constexpr const char* LIBRARY_INDEX_FILE = "/.mp3adv/library.idx";  // Track list, loaded instead of scanning at boot
+constexpr const char* SD_MOUNT_POINT = "/sd";            // VFS path of the card (directory listing via readdir)
+constexpr const char* META_DB_FILE = "/.mp3adv/meta.db";  // Tags and duration of every track
+constexpr const char* BROWSE_INDEX_FILE = "/.mp3adv/browse.idx";  // Artist/album/genre/year views, built from META_DB_FILE
+constexpr const char* SEARCH_INDEX_FILE = "/.mp3adv/search.idx";  // Word prefix and trigram postings of titles, artists, file names
+constexpr const char* SHUFFLE_FILE = "/.mp3adv/shuffle.bin";  // Random mode play order, continued after a reboot
+
+// Library scan and index: both run on a background task while the first tracks already play
+constexpr uint32_t LIBRARY_TASK_STACK = 6144;
+constexpr int LIBRARY_TASK_PRIORITY = 1;                  // Below Task_TFT (2) and Task_Audio (3)
+constexpr uint32_t LIBRARY_SCAN_BATCH = 16;               // Directory entries listed between two pauses
+constexpr uint32_t LIBRARY_SCAN_YIELD_MS = 5;             // Pause that leaves the card to the audio reads
+constexpr unsigned long LIBRARY_COMPACT_IDLE_MS = 3000;   // Deleted tracks are dropped from the list after this long without a key
+
+// Metadata database (tags read straight from the files on a background task, see MetadataDb)
+constexpr size_t META_DB_FRAME_MAX = 512;                // Bytes read of a text frame, longer ones are cut
+constexpr size_t META_DB_SYNC_SCAN = 2048;               // Bytes searched for the first MP3 frame after the tag
+constexpr size_t META_DB_BATCH = 16;                     // Records appended to the store per write
+constexpr size_t META_DB_UNSORTED_MAX = 256;             // New records looked up linearly until the directory is re-sorted
+constexpr size_t META_DB_CACHE_ENTRIES = 16;             // Records kept for the list rows on screen
+constexpr unsigned long META_DB_LOOKUP_WAIT_MS = 5;      // A list row waits this long for the store, else shows the file name
+constexpr uint32_t META_DB_COMPACT_BYTES = 64 * 1024;    // Rewrite the store when this much is superseded
+constexpr unsigned long META_DB_INTERVAL_MS = 20;        // Pause between two tracks, leaves the card to the audio reads
+constexpr uint32_t META_DB_TASK_STACK = 6144;
+constexpr int META_DB_TASK_PRIORITY = 1;                 // Below Task_TFT (2) and Task_Audio (3)
+
+// Browse page ('b'): artist -> album -> track, album, genre and year views read row by row from BROWSE_INDEX_FILE
+constexpr int BROWSE_MAX_DEPTH = 4;                      // Categories, artists, albums, tracks
+constexpr int BROWSE_RESOLVE_WINDOW = 8;                 // Tracks deleted since the build shift indexes down by this many at most
+constexpr size_t BROWSE_BUILD_ROWS = 4096;               // Track rows sorted per build pass at most, 36 B each
+constexpr size_t BROWSE_BUILD_MIN_ROWS = 64;             // Per pass even when the TrackList pool is short
+
+// Folder page ('o'): a directory is listed when it is entered, the last listings are kept
+constexpr int FOLDER_CACHE_ENTRIES = 4;                  // Listings kept (LRU), charged to the TrackList pool
+constexpr size_t FOLDER_LIST_MAX = 1024;                 // Entries kept of one directory
+
+// Playlists (.m3u/.m3u8, opened from the folder page): entry lines found chunk by chunk, paths looked up when needed
+constexpr size_t PLAYLIST_MAX_ENTRIES = 4096;            // 8 B each, charged to the TrackList pool
+constexpr size_t PLAYLIST_READ_CHUNK = 1024;             // Bytes searched for entry lines per frame
+constexpr size_t PLAYLIST_LINE_MAX = 384;                // Longest entry line read
+constexpr int PLAYLIST_RESOLVE_PER_CALL = 8;             // Entries next() looks up at most, the rest is left to pump()
+
+// Search page (Tab): results refined on every key from SEARCH_INDEX_FILE, built next to the browse index
+constexpr size_t SEARCH_QUERY_MAX = 32;                  // Characters of the query
+constexpr size_t SEARCH_MAX_RESULTS = 2048;              // Matches held in RAM, more are reported as "2048+"
+constexpr size_t SEARCH_BUILD_PAIRS = 16 * 1024;         // (key, track) pairs sorted per build pass, 4 B each
+constexpr size_t SEARCH_BUILD_PAIRS_PSRAM = 256 * 1024;  // Same with PSRAM: fewer passes over the tag text
+
+// MP3 seek index (built in the background for files without Xing/VBRI TOC, cached for all tracks)
+constexpr size_t SEEK_INDEX_MAX_POINTS = 2048;   // Points are thinned out (interval doubled) when exceeded
+constexpr uint32_t SEEK_INDEX_COMPACT_BYTES = 64 * 1024;  // Rewrite the store when this much is superseded
+constexpr size_t SEEK_INDEX_READ_SIZE = 4096;    // Bytes read per SD access while scanning frames
+constexpr uint32_t SEEK_INDEX_TASK_STACK = 6144;
+constexpr int SEEK_INDEX_TASK_PRIORITY = 1;       // Below Task_TFT (2) and Task_Audio (3)
+
+// Seeking: ',' rewinds, '/' fast-forwards, holding the key scrubs with increasing steps
+constexpr int SEEK_STEP_SEC = 5;                         // First step and step while the key is held briefly
+constexpr int SEEK_STEP_MAX_SEC = 60;
+constexpr unsigned long SEEK_HOLD_DELAY_MS = 400;        // Held this long before auto-repeat starts
+constexpr unsigned long SEEK_REPEAT_MS = 150;
+constexpr unsigned long SEEK_ACCEL_MS = 1500;            // Step grows by SEEK_STEP_SEC per this much hold time
+constexpr unsigned long SEEK_MERGE_MS = 300;             // Presses closer than this are merged into one seek
+constexpr uint32_t SEEK_PREFILL_BYTES = 16 * 1024;       // Buffered after a seek before output resumes
+
+// SD read-ahead: a reader task on core 0 fills two blocks while Task_Audio decodes
+constexpr uint32_t READ_AHEAD_BLOCK_SIZE = 32 * 1024;    // One FAT cluster on most cards, 0 = synchronous reads
+                                                         // (smaller if the memory budget is tight)
+constexpr int READ_AHEAD_TASK_PRIORITY = 3;              // Above Task_TFT so the SD bus stays busy
+
+// Memory budget: free heap at boot minus a reserve is split between the pools below.
+// Pools get their minimum in priority order (0 = first), then the rest up to their maximum, again by priority.
+// The maximum depends on where the budget comes from (PSRAM if found, internal RAM otherwise). Without PSRAM
+// the input buffer keeps its former ~8 KB and the read-ahead gets two 8 KB blocks: the RAM reserve is an estimate,
+// not a measurement of what is allocated after begin() (task stacks, I2S DMA, decoder).
+struct MemPoolLimits {
+  uint8_t priority;
+  uint32_t minBytes;
+  uint32_t maxRam;
+  uint32_t maxPsram;
+};
+constexpr uint32_t MEM_RESERVE_RAM = 96 * 1024;     // Decoder state, task stacks, SD/FS and display buffers
+constexpr uint32_t MEM_RESERVE_PSRAM = 256 * 1024;
+constexpr MemPoolLimits MEM_POOL_INPUT = {0, 8 * 1024, 8 * 1024, 300 * 1024};         // AudioBuffer (InBuff)
+constexpr MemPoolLimits MEM_POOL_READ_AHEAD = {1, 8 * 1024, 16 * 1024, 64 * 1024};    // 2 blocks, see above
+constexpr MemPoolLimits MEM_POOL_COVER_ART = {3, 0, 56 * 1024, 128 * 1024};           // Thumbnails, file blocks, JPEG decode
+constexpr MemPoolLimits MEM_POOL_TRACK_LIST = {2, 4 * 1024, 40 * 1024, 512 * 1024};   // Track library, ~40 B/track; browse build scratch
+
+// Resume state journal (NVS)
+constexpr const char* STATE_NVS_NAMESPACE = "mp3adv";
+constexpr uint8_t STATE_SLOT_COUNT = 4;                   // Snapshots are written round-robin
+constexpr unsigned long STATE_SAVE_INTERVAL = 30000;      // Position while playing
+constexpr unsigned long STATE_SETTINGS_DEBOUNCE = 2000;   // Track/volume/mode changes settle before writing
+constexpr unsigned long STATE_PUBLISH_INTERVAL = 1000;    // Task_Audio updates the position in AppState
+constexpr int STATE_LOW_BATTERY_PERCENT = 5;
+constexpr unsigned long SHUFFLE_SAVE_INTERVAL = 10000;    // Shuffle order rewrites (new cycle, track picked by hand)
 
 // Volume and brightness
 constexpr int VOLUME_MIN = 0;
@@ -288,6 +420,15 @@ constexpr int LIST_SCROLL_THRESHOLD = 3;  // Start scrolling when selected index
 constexpr int FILENAME_DISPLAY_MAX_LENGTH = 20;  // Maximum characters to display for filename
 constexpr int TEXT_WIDTH_ESTIMATE_PX = 5;  // Estimated pixels per character for text width calculation
 
+// Browse page
+constexpr int BROWSE_TITLE_Y = 2;
+constexpr int BROWSE_ROWS_Y = 16;
+constexpr int BROWSE_VISIBLE_ROWS = 7;
+constexpr int BROWSE_ROW_HEIGHT = 16;
+constexpr int BROWSE_TEXT_X = 6;
+constexpr int BROWSE_COUNT_X = 234;  // Right edge of the child count column
+constexpr int BROWSE_TEXT_WIDTH = 196;
+
 // Border lines
 constexpr int BORDER_LEFT_X = 3;
 constexpr int BORDER_LEFT_Y = 9;
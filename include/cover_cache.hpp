@@ -0,0 +1,40 @@
+#pragma once
+
+#include <Arduino.h>
+#include "M5Cardputer.h"
+#include "track_library.hpp"
+
+// CoverCache: the embedded cover (or folder image) of the playing track, decoded once into a
+// COVER_WIDTH x COVER_HEIGHT RGB565 thumbnail by a low priority worker task. The ID3 page only blits
+// the thumbnail, the SD card is read once per track instead of on every frame. Thumbnails are kept in the ThumbStore on the card,
+// so after a reboot they are loaded instead of decoded.
+
+namespace CoverCache {
+
+enum class State {
+  None,       // Nothing requested
+  Pending,    // Requested or being decoded
+  Ready,      // Thumbnail available
+  NoCover,    // The tag has no image in a supported format
+  Failed      // File could not be read or out of memory
+};
+
+// Ask for the cover at [pos, pos + len) of path (len 0 = to the end); no-op if it is already requested
+void request(const String& path, size_t pos, size_t len);
+
+// Ask for the folder image of a track without embedded cover (see FolderArt). All tracks of a folder
+// share the request, so the thumbnail is kept across them. The image is looked up once per folder; without
+// one the previous thumbnail is dropped (state None) and the worker is not involved.
+void requestFolderArt(const String& trackPath);
+
+// Store thumbnails of all tracks in the background once nothing was requested for COVER_PREFILL_IDLE_MS,
+// so their covers show without decoding. Tracks without embedded cover store the folder image.
+void prefill(const TrackLibrary& tracks);
+
+// Draw the thumbnail at x, y if it is ready; returns the state either way
+State draw(M5Canvas& dst, int x, int y);
+
+// Drop the thumbnail and wait for a running decode (e.g. before the file is deleted)
+void clear();
+
+}  // namespace CoverCache
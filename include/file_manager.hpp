@@ -15,14 +15,15 @@ struct Callbacks {
   void (*onFileDeleted)(int deletedIndex, int newPlayingIndex) = nullptr;
 };
 
-// List audio files from directory and populate appState.audioFiles
-// Supports recursive directory scanning
-void listFiles(fs::FS& fs, const char* dirname, uint8_t levels, AppState& appState);
-
 // Delete currently selected file from SD card and update appState
-// Handles index adjustments, playback state, and triggers callbacks
+// The track becomes a tombstone in the list, so no other index changes; selection (and playback, if it
+// was the track playing) moves on to the next track. Triggers callbacks.
 void deleteCurrentFile(fs::FS& fs, AppState& appState, const Callbacks& callbacks);
 
+// Drop the tombstones of deleted tracks and move the playing/selected indexes and the shuffle order
+// along. Call when idle (Task_TFT); skipped while a background task walks the list. True if compacted.
+bool compactLibrary(AppState& appState);
+
 // Capture current screen content and save as BMP to SD card
 // Creates /screen directory if it doesn't exist
 void captureScreenshot(fs::FS& fs, M5Canvas& sprite, ESP32Time& rtc);
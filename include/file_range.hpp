@@ -0,0 +1,76 @@
+#pragma once
+
+#include <Arduino.h>
+#include <FS.h>
+#include "M5Cardputer.h"  // lgfx::DataWrapper
+#include "config.hpp"
+
+// FileRange: a window [offset, offset + length) of a file, read through a small LRU block cache
+// It is an lgfx::DataWrapper, so drawJpg()/drawPng() decode straight from it, and positions are
+// relative to the window start. The file handle is kept between draws; close() only drops the
+// handle (it is reopened on the next cache miss), release() also frees the cache.
+
+class FileRange : public lgfx::DataWrapper {
+public:
+  struct Stats {
+    uint32_t hits = 0;
+    uint32_t misses = 0;    // Block reads from the card
+  };
+
+  FileRange() = default;
+  ~FileRange() override;
+
+  // Open path (kept open if it is already the current one) and select a window; length 0 = to the end
+  bool open(fs::FS& fs, const char* path, uint32_t offset, uint32_t length);
+
+  // Move the window within the open file (cached blocks stay valid), position goes to 0
+  void setWindow(uint32_t offset, uint32_t length);
+
+  bool isOpen() const { return m_fs != nullptr; }
+  const String& path() const { return m_path; }
+  uint32_t offset() const { return m_offset; }
+  uint32_t length() const { return m_length; }
+  uint32_t position() const { return m_pos; }
+  uint32_t fileSize() const { return m_fileSize; }
+  uint32_t lastWrite() const { return m_lastWrite; }   // File modification time, for cache keys
+  Stats getStats() const { return m_stats; }
+
+  // lgfx::DataWrapper
+  int read(uint8_t* buf, uint32_t len) override;
+  void skip(int32_t offset) override;
+  bool seek(uint32_t offset) override;
+  void close() override;
+  int32_t tell() override { return m_pos; }
+
+  // One byte, -1 at the end of the window
+  int read();
+
+  // Close the file and free the block cache
+  void release();
+
+private:
+  struct Block {
+    uint32_t index = 0;     // File offset / FILE_RANGE_BLOCK_SIZE
+    uint32_t lastUse = 0;
+    uint16_t len = 0;
+    bool valid = false;
+  };
+
+  const uint8_t* block(uint32_t index, uint32_t& len);
+  bool ensureFile();
+
+  fs::FS* m_fs = nullptr;
+  fs::File m_file;
+  String m_path;
+  uint32_t m_fileSize = 0;
+  uint32_t m_lastWrite = 0;
+  uint32_t m_offset = 0;
+  uint32_t m_length = 0;
+  uint32_t m_pos = 0;
+  uint8_t* m_cache = nullptr;
+  size_t m_cacheBytes = 0;
+  Block m_blocks[FILE_RANGE_CACHE_BLOCKS];
+  size_t m_blockCount = 0;
+  uint32_t m_useTick = 0;
+  Stats m_stats;
+};
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <Arduino.h>
+
+// FolderArt: cover images stored next to the tracks (cover.jpg, folder.jpg, ...)
+// The library scan reports every file it skips, so the lookup costs no extra directory reads.
+// All tracks of a folder resolve to the same image path, the cover cache then shares one thumbnail.
+
+namespace FolderArt {
+
+// Forget all folders (before the directory is listed again)
+void clear();
+
+// A non-audio file fileName was listed in dir; kept if it is a better folder image than the current one.
+// Returns true if it is now the image of dir.
+bool note(const String& dir, const String& fileName);
+
+// Image of the folder containing trackPath; false if the folder has none
+bool find(const String& trackPath, String& imagePath);
+
+// Changes whenever a folder gets another image or all are forgotten, so callers can keep find() results
+uint32_t generation();
+
+}  // namespace FolderArt
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <Arduino.h>
+#include <FS.h>
+
+// FolderBrowser: the card's directory tree, one folder at a time
+// A directory is listed (names only: subfolders first, then tracks and playlists) when it is entered,
+// never the tree below it. The last FOLDER_CACHE_ENTRIES listings are kept, so going back up or into a
+// folder visited recently does not read the card again. Called from Task_TFT only.
+
+namespace FolderBrowser {
+
+struct Row {
+  String name;
+  bool isDir = false;
+};
+
+// Show dir. With "" the page shows the folder it was left in (MUSIC_DIR, or the card root if there is
+// none, the first time).
+void open(fs::FS& fs, const String& dir);
+
+const String& path();      // Folder shown
+int rowCount();
+bool truncated();          // The folder has more than FOLDER_LIST_MAX entries, the rest is not shown
+int selected();
+void move(int delta);      // Wraps around
+
+// Open the selected row: a folder is entered (returns false); a track or playlist returns true and its path
+bool enter(fs::FS& fs, String& trackPath);
+
+// Parent folder, with its row of the folder left selected; false at the card root
+bool back(fs::FS& fs);
+
+// Rows [first, first + count) of the folder; returns how many were filled
+int rows(int first, int count, Row* out);
+
+// Drop the cached listings (after files were deleted); the next open(fs, "") lists the folder again
+void invalidate();
+
+}  // namespace FolderBrowser
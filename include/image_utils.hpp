@@ -2,6 +2,7 @@
 
 #include <Arduino.h>
 #include <FS.h>
+#include "file_range.hpp"
 
 enum class ImageFormat {
   Unknown = 0,
@@ -12,14 +13,25 @@ enum class ImageFormat {
   QOI
 };
 
+// Locate the picture frame (APIC, PIC in ID3v2.2) of an ID3v2 tag at the start of the range.
+// pos/len are the frame data (encoding, MIME type and description precede the image) as the audio
+// library reports them to audio_id3image().
+bool findId3Picture(FileRange& r, uint32_t& pos, uint32_t& len, bool* id3v22 = nullptr);
+
+// Find the image in a picture frame whose data starts at position 0 of the range (frameLen bytes, 0 = unknown).
+// The frame header is parsed, so the offset is exact; a malformed header falls back to findImageStart().
+bool findPictureImage(FileRange& r, size_t frameLen, bool id3v22, size_t& startOff, ImageFormat& format);
+
 // Scan forward from current file position up to maxToScan bytes to find image data.
 // Returns true if a supported image magic is found; outputs startOff relative to the scan start,
 // and detected image format.
 bool findImageStart(fs::File& f, size_t maxToScan, size_t& startOff, ImageFormat& format);
+bool findImageStart(FileRange& r, size_t maxToScan, size_t& startOff, ImageFormat& format);
 
 // Read dimensions for the given format from file at dataPos.
 // On success returns true and sets outW/outH (best-effort).
 bool getImageSize(fs::File& f, size_t dataPos, ImageFormat format, uint32_t& outW, uint32_t& outH);
+bool getImageSize(FileRange& r, size_t dataPos, ImageFormat format, uint32_t& outW, uint32_t& outH);
 
 // Read dimensions for the given format from memory buffer.
 // On success returns true and sets outW/outH (best-effort).
@@ -10,6 +10,9 @@ namespace InputHandler {
 // - 'm': cycle playback mode (SEQ -> RND -> ONE)
 // - 's': screen on/off toggle with brightness restore/save
 // - 'i': toggle ID3 page and reset its scroll timer
+// - 'b': toggle the browse page
+// - 'o': toggle the folder page
+// - Tab: open the search page
 //
 // Returns true if any UI needs immediate redraw.
 bool processBasicToggles(AppState& appState);
@@ -28,6 +31,49 @@ struct Actions {
 // Returns true if anything changed requiring redraw.
 bool processPlaybackAndList(AppState& appState);
 
+// Handle the browse page keys (instead of processPlaybackAndList while it is open):
+// - ';' '.' : move the selection up/down (wrap around)
+// - Enter   : open the selected group, or play the selected track and stay on the page
+// - Backspace: one level up
+//
+// Returns true if anything changed requiring redraw.
+bool processBrowse(AppState& appState);
+
+// Handle the folder page keys (instead of processPlaybackAndList while it is open):
+// - ';' '.' : move the selection up/down (wrap around)
+// - Enter   : enter the selected folder, or play the selected track; next/previous/random then stay
+//             in the folder shown and its subfolders (appState.playScope); a playlist is opened on the
+//             playlist page
+// - Backspace: parent folder
+//
+// Returns true if anything changed requiring redraw.
+bool processFolder(AppState& appState);
+
+// Handle the playlist page keys (over the folder page, instead of processFolder while it is open):
+// - ';' '.' : move the selection up/down (wrap around)
+// - Enter   : play the selected entry; next/previous/random then follow the playlist
+// - Backspace: back to the folder page
+//
+// Returns true if anything changed requiring redraw.
+bool processPlaylist(AppState& appState);
+
+// Handle the keys of the search page (instead of all other handlers while it is open):
+// - letters, digits, space: refine the query
+// - ';' '.' : move the selection up/down (wrap around)
+// - Enter   : play the selected result and stay on the page
+// - Backspace: remove the last character, close the page when the query is empty
+// - Tab     : close the page
+//
+// Returns true if anything changed requiring redraw.
+bool processSearch(AppState& appState);
+
+// Handle seek keys, call on every UI loop iteration (not only on key changes) for hold-to-scrub:
+// - ',' : rewind, '/' : fast-forward; a held key repeats with growing steps
+// Presses are accumulated and handed to Task_Audio as one seek (appState.seekRequested) once input pauses.
+//
+// Returns true if the pending seek changed.
+bool processSeek(AppState& appState);
+
 // Handle delete dialog and screenshot keys:
 // - 'd' : open delete dialog
 // - 'y' : confirm delete (calls actions.deleteCurrentFile if provided)
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <Arduino.h>
+#include "M5Cardputer.h"
+
+// JpegThumb: decode a JPEG straight to thumbnail size
+// TJpgDec's 1/2, 1/4 and 1/8 DCT scaling brings the image close to the target while decoding, a box
+// filter over the decoded rows does the rest. Only a few rows of accumulators are held, never the image.
+
+namespace JpegThumb {
+
+struct Stats {
+  uint16_t srcW = 0;       // JPEG size
+  uint16_t srcH = 0;
+  uint8_t dctScale = 0;    // 0..3 = 1/1 .. 1/8
+  uint16_t outW = 0;       // Thumbnail size (fits dstW x dstH, aspect kept, never enlarged)
+  uint16_t outH = 0;
+  uint32_t decodeMs = 0;
+  uint32_t heapBytes = 0;  // Work area and accumulators
+};
+
+// Decode from src into dst (dstW x dstH pixels, byte-swapped RGB565 as in an M5Canvas buffer), top-left aligned.
+// Pixels outside the image are not touched. Returns false if the JPEG cannot be decoded this way.
+bool decode(lgfx::DataWrapper& src, uint16_t* dst, int dstW, int dstH, Stats* stats = nullptr);
+
+}  // namespace JpegThumb
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <Arduino.h>
+#include <FS.h>
+#include <functional>
+#include "app_state.hpp"
+
+// LibraryIndex: the track list kept in LIBRARY_INDEX_FILE, so boot does not walk the whole card
+// Every listed directory is stored with a fingerprint of its entries (count and a hash of the names)
+// followed by its tracks. At boot the index fills the library right away; once playback started a
+// low priority task lists each directory again (names only, no file is opened) and rescans just the
+// ones whose fingerprint changed. Both tasks pause every LIBRARY_SCAN_BATCH entries so the audio
+// reads always get the card. When either task is done, the MetadataDb is brought up to date.
+
+namespace LibraryIndex {
+
+// Fill appState.tracks (and the folder art) from the index; false if there is no valid index
+bool load(fs::FS& fs, AppState& appState);
+
+struct Progress {
+  bool scanning = false;    // startScan() running
+  bool validating = false;  // startValidation() running
+  int dirs = 0;             // Directories listed (or checked) so far
+};
+
+// Scan MUSIC_DIR (the card root if it has no tracks) on a background task and write the index when done.
+// Tracks show up in appState.tracks as they are found; the first one is played right away.
+bool startScan(fs::FS& fs, AppState& appState);
+
+// Check the index from load() against the card in the background. Changed directories are rescanned,
+// the library is replaced and the index rewritten; the playing and selected tracks keep their place
+// (playback stops if the playing track is gone).
+bool startValidation(fs::FS& fs, AppState& appState);
+
+Progress getProgress();
+
+// Call fn(name, isDir) for every entry of dir right away (no pauses, only the directory is read);
+// false if dir can't be opened. The folder browser lists a directory this way when it is entered.
+bool listDirectory(fs::FS& fs, const String& dir, const std::function<void(const char* name, bool isDir)>& fn);
+
+// True for the file types the library lists (.mp3, .wav)
+bool isAudioFile(const char* name);
+
+}  // namespace LibraryIndex
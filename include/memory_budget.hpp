@@ -0,0 +1,85 @@
+#pragma once
+
+#include <Arduino.h>
+#include <new>
+#include <vector>
+
+// MemoryBudget: one split of the heap between the big buffers of the player
+// begin() detects PSRAM and hands each pool a limit from the MEM_POOL_* settings in config.hpp.
+// Owners ask for their limit when sizing buffers and charge what they actually hold,
+// so the report shows where the memory went.
+
+namespace MemoryBudget {
+
+enum class Pool : uint8_t {
+  Input = 0,   // Audio input buffer (InBuff)
+  ReadAhead,   // SD read-ahead blocks
+  CoverArt,    // id3CoverBuf, cover thumbnails and file blocks, JPEG thumbnail decode
+  TrackList,   // Track library (AppState::tracks), folder art paths, index build scratch
+  Count
+};
+
+struct PoolStats {
+  uint32_t limit = 0;
+  uint32_t used = 0;
+  uint32_t peak = 0;
+  uint32_t denied = 0;   // Requests refused because the pool was full
+};
+
+// Detect PSRAM and compute the pool limits (call once in setup, before the pools are used)
+void begin();
+
+// True if the budget comes from PSRAM
+bool havePsram();
+
+// Bytes a pool may hold
+uint32_t limit(Pool pool);
+
+// Account bytes to a pool; returns false (and charges nothing) if the limit would be exceeded
+bool charge(Pool pool, uint32_t bytes);
+
+// Give bytes charged before back to a pool
+void release(Pool pool, uint32_t bytes);
+
+// Allocate from PSRAM if present (internal RAM otherwise) and charge the pool; nullptr if over budget
+void* allocate(Pool pool, size_t bytes);
+
+// Resize a block from allocate() (nullptr/0 allocates); on failure nullptr, the old block stays valid
+void* reallocate(Pool pool, void* ptr, size_t oldBytes, size_t newBytes);
+
+// Free a block from allocate()
+void deallocate(Pool pool, void* ptr, size_t bytes);
+
+PoolStats getStats(Pool pool);
+
+// Log limit, use and peak of every pool to the serial console
+void logReport(const char* context);
+
+// std::vector allocator charging pool P, for scratch data that grows with the library (index builds).
+// Throws std::bad_alloc when the pool is full; the builder catches it and gives up cleanly.
+template <typename T, Pool P>
+struct Allocator {
+  using value_type = T;
+  template <typename U>
+  struct rebind {
+    using other = Allocator<U, P>;
+  };
+  Allocator() = default;
+  template <typename U>
+  Allocator(const Allocator<U, P>&) {}
+  T* allocate(size_t n) {
+    void* p = MemoryBudget::allocate(P, n * sizeof(T));
+    if (!p) throw std::bad_alloc();
+    return (T*)p;
+  }
+  void deallocate(T* p, size_t n) { MemoryBudget::deallocate(P, p, n * sizeof(T)); }
+  template <typename U>
+  bool operator==(const Allocator<U, P>&) const { return true; }
+  template <typename U>
+  bool operator!=(const Allocator<U, P>&) const { return false; }
+};
+
+template <typename T, Pool P>
+using Vector = std::vector<T, Allocator<T, P>>;
+
+}  // namespace MemoryBudget
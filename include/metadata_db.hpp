@@ -0,0 +1,48 @@
+#pragma once
+
+#include <Arduino.h>
+#include <FS.h>
+#include <functional>
+#include "track_library.hpp"
+
+// MetadataDb: title, artist, album, genre, year and duration of every track in one store on the SD card
+// The tags are read straight from the files (ID3v2.2-2.4, ID3v1, RIFF INFO and "id3 " chunks of WAV files),
+// the decoder is not involved. A low priority task walks the library, parses only tracks that are new or
+// changed (size or modification time) and appends their records; records of tracks gone from the library
+// are dropped when the store is compacted. The list view looks records up instead of opening the tracks.
+
+namespace MetadataDb {
+
+struct Info {
+  String title;
+  String artist;       // Album artist if the track has no artist
+  String album;
+  String genre;        // ID3v1 genre numbers are resolved to names
+  uint16_t year = 0;
+  uint32_t durationMs = 0;  // Xing/VBRI frame count, TLEN or CBR estimate for MP3; 0 if unknown
+};
+
+// Hash of a track's path (FNV-1a) as passed to forEach(); the store itself compares a 64-bit key
+uint32_t hashPath(const char* path);
+
+// Read the tags and the duration of path (blocking); false if the file can't be opened
+bool extract(fs::FS& fs, const char* path, Info& out);
+
+// Record of path from the store; false if the track has none (yet) or the store is not loaded.
+// The last META_DB_CACHE_ENTRIES results are cached, so calling this for every list row on every frame is cheap.
+// Never waits longer than META_DB_LOOKUP_WAIT_MS for the update task, false then as well.
+bool lookup(fs::FS& fs, const String& path, Info& out);
+
+// Call fn with the record of every track in the store, read sequentially (blocking, meant for the
+// background task; records written meanwhile may be missed)
+void forEach(fs::FS& fs, const std::function<void(uint32_t pathHash, const Info& info)>& fn);
+
+// Bring the store up to date with tracks on the background task. If a pass is already running it
+// starts over once more, e.g. after the library was rebuilt. The BrowseIndex and SearchIndex are rebuilt
+// when the pass changed a record or the library changed.
+bool startUpdate(fs::FS& fs, const TrackLibrary& tracks);
+
+// True while the background task is running
+bool isUpdating();
+
+}  // namespace MetadataDb
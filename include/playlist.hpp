@@ -0,0 +1,52 @@
+#pragma once
+
+#include <Arduino.h>
+#include <FS.h>
+#include "track_library.hpp"
+
+// Playlist: a local .m3u/.m3u8 file opened from the folder page
+// Opening reads one chunk; the offsets of the entry lines are collected chunk by chunk after that (one per
+// frame, or at once when playback needs an entry further down), so a playlist of thousands of entries shows
+// at once and holds 8 bytes per entry. An entry's path is read and looked up in the library only when
+// it is shown or comes near the playing entry. Relative paths are taken from the playlist's folder,
+// '\' separators and drive letters of playlists written on a PC are accepted, URLs are skipped.
+
+namespace Playlist {
+
+struct Row {
+  String name;     // File name of the entry
+  int track = -1;  // Library index, -1 if the file is not in the library
+};
+
+bool isPlaylistFile(const char* name);  // .m3u or .m3u8
+
+// Open path (the previous playlist is closed, playback from it stops); false if it cannot be read
+bool open(fs::FS& fs, const String& path);
+void close();
+
+const String& path();  // "" if none is open
+int count();           // Entries found so far
+bool complete();       // The whole file has been read (or PLAYLIST_MAX_ENTRIES reached)
+int selected();
+void move(int delta);  // Wraps around
+
+// Page rows [first, first + count); returns how many were filled. The last rows read are cached.
+int rows(const TrackLibrary& tracks, int first, int count, Row* out);
+
+// Start playing the selected entry: returns its library index, -1 if it is not in the library
+int play(const TrackLibrary& tracks);
+void stop();           // Next/previous leave the playlist (a track was played from another page)
+bool active();         // Next/previous/random follow the playlist
+int position();        // Entry playing, valid while active
+
+// Library index of the entry step places from the playing one, skipping entries not in the library. With
+// shuffle the playlist keeps its own order as Shuffle does for the library: every entry once per cycle, and
+// step -1 goes back through the ones played. -1 if the playlist is not active, none of its entries is in the
+// library or PLAYLIST_RESOLVE_PER_CALL lookups found none (the search goes on from there on the next call)
+int next(const TrackLibrary& tracks, int step, bool shuffle);
+
+// Once per frame from Task_TFT: looks up one entry next() will need (the next ones up to an entry in the library,
+// in the shuffle order if shuffle), else reads the next chunk
+void pump(const TrackLibrary& tracks, bool shuffle);
+
+}  // namespace Playlist
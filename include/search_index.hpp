@@ -0,0 +1,36 @@
+#pragma once
+
+#include <Arduino.h>
+#include <FS.h>
+#include "track_library.hpp"
+
+// SearchIndex: type-to-search over titles, artists and file names
+// Text is folded to lower case ASCII words (accents removed). For every word the index holds its one and
+// two letter prefixes and all its trigrams, each key with a sorted list of the tracks containing it.
+// A query term matches the tracks that have a word starting with its first two letters and contain all
+// its trigrams; terms separated by spaces must all match. Each typed letter adds one key, so refining is
+// one table read and one merge against the previous results. Built on the MetadataDb background task.
+
+namespace SearchIndex {
+
+// Write SEARCH_INDEX_FILE for tracks (blocking, background task). Skipped if the file was built from the
+// same library and force is false.
+bool build(fs::FS& fs, const TrackLibrary& tracks, bool force);
+
+// Search page state, called from Task_TFT
+void refresh(fs::FS& fs);  // Once per frame before the calls below: re-runs the query on a rebuilt index
+bool ready();              // False until an index has been built
+void clear();              // Empty query, no results
+void type(fs::FS& fs, char c);  // Letters, digits and space; other characters are ignored
+void erase(fs::FS& fs);    // Remove the last character
+const String& query();
+int resultCount();
+bool truncated();          // More than SEARCH_MAX_RESULTS matches, only the first ones are kept
+int selected();
+void move(int delta);      // Wraps around
+
+// Library indexes of results [first, first + count); -1 for a track no longer in the library.
+// The last rows read are cached like BrowseIndex::rows().
+int rows(fs::FS& fs, const TrackLibrary& tracks, int first, int count, int* out);
+
+}  // namespace SearchIndex
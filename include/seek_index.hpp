@@ -0,0 +1,59 @@
+#pragma once
+
+#include <Arduino.h>
+#include <FS.h>
+#include <vector>
+
+// SeekIndex: per-track duration and seek table cache
+// MP3 files without Xing/VBRI TOC get a sparse frame-offset index built by walking the frame headers
+// on a low-priority task. Every index (built or taken from the TOC) is kept in one store on the SD card,
+// keyed by path, size and modification time, so a track opens with the exact duration and instant seeks.
+
+namespace SeekIndex {
+
+struct Index {
+  uint32_t durationMs = 0;
+  uint32_t audioDataStart = 0;      // Behind the ID3 tag
+  uint16_t encoderDelay = 0;        // LAME tag, in samples
+  uint16_t encoderPadding = 0;
+  uint32_t intervalUs = 0;          // Time between two consecutive offsets
+  std::vector<uint32_t> offsets;    // Frame start positions relative to the audio data start
+};
+
+// Identifies the content of a file: a record is only used while both match
+struct FileKey {
+  uint32_t size = 0;
+  uint32_t mtime = 0;
+};
+
+// Read size and modification time of path; returns false if it can't be opened
+bool stat(fs::FS& fs, const char* path, FileKey& key);
+
+// Decode an MPEG audio Layer III frame header.
+// Returns the frame length in bytes (0 if invalid) and the samples per frame / sample rate.
+uint32_t parseFrameHeader(const uint8_t* h, uint16_t& samplesPerFrame, uint32_t& sampleRate);
+
+// Walk all MP3 frame headers of the file starting at audioDataStart (blocking, meant for the worker task).
+// cancel is polled between reads; returns false if cancelled, on read error or if no valid frame was found.
+bool buildMp3(fs::FS& fs, const char* path, uint32_t audioDataStart, Index& out, volatile bool* cancel = nullptr);
+
+// Look up / store the index of a file in SEEK_INDEX_FILE. A record is replaced when the file changed or the
+// decoder found the audio data elsewhere (the offsets are relative to audioDataStart, the caller checks it once
+// the header is parsed); superseded records are dropped once enough of them accumulated.
+bool load(fs::FS& fs, const char* path, const FileKey& key, Index& out);
+bool save(fs::FS& fs, const char* path, const FileKey& key, const Index& index);
+
+// Start building the index of path on the background task, the result is saved to the store.
+// Returns false if the task could not be created or a cancelled build is still finishing (retry later).
+bool startBuild(fs::FS& fs, const char* path, const FileKey& key, uint32_t audioDataStart);
+
+// Cancel a running build, e.g. on track change
+void cancelBuild();
+
+// True while the background task is running
+bool isBuilding();
+
+// Take the finished index for path; returns false if no result for this path is ready
+bool takeResult(const char* path, Index& out);
+
+}  // namespace SeekIndex
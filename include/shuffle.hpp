@@ -0,0 +1,35 @@
+#pragma once
+
+#include <Arduino.h>
+#include <FS.h>
+#include <vector>
+#include "track_library.hpp"
+
+// Shuffle: the play order of Random mode, a permutation of the library (16 bits per track)
+// Positions up to the cursor are the tracks played, in the order they played; the rest is still to come,
+// so every track plays once per cycle and 'p' walks back through what actually played. A track picked by
+// hand is moved to the cursor. Tracks added to the library are shuffled into the part still to come,
+// a deleted track is taken out. The order is saved to SHUFFLE_FILE and continues after a reboot.
+
+namespace Shuffle {
+
+// Load SHUFFLE_FILE on first use
+void begin(fs::FS& fs);
+
+// Track step places (1 or -1) from current in the play order, only tracks in [first, first + count).
+// Returns -1 if no order could be kept (memory budget).
+int step(const TrackLibrary& tracks, int current, int step, int first, int count);
+
+// Take the track at index out of the order (when it is deleted)
+void remove(int index);
+
+// Follow TrackLibrary::compact(): removed are the indexes it returned
+void compact(const std::vector<int>& removed);
+
+// Drop the order (the library was rebuilt, indexes mean other tracks), a new one is shuffled on use
+void reset();
+
+// From the main loop: write the order if it changed, at most every SHUFFLE_SAVE_INTERVAL
+void save();
+
+}  // namespace Shuffle
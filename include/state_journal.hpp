@@ -0,0 +1,35 @@
+#pragma once
+
+#include <Arduino.h>
+#include "app_state.hpp"
+
+// StateJournal: persist the playing track, position and settings across reboots
+// Snapshots go round-robin into a few NVS slots with a sequence number and CRC,
+// so a write interrupted by power loss leaves the previous snapshot intact.
+
+namespace StateJournal {
+
+struct Snapshot {
+  uint32_t filePos = 0;        // Audio::connecttoFS() resume position
+  uint32_t playTimeSec = 0;
+  uint8_t volume = 0;
+  uint8_t brightnessIndex = 0;
+  uint8_t playMode = 0;
+  bool stopped = false;
+  String path;
+};
+
+// Read the newest valid snapshot; returns false if none was written yet
+bool load(Snapshot& out);
+
+// Apply volume, brightness and mode of a snapshot to appState (call before audio/display init)
+void applySettings(const Snapshot& snap, AppState& appState);
+
+// Write a snapshot of appState now (e.g. before a deliberate power-off)
+bool saveNow(const AppState& appState);
+
+// Call periodically (main loop): writes on track/settings changes, every STATE_SAVE_INTERVAL
+// while playing and once when the battery runs low. Unchanged state is never rewritten.
+void update(const AppState& appState);
+
+}  // namespace StateJournal
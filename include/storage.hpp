@@ -0,0 +1,27 @@
+#pragma once
+
+#include <Arduino.h>
+#include <FS.h>
+
+// Storage: SD card mount and throughput check
+// The card is mounted over SPI with the fastest clock from SD_SPI_CLOCKS_HZ that works.
+
+namespace Storage {
+
+struct BenchResult {
+  uint32_t seqKBps = 0;         // Sequential reads of STORAGE_BENCH_SEQ_CHUNK
+  uint32_t randKBps = 0;        // Random reads of STORAGE_BENCH_RANDOM_SIZE
+  uint32_t randAvgUs = 0;
+  uint32_t randMaxUs = 0;
+};
+
+// Start the SPI bus and mount the card; returns false if no clock worked
+bool begin();
+
+// SPI clock the card was mounted with (0 if not mounted)
+uint32_t getClockHz();
+
+// Read benchmark on an existing file (nothing is written to the card)
+bool benchmark(fs::FS& fs, const char* path, BenchResult& out);
+
+}  // namespace Storage
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <Arduino.h>
+#include <FS.h>
+
+// ThumbStore: decoded cover thumbnails on the SD card (THUMB_DIR), so a cover is decoded once, not once per boot
+// One file per track: a header with the track identity followed by the raw pixels as the canvas holds them.
+// A track without a usable image gets a header-only entry, so it is not decoded again either.
+
+namespace ThumbStore {
+
+// Identity of a cover: changes when the file is replaced or retagged
+struct Key {
+  uint32_t pathHash = 0;
+  uint32_t fileSize = 0;
+  uint32_t mtime = 0;
+  uint32_t coverPos = 0;
+  uint32_t coverLen = 0;
+};
+
+enum class Result { Missing, Image, NoCover };
+
+Key makeKey(const char* path, uint32_t fileSize, uint32_t mtime, uint32_t coverPos, uint32_t coverLen);
+
+// Read the thumbnail (COVER_WIDTH x COVER_HEIGHT pixels) for key
+Result load(fs::FS& fs, const Key& key, uint16_t* pixels);
+
+// True if an entry (image or no-cover) for key exists, reads only the header
+bool contains(fs::FS& fs, const Key& key);
+
+// Store a thumbnail, pixels nullptr stores a no-cover entry
+bool save(fs::FS& fs, const Key& key, const uint16_t* pixels);
+
+}  // namespace ThumbStore
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <Arduino.h>
+#include <vector>
+
+// TrackLibrary: the list of audio files, compact enough for thousands of tracks
+// Directory paths are stored once and shared by their tracks; file names live in one text arena
+// and tracks refer to them by 32-bit offset (8 bytes per track plus the name). The arrays come from
+// the TrackList memory pool and grow as files are added. Access is guarded by a mutex, so
+// Task_TFT and Task_Audio may read while the list changes.
+// A removed track only leaves a tombstone, so the index of every other track stays valid (playing,
+// selected, shuffle order, search results); compact() drops the tombstones later, when idle.
+
+class TrackLibrary {
+ public:
+  TrackLibrary();
+  ~TrackLibrary();
+  TrackLibrary(const TrackLibrary&) = delete;
+  TrackLibrary& operator=(const TrackLibrary&) = delete;
+
+  // Append a track ("/dir/name.mp3"); false if the memory budget is exhausted
+  bool add(const char* path);
+
+  // Remove the track at index: its slot stays as a tombstone, no other index changes
+  void remove(int index);
+
+  // Drop the tombstones, the following tracks move down. Returns the indexes removed (ascending) for
+  // compactedIndex(); empty if there were none.
+  std::vector<int> compact();
+
+  // Index after compact() of the track at index before it (removed: the track that followed it)
+  static int compactedIndex(const std::vector<int>& removed, int index);
+
+  // Remove all tracks and free the arrays
+  void clear();
+
+  // Exchange the contents with other (e.g. a library rebuilt in the background)
+  void swap(TrackLibrary& other);
+
+  // Slots, tombstones included: valid indexes are [0, count)
+  int count() const { return m_count; }
+
+  bool deleted(int index) const;
+  int deletedCount() const { return m_deleted; }
+
+  // Changes whenever indexes change meaning (remove, compact, swap, clear), not when tracks are added
+  uint32_t generation() const { return m_generation; }
+
+  // Full path of the track at index ("" if out of range or deleted)
+  String path(int index) const;
+
+  // File name (without directory) of the track at index ("" if out of range or deleted)
+  String name(int index) const;
+
+  // Index of the track with this path, -1 if not in the library
+  int find(const String& path) const;
+
+  // Tracks in dir and its subdirectories: [first, first + count). Tracks are added directory by
+  // directory, a folder before its subfolders, so they are one range (tombstones may lie inside);
+  // count is 0 if there are none.
+  void dirRange(const String& dir, int& first, int& count) const;
+
+  // Bytes held by the arrays (capacity, not only what is used)
+  size_t memoryUsed() const;
+
+ private:
+  static constexpr uint16_t DELETED_DIR = UINT16_MAX;
+
+  struct Track {
+    uint32_t nameOff;   // Offset of the name in m_text
+    uint16_t dir;       // Index in m_dirs, DELETED_DIR for a tombstone
+    uint16_t nameLen;
+  };
+  struct Dir {
+    uint32_t off;       // Offset of the path in m_text (no trailing '/')
+    uint16_t len;
+  };
+
+  int internDir(const char* dir, size_t len);
+  uint32_t appendText(const char* s, size_t len);
+  void lock() const;
+  void unlock() const;
+
+  SemaphoreHandle_t m_mutex = nullptr;
+  char* m_text = nullptr;         // Directory paths and names, each NUL terminated
+  uint32_t m_textUsed = 0;
+  uint32_t m_textCap = 0;
+  Track* m_tracks = nullptr;
+  int m_count = 0;
+  int m_deleted = 0;              // Tombstones among the m_count tracks
+  uint32_t m_generation = 0;
+  int m_trackCap = 0;
+  Dir* m_dirs = nullptr;
+  int m_dirCount = 0;
+  int m_dirCap = 0;
+  int m_lastDir = -1;             // Tracks are added directory by directory
+};
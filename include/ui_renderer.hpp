@@ -18,6 +18,31 @@ void drawId3Page(M5Canvas& sprite,
                  const unsigned short* grays,
                  const lgfx::U8g2font* (*detectAndGetFont)(const String&));
 
+// Render the browse page (categories, groups and tracks of the BrowseIndex level that is open).
+// Reads only the visible rows from the index file.
+void drawBrowsePage(M5Canvas& sprite,
+                    AppState& appState,
+                    const unsigned short* grays,
+                    const lgfx::U8g2font* (*detectAndGetFont)(const String&));
+
+// Render the folder page: the folder shown by the FolderBrowser, subfolders first.
+void drawFolderPage(M5Canvas& sprite,
+                    AppState& appState,
+                    const unsigned short* grays,
+                    const lgfx::U8g2font* (*detectAndGetFont)(const String&));
+
+// Render the playlist page: the entries of the Playlist open, those not in the library grayed.
+void drawPlaylistPage(M5Canvas& sprite,
+                      AppState& appState,
+                      const unsigned short* grays,
+                      const lgfx::U8g2font* (*detectAndGetFont)(const String&));
+
+// Render the search page: the query and the visible results of the SearchIndex.
+void drawSearchPage(M5Canvas& sprite,
+                    AppState& appState,
+                    const unsigned short* grays,
+                    const lgfx::U8g2font* (*detectAndGetFont)(const String&));
+
 // Render the main view (file list, status bar, controls, etc.)
 // Requires access to RTC, battery function, and font detection.
 // Audio access is now through AudioManager.
@@ -9,6 +9,7 @@
  *
  */
 #include "Audio.h"
+#include <algorithm>
 #include "mp3_decoder/mp3_decoder.h"
 #include "aac_decoder/aac_decoder.h"
 #include "flac_decoder/flac_decoder.h"
@@ -17,137 +18,6 @@
 fs::SDFATFS SD_SDFAT;
 #endif
 
-//---------------------------------------------------------------------------------------------------------------------
-AudioBuffer::AudioBuffer(size_t maxBlockSize) {
-    // if maxBlockSize isn't set use defaultspace (1600 bytes) is enough for aac and mp3 player
-    if(maxBlockSize) m_resBuffSizeRAM  = maxBlockSize;
-    if(maxBlockSize) m_maxBlockSize = maxBlockSize;
-}
-
-AudioBuffer::~AudioBuffer() {
-    if(m_buffer)
-        free(m_buffer);
-    m_buffer = NULL;
-}
-
-void AudioBuffer::setBufsize(int ram, int psram) {
-    if (ram > -1) // -1 == default / no change
-        m_buffSizeRAM = ram;
-    if (psram > -1)
-        m_buffSizePSRAM = psram;
-}
-
-size_t AudioBuffer::init() {
-    if(m_buffer) free(m_buffer);
-    m_buffer = NULL;
-    if(psramInit() && m_buffSizePSRAM > 0) {
-        // PSRAM found, AudioBuffer will be allocated in PSRAM
-        m_f_psram = true;
-        m_buffSize = m_buffSizePSRAM;
-        m_buffer = (uint8_t*) ps_calloc(m_buffSize, sizeof(uint8_t));
-        m_buffSize = m_buffSizePSRAM - m_resBuffSizePSRAM;
-    }
-    if(m_buffer == NULL) {
-        // PSRAM not found, not configured or not enough available
-        m_f_psram = false;
-        m_buffSize = m_buffSizeRAM;
-        m_buffer = (uint8_t*) calloc(m_buffSize, sizeof(uint8_t));
-        m_buffSize = m_buffSizeRAM - m_resBuffSizeRAM;
-    }
-    if(!m_buffer)
-        return 0;
-    m_f_init = true;
-    resetBuffer();
-    return m_buffSize;
-}
-
-void AudioBuffer::changeMaxBlockSize(uint16_t mbs){
-    m_maxBlockSize = mbs;
-    return;
-}
-
-uint16_t AudioBuffer::getMaxBlockSize(){
-    return m_maxBlockSize;
-}
-
-size_t AudioBuffer::freeSpace() {
-    if(m_readPtr >= m_writePtr) {
-        m_freeSpace = (m_readPtr - m_writePtr);
-    } else {
-        m_freeSpace = (m_endPtr - m_writePtr) + (m_readPtr - m_buffer);
-    }
-    if(m_f_start)
-        m_freeSpace = m_buffSize;
-    return m_freeSpace - 1;
-}
-
-size_t AudioBuffer::writeSpace() {
-    if(m_readPtr >= m_writePtr) {
-        m_writeSpace = (m_readPtr - m_writePtr - 1); // readPtr must not be overtaken
-    } else {
-        if(getReadPos() == 0)
-            m_writeSpace = (m_endPtr - m_writePtr - 1);
-        else
-            m_writeSpace = (m_endPtr - m_writePtr);
-    }
-    if(m_f_start)
-        m_writeSpace = m_buffSize - 1;
-    return m_writeSpace;
-}
-
-size_t AudioBuffer::bufferFilled() {
-    if(m_writePtr >= m_readPtr) {
-        m_dataLength = (m_writePtr - m_readPtr);
-    } else {
-        m_dataLength = (m_endPtr - m_readPtr) + (m_writePtr - m_buffer);
-    }
-    return m_dataLength;
-}
-
-void AudioBuffer::bytesWritten(size_t bw) {
-    m_writePtr += bw;
-    if(m_writePtr == m_endPtr) {
-        m_writePtr = m_buffer;
-    }
-    if(bw && m_f_start)
-        m_f_start = false;
-}
-
-void AudioBuffer::bytesWasRead(size_t br) {
-    m_readPtr += br;
-    if(m_readPtr >= m_endPtr) {
-        size_t tmp = m_readPtr - m_endPtr;
-        m_readPtr = m_buffer + tmp;
-    }
-}
-
-uint8_t* AudioBuffer::getWritePtr() {
-    return m_writePtr;
-}
-
-uint8_t* AudioBuffer::getReadPtr() {
-    size_t len = m_endPtr - m_readPtr;
-    if(len < m_maxBlockSize) { // be sure the last frame is completed
-        memcpy(m_endPtr, m_buffer, m_maxBlockSize - len);  // cpy from m_buffer to m_endPtr with len
-    }
-    return m_readPtr;
-}
-
-void AudioBuffer::resetBuffer() {
-    m_writePtr = m_buffer;
-    m_readPtr = m_buffer;
-    m_endPtr = m_buffer + m_buffSize;
-    m_f_start = true;
-    // memset(m_buffer, 0, m_buffSize); //Clear Inputbuffer
-}
-
-uint32_t AudioBuffer::getWritePos() {
-    return m_writePtr - m_buffer;
-}
-
-uint32_t AudioBuffer::getReadPos() {
-    return m_readPtr - m_buffer;
-}
 //---------------------------------------------------------------------------------------------------------------------
 Audio::Audio(bool internalDAC /* = false */, uint8_t channelEnabled /* = I2S_DAC_CHANNEL_BOTH_EN */, uint8_t i2sPort) {
 
@@ -298,6 +168,8 @@ Audio::~Audio() {
     //I2Sstop(m_i2s_num);
     //InBuff.~AudioBuffer(); #215 the AudioBuffer is automatically destroyed by the destructor
     setDefaults();
+    freeDecoderBuffers(CODEC_NONE);
+    setReadAhead(0);
 #ifndef AUDIO_NO_NETWORK
     if(m_playlistBuff) {free(m_playlistBuff); m_playlistBuff = NULL;}
 #endif
@@ -309,9 +181,7 @@ void Audio::setDefaults() {
     stopSong();
     initInBuff(); // initialize InputBuffer if not already done
     InBuff.resetBuffer();
-    MP3Decoder_FreeBuffers();
-    FLACDecoder_FreeBuffers();
-    AACDecoder_FreeBuffers();
+    m_f_decoderReset = true; // decoder buffers are kept and cleared by initializeDecoder(), see freeDecoderBuffers()
 #ifndef AUDIO_NO_NETWORK
     if(m_playlistBuff)   {free(m_playlistBuff);     m_playlistBuff = NULL;} // free if stream is not m3u8
     vector_clear_and_shrink(m_playlistURL);
@@ -353,6 +223,12 @@ void Audio::setDefaults() {
     m_datamode = AUDIO_NONE;
     m_audioCurrentTime = 0;                                 // Reset playtimer
     m_audioFileDuration = 0;
+    m_exactDurationMs = 0;
+    m_seekIntervalUs = 0;
+    m_seekTable.clear(); m_seekTable.shrink_to_fit();
+    m_encoderDelay = 0;
+    m_encoderPadding = 0;
+    m_f_seekRefill = false;
     m_audioDataStart = 0;
     m_audioDataSize = 0;
     m_avr_bitrate = 0;                                      // the same as m_bitrate if CBR, median if VBR
@@ -1160,6 +1036,7 @@ size_t Audio::readAudioHeader(uint32_t bytes){
         else{ // error, skip header
             m_controlCounter = 100;
         }
+        if(m_controlCounter == 100 && getDatamode() == AUDIO_LOCALFILE) mp3_readInfoFrame(); // Xing/VBRI
     }
     if(m_codec == CODEC_M4A){
         int res = read_M4A_Header(InBuff.getReadPtr(), bytes);
@@ -2316,13 +2193,15 @@ size_t Audio::process_m3u8_ID3_Header(uint8_t* packet){
 //---------------------------------------------------------------------------------------------------------------------
 uint32_t Audio::stopSong() {
     uint32_t pos = 0;
+    uint32_t filePos = getFilePos(); // as seen by InBuff, read before the reader task releases the file
+    readAhead_stop();
     if(m_f_running) {
         m_f_running = false;
         if(getDatamode() == AUDIO_LOCALFILE){
 #ifndef AUDIO_NO_NETWORK
             m_streamType = ST_NONE;
 #endif
-            pos = getFilePos() - inBufferFilled();
+            pos = filePos - inBufferFilled();
             audiofile.close();
             AUDIO_INFO("Closing audio file");
         }
@@ -2966,7 +2845,32 @@ void Audio::processLocalFile() {
         availableBytes = min(availableBytes, m_audioDataSize + m_audioDataStart - byteCounter);
     }
 
-    int32_t bytesAddedToBuffer = audiofile.read(InBuff.getWritePtr(), availableBytes);
+    int32_t bytesAddedToBuffer = 0;
+    if(m_readAheadSize && m_controlCounter == 100 && !m_resumeFilePos){ // header is read, stream from the reader task
+        if(!m_f_ra_active){
+            uint32_t endPos = audiofile.size();
+            if(m_audioDataSize) endPos = min(endPos, (uint32_t)(m_audioDataStart + m_audioDataSize));
+            readAhead_start(byteCounter, endPos);
+        }
+        bytesAddedToBuffer = readAhead_read(InBuff.getWritePtr(), availableBytes);
+        if(!bytesAddedToBuffer && availableBytes && m_f_ra_error){ // the reader failed: retry once from here, else the file ends here
+            readAhead_stop();
+            audiofile.seek(m_ra_consumedPos);
+            bytesAddedToBuffer = audiofile.read(InBuff.getWritePtr(), availableBytes);
+            if(bytesAddedToBuffer <= 0){
+                log_w("read error at %u, end of file", byteCounter);
+                f_fileDataComplete = true;
+            }
+        }
+        else if(!bytesAddedToBuffer && availableBytes && InBuff.bufferFilled() < maxFrameSize) m_ra_stats.underruns++;
+    }
+    else{
+        if(m_f_ra_active){ // seek, setFilePos, loop or resume: take the file back from the reader task first
+            readAhead_stop();
+            audiofile.seek(m_ra_consumedPos);
+        }
+        bytesAddedToBuffer = audiofile.read(InBuff.getWritePtr(), availableBytes);
+    }
 
     if(bytesAddedToBuffer > 0) {
         byteCounter += bytesAddedToBuffer;  // Pull request #42
@@ -2980,10 +2884,13 @@ void Audio::processLocalFile() {
             return;
         }
         else{
-            if((InBuff.freeSpace() > maxFrameSize) && (m_file_size - byteCounter) > maxFrameSize){
+            bool f_fill = InBuff.freeSpace() > maxFrameSize;
+            if(m_f_seekRefill && m_seekPrefill) f_fill = f_fill && InBuff.bufferFilled() < m_seekPrefill; // after a seek
+            if(f_fill && (m_file_size - byteCounter) > maxFrameSize){
                 // fill the buffer before playing
                 return;
             }
+            m_f_seekRefill = false;
 
             f_stream = true;
             AUDIO_INFO("stream ready");
@@ -2992,13 +2899,15 @@ void Audio::processLocalFile() {
     }
 
     if(m_resumeFilePos){
+        readAhead_stop(); // the file is accessed directly below, the reader restarts at the new position
         if(m_resumeFilePos < m_audioDataStart) m_resumeFilePos = m_audioDataStart;
         if(m_resumeFilePos > m_file_size) m_resumeFilePos = m_file_size;
         if(m_codec == CODEC_M4A) m_resumeFilePos = m4a_correctResumeFilePos(m_resumeFilePos);
         if(m_codec == CODEC_WAV) {while((m_resumeFilePos % 4) != 0) m_resumeFilePos++;} // must be divisible by four
         if(m_codec == CODEC_FLAC) {m_resumeFilePos = flac_correctResumeFilePos(m_resumeFilePos); FLACDecoderReset();}
         if(m_codec == CODEC_MP3) {m_resumeFilePos = mp3_correctResumeFilePos(m_resumeFilePos);}
-        if(m_avr_bitrate) m_audioCurrentTime = ((m_resumeFilePos - m_audioDataStart) / m_avr_bitrate) * 8;
+        if(!m_seekTable.empty()) m_audioCurrentTime = seekTable_timeForPos(m_resumeFilePos);
+        else if(m_avr_bitrate) m_audioCurrentTime = ((m_resumeFilePos - m_audioDataStart) / m_avr_bitrate) * 8;
         audiofile.seek(m_resumeFilePos);
         InBuff.resetBuffer();
         byteCounter = m_resumeFilePos;
@@ -3011,6 +2920,9 @@ void Audio::processLocalFile() {
         }
         m_resumeFilePos = 0;
         f_stream = false;
+        m_f_seekRefill = true;
+        m_validSamples = 0;                           // drop samples decoded before the seek
+        i2s_zero_dma_buffer((i2s_port_t)m_i2s_num);
     }
 
     // end of file reached? - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
@@ -3046,11 +2958,7 @@ void Audio::processLocalFile() {
         char *afn =strdup(audiofile.name()); // store temporary the name
 #endif
 
-        stopSong();
-        if(m_codec == CODEC_MP3)   MP3Decoder_FreeBuffers();
-        if(m_codec == CODEC_AAC)   AACDecoder_FreeBuffers();
-        if(m_codec == CODEC_M4A)   AACDecoder_FreeBuffers();
-        if(m_codec == CODEC_FLAC) FLACDecoder_FreeBuffers();
+        stopSong(); // the decoder buffers stay allocated for the next file
         AUDIO_INFO("End of file \"%s\"", afn);
         if(audio_eof_mp3) audio_eof_mp3(afn);
         if(afn) {free(afn); afn = NULL;}
@@ -3748,22 +3656,34 @@ bool Audio::parseHttpResponseHeader() { // this is the response to a GET / reque
 }
 #endif // AUDIO_NO_NETWORK
 //---------------------------------------------------------------------------------------------------------------------
+void Audio::freeDecoderBuffers(uint8_t keepCodec){
+    // The decoder buffers are allocated once and reused as long as the codec stays the same, this avoids
+    // heap fragmentation and allocation latency on every track change. Only the buffers of other codecs are freed.
+    bool keepAAC = (keepCodec == CODEC_AAC || keepCodec == CODEC_M4A);
+    if(keepCodec != CODEC_MP3)  MP3Decoder_FreeBuffers();
+    if(!keepAAC)                AACDecoder_FreeBuffers();
+    if(keepCodec != CODEC_FLAC) FLACDecoder_FreeBuffers();
+}
+//---------------------------------------------------------------------------------------------------------------------
 bool Audio:: initializeDecoder(){
+    bool f_reset = m_f_decoderReset; // first call after connecttoXXX(), existing buffers must be cleared
+    m_f_decoderReset = false;
+    freeDecoderBuffers(m_codec);
     switch(m_codec){
         case CODEC_MP3:
-            if(!MP3Decoder_AllocateBuffers()) goto exit;
+            if(!MP3Decoder_AllocateBuffers()) goto exit; // reuses and clears existing buffers
             AUDIO_INFO("MP3Decoder has been initialized, free Heap: %u bytes", ESP.getFreeHeap());
             InBuff.changeMaxBlockSize(m_frameSizeMP3);
             break;
         case CODEC_AAC:
-            if(!AACDecoder_IsInit()){
+            if(!AACDecoder_IsInit() || f_reset){
                 if(!AACDecoder_AllocateBuffers()) goto exit;
                 AUDIO_INFO("AACDecoder has been initialized, free Heap: %u bytes", ESP.getFreeHeap());
                 InBuff.changeMaxBlockSize(m_frameSizeAAC);
             }
             break;
         case CODEC_M4A:
-            if(!AACDecoder_IsInit()){
+            if(!AACDecoder_IsInit() || f_reset){
                 if(!AACDecoder_AllocateBuffers()) goto exit;
                 AUDIO_INFO("AACDecoder has been initialized, free Heap: %u bytes", ESP.getFreeHeap());
                 InBuff.changeMaxBlockSize(m_frameSizeAAC);
@@ -4249,7 +4169,7 @@ void Audio::compute_audioCurrentTime(int bd) {
             // if VBR: m_avr_bitrate is average of the first values of m_bitrate
             sum_bitrate += getBitRate();
             m_avr_bitrate = sum_bitrate / (loop_counter - 20);
-            if(loop_counter == 199 && m_resumeFilePos){
+            if(loop_counter == 199 && m_resumeFilePos && m_seekTable.empty()){
                 m_audioCurrentTime = ((getFilePos() - m_audioDataStart - inBufferFilled()) / m_avr_bitrate) * 8; // #293
             }
         }
@@ -4257,12 +4177,17 @@ void Audio::compute_audioCurrentTime(int bd) {
     else {
         if(loop_counter == 2){
             m_avr_bitrate = getBitRate();
-            if(m_resumeFilePos){  // if connecttoFS() is called with resumeFilePos != 0
+            if(m_resumeFilePos && m_seekTable.empty()){  // if connecttoFS() is called with resumeFilePos != 0
                 m_audioCurrentTime = ((getFilePos() - m_audioDataStart - inBufferFilled()) / m_avr_bitrate) * 8; // #293
             }
         }
     }
-    m_audioCurrentTime += ((float)bd / m_avr_bitrate) * 8;
+    if(m_exactDurationMs && m_codec == CODEC_MP3 && getSampleRate()){
+        m_audioCurrentTime += (float)m_validSamples / getSampleRate(); // exact, independent of VBR
+    }
+    else {
+        m_audioCurrentTime += ((float)bd / m_avr_bitrate) * 8;
+    }
 }
 //---------------------------------------------------------------------------------------------------------------------
 void Audio::printDecodeError(int r) {
@@ -4357,6 +4282,7 @@ uint32_t Audio::getFileSize() {
 //---------------------------------------------------------------------------------------------------------------------
 uint32_t Audio::getFilePos() {
     if(!audiofile) return 0;
+    if(m_f_ra_active) return m_ra_consumedPos; // the reader task is ahead
     return audiofile.position();
 }
 //---------------------------------------------------------------------------------------------------------------------
@@ -4371,6 +4297,7 @@ uint32_t Audio::getAudioFileDuration() {
     if(m_streamType == ST_WEBFILE)   {if(!m_contentlength) return 0;}
 #endif
 
+    if(m_exactDurationMs) {m_audioFileDuration = (m_exactDurationMs + 500) / 1000; return m_audioFileDuration;}
     if     (m_avr_bitrate && m_codec == CODEC_MP3)   m_audioFileDuration = 8 * (m_audioDataSize / m_avr_bitrate); // #289
     else if(m_avr_bitrate && m_codec == CODEC_WAV)   m_audioFileDuration = 8 * (m_audioDataSize / m_avr_bitrate);
     else if(m_avr_bitrate && m_codec == CODEC_M4A)   m_audioFileDuration = 8 * (m_audioDataSize / m_avr_bitrate);
@@ -4380,6 +4307,11 @@ uint32_t Audio::getAudioFileDuration() {
     return m_audioFileDuration;
 }
 //---------------------------------------------------------------------------------------------------------------------
+uint32_t Audio::getAudioFileDurationMs() {
+    if(getDatamode() == AUDIO_LOCALFILE) {if(!audiofile) return 0;}
+    return m_exactDurationMs;
+}
+//---------------------------------------------------------------------------------------------------------------------
 uint32_t Audio::getAudioCurrentTime() {  // return current time in seconds
     return (uint32_t) m_audioCurrentTime;
 }
@@ -4390,11 +4322,37 @@ bool Audio::setAudioPlayPosition(uint16_t sec){
     // works only with format mp3 or wav
     if(m_codec == CODEC_M4A)  return false;
     if(sec > getAudioFileDuration()) sec = getAudioFileDuration();
-    uint32_t filepos = m_audioDataStart + (m_avr_bitrate * sec / 8);
+    uint32_t filepos;
+    if(!m_seekTable.empty()) filepos = seekTable_posForTime((uint32_t)sec * 1000); // interpolated, resynced to a frame
+    else                     filepos = m_audioDataStart + (uint32_t)((uint64_t)m_avr_bitrate * sec / 8);
 
     return setFilePos(filepos);
 }
 //---------------------------------------------------------------------------------------------------------------------
+bool Audio::setSeekIndex(uint32_t durationMs, uint32_t intervalUs, const uint32_t* offsets, uint32_t count,
+                         uint16_t encoderDelay, uint16_t encoderPadding){
+    // Takes a sparse seek table built outside the decoder (e.g. a frame index scanned in the background or a cached one).
+    // offsets[i] is the byte position (relative to the audio data start) of the frame that begins at i * intervalUs.
+    // Can be called directly after connecttoFS(), before the header is parsed.
+    if(!audiofile || !offsets || !count || !intervalUs) return false;
+    m_seekTable.assign(offsets, offsets + count);
+    m_seekIntervalUs = intervalUs;
+    if(durationMs) m_exactDurationMs = durationMs;
+    if(encoderDelay || encoderPadding) {m_encoderDelay = encoderDelay; m_encoderPadding = encoderPadding;}
+    if(m_f_running && m_controlCounter == 100){ // resync the play time, the bitrate estimation may have drifted
+        uint32_t pos = getFilePos() - inBufferFilled();
+        if(pos >= m_audioDataStart) m_audioCurrentTime = seekTable_timeForPos(pos);
+    }
+    return true;
+}
+//---------------------------------------------------------------------------------------------------------------------
+void Audio::clearSeekIndex(){
+    // The play time falls back to the bitrate estimation, the exact duration goes with the table it came from
+    m_seekTable.clear();
+    m_seekIntervalUs = 0;
+    m_exactDurationMs = 0;
+}
+//---------------------------------------------------------------------------------------------------------------------
 uint32_t Audio::getTotalPlayingTime() {
     // Is set to zero by a connectToXXX() and starts as soon as the first audio data is available,
     // the time counting is not interrupted by a 'pause / resume' and is not reset by a fileloop
@@ -4405,7 +4363,13 @@ bool Audio::setTimeOffset(int sec){
     // fast forward or rewind the current position in seconds
     // audiosource must be a mp3, aac or wav file
 
-    if(!audiofile || !m_avr_bitrate) return false;
+    if(!audiofile) return false;
+    if(!m_seekTable.empty()){
+        int32_t t = (int32_t)getAudioCurrentTime() + sec;
+        if(t < 0) t = 0;
+        return setAudioPlayPosition((uint16_t)min((uint32_t)t, (uint32_t)UINT16_MAX));
+    }
+    if(!m_avr_bitrate) return false;
 
     uint32_t oneSec  = m_avr_bitrate / 8;                   // bytes decoded in one sec
     int32_t  offset  = oneSec * sec;                        // bytes to be wind/rewind
@@ -5393,5 +5357,241 @@ uint32_t Audio::mp3_correctResumeFilePos(uint32_t resumeFilePos){
     return m_audioDataStart;
 }
 //----------------------------------------------------------------------------------------------------------------------
+uint32_t Audio::seekTable_posForTime(uint32_t ms){
+    // file position of ms, linear interpolation between the two seek points around it (a Xing TOC has only 100
+    // points); the position is moved to the next frame start by the mp3 resync in processLocalFile()
+    if(m_seekTable.empty() || !m_seekIntervalUs) return m_audioDataStart;
+    uint64_t us = (uint64_t)ms * 1000;
+    uint64_t idx = us / m_seekIntervalUs;
+    if(idx >= m_seekTable.size() - 1) return m_audioDataStart + m_seekTable.back();
+    uint32_t pos = m_seekTable[idx];
+    if(m_seekTable[idx + 1] > pos){
+        pos += (uint64_t)(m_seekTable[idx + 1] - pos) * (us - idx * m_seekIntervalUs) / m_seekIntervalUs;
+    }
+    return m_audioDataStart + pos;
+}
+//----------------------------------------------------------------------------------------------------------------------
+float Audio::seekTable_timeForPos(uint32_t pos){
+    // inverse of seekTable_posForTime(), linear interpolation between two seek points
+    if(m_seekTable.empty() || pos < m_audioDataStart) return 0;
+    uint32_t rel = pos - m_audioDataStart;
+    auto it = std::upper_bound(m_seekTable.begin(), m_seekTable.end(), rel);
+    if(it == m_seekTable.begin()) return 0;
+    size_t idx = (it - m_seekTable.begin()) - 1;
+    float t = (float)idx * m_seekIntervalUs / 1000000;
+    if(idx + 1 < m_seekTable.size() && m_seekTable[idx + 1] > m_seekTable[idx]){
+        t += (float)(rel - m_seekTable[idx]) / (m_seekTable[idx + 1] - m_seekTable[idx]) * m_seekIntervalUs / 1000000;
+    }
+    return t;
+}
+//----------------------------------------------------------------------------------------------------------------------
+void Audio::mp3_readInfoFrame(){
+    // The first frame behind the ID3 tag may be a Xing/Info (LAME, ffmpeg) or VBRI (Fraunhofer) header without audio.
+    // It contains the number of frames, so the duration is exact also for VBR files, and a TOC for seeking.
+    // The file pointer is restored, processLocalFile() continues reading where it stopped.
+
+    const uint16_t sampleRates[4][3] = {{11025, 12000, 8000}, {0, 0, 0}, {22050, 24000, 16000}, {44100, 48000, 32000}};
+    uint8_t  buff[1024];
+    uint32_t pos = audiofile.position();
+    audiofile.seek(m_audioDataStart);
+    int len = audiofile.read(buff, sizeof(buff));
+    audiofile.seek(pos);
+    if(len < 64) return;
 
-
+    int i = 0; // skip leading garbage until the first valid frame header
+    while(i + 4 <= len){
+        if(buff[i] == 0xFF && (buff[i + 1] & 0xE0) == 0xE0){
+            uint8_t version = (buff[i + 1] >> 3) & 3, layer = (buff[i + 1] >> 1) & 3;
+            uint8_t brIdx = buff[i + 2] >> 4, srIdx = (buff[i + 2] >> 2) & 3;
+            if(version != 1 && layer == 1 && brIdx != 0 && brIdx != 15 && srIdx != 3) break;
+        }
+        i++;
+    }
+    if(i + 4 > len) return;
+
+    uint8_t  version    = (buff[i + 1] >> 3) & 3;
+    uint8_t  chMode     = (buff[i + 3] >> 6) & 3;
+    uint32_t sampleRate = sampleRates[version][(buff[i + 2] >> 2) & 3];
+    uint16_t spf        = (version == 3) ? 1152 : 576;                                     // samples per frame
+    uint8_t  sideInfo   = (version == 3) ? (chMode == 3 ? 17 : 32) : (chMode == 3 ? 9 : 17);
+    uint32_t frameStart = i;                                                               // relative to data start
+    uint32_t frames = 0, bytes = 0;
+
+    int x = i + 4 + sideInfo;
+    int v = i + 4 + 32;
+    if(x + 8 <= len && (!memcmp(buff + x, "Xing", 4) || !memcmp(buff + x, "Info", 4))){
+        uint32_t flags = bigEndian(buff + x + 4, 4);
+        int p = x + 8;
+        uint8_t toc[100]; bool f_toc = false;
+        if((flags & 0x01) && p + 4 <= len) {frames = bigEndian(buff + p, 4); p += 4;}
+        if((flags & 0x02) && p + 4 <= len) {bytes  = bigEndian(buff + p, 4); p += 4;}
+        if((flags & 0x04) && p + 100 <= len) {memcpy(toc, buff + p, 100); f_toc = true; p += 100;}
+        if(flags & 0x08) p += 4; // quality indicator
+        if(p + 24 <= len && (!memcmp(buff + p, "LAME", 4) || !memcmp(buff + p, "Lavc", 4))){
+            m_encoderDelay   = (buff[p + 21] << 4) | (buff[p + 22] >> 4);
+            m_encoderPadding = ((buff[p + 22] & 0x0F) << 8) | buff[p + 23];
+        }
+        if(frames && sampleRate){
+            uint64_t samples = (uint64_t)frames * spf;
+            if(samples > (uint64_t)m_encoderDelay + m_encoderPadding) samples -= m_encoderDelay + m_encoderPadding;
+            m_exactDurationMs = samples * 1000 / sampleRate;
+        }
+        if(f_toc && bytes && m_exactDurationMs){ // TOC: 100 entries, file position in 1/256 of bytes for each percent
+            m_seekTable.resize(100);
+            for(int k = 0; k < 100; k++) m_seekTable[k] = frameStart + (uint32_t)((uint64_t)toc[k] * bytes / 256);
+            m_seekIntervalUs = m_exactDurationMs * 10;
+        }
+        AUDIO_INFO("%s header: frames %u, bytes %u, TOC %s", buff[x] == 'X' ? "Xing" : "Info", frames, bytes, f_toc ? "yes" : "no");
+    }
+    else if(v + 26 <= len && !memcmp(buff + v, "VBRI", 4)){
+        bytes                   = bigEndian(buff + v + 10, 4);
+        frames                  = bigEndian(buff + v + 14, 4);
+        uint16_t tocEntries     = bigEndian(buff + v + 18, 2);
+        uint16_t tocScale       = bigEndian(buff + v + 20, 2);
+        uint16_t entrySize      = bigEndian(buff + v + 22, 2);
+        uint16_t framesPerEntry = bigEndian(buff + v + 24, 2);
+        if(frames && sampleRate) m_exactDurationMs = (uint64_t)frames * spf * 1000 / sampleRate;
+        if(tocEntries && entrySize >= 1 && entrySize <= 4 && framesPerEntry && v + 26 + tocEntries * entrySize <= len){
+            // each entry is the size of the next framesPerEntry frames, the first point is the VBRI frame itself
+            m_seekTable.resize(tocEntries + 1);
+            uint32_t offset = frameStart;
+            m_seekTable[0] = offset;
+            for(int k = 0; k < tocEntries; k++){
+                offset += bigEndian(buff + v + 26 + k * entrySize, entrySize) * tocScale;
+                m_seekTable[k + 1] = offset;
+            }
+            m_seekIntervalUs = (uint64_t)framesPerEntry * spf * 1000000 / sampleRate;
+        }
+        AUDIO_INFO("VBRI header: frames %u, bytes %u, TOC entries %u", frames, bytes, tocEntries);
+    }
+    if(m_exactDurationMs) AUDIO_INFO("exact duration: %u ms", m_exactDurationMs);
+}
+//----------------------------------------------------------------------------------------------------------------------
+bool Audio::setReadAhead(uint32_t blockSize, uint8_t core, uint8_t prio){
+    // Local files are read in large blocks by a separate task into two buffers, the audio task only copies
+    // from a filled block into InBuff and does not wait for the SD card. Blocks end at multiples of blockSize
+    // in the file, so with 32KB clusters every read is one cluster. The buffers are allocated once.
+    stopSong();
+    if(m_ra_task){ // not while it holds the mutex
+        xSemaphoreTake(m_ra_mutex, portMAX_DELAY);
+        vTaskDelete(m_ra_task);
+        m_ra_task = NULL;
+        xSemaphoreGive(m_ra_mutex);
+    }
+    for(int i = 0; i < 2; i++) {if(m_ra_block[i].data) {free(m_ra_block[i].data); m_ra_block[i].data = NULL;}}
+    m_readAheadSize = 0;
+    if(!blockSize) return true;
+
+    for(int i = 0; i < 2; i++){
+        m_ra_block[i].data = (uint8_t*)heap_caps_malloc_prefer(blockSize, 2, MALLOC_CAP_DEFAULT | MALLOC_CAP_SPIRAM,
+                                                                MALLOC_CAP_DEFAULT | MALLOC_CAP_INTERNAL);
+        if(!m_ra_block[i].data){
+            log_e("not enough memory for the read-ahead buffers");
+            setReadAhead(0);
+            return false;
+        }
+    }
+    if(!m_ra_mutex) m_ra_mutex = xSemaphoreCreateMutex();
+    if(xTaskCreatePinnedToCore(readAheadTask, "ReadAhead", 3072, this, prio, &m_ra_task, core) != pdPASS){
+        m_ra_task = NULL;
+        setReadAhead(0);
+        return false;
+    }
+    m_readAheadSize = blockSize;
+    memset(&m_ra_stats, 0, sizeof(m_ra_stats));
+    m_ra_busyUs = 0;
+    AUDIO_INFO("read-ahead 2 x %u bytes", blockSize);
+    return true;
+}
+//----------------------------------------------------------------------------------------------------------------------
+void Audio::readAheadTask(void* param){
+    static_cast<Audio*>(param)->readAheadLoop();
+}
+//----------------------------------------------------------------------------------------------------------------------
+void Audio::readAheadLoop(){
+    while(true){
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(20));
+        while(true){ // fill every free block
+            xSemaphoreTake(m_ra_mutex, portMAX_DELAY);
+            raBlock_t& b = m_ra_block[m_ra_write];
+            if(!m_f_ra_active || m_f_ra_error || b.state != RA_FREE || m_ra_nextPos >= m_ra_endPos){
+                xSemaphoreGive(m_ra_mutex);
+                break;
+            }
+            uint32_t len = m_readAheadSize - (m_ra_nextPos % m_readAheadSize); // up to the next block boundary
+            len = min(len, m_ra_endPos - m_ra_nextPos);
+            if(audiofile.position() != m_ra_nextPos) audiofile.seek(m_ra_nextPos);
+            uint32_t t0 = micros();
+            int32_t  rd = audiofile.read(b.data, len);
+            uint32_t dt = micros() - t0;
+            if(rd <= 0){
+                log_w("read-ahead: read error at %u", m_ra_nextPos);
+                m_f_ra_error = true; // processLocalFile() takes over once the blocks read before are used up
+                xSemaphoreGive(m_ra_mutex);
+                break;
+            }
+            m_ra_busyUs += dt;
+            m_ra_stats.reads++;
+            m_ra_stats.bytes += rd;
+            m_ra_stats.lastLatencyUs = dt;
+            if(dt > m_ra_stats.maxLatencyUs) m_ra_stats.maxLatencyUs = dt;
+            m_ra_stats.avgLatencyUs = m_ra_busyUs / m_ra_stats.reads;
+            if(m_ra_busyUs) m_ra_stats.bytesPerSec = (uint64_t)m_ra_stats.bytes * 1000000 / m_ra_busyUs;
+
+            b.filePos = m_ra_nextPos;
+            b.len = rd;
+            b.rdIdx = 0;
+            m_ra_nextPos += rd;
+            __sync_synchronize();  // data before state
+            b.state = RA_READY;
+            m_ra_write ^= 1;
+            xSemaphoreGive(m_ra_mutex);
+        }
+    }
+}
+//----------------------------------------------------------------------------------------------------------------------
+void Audio::readAhead_start(uint32_t pos, uint32_t endPos){
+    if(!m_readAheadSize) return;
+    xSemaphoreTake(m_ra_mutex, portMAX_DELAY);
+    m_ra_block[0].state = RA_FREE;
+    m_ra_block[1].state = RA_FREE;
+    m_ra_read = m_ra_write = 0;
+    m_ra_nextPos = pos;
+    m_ra_endPos = endPos;
+    m_ra_consumedPos = pos;
+    m_f_ra_error = false;
+    m_f_ra_active = true;
+    xSemaphoreGive(m_ra_mutex);
+    xTaskNotifyGive(m_ra_task);
+}
+//----------------------------------------------------------------------------------------------------------------------
+void Audio::readAhead_stop(){
+    // waits until a running read is finished, afterwards the audio task owns audiofile again
+    if(!m_f_ra_active) return;
+    xSemaphoreTake(m_ra_mutex, portMAX_DELAY);
+    m_f_ra_active = false;
+    m_ra_block[0].state = RA_FREE;
+    m_ra_block[1].state = RA_FREE;
+    xSemaphoreGive(m_ra_mutex);
+}
+//----------------------------------------------------------------------------------------------------------------------
+size_t Audio::readAhead_read(uint8_t* dst, size_t len){
+    size_t copied = 0;
+    while(copied < len){
+        raBlock_t& b = m_ra_block[m_ra_read];
+        if(b.state != RA_READY) break;
+        __sync_synchronize();
+        size_t n = min((size_t)(b.len - b.rdIdx), len - copied);
+        memcpy(dst + copied, b.data + b.rdIdx, n);
+        b.rdIdx += n;
+        copied += n;
+        m_ra_consumedPos = b.filePos + b.rdIdx;
+        if(b.rdIdx == b.len){ // hand the block back to the reader
+            b.state = RA_FREE;
+            m_ra_read ^= 1;
+            xTaskNotifyGive(m_ra_task);
+        }
+    }
+    return copied;
+}
+//----------------------------------------------------------------------------------------------------------------------
@@ -26,6 +26,7 @@
 #endif
 #include <vector>
 #include <driver/i2s.h>
+#include "AudioBuffer.h"
 
 #ifdef SDFATFS_USED
 #include <SdFat.h>  // https://github.com/greiman/SdFat
@@ -93,73 +94,6 @@ extern __attribute__((weak)) void audio_process_i2s(uint32_t* sample, bool *cont
 
 //----------------------------------------------------------------------------------------------------------------------
 
-class AudioBuffer {
-// AudioBuffer will be allocated in PSRAM, If PSRAM not available or has not enough space AudioBuffer will be
-// allocated in FlashRAM with reduced size
-//
-//  m_buffer            m_readPtr                 m_writePtr                 m_endPtr
-//   |                       |<------dataLength------->|<------ writeSpace ----->|
-//   ▼                       ▼                         ▼                         ▼
-//   ---------------------------------------------------------------------------------------------------------------
-//   |                     <--m_buffSize-->                                      |      <--m_resBuffSize -->     |
-//   ---------------------------------------------------------------------------------------------------------------
-//   |<-----freeSpace------->|                         |<------freeSpace-------->|
-//
-//
-//
-//   if the space between m_readPtr and buffend < m_resBuffSize copy data from the beginning to resBuff
-//   so that the mp3/aac/flac frame is always completed
-//
-//  m_buffer                      m_writePtr                 m_readPtr        m_endPtr
-//   |                                 |<-------writeSpace------>|<--dataLength-->|
-//   ▼                                 ▼                         ▼                ▼
-//   ---------------------------------------------------------------------------------------------------------------
-//   |                        <--m_buffSize-->                                    |      <--m_resBuffSize -->     |
-//   ---------------------------------------------------------------------------------------------------------------
-//   |<---  ------dataLength--  ------>|<-------freeSpace------->|
-//
-//
-
-public:
-    AudioBuffer(size_t maxBlockSize = 0);       // constructor
-    ~AudioBuffer();                             // frees the buffer
-    size_t   init();                            // set default values
-    bool     isInitialized() { return m_f_init; };
-    void     setBufsize(int ram, int psram);
-    void     changeMaxBlockSize(uint16_t mbs);  // is default 1600 for mp3 and aac, set 16384 for FLAC
-    uint16_t getMaxBlockSize();                 // returns maxBlockSize
-    size_t   freeSpace();                       // number of free bytes to overwrite
-    size_t   writeSpace();                      // space fom writepointer to bufferend
-    size_t   bufferFilled();                    // returns the number of filled bytes
-    void     bytesWritten(size_t bw);           // update writepointer
-    void     bytesWasRead(size_t br);           // update readpointer
-    uint8_t* getWritePtr();                     // returns the current writepointer
-    uint8_t* getReadPtr();                      // returns the current readpointer
-    uint32_t getWritePos();                     // write position relative to the beginning
-    uint32_t getReadPos();                      // read position relative to the beginning
-    void     resetBuffer();                     // restore defaults
-    bool     havePSRAM() { return m_f_psram; };
-
-protected:
-    size_t   m_buffSizePSRAM    = 300000;   // most webstreams limit the advance to 100...300Kbytes
-    size_t   m_buffSizeRAM      = 1600 * 5;
-    size_t   m_buffSize         = 0;
-    size_t   m_freeSpace        = 0;
-    size_t   m_writeSpace       = 0;
-    size_t   m_dataLength       = 0;
-    size_t   m_resBuffSizeRAM   = 1600;     // reserved buffspace, >= one mp3  frame
-    size_t   m_resBuffSizePSRAM = 4096 * 4; // reserved buffspace, >= one flac frame
-    size_t   m_maxBlockSize     = 1600;
-    uint8_t* m_buffer           = NULL;
-    uint8_t* m_writePtr         = NULL;
-    uint8_t* m_readPtr          = NULL;
-    uint8_t* m_endPtr           = NULL;
-    bool     m_f_start          = true;
-    bool     m_f_init           = false;
-    bool     m_f_psram          = false;    // PSRAM is available (and used...)
-};
-//----------------------------------------------------------------------------------------------------------------------
-
 class Audio : private AudioBuffer{
 
     AudioBuffer InBuff; // instance of input buffer
@@ -202,9 +136,30 @@ public:
     uint8_t  getChannels();
     uint32_t getBitRate(bool avg = false);
     uint32_t getAudioFileDuration();
+    uint32_t getAudioFileDurationMs();          // exact if known from Xing/VBRI header or seek index, else 0
     uint32_t getAudioCurrentTime();
+    bool     setSeekIndex(uint32_t durationMs, uint32_t intervalUs, const uint32_t* offsets, uint32_t count,
+                          uint16_t encoderDelay = 0, uint16_t encoderPadding = 0);
+    bool     hasSeekIndex() {return !m_seekTable.empty();}
+    void     clearSeekIndex();                   // drop a table given by setSeekIndex() that turned out not to fit
+    void     setSeekPrefill(uint32_t bytes) {m_seekPrefill = bytes;} // resume after a seek once this is buffered, 0 = full buffer
+    const std::vector<uint32_t>& getSeekIndex(uint32_t& intervalUs) {intervalUs = m_seekIntervalUs; return m_seekTable;}
+    uint16_t getEncoderDelay() {return m_encoderDelay;}
+    uint16_t getEncoderPadding() {return m_encoderPadding;}
     uint32_t getTotalPlayingTime();
 
+    struct ReadAheadStats {
+        uint32_t reads;                         // SD reads issued by the reader task
+        uint32_t bytes;
+        uint32_t lastLatencyUs;
+        uint32_t maxLatencyUs;
+        uint32_t avgLatencyUs;
+        uint32_t bytesPerSec;                   // throughput while reading
+        uint32_t underruns;                     // InBuff ran low while the reader had no block ready
+    };
+    bool     setReadAhead(uint32_t blockSize, uint8_t core = 0, uint8_t prio = 3); // local files: async reads, 0 = off
+    ReadAheadStats getReadAheadStats() {return m_ra_stats;}
+
     esp_err_t i2s_mclk_pin_select(const uint8_t pin);
     uint32_t inBufferFilled(); // returns the number of stored bytes in the inputbuffer
     uint32_t inBufferFree();   // returns the number of free bytes in the inputbuffer
@@ -269,6 +224,7 @@ private:
     bool parseHttpResponseHeader();
 #endif
     bool initializeDecoder();
+    void freeDecoderBuffers(uint8_t keepCodec);
     esp_err_t I2Sstart(uint8_t i2s_num);
     esp_err_t I2Sstop(uint8_t i2s_num);
 #ifndef AUDIO_NO_NETWORK
@@ -299,6 +255,14 @@ private:
     uint32_t m4a_correctResumeFilePos(uint32_t resumeFilePos);
     uint32_t flac_correctResumeFilePos(uint32_t resumeFilePos);
     uint32_t mp3_correctResumeFilePos(uint32_t resumeFilePos);
+    void     mp3_readInfoFrame();
+    static void readAheadTask(void* param);
+    void     readAheadLoop();
+    void     readAhead_start(uint32_t pos, uint32_t endPos);
+    void     readAhead_stop();
+    size_t   readAhead_read(uint8_t* dst, size_t len);
+    uint32_t seekTable_posForTime(uint32_t ms);
+    float    seekTable_timeForPos(uint32_t pos);
 
 
 //++++ implement several function with respect to the index of string ++++
@@ -560,6 +524,7 @@ private:
     bool            m_f_exthdr = false;             // ID3 extended header
     bool            m_f_running = false;
     bool            m_f_firstCall = false;          // InitSequence for processWebstream and processLokalFile
+    bool            m_f_decoderReset = false;       // set by setDefaults(), the next initializeDecoder() clears the kept buffers
     bool            m_f_playing = false;            // valid mp3 stream recognized
     bool            m_f_loop = false;               // Set if audio file should loop
     bool            m_f_forceMono = false;          // if true stereo -> mono
@@ -581,6 +546,36 @@ private:
 #endif
     uint8_t         m_f_channelEnabled = 3;         // internal DAC, both channels
     uint32_t        m_audioFileDuration = 0;
+    uint32_t        m_exactDurationMs = 0;          // from Xing/VBRI frame count or setSeekIndex(), 0 = estimate
+    uint32_t        m_seekIntervalUs = 0;           // time between two entries of m_seekTable
+    std::vector<uint32_t> m_seekTable;              // byte offsets relative to m_audioDataStart, one per interval
+    uint16_t        m_encoderDelay = 0;             // LAME tag, samples to skip at the beginning
+    uint16_t        m_encoderPadding = 0;           // LAME tag, samples appended at the end
+    uint32_t        m_seekPrefill = 0;              // bytes to buffer after a seek before decoding resumes
+    bool            m_f_seekRefill = false;         // refilling InBuff after a seek
+
+    // read-ahead: a reader task fills two blocks from the file, processLocalFile() copies them into InBuff
+    enum : uint8_t {RA_FREE = 0, RA_READY = 1};
+    typedef struct _raBlock{
+        uint8_t*         data;
+        uint32_t         filePos;
+        uint32_t         len;
+        uint32_t         rdIdx;                     // bytes already copied into InBuff
+        volatile uint8_t state;                     // RA_FREE: owned by the reader, RA_READY: owned by the audio task
+    } raBlock_t;
+    raBlock_t         m_ra_block[2] = {};
+    uint32_t          m_readAheadSize = 0;          // bytes per block, reads end at multiples of it (cluster aligned)
+    TaskHandle_t      m_ra_task = NULL;
+    SemaphoreHandle_t m_ra_mutex = NULL;            // held by the reader while it fills a block
+    volatile bool     m_f_ra_active = false;        // the reader owns audiofile
+    volatile bool     m_f_ra_error = false;         // a read failed, the reader stopped at m_ra_nextPos
+    uint8_t           m_ra_read = 0;
+    uint8_t           m_ra_write = 0;
+    uint32_t          m_ra_nextPos = 0;             // next file position to read
+    uint32_t          m_ra_endPos = 0;
+    volatile uint32_t m_ra_consumedPos = 0;         // file position of the next byte for InBuff
+    uint64_t          m_ra_busyUs = 0;
+    ReadAheadStats    m_ra_stats = {};
     float           m_audioCurrentTime = 0;
     uint32_t        m_audioDataStart = 0;           // in bytes
     size_t          m_audioDataSize = 0;            //
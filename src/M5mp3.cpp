@@ -20,16 +20,20 @@
 #include "../include/ui_renderer.hpp"   // UI rendering
 #include "../include/board_init.hpp"    // Board / codec init (scaffold)
 #include "../include/audio_manager.hpp"  // Audio playback control
-#include "../include/file_manager.hpp"   // File operations (list, delete, screenshot)
+#include "../include/file_manager.hpp"   // File operations (delete, screenshot)
+#include "../include/library_index.hpp"  // Track list index, scanned only on first boot
+#include "../include/state_journal.hpp"  // Resume state across reboots
+#include "../include/storage.hpp"        // SD card mount and benchmark
+#include "../include/memory_budget.hpp"  // Heap split between the big buffers
+#include "../include/cover_cache.hpp"    // Decoded cover thumbnail
+#include "../include/folder_browser.hpp"  // Folder page listings
+#include "../include/playlist.hpp"        // Playlist opened on the folder page
+#include "../include/shuffle.hpp"         // Random mode play order
 M5Canvas sprite(&M5Cardputer.Display);
 // Removed unused canvas: spr
 // Step 3: Centralized application state
 AppState appState;
-// microSD card
-#define SD_SCK 40
-#define SD_MISO 39
-#define SD_MOSI 14
-#define SD_CS 12
+// microSD card pins and clocks are in config.hpp (Storage module)
 // Cardputer audio pin mappings provided by config.hpp
 
 // Hardware initialization functions have been migrated to BoardInit module
@@ -63,7 +67,7 @@ bool codec_initialized = false;
 void Task_TFT(void *pvParameters);
 void Task_Audio(void *pvParameters);
 const lgfx::U8g2font* detectAndGetFont(const String& text);  // Detect language and return appropriate font
-// File operations (listFiles, deleteCurrentFile, captureScreenshot) are now in FileManager module
+// File operations (deleteCurrentFile, captureScreenshot) are now in FileManager module
 // Forward declarations for draw functions (now implemented via UiRenderer)
 void drawId3Page();  // Render ID3 information page (delegates to UiRenderer)
 void resetClock() {
@@ -82,7 +86,9 @@ static void deleteCurrentFileWrapper() {
     (void)deletedIndex;
     (void)newPlayingIndex;
   };
+  CoverCache::clear();  // A running cover decode must not hold the file while it is deleted
   FileManager::deleteCurrentFile(SD, appState, fileCallbacks);
+  FolderBrowser::invalidate();  // Listed again when the folder page is opened
 }
 
 // Detect language from text and return appropriate font
@@ -202,20 +208,37 @@ void setup() {
   M5Cardputer.Speaker.config(spk_cfg);
   // Do NOT initialize M5Cardputer.Speaker when using external ES8311 via I2S.
   // It can take over the I2S peripheral and conflict with ESP32-audioI2S.
+  // Restore volume, brightness, mode and the last track from the state journal
+  StateJournal::Snapshot resume;
+  bool hasResume = StateJournal::load(resume);
+  if (hasResume) StateJournal::applySettings(resume, appState);
   M5Cardputer.Display.setRotation(1);
   M5Cardputer.Display.setBrightness(BRIGHTNESS_VALUES[appState.brightnessIndex]);
   // Enable UTF-8 support for Chinese character display
   M5Cardputer.Display.setAttribute(utf8_switch, true);
   sprite.createSprite(SCREEN_WIDTH, SCREEN_HEIGHT);
-  SPI.begin(SD_SCK, SD_MISO, SD_MOSI);
-  if (!SD.begin(SD_CS)) {
+  if (!Storage::begin()) {
     LOG_PRINTLN(F("ERROR: SD Mount Failed!"));
   }
-  // Read song files from /music directory
-  FileManager::listFiles(SD, MUSIC_DIR, MAX_FILES, appState);
-  if (appState.fileCount == 0) {
-    LOG_PRINTLN("No files found in /music, scanning root as fallback");
-    FileManager::listFiles(SD, "/", MAX_FILES, appState);
+  MemoryBudget::begin();
+  // Song list from the library index (checked against the card once playing), scanned in the background on first boot
+  bool libraryIndexed = LibraryIndex::load(SD, appState);
+  Shuffle::begin(SD);  // Random mode order of the last session, read on first use
+  LOG_PRINTF("%d tracks, library uses %u bytes\n", appState.tracks.count(), (unsigned)appState.tracks.memoryUsed());
+#if STORAGE_BENCHMARK_ON_BOOT
+  if (appState.tracks.count() > 0) {
+    Storage::BenchResult bench;
+    Storage::benchmark(SD, appState.tracks.path(0).c_str(), bench);
+  }
+#endif
+  CoverCache::prefill(appState.tracks);  // Starts once playback is idle
+  uint32_t resumePos = 0;
+  if (hasResume && resume.path.length() > 0) {
+    int i = appState.tracks.find(resume.path);
+    if (i >= 0) {
+      appState.currentSelectedIndex = i;
+      resumePos = resume.filePos;
+    }
   }
   // Initialize AudioManager with the global Audio instance (must be before BoardInit)
   AudioManager::setAudioInstance(&audio);
@@ -235,12 +258,13 @@ void setup() {
   
   // Configure keyboard driver
   BoardInit::configureKeyboard(detected);
-  if (appState.fileCount > 0) {
-    LOG_PRINTF("Trying to play: %s\n", appState.audioFiles[appState.currentSelectedIndex].c_str());
+  if (appState.tracks.count() > 0) {
+    const String firstPath = appState.tracks.path(appState.currentSelectedIndex);
+    LOG_PRINTF("Trying to play: %s\n", firstPath.c_str());
     // Double-check the file exists
-    if (SD.exists(appState.audioFiles[appState.currentSelectedIndex])) {
+    if (SD.exists(firstPath)) {
       // Open the file directly and print size + header bytes for verification
-      File f = SD.open(appState.audioFiles[appState.currentSelectedIndex]);
+      File f = SD.open(firstPath);
       if (f) {
         uint32_t sz = f.size();
         LOG_PRINTF("SD open OK, size=%u bytes\n", (unsigned)sz);
@@ -259,12 +283,22 @@ void setup() {
         LOG_PRINTLN("SD.open failed (could not read file)");
       }
       // Always connect; decoding + ID3 parsing should not depend on codec init state
-      AudioManager::connectToFile(SD, appState.audioFiles[appState.currentSelectedIndex].c_str());
+      AudioManager::connectToFile(SD, firstPath.c_str(), resumePos);
       appState.currentPlayingIndex = appState.currentSelectedIndex;  // Sync playing index on initialization
       appState.isPlaying = true;
       appState.stopped = false;
+      if (resumePos) {
+        LOG_PRINTF("Resuming at %lu s\n", (unsigned long)resume.playTimeSec);
+        appState.playFilePos = resumePos;
+        appState.playTimeSec = resume.playTimeSec;
+        rtc.setTime(resume.playTimeSec % 60, (resume.playTimeSec / 60) % 60, resume.playTimeSec / 3600, 17, 1, 2021);
+        if (resume.stopped) {
+          appState.isPlaying = false;
+          appState.stopped = true;
+        }
+      }
     } else {
-      LOG_PRINTF("File not found on SD: %s\n", appState.audioFiles[appState.currentSelectedIndex].c_str());
+      LOG_PRINTF("File not found on SD: %s\n", firstPath.c_str());
     }
   } else {
     LOG_PRINTLN("No audio files found on SD - skipping connect");
@@ -284,8 +318,12 @@ void setup() {
   // Create tasks and pin them to different cores
   xTaskCreatePinnedToCore(Task_TFT, "Task_TFT", 20480, NULL, 2, NULL, 0);                  // Core 0
   xTaskCreatePinnedToCore(Task_Audio, "Task_Audio", 10240, NULL, 3, &handleAudioTask, 1);  // Core 1
+  if (libraryIndexed) LibraryIndex::startValidation(SD, appState);
+  else LibraryIndex::startScan(SD, appState);  // Plays the first track found, the list fills up meanwhile
 }
 void loop() {
+  StateJournal::update(appState);
+  Shuffle::save();
   // Poll headphone detect and gate AMP_EN accordingly
   if (hpDetectPin >= 0) {
     bool hpInserted = (digitalRead(hpDetectPin) == LOW);
@@ -315,6 +353,22 @@ void drawId3Page() {
 // (removed original implementation after extraction)
 
 void draw() {
+  if (appState.showSearchPage) {
+    UiRenderer::drawSearchPage(sprite, appState, grays, detectAndGetFont);
+    return;
+  }
+  if (appState.showBrowsePage) {
+    UiRenderer::drawBrowsePage(sprite, appState, grays, detectAndGetFont);
+    return;
+  }
+  if (appState.showFolderPage && appState.showPlaylistPage) {
+    UiRenderer::drawPlaylistPage(sprite, appState, grays, detectAndGetFont);
+    return;
+  }
+  if (appState.showFolderPage) {
+    UiRenderer::drawFolderPage(sprite, appState, grays, detectAndGetFont);
+    return;
+  }
   if (appState.showID3Page) {
     drawId3Page();
     return;
@@ -325,13 +379,22 @@ void draw() {
 }
 
 void Task_TFT(void *pvParameters) {
+  unsigned long lastInput = 0;
   while (1) {
     M5Cardputer.update();
+    if (M5Cardputer.Keyboard.isChange()) lastInput = millis();
     // Check for key press events
-    if (M5Cardputer.Keyboard.isChange()) {
+    if (M5Cardputer.Keyboard.isChange() && appState.showSearchPage) {
+      // The search page takes every key, letters go into the query
+      (void)InputHandler::processSearch(appState);
+    } else if (M5Cardputer.Keyboard.isChange()) {
       // Centralized handlers
       (void)InputHandler::processBasicToggles(appState);
-      (void)InputHandler::processPlaybackAndList(appState);
+      // List keys move within the browse, folder or playlist page while it is open
+      if (appState.showBrowsePage) (void)InputHandler::processBrowse(appState);
+      else if (appState.showFolderPage && appState.showPlaylistPage) (void)InputHandler::processPlaylist(appState);
+      else if (appState.showFolderPage) (void)InputHandler::processFolder(appState);
+      else (void)InputHandler::processPlaybackAndList(appState);
       InputHandler::Actions acts;
       acts.captureScreenshot = &captureScreenshotWrapper;
       acts.deleteCurrentFile = &deleteCurrentFileWrapper;
@@ -366,6 +429,14 @@ void Task_TFT(void *pvParameters) {
       }
       // All other keys handled by InputHandler
     }
+    // Seek keys are polled every iteration so a held key keeps scrubbing
+    if (!appState.showSearchPage) (void)InputHandler::processSeek(appState);
+    // Playlist: look up the entries about to play, else find more entry lines
+    Playlist::pump(appState.tracks, appState.playMode == PlaybackMode::Random);
+    // Deleted tracks leave tombstones; they are dropped once the keyboard has been idle for a while
+    if (appState.tracks.deletedCount() > 0 && millis() - lastInput >= LIBRARY_COMPACT_IDLE_MS) {
+      (void)FileManager::compactLibrary(appState);
+    }
     // If screen is off, skip drawing to save CPU
     if (!appState.screenOff) {
       draw();
@@ -388,21 +459,33 @@ void Task_Audio(void *pvParameters) {
 
     if (appState.nextS) {
       AudioManager::stop();
-      LOG_PRINTF("Task_Audio: next track requested: %s\n", appState.audioFiles[appState.currentSelectedIndex].c_str());
-      if (SD.exists(appState.audioFiles[appState.currentSelectedIndex])) {
+      appState.lockIndexes();  // currentSelectedIndex stays the track of nextPath until it is playing
+      const String nextPath = appState.tracks.path(appState.currentSelectedIndex);
+      LOG_PRINTF("Task_Audio: next track requested: %s\n", nextPath.c_str());
+      if (SD.exists(nextPath)) {
         // Reset ID3 metadata before opening the next file to avoid stale display
         appState.resetID3Metadata();
-        AudioManager::connectToFile(SD, appState.audioFiles[appState.currentSelectedIndex].c_str());
+        appState.playFilePos = 0;
+        appState.playTimeSec = 0;
+        AudioManager::connectToFile(SD, nextPath.c_str());
         appState.currentPlayingIndex = appState.currentSelectedIndex;  // Update actual playing index
         // Reset audio info cache when switching songs (will be updated after decoder initializes)
         appState.cachedAudioInfo = "";
         appState.lastAudioInfoUpdate = millis();  // Reset timer to allow decoder initialization time
       } else {
-        LOG_PRINTF("Task_Audio: file not found: %s\n", appState.audioFiles[appState.currentSelectedIndex].c_str());
+        LOG_PRINTF("Task_Audio: file not found: %s\n", nextPath.c_str());
       }
       appState.isPlaying = true;
       appState.stopped = false;  // Ensure playback is not stopped after switching tracks
       appState.nextS = 0;
+      appState.unlockIndexes();
+    }
+
+    if (appState.seekRequested) {
+      if (AudioManager::seekBy(appState.seekRequestSec)) {
+        appState.lastTimeUpdate = 0;  // Refresh the elapsed time on the next frame
+      }
+      appState.seekRequested = false;
     }
 
     // Do not gate decoding/ID3 parsing on codec_initialized; allow loop() to run
@@ -3,6 +3,8 @@
 #include <SD.h>
 #include "../include/audio_manager.hpp"
 #include "../include/config.hpp"
+#include "../include/seek_index.hpp"
+#include "../include/memory_budget.hpp"
 #include "M5Cardputer.h"
 #include <ESP32Time.h>
 
@@ -13,13 +15,90 @@ extern ESP32Time rtc;
 // Global Audio instance (managed by AudioManager)
 static Audio* g_audio = nullptr;
 
+// Seek index of the current track (MP3 files without Xing/VBRI TOC)
+enum class SeekIndexState { None, Pending, Verify, Building, Done };
+static SeekIndexState s_seekIndexState = SeekIndexState::None;
+static uint32_t s_cachedDataStart = 0;  // audioDataStart of the cached index applied at connect (Verify)
+static fs::FS* s_currentFs = nullptr;
+static String s_currentPath;
+static SeekIndex::FileKey s_currentKey;
+
 namespace AudioManager {
 
+static void applySeekIndex(const SeekIndex::Index& idx) {
+  g_audio->setSeekIndex(idx.durationMs, idx.intervalUs, idx.offsets.data(), idx.offsets.size(),
+                        idx.encoderDelay, idx.encoderPadding);
+  LOG_PRINTF("Seek index applied: %u points, duration %lu ms\n", (unsigned)idx.offsets.size(), (unsigned long)idx.durationMs);
+}
+
+// Runs on Task_Audio: once the header is parsed, store the Xing/VBRI TOC or build a frame index
+static void updateSeekIndex() {
+  if (s_seekIndexState == SeekIndexState::None || s_seekIndexState == SeekIndexState::Done) return;
+  if (s_seekIndexState == SeekIndexState::Verify) {
+    if (g_audio->getBitRate() == 0) return;
+    // The cached offsets count from where the index was built; a stale record would seek into the tag or the audio
+    if (g_audio->getAudioDataStartPos() == s_cachedDataStart) {
+      s_seekIndexState = SeekIndexState::Done;
+      return;
+    }
+    LOG_PRINTF("Seek index stale: audio data at %lu, cached for %lu, rebuilding\n",
+               (unsigned long)g_audio->getAudioDataStartPos(), (unsigned long)s_cachedDataStart);
+    g_audio->clearSeekIndex();
+    s_seekIndexState = SeekIndexState::Pending;
+  }
+  if (s_seekIndexState == SeekIndexState::Pending) {
+    if (g_audio->getBitRate() == 0) return;  // Header not parsed / decoder not started yet
+    if (g_audio->hasSeekIndex()) {
+      SeekIndex::Index idx;
+      idx.durationMs = g_audio->getAudioFileDurationMs();
+      idx.audioDataStart = g_audio->getAudioDataStartPos();
+      idx.encoderDelay = g_audio->getEncoderDelay();
+      idx.encoderPadding = g_audio->getEncoderPadding();
+      idx.offsets = g_audio->getSeekIndex(idx.intervalUs);
+      SeekIndex::save(*s_currentFs, s_currentPath.c_str(), s_currentKey, idx);
+      s_seekIndexState = SeekIndexState::Done;
+    } else if (SeekIndex::startBuild(*s_currentFs, s_currentPath.c_str(), s_currentKey,
+                                     g_audio->getAudioDataStartPos())) {
+      s_seekIndexState = SeekIndexState::Building;
+    }
+    return;
+  }
+  bool building = SeekIndex::isBuilding();
+  SeekIndex::Index idx;
+  if (SeekIndex::takeResult(s_currentPath.c_str(), idx)) {
+    applySeekIndex(idx);
+    s_seekIndexState = SeekIndexState::Done;
+  } else if (!building) {
+    s_seekIndexState = SeekIndexState::Done;  // Build failed or was cancelled
+  }
+}
+
 bool initialize(AppState& appState) {
   // Audio object will be created externally and passed via setAudioInstance
   // For now, we'll use a static instance
   static Audio audioInstance;
   g_audio = &audioInstance;
+  g_audio->setSeekPrefill(SEEK_PREFILL_BYTES);
+
+  // Input buffer: the library allocates it on the first connect, in PSRAM if it has a size for it
+  uint32_t inSize = MemoryBudget::limit(MemoryBudget::Pool::Input);
+  if (MemoryBudget::havePsram()) {
+    g_audio->setBufsize(-1, inSize);
+  } else {
+    g_audio->setBufsize(inSize, 0);
+  }
+  MemoryBudget::charge(MemoryBudget::Pool::Input, inSize);
+
+  // Read-ahead: two blocks, halved (staying cluster aligned) until they fit the budget
+  uint32_t raLimit = MemoryBudget::limit(MemoryBudget::Pool::ReadAhead);
+  uint32_t blockSize = READ_AHEAD_BLOCK_SIZE;
+  while (blockSize > 4096 && 2 * blockSize > raLimit) blockSize /= 2;
+  if (2 * blockSize > raLimit) blockSize = 0;
+  if (!g_audio->setReadAhead(blockSize, 0, READ_AHEAD_TASK_PRIORITY)) {
+    LOG_PRINTLN("Read-ahead disabled (no memory), reading synchronously");
+  } else {
+    MemoryBudget::charge(MemoryBudget::Pool::ReadAhead, 2 * blockSize);
+  }
   return true;
 }
 
@@ -31,20 +110,69 @@ Audio* getAudioInstance() {
   return g_audio;
 }
 
-void connectToFile(fs::FS& fs, const char* path) {
+void connectToFile(fs::FS& fs, const char* path, uint32_t resumeFilePos) {
   if (!g_audio) return;
-  g_audio->connecttoFS(fs, path);
+  SeekIndex::cancelBuild();
+  s_currentFs = &fs;
+  s_currentPath = path;
+  String lower = s_currentPath;
+  lower.toLowerCase();
+  s_seekIndexState = SeekIndexState::None;
+  bool isMp3 = lower.endsWith(".mp3") && SeekIndex::stat(fs, path, s_currentKey);
+  logReadStats();  // Of the previous track
+  bool connected = g_audio->connecttoFS(fs, path, resumeFilePos);
+  logHeapStats("track change");
+  MemoryBudget::logReport("track change");
+  if (!connected || !isMp3) return;
+
+  // A cached index gives the exact duration before the first frame is decoded, checked once the header is parsed
+  SeekIndex::Index idx;
+  if (SeekIndex::load(fs, path, s_currentKey, idx)) {
+    applySeekIndex(idx);
+    s_cachedDataStart = idx.audioDataStart;
+    s_seekIndexState = SeekIndexState::Verify;
+  } else {
+    s_seekIndexState = SeekIndexState::Pending;
+  }
 }
 
 void stop() {
   if (!g_audio) return;
+  SeekIndex::cancelBuild();
+  s_seekIndexState = SeekIndexState::None;
   g_audio->stopSong();
 }
 
+bool seekBy(int seconds) {
+  if (!g_audio || seconds == 0) return false;
+  int32_t target = (int32_t)g_audio->getAudioCurrentTime() + seconds;
+  int32_t duration = (int32_t)g_audio->getAudioFileDuration();
+  if (target < 0) target = 0;
+  if (duration > 0 && target > duration) target = duration;
+  if (!g_audio->setTimeOffset(seconds)) {
+    LOG_PRINTLN("Seek not supported for this file");
+    return false;
+  }
+  // The main view shows the elapsed time from the RTC, move it along
+  rtc.setTime(target % 60, (target / 60) % 60, target / 3600, 17, 1, 2021);
+  LOG_PRINTF("Seek %+d s -> %ld s\n", seconds, (long)target);
+  return true;
+}
+
 void loop(AppState& appState, bool codecInitialized) {
   if (!g_audio) return;
   if (appState.isPlaying && !appState.stopped) {
     g_audio->loop();
+    updateSeekIndex();
+
+    static unsigned long lastPublish = 0;
+    if (millis() - lastPublish >= STATE_PUBLISH_INTERVAL) {
+      lastPublish = millis();
+      uint32_t pos = g_audio->getFilePos();
+      uint32_t buffered = g_audio->inBufferFilled();
+      appState.playFilePos = pos > buffered ? pos - buffered : 0;  // Not yet decoded data is replayed on resume
+      appState.playTimeSec = g_audio->getAudioCurrentTime();
+    }
   }
 }
 
@@ -83,6 +211,34 @@ uint32_t getFileDuration() {
   return g_audio->getAudioFileDuration();
 }
 
+HeapStats getHeapStats() {
+  HeapStats st;
+  st.freeInternal = heap_caps_get_free_size(MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+  st.largestInternal = heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+  st.minFreeInternal = heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+  st.freePsram = heap_caps_get_free_size(MALLOC_CAP_SPIRAM);
+  st.largestPsram = heap_caps_get_largest_free_block(MALLOC_CAP_SPIRAM);
+  st.fragmentation = st.freeInternal ? (uint8_t)(100 - (uint64_t)st.largestInternal * 100 / st.freeInternal) : 0;
+  return st;
+}
+
+void logHeapStats(const char* context) {
+  HeapStats st = getHeapStats();
+  LOG_PRINTF("Heap [%s]: internal free=%lu largest=%lu min=%lu frag=%u%%, psram free=%lu largest=%lu\n", context,
+             (unsigned long)st.freeInternal, (unsigned long)st.largestInternal, (unsigned long)st.minFreeInternal,
+             (unsigned)st.fragmentation, (unsigned long)st.freePsram, (unsigned long)st.largestPsram);
+}
+
+void logReadStats() {
+  if (!g_audio) return;
+  Audio::ReadAheadStats st = g_audio->getReadAheadStats();
+  if (st.reads == 0) return;
+  LOG_PRINTF("SD read-ahead: %lu reads, %lu KB, latency avg=%lu max=%lu last=%lu us, %lu KB/s, underruns=%lu\n",
+             (unsigned long)st.reads, (unsigned long)(st.bytes / 1024), (unsigned long)st.avgLatencyUs,
+             (unsigned long)st.maxLatencyUs, (unsigned long)st.lastLatencyUs, (unsigned long)(st.bytesPerSec / 1024),
+             (unsigned long)st.underruns);
+}
+
 void onID3Data(const char* info, AppState& appState) {
   if (!info) return;
   String s(info);
@@ -143,7 +299,7 @@ void onID3Image(File& file, const size_t pos, const size_t size, AppState& appSt
   appState.id3CoverPos = pos;
   appState.id3CoverLen = size;
   if (appState.id3CoverBuf) { 
-    heap_caps_free(appState.id3CoverBuf); 
+    MemoryBudget::deallocate(MemoryBudget::Pool::CoverArt, appState.id3CoverBuf, appState.id3CoverSize); 
     appState.id3CoverBuf = nullptr; 
     appState.id3CoverSize = 0; 
   }
@@ -154,35 +310,37 @@ void onEOF(const char* info, AppState& appState, fs::FS& fs) {
   resetClock();
   LOG_PRINT("eof_mp3     ");
   LOG_PRINTLN(info);
+  appState.lockIndexes();  // The library is not renumbered between picking the next index and opening its path
   
   // Determine next song based on playback mode
   if (appState.playMode == PlaybackMode::Sequential) {
-    // Sequential playback: next song
-    appState.currentPlayingIndex++;
-    if (appState.currentPlayingIndex >= appState.fileCount) appState.currentPlayingIndex = 0;
+    // Sequential playback: next song (of the playlist playing, or within the folder scope)
+    appState.currentPlayingIndex = appState.nextTrack(appState.currentPlayingIndex, 1);
   } else if (appState.playMode == PlaybackMode::Random) {
-    // Random playback: random selection
-    appState.currentPlayingIndex = random(0, appState.fileCount);
+    // Random playback: next of the shuffle order (of the playlist playing, or within the folder scope)
+    appState.currentPlayingIndex = appState.nextTrack(appState.currentPlayingIndex, 1);
   } else if (appState.playMode == PlaybackMode::SingleRepeat) {
     // Single repeat: don't change index, continue playing current song
     // appState.currentPlayingIndex remains unchanged
   }
   
   appState.currentSelectedIndex = appState.currentPlayingIndex;  // Sync selected index to playing index
+  const String nextPath = appState.tracks.path(appState.currentPlayingIndex);
   LOG_PRINTF("eof: opening next file: %s (index %d, mode %d)\n", 
-                appState.audioFiles[appState.currentPlayingIndex].c_str(), 
+                nextPath.c_str(), 
                 appState.currentPlayingIndex, 
                 static_cast<int>(appState.playMode));
-  if (fs.exists(appState.audioFiles[appState.currentPlayingIndex])) {
-    connectToFile(fs, appState.audioFiles[appState.currentPlayingIndex].c_str());
+  if (fs.exists(nextPath)) {
+    connectToFile(fs, nextPath.c_str());
     // Reset audio info cache when auto-switching songs (will be updated after decoder initializes)
     appState.cachedAudioInfo = "";
     appState.lastAudioInfoUpdate = millis();  // Reset timer to allow decoder initialization time
     // Reset ID3 metadata
     appState.resetID3Metadata();
   } else {
-    LOG_PRINTF("eof: next file not found: %s\n", appState.audioFiles[appState.currentPlayingIndex].c_str());
+    LOG_PRINTF("eof: next file not found: %s\n", nextPath.c_str());
   }
+  appState.unlockIndexes();
 }
 
 }  // namespace AudioManager
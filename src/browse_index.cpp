@@ -0,0 +1,691 @@
+#include "../include/browse_index.hpp"
+#include "../include/config.hpp"
+#include "../include/memory_budget.hpp"
+#include "../include/metadata_db.hpp"
+#include <algorithm>
+#include <cstring>
+#include <new>
+#include <vector>
+
+namespace BrowseIndex {
+
+// Lists in the file. Groups point at a range of their child list, tracks at the library.
+enum List : uint8_t { ARTISTS, ARTIST_ALBUMS, ALBUMS, GENRES, YEARS, BY_ARTIST, BY_GENRE, BY_YEAR, LIST_COUNT };
+static constexpr uint8_t NO_LIST = 0xFF;
+
+// File layout: FileHeader, the lists (arrays of Entry), then the name pool (UTF-8, NUL terminated)
+struct FileHeader {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t reserved;
+  uint32_t fingerprint;   // Of the library the index was built from
+  uint32_t trackCount;
+  uint32_t listOff[LIST_COUNT];
+  uint32_t listLen[LIST_COUNT];
+  uint32_t poolOff;
+  uint32_t poolLen;
+};
+struct Entry {
+  uint32_t nameOff;       // In the pool
+  uint16_t nameLen;
+  uint8_t childList;      // NO_LIST for a track
+  uint8_t reserved;
+  uint32_t first;         // Group: first child; track: library index when the index was built
+  uint32_t count;         // Group: number of children; track: path hash
+};
+static constexpr uint32_t FILE_MAGIC = 0x53575242;  // "BRWS"
+static constexpr uint16_t FILE_VERSION = 1;
+static constexpr const char* TMP_FILE = "/.mp3adv/browse.tmp";
+static constexpr const char* ROWS_TMP_FILE = "/.mp3adv/browse.row";
+static constexpr const char* ORDERED_TMP_FILE = "/.mp3adv/browse.ord";
+static constexpr const char* LABELS_TMP_FILE = "/.mp3adv/browse.lbl";
+
+static const char* const CATEGORY_NAMES[] = {"Artists", "Albums", "Genres", "Years"};
+static const List CATEGORY_LISTS[] = {ARTISTS, ALBUMS, GENRES, YEARS};
+static constexpr int CATEGORY_COUNT = sizeof(CATEGORY_LISTS) / sizeof(CATEGORY_LISTS[0]);
+
+// ---- Collation ----
+
+// Base letters of U+00C0..U+00FF (upper and lower case share the layout), 0 = no base letter
+static const char LATIN1_BASE[32] = {'a', 'a', 'a', 'a', 'a', 'a', 'a', 'c', 'e', 'e', 'e', 'e', 'i', 'i', 'i', 'i',
+                                     'd', 'n', 'o', 'o', 'o', 'o', 'o', 0,   'o', 'u', 'u', 'u', 'u', 'y', 0,   0};
+
+uint32_t nextCodepoint(const uint8_t*& p) {
+  uint32_t c = *p++;
+  int follow = c < 0x80 ? 0 : (c & 0xE0) == 0xC0 ? 1 : (c & 0xF0) == 0xE0 ? 2 : (c & 0xF8) == 0xF0 ? 3 : -1;
+  if (follow <= 0) return c;  // ASCII or a stray continuation byte
+  c &= 0x3F >> follow;
+  for (int i = 0; i < follow && (*p & 0xC0) == 0x80; i++) c = c << 6 | (*p++ & 0x3F);
+  return c;
+}
+
+uint32_t foldCodepoint(uint32_t cp) {
+  if (cp >= 0xFF01 && cp <= 0xFF5E) cp -= 0xFEE0;  // Fullwidth ASCII
+  if (cp >= 'A' && cp <= 'Z') return cp + ('a' - 'A');
+  if (cp >= 0xC0 && cp <= 0xFF && LATIN1_BASE[cp & 0x1F]) return LATIN1_BASE[cp & 0x1F];
+  if (cp >= 0x30A1 && cp <= 0x30F6) return cp - 0x60;  // Katakana to hiragana
+  return cp;
+}
+
+// Latin and other alphabets first, then the scripts detectAndGetFont has fonts for: Hangul, kana, CJK ideographs.
+// Ideographs and Hangul syllables keep their code point order.
+static uint32_t weight(uint32_t cp) {
+  cp = foldCodepoint(cp);
+  if (cp < 0x3000) return cp;
+  if (cp >= 0xAC00 && cp <= 0xD7AF) return 0x100000 + cp;
+  if (cp >= 0x3040 && cp <= 0x309F) return 0x200000 + cp;
+  if (cp >= 0x4E00 && cp <= 0x9FFF) return 0x300000 + cp;
+  return 0x400000 + cp;
+}
+
+static int collate(const char* a, const char* b) {
+  const uint8_t* pa = (const uint8_t*)a;
+  const uint8_t* pb = (const uint8_t*)b;
+  while (*pa && *pb) {
+    uint32_t wa = weight(nextCodepoint(pa));
+    uint32_t wb = weight(nextCodepoint(pb));
+    if (wa != wb) return wa < wb ? -1 : 1;
+  }
+  if (*pa || *pb) return *pa ? 1 : -1;
+  return strcmp(a, b);  // Equal up to case and accents: still a stable order
+}
+
+// ---- Build ----
+
+// Build data grows with the library: charged to the TrackList pool, a build that does not fit gives up
+template <typename T>
+using BuildVector = MemoryBudget::Vector<T, MemoryBudget::Pool::TrackList>;
+
+// Interned strings, ids are stable while the table grows
+struct Names {
+  BuildVector<char> pool;
+  BuildVector<uint32_t> offs;
+  BuildVector<int32_t> slots;  // Open addressing on the FNV-1a hash, -1 = free
+
+  static uint32_t hash(const char* s) {
+    uint32_t h = 2166136261u;
+    while (*s) {
+      h ^= (uint8_t)*s++;
+      h *= 16777619u;
+    }
+    return h;
+  }
+
+  const char* str(uint32_t id) const { return pool.data() + offs[id]; }
+
+  uint32_t intern(const char* s) {
+    if (slots.size() < (offs.size() + 1) * 2) {
+      BuildVector<int32_t> grown(std::max((size_t)64, slots.size() * 2), -1);
+      for (uint32_t id = 0; id < offs.size(); id++) {
+        size_t i = hash(str(id)) & (grown.size() - 1);
+        while (grown[i] >= 0) i = (i + 1) & (grown.size() - 1);
+        grown[i] = id;
+      }
+      slots.swap(grown);
+    }
+    size_t i = hash(s) & (slots.size() - 1);
+    while (slots[i] >= 0) {
+      if (strcmp(str(slots[i]), s) == 0) return slots[i];
+      i = (i + 1) & (slots.size() - 1);
+    }
+    uint32_t id = offs.size();
+    offs.push_back(pool.size());
+    pool.insert(pool.end(), s, s + strlen(s) + 1);
+    slots[i] = id;
+    return id;
+  }
+
+  // Sort position of every id; unknown (the placeholder) sorts last
+  BuildVector<uint32_t> ranks(uint32_t unknown) const {
+    BuildVector<uint32_t> order(offs.size());
+    for (uint32_t i = 0; i < order.size(); i++) order[i] = i;
+    std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return collate(str(a), str(b)) < 0; });
+    BuildVector<uint32_t> rank(offs.size());
+    for (uint32_t i = 0; i < order.size(); i++) rank[order[i]] = i;
+    if (unknown < rank.size()) rank[unknown] = UINT32_MAX;
+    return rank;
+  }
+};
+
+// Row of a live track, spilled to ROWS_TMP_FILE by the tag pass
+struct TrackRow {
+  uint32_t track;
+  uint32_t pathHash;
+  uint32_t label;     // Offset in LABELS_TMP_FILE: title, the file name without extension if the track has none
+  uint16_t labelLen;
+  uint16_t yearNum;
+  uint32_t artist;    // Name ids
+  uint32_t album;
+  uint32_t genre;
+  uint32_t year;
+};
+static constexpr uint32_t NO_LABEL = UINT32_MAX;
+
+// Row in a sort pass; its position in the file is the last key of every order, so the orders are total
+struct SortRow {
+  TrackRow row;
+  uint32_t pos;
+};
+
+struct Build {
+  Names names;
+  BuildVector<Entry> lists[LIST_COUNT];  // The group lists, the track lists are written as they are sorted
+  uint32_t labelBase = 0;                // Pool offset of the labels, behind the names
+
+  Entry node(uint32_t nameId, uint8_t childList, uint32_t first) {
+    Entry e = {names.offs[nameId], (uint16_t)strlen(names.str(nameId)), childList, 0, first, 0};
+    return e;
+  }
+
+  Entry trackRef(const TrackRow& r) {
+    Entry e = {labelBase + r.label, r.labelLen, NO_LIST, 0, r.track, r.pathHash};
+    return e;
+  }
+};
+
+static uint32_t fingerprintOf(const TrackLibrary& tracks, uint32_t& live) {
+  uint32_t h = 2166136261u;
+  live = 0;
+  for (int i = 0; i < tracks.count(); i++) {
+    if (tracks.deleted(i)) continue;
+    uint32_t pathHash = MetadataDb::hashPath(tracks.path(i).c_str());
+    for (int k = 0; k < 4; k++) {
+      h ^= (uint8_t)(pathHash >> (8 * k));
+      h *= 16777619u;
+    }
+    live++;
+  }
+  return h;
+}
+
+static bool readHeader(fs::FS& fs, FileHeader& hdr) {
+  if (!fs.exists(BROWSE_INDEX_FILE)) return false;
+  File f = fs.open(BROWSE_INDEX_FILE);
+  if (!f) return false;
+  bool ok = f.read((uint8_t*)&hdr, sizeof(hdr)) == sizeof(hdr) && hdr.magic == FILE_MAGIC &&
+            hdr.version == FILE_VERSION && hdr.poolOff + hdr.poolLen == f.size();
+  f.close();
+  return ok;
+}
+
+static SemaphoreHandle_t s_mutex = xSemaphoreCreateMutex();  // The build replaces the file while the page reads it
+static uint32_t s_generation = 0;                              // Incremented on every rebuild
+
+static void lock() {
+  xSemaphoreTake(s_mutex, portMAX_DELAY);
+}
+
+static void unlock() {
+  xSemaphoreGive(s_mutex);
+}
+
+static void removeTmpFiles(fs::FS& fs) {
+  fs.remove(ROWS_TMP_FILE);
+  fs.remove(ORDERED_TMP_FILE);
+  fs.remove(LABELS_TMP_FILE);
+}
+
+static bool copyFile(fs::FS& fs, const char* from, File& to) {
+  File f = fs.open(from);
+  if (!f) return false;
+  uint8_t buf[512];
+  bool ok = true;
+  int n;
+  while (ok && (n = f.read(buf, sizeof(buf))) > 0) ok = to.write(buf, n) == (size_t)n;
+  f.close();
+  return ok;
+}
+
+// Rows per pass: what the TrackList pool has room for, half of it left to the names and group lists
+static size_t passRowsFor() {
+  const MemoryBudget::PoolStats pool = MemoryBudget::getStats(MemoryBudget::Pool::TrackList);
+  const size_t rows = (pool.limit - std::min(pool.used, pool.limit)) / 2 / sizeof(SortRow);
+  return std::max(BROWSE_BUILD_MIN_ROWS, std::min(rows, BROWSE_BUILD_ROWS));
+}
+
+// Tag pass: a row for every live track to ROWS_TMP_FILE, the labels to LABELS_TMP_FILE, the artist, album, genre
+// and year names interned. passRows tracks at a time, one read of the store each.
+static bool writeRows(fs::FS& fs, const TrackLibrary& tracks, Build& b, size_t passRows, uint32_t& rowCount,
+                      int& passes) {
+  const uint32_t unknownArtist = b.names.intern(PLACEHOLDER_UNKNOWN_ARTIST);
+  const uint32_t unknownAlbum = b.names.intern(PLACEHOLDER_UNKNOWN_ALBUM);
+  const uint32_t unknownGenre = b.names.intern(PLACEHOLDER_UNKNOWN_GENRE);
+  const uint32_t unknownYear = b.names.intern(PLACEHOLDER_UNKNOWN_YEAR);
+  File rowsFile = fs.open(ROWS_TMP_FILE, FILE_WRITE);
+  File labels = fs.open(LABELS_TMP_FILE, FILE_WRITE);
+  bool ok = rowsFile && labels;
+  uint32_t labelPos = 0;
+  auto addLabel = [&](TrackRow& r, const String& s) {
+    r.label = labelPos;
+    r.labelLen = std::min(s.length(), (unsigned)UINT16_MAX);
+    labelPos += r.labelLen + 1;
+    ok = ok && labels.write((const uint8_t*)s.c_str(), r.labelLen) == r.labelLen && labels.write((uint8_t)0) == 1;
+  };
+
+  BuildVector<TrackRow> rows;
+  BuildVector<uint32_t> byHash;
+  rows.reserve(passRows);
+  byHash.reserve(passRows);
+  rowCount = 0;
+  for (int t = 0; ok && t < tracks.count();) {
+    rows.clear();
+    for (; t < tracks.count() && rows.size() < passRows; t++) {
+      if (tracks.deleted(t)) continue;
+      const uint32_t pathHash = MetadataDb::hashPath(tracks.path(t).c_str());
+      rows.push_back({(uint32_t)t, pathHash, NO_LABEL, 0, 0, unknownArtist, unknownAlbum, unknownGenre, unknownYear});
+    }
+    if (rows.empty()) break;
+
+    // Tags by path hash, tracks without a record stay under the placeholders
+    byHash.resize(rows.size());
+    for (uint32_t i = 0; i < byHash.size(); i++) byHash[i] = i;
+    std::sort(byHash.begin(), byHash.end(),
+              [&](uint32_t x, uint32_t y) { return rows[x].pathHash < rows[y].pathHash; });
+    MetadataDb::forEach(fs, [&](uint32_t pathHash, const MetadataDb::Info& info) {
+      auto it = std::lower_bound(byHash.begin(), byHash.end(), pathHash,
+                                 [&](uint32_t row, uint32_t h) { return rows[row].pathHash < h; });
+      for (; it != byHash.end() && rows[*it].pathHash == pathHash; ++it) {
+        TrackRow& r = rows[*it];
+        if (info.title.length()) addLabel(r, info.title);
+        if (info.artist.length()) r.artist = b.names.intern(info.artist.c_str());
+        if (info.album.length()) r.album = b.names.intern(info.album.c_str());
+        if (info.genre.length()) r.genre = b.names.intern(info.genre.c_str());
+        if (info.year) {
+          r.yearNum = info.year;
+          r.year = b.names.intern(String(info.year).c_str());
+        }
+      }
+    });
+    for (TrackRow& r : rows) {
+      if (r.label != NO_LABEL) continue;
+      String name = tracks.name(r.track);
+      int dot = name.lastIndexOf('.');
+      if (dot > 0) name = name.substring(0, dot);
+      addLabel(r, name);
+    }
+    const size_t bytes = rows.size() * sizeof(TrackRow);
+    ok = ok && rowsFile.write((const uint8_t*)rows.data(), bytes) == bytes;
+    rowCount += rows.size();
+    passes++;
+    vTaskDelay(1);
+  }
+  if (rowsFile) rowsFile.close();
+  if (labels) labels.close();
+  return ok;
+}
+
+// Call emit with the rows of path in the order of less, passRows of them in memory: every pass reads the whole
+// file and keeps the passRows smallest rows after the last one emitted. Returns the rows emitted, -1 on an error.
+template <typename Less, typename Emit>
+static int32_t forEachSorted(fs::FS& fs, const char* path, uint32_t rowCount, size_t passRows, Less less, Emit emit,
+                             int& passes) {
+  BuildVector<SortRow> heap;
+  heap.reserve(passRows);
+  SortRow last = {};
+  uint32_t done = 0;
+  while (done < rowCount) {
+    File f = fs.open(path);
+    if (!f) return -1;
+    heap.clear();
+    TrackRow buf[16];
+    SortRow s;
+    s.pos = 0;
+    size_t n;
+    while ((n = f.read((uint8_t*)buf, sizeof(buf)) / sizeof(TrackRow)) > 0) {
+      for (size_t i = 0; i < n; i++, s.pos++) {
+        s.row = buf[i];
+        if (done && !less(last, s)) continue;  // Emitted by an earlier pass
+        if (heap.size() < passRows) {
+          heap.push_back(s);
+          std::push_heap(heap.begin(), heap.end(), less);
+        } else if (less(s, heap.front())) {
+          std::pop_heap(heap.begin(), heap.end(), less);
+          heap.back() = s;
+          std::push_heap(heap.begin(), heap.end(), less);
+        }
+      }
+    }
+    f.close();
+    if (heap.empty()) break;  // Fewer rows than written
+    std::sort_heap(heap.begin(), heap.end(), less);
+    for (const SortRow& r : heap) {
+      if (!emit(r.row)) return -1;
+    }
+    last = heap.back();
+    done += heap.size();
+    passes++;
+    vTaskDelay(1);
+  }
+  return done;
+}
+
+static bool buildIndex(fs::FS& fs, const TrackLibrary& tracks, bool force) {
+  unsigned long t0 = millis();
+  uint32_t live;
+  const uint32_t fingerprint = fingerprintOf(tracks, live);
+  FileHeader old;
+  if (!force && readHeader(fs, old) && old.fingerprint == fingerprint && old.trackCount == live) {
+    DEBUG_PRINTF("BrowseIndex: up to date\n");
+    return true;
+  }
+
+  // The rows go to the card and are sorted in passes of passRows, only the names and groups stay in memory
+  if (!fs.exists(APP_DATA_DIR)) fs.mkdir(APP_DATA_DIR);
+  Build b;
+  const size_t passRows = passRowsFor();
+  uint32_t rowCount = 0;
+  int passes = 0;
+  if (!writeRows(fs, tracks, b, passRows, rowCount, passes)) {
+    removeTmpFiles(fs);
+    LOG_PRINTF("BrowseIndex: cannot write %s\n", ROWS_TMP_FILE);
+    return false;
+  }
+  b.labelBase = b.names.pool.size();
+  // Ids of the placeholders, interned by writeRows already
+  const uint32_t unknownArtist = b.names.intern(PLACEHOLDER_UNKNOWN_ARTIST);
+  const uint32_t unknownAlbum = b.names.intern(PLACEHOLDER_UNKNOWN_ALBUM);
+  const uint32_t unknownGenre = b.names.intern(PLACEHOLDER_UNKNOWN_GENRE);
+  const BuildVector<uint32_t> rank = b.names.ranks(UINT32_MAX);
+  auto rankOf = [&](uint32_t id, uint32_t unknown) { return id == unknown ? UINT32_MAX : rank[id]; };
+
+  FileHeader hdr = {};
+  hdr.magic = FILE_MAGIC;
+  hdr.version = FILE_VERSION;
+  hdr.fingerprint = fingerprint;
+  hdr.trackCount = live;
+  File out = fs.open(TMP_FILE, FILE_WRITE);
+  File ordered = fs.open(ORDERED_TMP_FILE, FILE_WRITE);
+  bool ok = out && ordered && out.write((const uint8_t*)&hdr, sizeof(hdr)) == sizeof(hdr);
+
+  // Artists -> albums -> tracks, the tracks of an album by file name; the album list shares the album groups.
+  // The rows are also written in this order, the genre and year orders keep it within a group.
+  BuildVector<std::pair<uint32_t, uint32_t>> albumKeys;  // Album and artist of every ARTIST_ALBUMS entry
+  TrackRow prev = {};
+  uint32_t n = 0;
+  hdr.listOff[BY_ARTIST] = sizeof(hdr);
+  auto byArtistAlbum = [&](const SortRow& x, const SortRow& y) {
+    const TrackRow& rx = x.row;
+    const TrackRow& ry = y.row;
+    if (rx.artist != ry.artist) return rankOf(rx.artist, unknownArtist) < rankOf(ry.artist, unknownArtist);
+    if (rx.album != ry.album) return rankOf(rx.album, unknownAlbum) < rankOf(ry.album, unknownAlbum);
+    int c = rx.track != ry.track ? collate(tracks.name(rx.track).c_str(), tracks.name(ry.track).c_str()) : 0;
+    return c ? c < 0 : x.pos < y.pos;
+  };
+  auto addByArtist = [&](const TrackRow& r) {
+    bool newArtist = n == 0 || prev.artist != r.artist;
+    if (newArtist) b.lists[ARTISTS].push_back(b.node(r.artist, ARTIST_ALBUMS, b.lists[ARTIST_ALBUMS].size()));
+    if (newArtist || prev.album != r.album) {
+      b.lists[ARTIST_ALBUMS].push_back(b.node(r.album, BY_ARTIST, n));
+      albumKeys.push_back({r.album, r.artist});
+      b.lists[ARTISTS].back().count++;
+    }
+    b.lists[ARTIST_ALBUMS].back().count++;
+    prev = r;
+    n++;
+    const Entry e = b.trackRef(r);
+    return out.write((const uint8_t*)&e, sizeof(e)) == sizeof(e) &&
+           ordered.write((const uint8_t*)&r, sizeof(r)) == sizeof(r);
+  };
+  const int32_t sorted = ok ? forEachSorted(fs, ROWS_TMP_FILE, rowCount, passRows, byArtistAlbum, addByArtist, passes)
+                            : -1;
+  if (ordered) ordered.close();
+  ok = sorted >= 0;
+  hdr.listLen[BY_ARTIST] = n;
+  BuildVector<uint32_t> albumOrder(albumKeys.size());
+  for (uint32_t i = 0; i < albumOrder.size(); i++) albumOrder[i] = i;
+  std::sort(albumOrder.begin(), albumOrder.end(), [&](uint32_t x, uint32_t y) {
+    const auto& kx = albumKeys[x];
+    const auto& ky = albumKeys[y];
+    if (kx.first != ky.first) return rankOf(kx.first, unknownAlbum) < rankOf(ky.first, unknownAlbum);
+    return rankOf(kx.second, unknownArtist) < rankOf(ky.second, unknownArtist);
+  });
+  for (uint32_t i : albumOrder) b.lists[ALBUMS].push_back(b.lists[ARTIST_ALBUMS][i]);
+  BuildVector<uint32_t>().swap(albumOrder);
+  BuildVector<std::pair<uint32_t, uint32_t>>().swap(albumKeys);
+
+  // Genres and years, tracks in artist/album order within a group
+  auto groupBy = [&](List groups, List refs, uint32_t TrackRow::*key, auto keyRank) {
+    hdr.listOff[refs] = out.position();
+    uint32_t count = 0;
+    uint32_t prevKey = 0;
+    auto less = [&](const SortRow& x, const SortRow& y) {
+      uint32_t kx = keyRank(x.row);
+      uint32_t ky = keyRank(y.row);
+      return kx != ky ? kx < ky : x.pos < y.pos;
+    };
+    auto add = [&](const TrackRow& r) {
+      if (count == 0 || prevKey != r.*key) b.lists[groups].push_back(b.node(r.*key, refs, count));
+      b.lists[groups].back().count++;
+      prevKey = r.*key;
+      count++;
+      const Entry e = b.trackRef(r);
+      return out.write((const uint8_t*)&e, sizeof(e)) == sizeof(e);
+    };
+    const int32_t grouped = forEachSorted(fs, ORDERED_TMP_FILE, (uint32_t)sorted, passRows, less, add, passes);
+    hdr.listLen[refs] = count;
+    return grouped >= 0;
+  };
+  ok = ok && groupBy(GENRES, BY_GENRE, &TrackRow::genre,
+                     [&](const TrackRow& r) { return rankOf(r.genre, unknownGenre); });
+  ok = ok && groupBy(YEARS, BY_YEAR, &TrackRow::year,
+                     [&](const TrackRow& r) { return r.yearNum ? (uint32_t)r.yearNum : UINT16_MAX + 1u; });
+
+  // The group lists, the pool (names, then the labels) and the header with the offsets
+  for (int l = 0; l < LIST_COUNT && ok; l++) {
+    if (l == BY_ARTIST || l == BY_GENRE || l == BY_YEAR) continue;
+    hdr.listOff[l] = out.position();
+    hdr.listLen[l] = b.lists[l].size();
+    size_t bytes = b.lists[l].size() * sizeof(Entry);
+    ok = out.write((const uint8_t*)b.lists[l].data(), bytes) == bytes;
+  }
+  hdr.poolOff = out.position();
+  ok = ok && out.write((const uint8_t*)b.names.pool.data(), b.labelBase) == b.labelBase &&
+       copyFile(fs, LABELS_TMP_FILE, out);
+  hdr.poolLen = out.position() - hdr.poolOff;
+  ok = ok && out.seek(0) && out.write((const uint8_t*)&hdr, sizeof(hdr)) == sizeof(hdr);
+  if (out) out.close();
+  removeTmpFiles(fs);
+  if (!ok) {
+    fs.remove(TMP_FILE);
+    LOG_PRINTLN("BrowseIndex: write failed");
+    return false;
+  }
+  lock();
+  fs.remove(BROWSE_INDEX_FILE);
+  fs.rename(TMP_FILE, BROWSE_INDEX_FILE);
+  s_generation++;
+  unlock();
+  LOG_PRINTF("BrowseIndex: %u artists, %u albums, %u genres, %u years, %d passes, %lu bytes in %lu ms\n",
+             (unsigned)hdr.listLen[ARTISTS], (unsigned)hdr.listLen[ALBUMS], (unsigned)hdr.listLen[GENRES],
+             (unsigned)hdr.listLen[YEARS], passes, (unsigned long)(hdr.poolOff + hdr.poolLen),
+             (unsigned long)(millis() - t0));
+  return true;
+}
+
+bool build(fs::FS& fs, const TrackLibrary& tracks, bool force) {
+  try {
+    return buildIndex(fs, tracks, force);
+  } catch (const std::bad_alloc&) {
+    // The files were closed while unwinding, the index in use stays
+    fs.remove(TMP_FILE);
+    removeTmpFiles(fs);
+    LOG_PRINTF("BrowseIndex: not enough memory for %d tracks, views not updated\n", tracks.count());
+    return false;
+  }
+}
+
+// ---- Navigation (Task_TFT) ----
+
+struct Level {
+  uint8_t list;      // NO_LIST: categories
+  uint32_t first;
+  uint32_t count;
+  int selected;
+  String title;
+};
+static Level s_levels[BROWSE_MAX_DEPTH];
+static int s_depth = 0;
+static FileHeader s_header;
+static bool s_headerValid = false;
+static uint32_t s_viewGeneration = UINT32_MAX;
+
+// Rows read last, valid while the level and window stay the same
+static Row s_rows[BROWSE_VISIBLE_ROWS];
+static int s_rowsDepth = -1;
+static int s_rowsFirst = 0;
+static int s_rowsCount = 0;
+static uint32_t s_rowsLibrary = 0;  // TrackLibrary::generation() the track indexes belong to
+
+static void dropRows() {
+  s_rowsDepth = -1;
+}
+
+// Back to the category level whenever the file changed
+void refresh(fs::FS& fs) {
+  if (s_viewGeneration == s_generation) return;
+  lock();
+  s_viewGeneration = s_generation;
+  s_headerValid = readHeader(fs, s_header);
+  unlock();
+  s_depth = 0;
+  s_levels[0] = {NO_LIST, 0, (uint32_t)CATEGORY_COUNT, s_levels[0].selected, "BROWSE"};
+  dropRows();
+}
+
+void reset() {
+  s_viewGeneration = UINT32_MAX;
+  s_levels[0].selected = 0;
+}
+
+int depth() {
+  return s_depth;
+}
+
+String title() {
+  return s_levels[s_depth].title;
+}
+
+int rowCount() {
+  return s_levels[s_depth].count;
+}
+
+int selected() {
+  return s_levels[s_depth].selected;
+}
+
+void move(int delta) {
+  Level& l = s_levels[s_depth];
+  if (l.count == 0) return;
+  l.selected = ((l.selected + delta) % (int)l.count + (int)l.count) % (int)l.count;
+}
+
+static bool readEntries(fs::FS& fs, uint8_t list, uint32_t index, int count, Entry* out) {
+  if (!s_headerValid || list >= LIST_COUNT || index + count > s_header.listLen[list]) return false;
+  lock();
+  File f = fs.open(BROWSE_INDEX_FILE);
+  size_t bytes = count * sizeof(Entry);
+  bool ok = f && f.seek(s_header.listOff[list] + index * sizeof(Entry)) && f.read((uint8_t*)out, bytes) == bytes;
+  if (f) f.close();
+  unlock();
+  return ok;
+}
+
+static String readName(File& f, const Entry& e) {
+  char buf[256];
+  size_t n = std::min((size_t)e.nameLen, sizeof(buf) - 1);
+  if (!f.seek(s_header.poolOff + e.nameOff) || f.read((uint8_t*)buf, n) != n) return String();
+  buf[n] = '\0';
+  return String(buf);
+}
+
+// Library index of a track entry; tracks deleted since the build move the following ones down
+static int resolve(const TrackLibrary& tracks, const Entry& e) {
+  for (int k = 0; k <= BROWSE_RESOLVE_WINDOW && (int)e.first - k >= 0; k++) {
+    int i = (int)e.first - k;
+    if (i < tracks.count() && MetadataDb::hashPath(tracks.path(i).c_str()) == e.count) return i;
+  }
+  return -1;
+}
+
+int rows(fs::FS& fs, const TrackLibrary& tracks, int first, int count, Row* out) {
+  refresh(fs);
+  const Level& l = s_levels[s_depth];
+  count = std::min(count, std::min((int)BROWSE_VISIBLE_ROWS, (int)l.count - first));
+  if (first < 0 || count <= 0) return 0;
+  if (s_rowsDepth != s_depth || s_rowsFirst != first || s_rowsCount != count ||
+      s_rowsLibrary != tracks.generation()) {
+    s_rowsDepth = s_depth;
+    s_rowsLibrary = tracks.generation();
+    s_rowsFirst = first;
+    s_rowsCount = count;
+    if (l.list == NO_LIST) {
+      for (int i = 0; i < count; i++) {
+        s_rows[i] = Row();
+        s_rows[i].label = CATEGORY_NAMES[first + i];
+        s_rows[i].count = s_headerValid ? s_header.listLen[CATEGORY_LISTS[first + i]] : 0;
+      }
+    } else {
+      Entry entries[BROWSE_VISIBLE_ROWS];
+      if (!readEntries(fs, l.list, l.first + first, count, entries)) {
+        s_rowsCount = 0;
+        return 0;
+      }
+      lock();
+      File f = fs.open(BROWSE_INDEX_FILE);
+      for (int i = 0; i < count; i++) {
+        Row& r = s_rows[i];
+        r = Row();
+        r.label = f ? readName(f, entries[i]) : String();
+        r.isTrack = entries[i].childList == NO_LIST;
+        r.count = r.isTrack ? 0 : entries[i].count;
+        r.track = r.isTrack ? resolve(tracks, entries[i]) : -1;
+      }
+      if (f) f.close();
+      unlock();
+    }
+  }
+  for (int i = 0; i < s_rowsCount; i++) out[i] = s_rows[i];
+  return s_rowsCount;
+}
+
+bool enter(fs::FS& fs, const TrackLibrary& tracks, int& trackIndex) {
+  refresh(fs);
+  Level& l = s_levels[s_depth];
+  if (l.count == 0 || s_depth + 1 >= BROWSE_MAX_DEPTH) return false;
+  Level next;
+  next.selected = 0;
+  if (l.list == NO_LIST) {
+    if (!s_headerValid) return false;
+    next.list = CATEGORY_LISTS[l.selected];
+    next.first = 0;
+    next.count = s_header.listLen[next.list];
+    next.title = CATEGORY_NAMES[l.selected];
+  } else {
+    Entry e;
+    if (!readEntries(fs, l.list, l.first + l.selected, 1, &e)) return false;
+    if (e.childList == NO_LIST) {
+      trackIndex = resolve(tracks, e);
+      return trackIndex >= 0;
+    }
+    next.list = e.childList;
+    next.first = e.first;
+    next.count = e.count;
+    lock();
+    File f = fs.open(BROWSE_INDEX_FILE);
+    next.title = f ? readName(f, e) : String();
+    if (f) f.close();
+    unlock();
+  }
+  s_levels[++s_depth] = next;
+  dropRows();
+  return false;
+}
+
+bool back() {
+  if (s_depth == 0) return false;
+  s_depth--;
+  dropRows();
+  return true;
+}
+
+}  // namespace BrowseIndex
@@ -0,0 +1,333 @@
+#include "../include/cover_cache.hpp"
+#include "../include/config.hpp"
+#include "../include/file_range.hpp"
+#include "../include/folder_art.hpp"
+#include "../include/image_utils.hpp"
+#include "../include/jpeg_thumb.hpp"
+#include "../include/memory_budget.hpp"
+#include "../include/thumb_store.hpp"
+#include <SD.h>
+
+namespace CoverCache {
+
+static constexpr size_t THUMB_BYTES = COVER_WIDTH * COVER_HEIGHT * sizeof(uint16_t);
+
+// What surrounds the image at [pos, pos + len)
+enum class Container {
+  Apic,  // ID3v2.3/2.4 picture frame
+  Pic,   // ID3v2.2 picture frame
+  File   // Image file (folder art), the image starts right at pos
+};
+
+struct Job {
+  String path;
+  size_t pos = 0;
+  size_t len = 0;
+  Container container = Container::Apic;
+};
+
+static SemaphoreHandle_t s_mutex = nullptr;  // Guards the job, the state and the thumbnail while Ready
+static TaskHandle_t s_task = nullptr;
+static Job s_job;                 // Latest request
+static uint32_t s_jobSeq = 0;     // Bumped by request() and clear()
+static uint32_t s_doneSeq = 0;    // Last job the worker finished
+static State s_state = State::None;
+static bool s_busy = false;       // Worker is decoding (outside the mutex)
+static uint16_t* s_buf = nullptr;  // Kept across tracks
+static M5Canvas s_thumb;
+
+// Thumbnails of the other tracks are stored while nothing else is requested
+static const TrackLibrary* s_prefill = nullptr;  // Until every track was visited
+static int s_prefillNext = 0;
+static unsigned long s_lastJobTime = 0;
+static uint16_t* s_scratchBuf = nullptr;  // Only while prefilling, the shown thumbnail stays intact
+static M5Canvas s_scratch;
+
+static void lock() {
+  xSemaphoreTake(s_mutex, portMAX_DELAY);
+}
+
+static void unlock() {
+  xSemaphoreGive(s_mutex);
+}
+
+// Decode the image in [pos, pos + len) of the open range into canvas (pixels is its buffer)
+static State decodeInto(M5Canvas& canvas, uint16_t* pixels, FileRange& range, size_t pos, size_t len,
+                        Container container) {
+  // A picture frame starts with encoding, MIME type and description before the image itself
+  size_t startOff = 0;
+  ImageFormat fmt = ImageFormat::Unknown;
+  bool found = container == Container::File
+                   ? findImageStart(range, COVER_HEADER_BUF_SIZE, startOff, fmt)
+                   : findPictureImage(range, len, container == Container::Pic, startOff, fmt);
+  if (!found || fmt == ImageFormat::GIF) return State::NoCover;
+  range.setWindow(pos + startOff, len > startOff ? len - startOff : 0);
+  canvas.fillScreen(BLACK);
+
+  if (fmt == ImageFormat::JPEG) {
+    // Usually a large JPEG: decode at 1/2..1/8 and box filter to the thumbnail size
+    JpegThumb::Stats st;
+    if (JpegThumb::decode(range, pixels, COVER_WIDTH, COVER_HEIGHT, &st)) {
+      DEBUG_PRINTF("Cover JPEG %ux%u at 1/%u -> %ux%u in %lu ms, %lu bytes heap\n", st.srcW, st.srcH,
+                   1u << st.dctScale, st.outW, st.outH, (unsigned long)st.decodeMs, (unsigned long)st.heapBytes);
+      return State::Ready;
+    }
+    range.seek(0);
+    canvas.fillScreen(BLACK);
+  }
+
+  float scaleX = 0.0f;  // 0.0 means fit to size if the dimensions are unknown
+  float scaleY = 0.0f;  // 0.0 means follow scaleX (maintain aspect ratio)
+  uint32_t imgW = 0, imgH = 0;
+  if (getImageSize(range, 0, fmt, imgW, imgH) && imgW > 0 && imgH > 0) {
+    float sx = (float)COVER_WIDTH / (float)imgW;
+    float sy = (float)COVER_HEIGHT / (float)imgH;
+    scaleX = sx < sy ? sx : sy;  // Use smaller scale to fit both dimensions
+    if (scaleX <= 0.0f || scaleX > 1.0f) scaleX = 1.0f;
+  }
+
+  range.seek(0);
+  lgfx::DataWrapper* data = &range;  // Not the File overloads
+  bool ok = false;
+  if (fmt == ImageFormat::JPEG) {
+    ok = canvas.drawJpg(data, 0, 0, COVER_WIDTH, COVER_HEIGHT, 0, 0, scaleX, scaleY);
+  } else if (fmt == ImageFormat::PNG) {
+    ok = canvas.drawPng(data, 0, 0, COVER_WIDTH, COVER_HEIGHT, 0, 0, scaleX, scaleY);
+  } else if (fmt == ImageFormat::BMP) {
+    ok = canvas.drawBmp(data, 0, 0, COVER_WIDTH, COVER_HEIGHT, 0, 0, scaleX, scaleY);
+  } else if (fmt == ImageFormat::QOI) {
+    ok = canvas.drawQoi(data, 0, 0, COVER_WIDTH, COVER_HEIGHT, 0, 0, scaleX, scaleY);
+  }
+  DEBUG_PRINTF("Cover %s: format %d, %lux%lu, %lu block reads\n", ok ? "decoded" : "decode failed", (int)fmt,
+               (unsigned long)imgW, (unsigned long)imgH, (unsigned long)range.getStats().misses);
+  return ok ? State::Ready : State::Failed;
+}
+
+// Thumbnail from the store, or decoded and stored. range is open on the track.
+static State loadOrDecode(M5Canvas& canvas, uint16_t* pixels, FileRange& range, size_t pos, size_t len,
+                          Container container) {
+  ThumbStore::Key key = ThumbStore::makeKey(range.path().c_str(), range.fileSize(), range.lastWrite(), pos, len);
+  ThumbStore::Result stored = ThumbStore::load(SD, key, pixels);
+  if (stored == ThumbStore::Result::Image) return State::Ready;
+  if (stored == ThumbStore::Result::NoCover) return State::NoCover;
+  range.setWindow(pos, len);
+  State st = decodeInto(canvas, pixels, range, pos, len, container);
+  if (st == State::Ready) ThumbStore::save(SD, key, pixels);
+  if (st == State::NoCover) ThumbStore::save(SD, key, nullptr);
+  return st;
+}
+
+static bool allocCanvas(M5Canvas& canvas, uint16_t*& buf) {
+  if (buf) return true;
+  buf = (uint16_t*)MemoryBudget::allocate(MemoryBudget::Pool::CoverArt, THUMB_BYTES);
+  if (!buf) return false;
+  canvas.setBuffer(buf, COVER_WIDTH, COVER_HEIGHT, 16);
+  return true;
+}
+
+// Runs on the worker without the mutex: the renderer only reads the thumbnail while it is Ready
+static State decode(const Job& job) {
+  if (!allocCanvas(s_thumb, s_buf)) return State::Failed;
+  FileRange range;  // File and read blocks are released when the decode is done
+  if (!range.open(SD, job.path.c_str(), job.pos, job.len)) return State::Failed;
+  // The audio library reports APIC frames; a PIC header fails the image check and is scanned
+  return loadOrDecode(s_thumb, s_buf, range, job.pos, job.len, job.container);
+}
+
+// Store the thumbnail of the next track in the prefill list; false when the list is done
+static bool prefillOne() {
+  lock();
+  if (!s_prefill || s_prefillNext >= s_prefill->count()) {
+    s_prefill = nullptr;
+    unlock();
+    MemoryBudget::deallocate(MemoryBudget::Pool::CoverArt, s_scratchBuf, THUMB_BYTES);
+    s_scratchBuf = nullptr;
+    return false;
+  }
+  const TrackLibrary* list = s_prefill;
+  int index = s_prefillNext++;
+  String path = list->path(index);
+  unlock();
+  if (path.length() == 0) return true;  // Deleted track
+  if (!allocCanvas(s_scratch, s_scratchBuf)) {
+    // Retried later, memory may be back; unless prefill() restarted the list meanwhile
+    lock();
+    if (s_prefill == list && s_prefillNext == index + 1) s_prefillNext = index;
+    unlock();
+    return true;
+  }
+  FileRange range;
+  uint32_t pos = 0, len = 0;
+  bool id3v22 = false;
+  if (!range.open(SD, path.c_str(), 0, 0)) return true;
+  Container container = Container::Apic;
+  if (!findId3Picture(range, pos, len, &id3v22)) {
+    // No embedded cover: the folder image, stored once for the whole folder
+    String image;
+    if (!FolderArt::find(path, image) || !range.open(SD, image.c_str(), 0, 0)) return true;
+    container = Container::File;
+  } else if (id3v22) {
+    container = Container::Pic;
+  }
+  ThumbStore::Key key = ThumbStore::makeKey(range.path().c_str(), range.fileSize(), range.lastWrite(), pos, len);
+  if (ThumbStore::contains(SD, key)) return true;
+  unsigned long t0 = millis();
+  loadOrDecode(s_scratch, s_scratchBuf, range, pos, len, container);
+  LOG_PRINTF("Cover prefill: %s in %lu ms\n", path.c_str(), (unsigned long)(millis() - t0));
+  return true;
+}
+
+static void workerTask(void*) {
+  bool prefilling = false;
+  while (true) {
+    ulTaskNotifyTake(pdTRUE, prefilling ? pdMS_TO_TICKS(COVER_PREFILL_INTERVAL_MS) : portMAX_DELAY);
+    while (true) {
+      lock();
+      if (s_doneSeq == s_jobSeq) {
+        unlock();
+        break;
+      }
+      Job job = s_job;
+      uint32_t seq = s_jobSeq;
+      bool work = job.path.length() > 0;  // Empty after clear()
+      s_state = work ? State::Pending : State::None;
+      s_busy = work;
+      unlock();
+
+      unsigned long t0 = millis();
+      State st = work ? decode(job) : State::None;
+      if (work) LOG_PRINTF("Cover cache: %s in %lu ms\n", job.path.c_str(), (unsigned long)(millis() - t0));
+
+      lock();
+      s_busy = false;
+      s_doneSeq = seq;
+      if (seq == s_jobSeq) s_state = st;  // Otherwise the loop picks up the newer job
+      s_lastJobTime = millis();
+      unlock();
+    }
+    lock();
+    prefilling = s_prefill || s_scratchBuf;
+    bool idle = millis() - s_lastJobTime >= COVER_PREFILL_IDLE_MS;
+    unlock();
+    if (prefilling && idle) prefilling = prefillOne();
+  }
+}
+
+static bool startTask() {
+  if (!s_mutex) s_mutex = xSemaphoreCreateMutex();
+  if (s_task) return true;
+  if (xTaskCreatePinnedToCore(workerTask, "CoverCache", COVER_CACHE_TASK_STACK, NULL, COVER_CACHE_TASK_PRIORITY,
+                              &s_task, 0) != pdPASS) {
+    s_task = nullptr;
+    return false;
+  }
+  return true;
+}
+
+// Called every UI frame: the job is only copied and the worker only woken when it differs from the current one
+static void submit(const String& path, size_t pos, size_t len, Container container) {
+  if (!startTask()) {
+    if (!s_mutex) return;
+    lock();
+    s_state = State::Failed;
+    unlock();
+    return;
+  }
+  lock();
+  bool same = s_job.path == path && s_job.pos == pos && s_job.len == len && s_job.container == container;
+  if (!same) {
+    s_job.path = path;
+    s_job.pos = pos;
+    s_job.len = len;
+    s_job.container = container;
+    s_jobSeq++;
+    s_state = State::Pending;
+  }
+  unlock();
+  if (!same) xTaskNotifyGive(s_task);
+}
+
+// Drop the thumbnail of the previous track without a job for the worker
+static void dropThumbnail() {
+  if (!s_mutex) return;
+  lock();
+  if (s_job.path.length() > 0 || s_state != State::None) {
+    s_job = Job();
+    s_jobSeq++;
+    s_state = State::None;
+    if (!s_busy) s_doneSeq = s_jobSeq;  // A running decode sees the newer sequence and leaves the state alone
+  }
+  unlock();
+}
+
+void request(const String& path, size_t pos, size_t len) {
+  submit(path, pos, len, Container::Apic);
+}
+
+// Folder image of the last requestFolderArt(), looked up again only when the folder or FolderArt changes
+// (UI task only)
+static String s_artDir;
+static String s_artImage;  // Empty: the folder has none
+static uint32_t s_artGeneration = 0;
+static bool s_artKnown = false;
+
+static bool inArtDir(const String& trackPath) {
+  const int slash = trackPath.lastIndexOf('/');
+  const int dirLen = s_artDir == "/" ? 0 : (int)s_artDir.length();
+  return slash == dirLen && trackPath.startsWith(s_artDir);
+}
+
+void requestFolderArt(const String& trackPath) {
+  const uint32_t generation = FolderArt::generation();
+  if (!s_artKnown || generation != s_artGeneration || !inArtDir(trackPath)) {
+    const int slash = trackPath.lastIndexOf('/');
+    s_artDir = slash > 0 ? trackPath.substring(0, slash) : String("/");
+    if (!FolderArt::find(trackPath, s_artImage)) s_artImage = "";
+    s_artGeneration = generation;
+    s_artKnown = true;
+  }
+  if (s_artImage.length() == 0) {
+    dropThumbnail();
+  } else {
+    submit(s_artImage, 0, 0, Container::File);
+  }
+}
+
+void prefill(const TrackLibrary& tracks) {
+  if (!startTask()) return;
+  lock();
+  s_prefill = &tracks;
+  s_prefillNext = 0;
+  s_lastJobTime = millis();
+  unlock();
+  xTaskNotifyGive(s_task);
+}
+
+State draw(M5Canvas& dst, int x, int y) {
+  if (!s_mutex) return State::None;
+  lock();
+  State st = s_state;
+  if (st == State::Ready) s_thumb.pushSprite(&dst, x, y);
+  unlock();
+  return st;
+}
+
+void clear() {
+  if (!s_mutex) return;
+  lock();
+  s_job = Job();
+  s_jobSeq++;
+  s_state = State::None;
+  unlock();
+  if (s_task) xTaskNotifyGive(s_task);
+  unsigned long t0 = millis();
+  while (millis() - t0 < COVER_CACHE_CLEAR_WAIT_MS) {
+    lock();
+    bool busy = s_busy;
+    unlock();
+    if (!busy) break;
+    vTaskDelay(pdMS_TO_TICKS(10));
+  }
+}
+
+}  // namespace CoverCache
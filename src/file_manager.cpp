@@ -1,80 +1,28 @@
 #include "../include/file_manager.hpp"
 #include "../include/config.hpp"
+#include "../include/library_index.hpp"
+#include "../include/metadata_db.hpp"
+#include "../include/shuffle.hpp"
 #include <SD.h>
 #include "M5Cardputer.h"
 #include <ESP32Time.h>
+#include <algorithm>
 #include <cstdio>
 
 namespace FileManager {
 
-void listFiles(fs::FS& fs, const char* dirname, uint8_t levels, AppState& appState) {
-  LOG_PRINTF("Listing directory: %s\n", dirname);
-  // Ensure dirname starts with '/'
-  String dir = String(dirname);
-  if (!dir.startsWith("/")) dir = String("/") + dir;
-  File root = fs.open(dir.c_str());
-  if (!root) {
-    LOG_PRINTLN("Failed to open directory");
-    return;
-  }
-  if (!root.isDirectory()) {
-    LOG_PRINTLN("Not a directory");
-    return;
-  }
-
-  File file = root.openNextFile();
-  while (file && appState.fileCount < MAX_FILES) {
-    if (file.isDirectory()) {
-      // Build subdirectory path ensuring single leading '/'
-      String sub = String(file.name());
-      if (!sub.startsWith("/")) sub = dir + String("/") + sub;
-      LOG_PRINT("DIR : ");
-      LOG_PRINTLN(sub.c_str());
-      if (levels) {
-        listFiles(fs, sub.c_str(), levels - 1, appState);
-      }
-    } else {
-      // Build full file path
-      String fname = String(file.name());
-      DEBUG_PRINTF("DEBUG: file.name() = '%s', dir = '%s'\n", fname.c_str(), dir.c_str());
-      if (!fname.startsWith("/")) fname = dir + String("/") + fname;
-      DEBUG_PRINTF("DEBUG: after path build, fname = '%s'\n", fname.c_str());
-      // Filter by supported extensions: .mp3 and .wav
-      String lower = fname; lower.toLowerCase();
-      int dot = lower.lastIndexOf('.');
-      bool supported = false;
-      if (dot >= 0) {
-        String ext = lower.substring(dot + 1);
-        if (ext == "mp3" || ext == "wav") supported = true;
-      }
-      if (supported) {
-        LOG_PRINT("FILE: ");
-        LOG_PRINTLN(fname.c_str());
-        appState.audioFiles[appState.fileCount] = fname;
-        LOG_PRINTF("Stored audioFiles[%d] = %s\n", appState.fileCount, appState.audioFiles[appState.fileCount].c_str());
-        appState.fileCount++;
-      } else {
-        LOG_PRINTF("SKIP (unsupported): %s\n", fname.c_str());
-      }
-    }
-    file = root.openNextFile();
-  }
-}
-
 void deleteCurrentFile(fs::FS& fs, AppState& appState, const Callbacks& callbacks) {
-  if (appState.fileCount == 0 || appState.currentSelectedIndex >= appState.fileCount) {
+  const int deleteIndex = appState.currentSelectedIndex;  // File index to delete (currently selected)
+  if (deleteIndex < 0 || deleteIndex >= appState.tracks.count() || appState.tracks.deleted(deleteIndex)) {
     LOG_PRINTLN("No file to delete");
     return;
   }
   
-  int deleteIndex = appState.currentSelectedIndex;  // File index to delete (currently selected)
-  String fileToDelete = appState.audioFiles[deleteIndex];
+  String fileToDelete = appState.tracks.path(deleteIndex);
   LOG_PRINTF("Attempting to delete: %s (index %d)\n", fileToDelete.c_str(), deleteIndex);
   
-  // Record if playing before delete, and which song is playing
+  // Record if playing before delete
   bool wasPlaying = (appState.isPlaying && !appState.stopped);
-  int playingIndexBeforeDelete = appState.currentPlayingIndex;
-  bool deletingPlayingSong = (deleteIndex == playingIndexBeforeDelete);
   
   // Delete the file from SD card
   if (fs.remove(fileToDelete)) {
@@ -84,70 +32,62 @@ void deleteCurrentFile(fs::FS& fs, AppState& appState, const Callbacks& callback
     return;
   }
   
-  // Remove file from list
-  for (int i = deleteIndex; i < appState.fileCount - 1; i++) {
-    appState.audioFiles[i] = appState.audioFiles[i + 1];
-  }
-  appState.fileCount--;
-  
-  // Adjust playing index: if delete index <= playing index, playing index needs to decrease by 1
-  int playingIndexAfterDelete = playingIndexBeforeDelete;
-  if (deleteIndex <= playingIndexBeforeDelete) {
-    playingIndexAfterDelete--;  // Playing index moves forward
-    if (playingIndexAfterDelete < 0 && appState.fileCount > 0) playingIndexAfterDelete = 0;
-    if (playingIndexAfterDelete >= appState.fileCount && appState.fileCount > 0) playingIndexAfterDelete = appState.fileCount - 1;
-  }
-  
-  // Adjust current selected index
-  if (deleteIndex < appState.currentSelectedIndex) {
-    appState.currentSelectedIndex--;  // Deleted file is before current position, index moves forward
-  } else if (deleteIndex == appState.currentSelectedIndex) {
-    // Deleted the currently selected song, need to adjust selected index
-    if (appState.currentSelectedIndex >= appState.fileCount) {
-      appState.currentSelectedIndex = appState.fileCount - 1;
-    }
-    if (appState.currentSelectedIndex < 0) {
-      appState.currentSelectedIndex = 0;
+  // Leave a tombstone: every other index (playing, shuffle order, search results) stays as it is
+  Shuffle::remove(deleteIndex);
+  appState.tracks.remove(deleteIndex);
+  const int next = appState.stepInList(deleteIndex, 1);  // deleteIndex itself if no track is left
+  appState.currentSelectedIndex = next;
+  
+  if (deleteIndex != appState.currentPlayingIndex) {
+    // Deleted song was not playing, continue playing current song
+    LOG_PRINTF("Deleted file (index %d) was not playing, continuing with: %s\n", deleteIndex,
+               appState.tracks.path(appState.currentPlayingIndex).c_str());
+  } else if (next != deleteIndex) {
+    // Deleted the playing song: the next one plays
+    appState.currentPlayingIndex = next;
+    if (callbacks.resetClock) callbacks.resetClock();
+    appState.nextS = 1;
+    // If playing before delete, continue playing new song after delete
+    if (wasPlaying) {
+      appState.isPlaying = true;
+      appState.stopped = false;
     }
-  }
-  // If deleteIndex > currentSelectedIndex, selection remains unchanged (deleted file is after current position)
-  
-  // Ensure currentSelectedIndex is within valid range
-  if (appState.currentSelectedIndex < 0) appState.currentSelectedIndex = 0;
-  if (appState.currentSelectedIndex >= appState.fileCount && appState.fileCount > 0) appState.currentSelectedIndex = appState.fileCount - 1;
-  
-  // If deleting currently playing song, need to switch to new song
-  if (deletingPlayingSong) {
-    // Playing index before delete has been adjusted, now need to switch to adjusted index
-    if (appState.fileCount > 0 && playingIndexAfterDelete >= 0 && playingIndexAfterDelete < appState.fileCount) {
-      appState.currentSelectedIndex = playingIndexAfterDelete;  // Make selected index follow playing index
-      appState.currentPlayingIndex = playingIndexAfterDelete;  // Update global variable
-      if (callbacks.resetClock) callbacks.resetClock();
-      appState.nextS = 1;
-      // If playing before delete, continue playing new song after delete
-      if (wasPlaying) {
-        appState.isPlaying = true;
-        appState.stopped = false;
-      }
-      LOG_PRINTF("Switched to new current file: %s (index %d)\n", appState.audioFiles[appState.currentSelectedIndex].c_str(), appState.currentSelectedIndex);
-      if (callbacks.onFileDeleted) {
-        callbacks.onFileDeleted(deleteIndex, playingIndexAfterDelete);
-      }
-    } else {
-      // No more files, stop playback
-      appState.isPlaying = false;
-      appState.stopped = true;
-      appState.currentPlayingIndex = 0;
-      LOG_PRINTLN("No more files available");
+    LOG_PRINTF("Switched to new current file: %s (index %d)\n", appState.tracks.path(next).c_str(), next);
+    if (callbacks.onFileDeleted) {
+      callbacks.onFileDeleted(deleteIndex, next);
     }
   } else {
-    // Deleted song was not playing, continue playing current song, don't switch
-    // Only need to update appState.currentPlayingIndex to adjusted index
-    appState.currentPlayingIndex = playingIndexAfterDelete;
-    LOG_PRINTF("Deleted file (index %d) was not playing (was index %d, now %d), continuing with: %s\n", 
-                  deleteIndex, playingIndexBeforeDelete, playingIndexAfterDelete, 
-                  appState.fileCount > 0 && playingIndexAfterDelete < appState.fileCount ? appState.audioFiles[playingIndexAfterDelete].c_str() : "none");
+    // No more files, stop playback
+    appState.isPlaying = false;
+    appState.stopped = true;
+    LOG_PRINTLN("No more files available");
+  }
+}
+
+bool compactLibrary(AppState& appState) {
+  const LibraryIndex::Progress progress = LibraryIndex::getProgress();
+  if (appState.tracks.deletedCount() == 0 || appState.nextS || progress.scanning || progress.validating ||
+      MetadataDb::isUpdating()) {
+    return false;
+  }
+  // Not while Task_Audio changes tracks: it reads an index and then its path (onEOF, nextS)
+  if (xSemaphoreTake(appState.indexMutex, 0) != pdTRUE) return false;
+  unsigned long t0 = millis();
+  const std::vector<int> removed = appState.tracks.compact();
+  if (removed.empty()) {
+    appState.unlockIndexes();
+    return false;
   }
+  const int count = appState.tracks.count();
+  auto move = [&](int index) { return std::max(0, std::min(TrackLibrary::compactedIndex(removed, index), count - 1)); };
+  if (appState.currentPlayingIndex >= 0) appState.currentPlayingIndex = move(appState.currentPlayingIndex);
+  appState.currentSelectedIndex = move(appState.currentSelectedIndex);
+  appState.lastSelectedIndex = appState.currentSelectedIndex;  // Same track, the name keeps scrolling
+  Shuffle::compact(removed);
+  appState.unlockIndexes();
+  LOG_PRINTF("Library compacted: %u deleted tracks dropped in %lu ms\n", (unsigned)removed.size(),
+             (unsigned long)(millis() - t0));
+  return true;
 }
 
 void captureScreenshot(fs::FS& fs, M5Canvas& sprite, ESP32Time& rtc) {
@@ -0,0 +1,131 @@
+#include "../include/file_range.hpp"
+#include "../include/memory_budget.hpp"
+
+FileRange::~FileRange() {
+  release();
+}
+
+bool FileRange::open(fs::FS& fs, const char* path, uint32_t offset, uint32_t length) {
+  if (m_fs != &fs || m_path != path) {
+    close();
+    for (size_t i = 0; i < m_blockCount; i++) m_blocks[i].valid = false;
+    m_fs = &fs;
+    m_path = path;
+    if (!ensureFile()) {
+      m_fs = nullptr;
+      m_path = "";
+      return false;
+    }
+    m_fileSize = m_file.size();
+    m_lastWrite = (uint32_t)m_file.getLastWrite();
+  }
+  if (!m_cache) {
+    // As many blocks as the cover art budget allows, uncached reads if none
+    for (size_t n = FILE_RANGE_CACHE_BLOCKS; n > 0 && !m_cache; n /= 2) {
+      m_cache = (uint8_t*)MemoryBudget::allocate(MemoryBudget::Pool::CoverArt, n * FILE_RANGE_BLOCK_SIZE);
+      if (m_cache) {
+        m_cacheBytes = n * FILE_RANGE_BLOCK_SIZE;
+        m_blockCount = n;
+      }
+    }
+  }
+  setWindow(offset, length);
+  return true;
+}
+
+void FileRange::setWindow(uint32_t offset, uint32_t length) {
+  m_offset = min(offset, m_fileSize);
+  uint32_t avail = m_fileSize - m_offset;
+  m_length = (length == 0 || length > avail) ? avail : length;
+  m_pos = 0;
+}
+
+bool FileRange::ensureFile() {
+  if (m_file) return true;
+  if (!m_fs) return false;
+  m_file = m_fs->open(m_path.c_str());
+  return (bool)m_file;
+}
+
+const uint8_t* FileRange::block(uint32_t index, uint32_t& len) {
+  m_useTick++;
+  Block* victim = &m_blocks[0];
+  for (size_t i = 0; i < m_blockCount; i++) {
+    Block& b = m_blocks[i];
+    if (b.valid && b.index == index) {
+      b.lastUse = m_useTick;
+      m_stats.hits++;
+      len = b.len;
+      return m_cache + i * FILE_RANGE_BLOCK_SIZE;
+    }
+    if (!b.valid || (victim->valid && b.lastUse < victim->lastUse)) victim = &b;
+  }
+  if (!ensureFile()) return nullptr;
+  uint8_t* data = m_cache + (victim - m_blocks) * FILE_RANGE_BLOCK_SIZE;
+  if (!m_file.seek(index * FILE_RANGE_BLOCK_SIZE)) return nullptr;
+  int rd = m_file.read(data, FILE_RANGE_BLOCK_SIZE);
+  if (rd <= 0) return nullptr;
+  m_stats.misses++;
+  victim->index = index;
+  victim->len = rd;
+  victim->lastUse = m_useTick;
+  victim->valid = true;
+  len = rd;
+  return data;
+}
+
+int FileRange::read(uint8_t* buf, uint32_t len) {
+  len = min(len, m_length - m_pos);
+  if (m_blockCount == 0) {
+    // No cache memory: plain reads from the file
+    if (!ensureFile() || !m_file.seek(m_offset + m_pos)) return 0;
+    int rd = m_file.read(buf, len);
+    if (rd > 0) {
+      m_pos += rd;
+      m_stats.misses++;
+    }
+    return rd > 0 ? rd : 0;
+  }
+  uint32_t done = 0;
+  while (done < len) {
+    uint32_t abs = m_offset + m_pos;
+    uint32_t blockLen = 0;
+    const uint8_t* data = block(abs / FILE_RANGE_BLOCK_SIZE, blockLen);
+    uint32_t inBlock = abs % FILE_RANGE_BLOCK_SIZE;
+    if (!data || inBlock >= blockLen) break;
+    uint32_t n = min(len - done, blockLen - inBlock);
+    memcpy(buf + done, data + inBlock, n);
+    done += n;
+    m_pos += n;
+  }
+  return done;
+}
+
+int FileRange::read() {
+  uint8_t c;
+  return read(&c, 1) == 1 ? c : -1;
+}
+
+void FileRange::skip(int32_t offset) {
+  seek((int32_t)m_pos + offset < 0 ? 0 : m_pos + offset);
+}
+
+bool FileRange::seek(uint32_t offset) {
+  m_pos = min(offset, m_length);
+  return m_pos == offset;
+}
+
+void FileRange::close() {
+  if (m_file) m_file.close();
+}
+
+void FileRange::release() {
+  close();
+  MemoryBudget::deallocate(MemoryBudget::Pool::CoverArt, m_cache, m_cacheBytes);
+  m_cache = nullptr;
+  m_cacheBytes = 0;
+  m_blockCount = 0;
+  m_fs = nullptr;
+  m_path = "";
+  m_fileSize = m_lastWrite = m_offset = m_length = m_pos = 0;
+}
@@ -0,0 +1,119 @@
+#include "../include/folder_art.hpp"
+#include "../include/config.hpp"
+#include "../include/memory_budget.hpp"
+#include <vector>
+
+namespace FolderArt {
+
+struct Entry {
+  String dir;
+  String image;
+  uint8_t rank;  // Index in FOLDER_ART_NAMES, lower is preferred
+};
+
+static constexpr size_t NAME_COUNT = sizeof(FOLDER_ART_NAMES) / sizeof(FOLDER_ART_NAMES[0]);
+
+static std::vector<Entry> s_entries;
+static size_t s_last = 0;  // Entry of the previous find(), consecutive tracks are usually in one folder
+static uint32_t s_generation = 0;
+static SemaphoreHandle_t s_mutex = xSemaphoreCreateMutex();  // The library scan may run next to the UI
+
+static void lock() {
+  xSemaphoreTake(s_mutex, portMAX_DELAY);
+}
+
+static void unlock() {
+  xSemaphoreGive(s_mutex);
+}
+
+// Heap held by an entry, charged to the track list like the paths themselves
+static uint32_t entryBytes(const Entry& e) {
+  return sizeof(Entry) + e.dir.length() + 1 + e.image.length() + 1;
+}
+
+// Rank of a folder image name, NAME_COUNT if it is none
+static size_t rankOf(const String& fileName) {
+  String lower = fileName;
+  lower.toLowerCase();
+  int dot = lower.lastIndexOf('.');
+  if (dot <= 0) return NAME_COUNT;
+  String ext = lower.substring(dot + 1);
+  if (ext != "jpg" && ext != "jpeg" && ext != "png") return NAME_COUNT;
+  String base = lower.substring(0, dot);
+  for (size_t i = 0; i < NAME_COUNT; i++) {
+    if (base == FOLDER_ART_NAMES[i]) return i;
+  }
+  return NAME_COUNT;
+}
+
+void clear() {
+  lock();
+  for (const Entry& e : s_entries) MemoryBudget::release(MemoryBudget::Pool::TrackList, entryBytes(e));
+  s_entries.clear();
+  s_entries.shrink_to_fit();
+  s_last = 0;
+  s_generation++;
+  unlock();
+}
+
+bool note(const String& dir, const String& fileName) {
+  String name = fileName.substring(fileName.lastIndexOf('/') + 1);  // Older cores report the full path
+  size_t rank = rankOf(name);
+  if (rank >= NAME_COUNT) return false;
+  String image = (dir.endsWith("/") ? dir : dir + "/") + name;
+  lock();
+  bool kept = false;
+  bool known = false;
+  for (Entry& e : s_entries) {
+    if (e.dir != dir) continue;
+    known = true;
+    if (rank <= e.rank) {  // Equal: the same name again after a rescan
+      MemoryBudget::release(MemoryBudget::Pool::TrackList, entryBytes(e));
+      e.image = image;
+      e.rank = rank;
+      MemoryBudget::charge(MemoryBudget::Pool::TrackList, entryBytes(e));
+      kept = true;
+    }
+    break;
+  }
+  Entry e{dir, image, (uint8_t)rank};
+  if (!known && MemoryBudget::charge(MemoryBudget::Pool::TrackList, entryBytes(e))) {
+    s_entries.push_back(e);
+    kept = true;
+    LOG_PRINTF("Folder art: %s\n", image.c_str());
+  }
+  if (kept) s_generation++;
+  unlock();
+  return kept;
+}
+
+uint32_t generation() {
+  lock();
+  uint32_t g = s_generation;
+  unlock();
+  return g;
+}
+
+bool find(const String& trackPath, String& imagePath) {
+  int slash = trackPath.lastIndexOf('/');
+  if (slash < 0) return false;
+  String dir = trackPath.substring(0, slash);
+  if (dir.length() == 0) dir = "/";
+  bool found = false;
+  lock();
+  if (s_last < s_entries.size() && s_entries[s_last].dir == dir) {
+    imagePath = s_entries[s_last].image;
+    found = true;
+  }
+  for (size_t i = 0; i < s_entries.size() && !found; i++) {
+    if (s_entries[i].dir == dir) {
+      s_last = i;
+      imagePath = s_entries[i].image;
+      found = true;
+    }
+  }
+  unlock();
+  return found;
+}
+
+}  // namespace FolderArt
@@ -0,0 +1,194 @@
+#include "../include/folder_browser.hpp"
+#include "../include/config.hpp"
+#include "../include/library_index.hpp"
+#include "../include/memory_budget.hpp"
+#include "../include/playlist.hpp"
+#include <algorithm>
+#include <vector>
+
+namespace FolderBrowser {
+
+// One directory listing: names in one arena, subfolders first, each group sorted case-insensitively
+struct Listing {
+  String path;
+  std::vector<char> names;
+  std::vector<uint32_t> offs;  // Offset in names, bit 31 set for a subfolder
+  bool truncated = false;
+  uint32_t lastUse = 0;
+  uint32_t charged = 0;        // Bytes charged to the TrackList pool
+};
+
+static constexpr uint32_t DIR_BIT = 0x80000000u;
+
+static Listing s_cache[FOLDER_CACHE_ENTRIES];
+static uint32_t s_useClock = 0;
+static int s_current = -1;     // Listing shown
+static String s_lastPath;      // Folder shown last, reopened after invalidate()
+static int s_selected = 0;
+
+static void drop(Listing& l) {
+  MemoryBudget::release(MemoryBudget::Pool::TrackList, l.charged);
+  l = Listing();
+}
+
+static const char* nameOf(const Listing& l, size_t i) {
+  return l.names.data() + (l.offs[i] & ~DIR_BIT);
+}
+
+static String parentOf(const String& dir) {
+  int slash = dir.lastIndexOf('/');
+  return slash > 0 ? dir.substring(0, slash) : String("/");
+}
+
+static String childOf(const String& dir, const char* name) {
+  return (dir.endsWith("/") ? dir : dir + "/") + name;
+}
+
+// Read dir into a free (or the least recently used) cache slot
+static int list(fs::FS& fs, const String& dir) {
+  for (int i = 0; i < FOLDER_CACHE_ENTRIES; i++) {
+    if (s_cache[i].charged && s_cache[i].path == dir) {
+      s_cache[i].lastUse = ++s_useClock;
+      return i;
+    }
+  }
+  unsigned long t0 = millis();
+  Listing l;
+  l.path = dir;
+  bool ok = LibraryIndex::listDirectory(fs, dir, [&](const char* name, bool isDir) {
+    if (name[0] == '.') return;  // Hidden, and APP_DATA_DIR
+    if (!isDir && !LibraryIndex::isAudioFile(name) && !Playlist::isPlaylistFile(name)) return;
+    if (l.offs.size() >= FOLDER_LIST_MAX) {
+      l.truncated = true;
+      return;
+    }
+    l.offs.push_back(l.names.size() | (isDir ? DIR_BIT : 0));
+    l.names.insert(l.names.end(), name, name + strlen(name) + 1);
+  });
+  if (!ok) {
+    LOG_PRINTF("FolderBrowser: cannot open %s\n", dir.c_str());
+    return -1;
+  }
+  std::sort(l.offs.begin(), l.offs.end(), [&](uint32_t a, uint32_t b) {
+    if ((a & DIR_BIT) != (b & DIR_BIT)) return (a & DIR_BIT) != 0;
+    return strcasecmp(l.names.data() + (a & ~DIR_BIT), l.names.data() + (b & ~DIR_BIT)) < 0;
+  });
+  l.names.shrink_to_fit();
+  l.offs.shrink_to_fit();
+
+  // Slot: a free one, else the least recently used other than the one shown
+  int slot = -1;
+  for (int i = 0; i < FOLDER_CACHE_ENTRIES; i++) {
+    if (i == s_current && s_cache[i].charged) continue;
+    if (slot < 0 || !s_cache[i].charged || (s_cache[slot].charged && s_cache[i].lastUse < s_cache[slot].lastUse)) {
+      slot = i;
+    }
+  }
+  drop(s_cache[slot]);
+  // Make room in the pool by dropping more listings, oldest first
+  const uint32_t bytes = l.names.capacity() + l.offs.capacity() * sizeof(uint32_t) + 1;
+  while (!MemoryBudget::charge(MemoryBudget::Pool::TrackList, bytes)) {
+    int oldest = -1;
+    for (int i = 0; i < FOLDER_CACHE_ENTRIES; i++) {
+      if (s_cache[i].charged && (oldest < 0 || s_cache[i].lastUse < s_cache[oldest].lastUse)) oldest = i;
+    }
+    if (oldest < 0) {
+      LOG_PRINTF("FolderBrowser: no memory for %s (%u bytes)\n", dir.c_str(), (unsigned)bytes);
+      return -1;
+    }
+    if (oldest == s_current) s_current = -1;
+    drop(s_cache[oldest]);
+  }
+  l.charged = bytes;
+  l.lastUse = ++s_useClock;
+  s_cache[slot] = std::move(l);
+  LOG_PRINTF("FolderBrowser: %s, %u entries in %lu ms\n", dir.c_str(), (unsigned)s_cache[slot].offs.size(),
+             (unsigned long)(millis() - t0));
+  return slot;
+}
+
+void open(fs::FS& fs, const String& dir) {
+  String target = dir;
+  if (target.length() == 0) {
+    if (s_current >= 0) return;  // Reopened: stay where the page was left
+    target = s_lastPath.length() ? s_lastPath : fs.exists(MUSIC_DIR) ? String(MUSIC_DIR) : String("/");
+  }
+  int slot = list(fs, target);
+  if (slot < 0) return;
+  s_current = slot;
+  s_selected = 0;
+  s_lastPath = target;
+}
+
+const String& path() {
+  static const String none;
+  return s_current >= 0 ? s_cache[s_current].path : none;
+}
+
+int rowCount() {
+  return s_current >= 0 ? s_cache[s_current].offs.size() : 0;
+}
+
+bool truncated() {
+  return s_current >= 0 && s_cache[s_current].truncated;
+}
+
+int selected() {
+  return s_selected;
+}
+
+void move(int delta) {
+  const int n = rowCount();
+  if (n == 0) return;
+  s_selected = ((s_selected + delta) % n + n) % n;
+}
+
+bool enter(fs::FS& fs, String& trackPath) {
+  if (s_current < 0 || s_selected >= rowCount()) return false;
+  const Listing& l = s_cache[s_current];
+  const String child = childOf(l.path, nameOf(l, s_selected));
+  if (!(l.offs[s_selected] & DIR_BIT)) {
+    trackPath = child;
+    return true;
+  }
+  open(fs, child);
+  return false;
+}
+
+bool back(fs::FS& fs) {
+  if (s_current < 0 || s_cache[s_current].path == "/") return false;
+  const String from = s_cache[s_current].path;
+  const String name = from.substring(from.lastIndexOf('/') + 1);
+  int slot = list(fs, parentOf(from));
+  if (slot < 0) return false;
+  s_current = slot;
+  s_selected = 0;
+  s_lastPath = s_cache[slot].path;
+  const Listing& l = s_cache[slot];
+  for (size_t i = 0; i < l.offs.size(); i++) {
+    if ((l.offs[i] & DIR_BIT) && name == nameOf(l, i)) {
+      s_selected = i;
+      break;
+    }
+  }
+  return true;
+}
+
+int rows(int first, int count, Row* out) {
+  if (s_current < 0 || first < 0) return 0;
+  const Listing& l = s_cache[s_current];
+  int n = 0;
+  for (int i = first; i < (int)l.offs.size() && n < count; i++, n++) {
+    out[n].name = nameOf(l, i);
+    out[n].isDir = l.offs[i] & DIR_BIT;
+  }
+  return n;
+}
+
+void invalidate() {
+  for (Listing& l : s_cache) drop(l);
+  s_current = -1;
+  s_selected = 0;
+}
+
+}  // namespace FolderBrowser
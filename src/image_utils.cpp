@@ -1,66 +1,108 @@
 #include "../include/image_utils.hpp"
+#include "../include/config.hpp"
 
-static inline bool match(const uint8_t* buf, size_t len, const uint8_t* sig, size_t siglen) {
-  if (len < siglen) return false;
-  return memcmp(buf, sig, siglen) == 0;
+// Image signatures; entries with the same first byte are adjacent
+struct Signature {
+  ImageFormat format;
+  uint8_t len;
+  uint8_t bytes[8];
+};
+static const Signature SIGNATURES[] = {
+  {ImageFormat::JPEG, 2, {0xFF, 0xD8}},
+  {ImageFormat::PNG, 8, {0x89, 0x50, 0x4E, 0x47, 0x0D, 0x0A, 0x1A, 0x0A}},
+  {ImageFormat::BMP, 2, {'B', 'M'}},
+  {ImageFormat::GIF, 6, {'G', 'I', 'F', '8', '9', 'a'}},
+  {ImageFormat::GIF, 6, {'G', 'I', 'F', '8', '7', 'a'}},
+  {ImageFormat::QOI, 4, {'q', 'o', 'i', 'f'}},
+};
+static constexpr size_t SIGNATURE_COUNT = sizeof(SIGNATURES) / sizeof(SIGNATURES[0]);
+static constexpr size_t SIGNATURE_MAX = 8;
+
+// First byte -> 1 + index of its first signature, 0 = no image starts with this byte
+struct FirstByteTable {
+  uint8_t index[256] = {};
+  FirstByteTable() {
+    for (size_t i = SIGNATURE_COUNT; i-- > 0;) index[SIGNATURES[i].bytes[0]] = i + 1;
+  }
+};
+static const FirstByteTable FIRST_BYTE;
+
+// Format of the signature starting at p (n bytes available)
+static ImageFormat matchSignature(const uint8_t* p, size_t n) {
+  size_t i = FIRST_BYTE.index[p[0]];
+  if (!i) return ImageFormat::Unknown;
+  for (i--; i < SIGNATURE_COUNT && SIGNATURES[i].bytes[0] == p[0]; i++) {
+    const Signature& sig = SIGNATURES[i];
+    if (n >= sig.len && memcmp(p, sig.bytes, sig.len) == 0) return sig.format;
+  }
+  return ImageFormat::Unknown;
 }
 
-bool findImageStart(fs::File& f, size_t maxToScan, size_t& startOff, ImageFormat& format) {
-  const uint8_t sigJpg[2] = {0xFF, 0xD8};
-  const uint8_t sigPng[8] = {0x89, 0x50, 0x4E, 0x47, 0x0D, 0x0A, 0x1A, 0x0A};
-  const uint8_t sigBmp[2] = {'B','M'};
-  const uint8_t sigGif1[6] = {'G','I','F','8','9','a'};
-  const uint8_t sigGif0[6] = {'G','I','F','8','7','a'};
-  const uint8_t sigQoi[4] = {'q','o','i','f'};
-
-  uint8_t buf[512];
+// Source: fs::File or FileRange (read(buf, len), read(), seek(pos), position())
+template <typename Source>
+static bool findImageStartIn(Source& f, size_t maxToScan, size_t& startOff, ImageFormat& format) {
+  // The tail of a block is carried over, so a signature across a block boundary is found as well
+  uint8_t buf[SIGNATURE_MAX - 1 + COVER_SCAN_READ_SIZE];
+  size_t carry = 0;
+  size_t base = 0;      // Scan offset of buf[0]
   size_t scanned = 0;
-  startOff = SIZE_MAX;
+  startOff = 0;
   format = ImageFormat::Unknown;
 
-  while (scanned < maxToScan) {
-    size_t toRead = maxToScan - scanned;
-    if (toRead > sizeof(buf)) toRead = sizeof(buf);
-    size_t rd = f.read(buf, toRead);
-    if (rd == 0) break;
-    // JPEG
-    for (size_t i = 0; i + 1 < rd; ++i) {
-      if (buf[i] == sigJpg[0] && buf[i+1] == sigJpg[1]) {
-        startOff = scanned + i; format = ImageFormat::JPEG; break;
-      }
-    }
-    // PNG
-    if (startOff == SIZE_MAX) {
-      for (size_t i = 0; i + sizeof(sigPng) <= rd; ++i) {
-        if (match(&buf[i], rd - i, sigPng, sizeof(sigPng))) { startOff = scanned + i; format = ImageFormat::PNG; break; }
-      }
-    }
-    // BMP
-    if (startOff == SIZE_MAX) {
-      for (size_t i = 0; i + 2 <= rd; ++i) {
-        if (buf[i] == sigBmp[0] && buf[i+1] == sigBmp[1]) { startOff = scanned + i; format = ImageFormat::BMP; break; }
-      }
-    }
-    // GIF
-    if (startOff == SIZE_MAX) {
-      for (size_t i = 0; i + 6 <= rd; ++i) {
-        if (match(&buf[i], rd - i, sigGif1, 6) || match(&buf[i], rd - i, sigGif0, 6)) { startOff = scanned + i; format = ImageFormat::GIF; break; }
-      }
-    }
-    // QOI
-    if (startOff == SIZE_MAX) {
-      for (size_t i = 0; i + 4 <= rd; ++i) {
-        if (match(&buf[i], rd - i, sigQoi, 4)) { startOff = scanned + i; format = ImageFormat::QOI; break; }
+  while (true) {
+    size_t toRead = min(maxToScan - scanned, COVER_SCAN_READ_SIZE);
+    size_t rd = toRead ? f.read(buf + carry, toRead) : 0;
+    scanned += rd;
+    size_t avail = carry + rd;
+    bool last = rd == 0 || scanned >= maxToScan;
+    // Positions that have a full signature length behind them (all of them in the last block)
+    size_t end = last ? avail : (avail > SIGNATURE_MAX - 1 ? avail - (SIGNATURE_MAX - 1) : 0);
+    for (size_t i = 0; i < end; i++) {
+      ImageFormat fmt = matchSignature(buf + i, avail - i);
+      if (fmt != ImageFormat::Unknown) {
+        startOff = base + i;
+        format = fmt;
+        return true;
       }
     }
-    if (startOff != SIZE_MAX) break;
-    scanned += rd;
+    if (last) return false;
+    carry = avail - end;
+    memmove(buf, buf + end, carry);
+    base += end;
   }
-  if (startOff == SIZE_MAX) { startOff = 0; format = ImageFormat::Unknown; }
-  return format != ImageFormat::Unknown;
 }
 
-bool getImageSize(fs::File& f, size_t dataPos, ImageFormat format, uint32_t& outW, uint32_t& outH) {
+// Offset of the image in an APIC (ID3v2.3/2.4) or PIC (ID3v2.2) frame: text encoding, MIME type
+// (PIC: 3 character format), picture type and description come first
+template <typename Source>
+static bool pictureDataOffset(Source& f, size_t frameLen, bool id3v22, size_t& off) {
+  uint8_t buf[COVER_APIC_HEADER_MAX];
+  size_t n = f.read(buf, min(frameLen, sizeof(buf)));
+  if (n < 4) return false;
+  const uint8_t encoding = buf[0];
+  size_t p = 1;
+  if (id3v22) {
+    p += 3;
+  } else {
+    while (p < n && buf[p]) p++;
+    p++;
+  }
+  p++;  // Picture type
+  if (encoding == 1 || encoding == 2) {
+    // UTF-16 description, terminated by 00 00 on a character boundary
+    while (p + 1 < n && (buf[p] || buf[p + 1])) p += 2;
+    p += 2;
+  } else {
+    while (p < n && buf[p]) p++;
+    p++;
+  }
+  if (p >= n) return false;  // Description longer than COVER_APIC_HEADER_MAX, let the scanner find the image
+  off = p;
+  return true;
+}
+
+template <typename Source>
+static bool getImageSizeIn(Source& f, size_t dataPos, ImageFormat format, uint32_t& outW, uint32_t& outH) {
   outW = outH = 0;
   uint8_t head[32];
   f.seek(dataPos);
@@ -129,6 +171,78 @@ bool getImageSize(fs::File& f, size_t dataPos, ImageFormat format, uint32_t& out
   return false;
 }
 
+bool findId3Picture(FileRange& r, uint32_t& pos, uint32_t& len, bool* id3v22) {
+  uint8_t h[10];
+  r.seek(0);
+  if (r.read(h, 10) != 10 || memcmp(h, "ID3", 3) != 0) return false;
+  const uint8_t ver = h[3];
+  const uint32_t tagEnd = 10 + (((uint32_t)(h[6] & 0x7F) << 21) | ((uint32_t)(h[7] & 0x7F) << 14) |
+                                ((uint32_t)(h[8] & 0x7F) << 7) | (h[9] & 0x7F));
+  uint32_t p = 10;
+  if (ver >= 3 && (h[5] & 0x40)) {  // Extended header
+    uint8_t e[4];
+    if (r.read(e, 4) != 4) return false;
+    uint32_t esz = ver == 4 ? (((uint32_t)e[0] << 21) | ((uint32_t)e[1] << 14) | ((uint32_t)e[2] << 7) | e[3])
+                            : ((((uint32_t)e[0] << 24) | ((uint32_t)e[1] << 16) | ((uint32_t)e[2] << 8) | e[3]) + 4);
+    p += esz;
+  }
+  const uint32_t hdrLen = ver == 2 ? 6 : 10;
+  while (p + hdrLen <= tagEnd) {
+    uint8_t f[10];
+    if (!r.seek(p) || r.read(f, hdrLen) != (int)hdrLen || f[0] == 0) break;  // End of file or padding
+    uint32_t size;
+    if (ver == 2) {
+      size = ((uint32_t)f[3] << 16) | ((uint32_t)f[4] << 8) | f[5];
+    } else if (ver == 4) {
+      size = ((uint32_t)(f[4] & 0x7F) << 21) | ((uint32_t)(f[5] & 0x7F) << 14) | ((uint32_t)(f[6] & 0x7F) << 7) | (f[7] & 0x7F);
+    } else {
+      size = ((uint32_t)f[4] << 24) | ((uint32_t)f[5] << 16) | ((uint32_t)f[6] << 8) | f[7];
+    }
+    if (ver == 2 ? memcmp(f, "PIC", 3) == 0 : memcmp(f, "APIC", 4) == 0) {
+      pos = p + hdrLen;
+      len = size;
+      if (id3v22) *id3v22 = ver == 2;
+      return true;
+    }
+    p += hdrLen + size;
+  }
+  return false;
+}
+
+bool findPictureImage(FileRange& r, size_t frameLen, bool id3v22, size_t& startOff, ImageFormat& format) {
+  size_t off = 0;
+  uint8_t head[SIGNATURE_MAX];
+  r.seek(0);
+  if (pictureDataOffset(r, frameLen, id3v22, off) && r.seek(off)) {
+    size_t n = r.read(head, sizeof(head));
+    format = n ? matchSignature(head, n) : ImageFormat::Unknown;
+    if (format != ImageFormat::Unknown) {
+      startOff = off;
+      return true;
+    }
+  }
+  // Malformed header or unknown MIME type: search the image instead
+  r.seek(0);
+  const size_t scanMax = (frameLen > 0 && frameLen < COVER_SCAN_MAX) ? frameLen : (size_t)COVER_SCAN_MAX;
+  return findImageStartIn(r, scanMax, startOff, format);
+}
+
+bool findImageStart(fs::File& f, size_t maxToScan, size_t& startOff, ImageFormat& format) {
+  return findImageStartIn(f, maxToScan, startOff, format);
+}
+
+bool findImageStart(FileRange& r, size_t maxToScan, size_t& startOff, ImageFormat& format) {
+  return findImageStartIn(r, maxToScan, startOff, format);
+}
+
+bool getImageSize(fs::File& f, size_t dataPos, ImageFormat format, uint32_t& outW, uint32_t& outH) {
+  return getImageSizeIn(f, dataPos, format, outW, outH);
+}
+
+bool getImageSize(FileRange& r, size_t dataPos, ImageFormat format, uint32_t& outW, uint32_t& outH) {
+  return getImageSizeIn(r, dataPos, format, outW, outH);
+}
+
 bool getImageSizeFromBuffer(const uint8_t* buf, size_t bufSize, ImageFormat format, uint32_t& outW, uint32_t& outH) {
   outW = outH = 0;
   if (!buf || bufSize < 16) return false;
@@ -1,7 +1,12 @@
 #include <Arduino.h>
+#include <SD.h>
 #include "M5Cardputer.h"
 #include "../include/input_handler.hpp"
 #include "../include/config.hpp"
+#include "../include/browse_index.hpp"
+#include "../include/folder_browser.hpp"
+#include "../include/playlist.hpp"
+#include "../include/search_index.hpp"
 
 // Forward declaration
 extern void resetClock();
@@ -52,73 +57,213 @@ bool processBasicToggles(AppState& appState) {
     needRedraw = true;
   }
 
+  // 'b' key: toggle the browse page, it opens at the category level
+  if (M5Cardputer.Keyboard.isKeyPressed('b')) {
+    appState.showBrowsePage = !appState.showBrowsePage;
+    if (appState.showBrowsePage) BrowseIndex::reset();
+    appState.showFolderPage = false;
+    appState.showPlaylistPage = false;
+    needRedraw = true;
+  }
+
+  // 'o' key: toggle the folder page, it opens in the folder it was left in
+  if (M5Cardputer.Keyboard.isKeyPressed('o')) {
+    appState.showFolderPage = !appState.showFolderPage;
+    if (appState.showFolderPage) FolderBrowser::open(SD, "");
+    appState.showBrowsePage = false;
+    appState.showPlaylistPage = false;
+    needRedraw = true;
+  }
+
+  // Tab: open the search page with an empty query
+  if (M5Cardputer.Keyboard.isKeyPressed(KEY_TAB)) {
+    appState.showSearchPage = true;
+    SearchIndex::clear();
+    needRedraw = true;
+  }
+
+  return needRedraw;
+}
+
+bool processBrowse(AppState& appState) {
+  bool needRedraw = false;
+  BrowseIndex::refresh(SD);
+
+  if (M5Cardputer.Keyboard.isKeyPressed(';')) {
+    BrowseIndex::move(-1);
+    needRedraw = true;
+  }
+  if (M5Cardputer.Keyboard.isKeyPressed('.')) {
+    BrowseIndex::move(1);
+    needRedraw = true;
+  }
+  // Enter: open the group or play the track
+  if (M5Cardputer.Keyboard.isKeyPressed(KEY_ENTER)) {
+    int track = -1;
+    if (BrowseIndex::enter(SD, appState.tracks, track)) {
+      resetClock();
+      appState.playScope = "";
+      Playlist::stop();
+      appState.currentSelectedIndex = track;
+      appState.isPlaying = false;
+      appState.stopped = false;
+      appState.nextS = 1;
+    }
+    needRedraw = true;
+  }
+  if (M5Cardputer.Keyboard.isKeyPressed(KEY_BACKSPACE)) {
+    BrowseIndex::back();
+    needRedraw = true;
+  }
+  return needRedraw;
+}
+
+bool processFolder(AppState& appState) {
+  bool needRedraw = false;
+
+  if (M5Cardputer.Keyboard.isKeyPressed(';')) {
+    FolderBrowser::move(-1);
+    needRedraw = true;
+  }
+  if (M5Cardputer.Keyboard.isKeyPressed('.')) {
+    FolderBrowser::move(1);
+    needRedraw = true;
+  }
+  // Enter: open the folder (listed now) or the playlist, or play the track with the folder as scope
+  if (M5Cardputer.Keyboard.isKeyPressed(KEY_ENTER)) {
+    String path;
+    if (FolderBrowser::enter(SD, path) && Playlist::isPlaylistFile(path.c_str())) {
+      if (path == Playlist::path() || Playlist::open(SD, path)) appState.showPlaylistPage = true;
+    } else if (path.length()) {
+      int track = appState.tracks.find(path);
+      if (track >= 0) {
+        resetClock();
+        appState.playScope = FolderBrowser::path();
+        Playlist::stop();
+        appState.currentSelectedIndex = track;
+        appState.isPlaying = false;
+        appState.stopped = false;
+        appState.nextS = 1;
+      } else {
+        LOG_PRINTF("Not in the library (too deep or list full): %s\n", path.c_str());
+      }
+    }
+    needRedraw = true;
+  }
+  if (M5Cardputer.Keyboard.isKeyPressed(KEY_BACKSPACE)) {
+    FolderBrowser::back(SD);
+    needRedraw = true;
+  }
   return needRedraw;
 }
 
+bool processPlaylist(AppState& appState) {
+  bool needRedraw = false;
+
+  if (M5Cardputer.Keyboard.isKeyPressed(';')) {
+    Playlist::move(-1);
+    needRedraw = true;
+  }
+  if (M5Cardputer.Keyboard.isKeyPressed('.')) {
+    Playlist::move(1);
+    needRedraw = true;
+  }
+  // Enter: play the entry, next/previous/random then follow the playlist
+  if (M5Cardputer.Keyboard.isKeyPressed(KEY_ENTER)) {
+    int track = Playlist::play(appState.tracks);
+    if (track >= 0) {
+      resetClock();
+      appState.playScope = "";
+      appState.currentSelectedIndex = track;
+      appState.isPlaying = false;
+      appState.stopped = false;
+      appState.nextS = 1;
+    }
+    needRedraw = true;
+  }
+  // Backspace: back to the folder, the playlist stays open (and playing)
+  if (M5Cardputer.Keyboard.isKeyPressed(KEY_BACKSPACE)) {
+    appState.showPlaylistPage = false;
+    needRedraw = true;
+  }
+  return needRedraw;
+}
+
+bool processSearch(AppState& appState) {
+  Keyboard_Class::KeysState keys = M5Cardputer.Keyboard.keysState();
+  SearchIndex::refresh(SD);
+
+  if (keys.tab) {
+    appState.showSearchPage = false;
+    return true;
+  }
+  // Enter: play the selected result
+  if (keys.enter) {
+    int track = -1;
+    if (SearchIndex::resultCount() > 0 &&
+        SearchIndex::rows(SD, appState.tracks, SearchIndex::selected(), 1, &track) == 1 && track >= 0) {
+      resetClock();
+      appState.playScope = "";
+      Playlist::stop();
+      appState.currentSelectedIndex = track;
+      appState.isPlaying = false;
+      appState.stopped = false;
+      appState.nextS = 1;
+    }
+    return true;
+  }
+  if (keys.del) {
+    if (SearchIndex::query().length() == 0) appState.showSearchPage = false;
+    else SearchIndex::erase(SD);
+    return true;
+  }
+  bool needRedraw = false;
+  for (char c : keys.word) {
+    if (c == ';') SearchIndex::move(-1);
+    else if (c == '.') SearchIndex::move(1);
+    else SearchIndex::type(SD, c);
+    needRedraw = true;
+  }
+  if (keys.space) SearchIndex::type(SD, ' ');  // Repeated spaces are ignored
+  return needRedraw || keys.space;
+}
+
 bool processPlaybackAndList(AppState& appState) {
   bool needRedraw = false;
 
-  // ';' previous in list
+  // ';' previous in list (wraps around, deleted tracks are skipped)
   if (M5Cardputer.Keyboard.isKeyPressed(';')) {
-    appState.currentSelectedIndex--;
-    if (appState.currentSelectedIndex < 0)
-      appState.currentSelectedIndex = appState.fileCount > 0 ? appState.fileCount - 1 : 0;
+    appState.currentSelectedIndex = appState.stepInList(appState.currentSelectedIndex, -1);
     needRedraw = true;
   }
   // '.' next in list
   if (M5Cardputer.Keyboard.isKeyPressed('.')) {
-    appState.currentSelectedIndex++;
-    if (appState.currentSelectedIndex >= appState.fileCount)
-      appState.currentSelectedIndex = 0;
+    appState.currentSelectedIndex = appState.stepInList(appState.currentSelectedIndex, 1);
     needRedraw = true;
   }
-  // 'n' next song (respect random)
+  // 'n' next song (respect random, the folder scope and the playlist)
   if (M5Cardputer.Keyboard.isKeyPressed('n')) {
     resetClock();
-    if (appState.playMode == PlaybackMode::Random) {
-      if (appState.fileCount <= 1) {
-        appState.currentSelectedIndex = 0;
-      } else {
-        int newIndex;
-        do {
-          newIndex = random(0, appState.fileCount);
-        } while (newIndex == appState.currentPlayingIndex);
-        appState.currentSelectedIndex = newIndex;
-      }
-    } else {
-      appState.currentSelectedIndex++;
-      if (appState.currentSelectedIndex >= appState.fileCount) appState.currentSelectedIndex = 0;
-    }
+    appState.currentSelectedIndex = appState.nextTrack(appState.currentSelectedIndex, 1);
     appState.isPlaying = false;
     // Note: stopped is not set here - it will be set to false in Task_Audio after nextS is processed
     appState.nextS = 1;
     needRedraw = true;
   }
-  // 'p' previous song (respect random)
+  // 'p' previous song (respect random, the folder scope and the playlist)
   if (M5Cardputer.Keyboard.isKeyPressed('p')) {
     resetClock();
-    if (appState.playMode == PlaybackMode::Random) {
-      if (appState.fileCount <= 1) {
-        appState.currentSelectedIndex = 0;
-      } else {
-        int newIndex;
-        do {
-          newIndex = random(0, appState.fileCount);
-        } while (newIndex == appState.currentPlayingIndex);
-        appState.currentSelectedIndex = newIndex;
-      }
-    } else {
-      appState.currentSelectedIndex--;
-      if (appState.currentSelectedIndex < 0) appState.currentSelectedIndex = appState.fileCount - 1;
-    }
+    appState.currentSelectedIndex = appState.nextTrack(appState.currentSelectedIndex, -1);
     appState.isPlaying = false;
     // Note: stopped is not set here - it will be set to false in Task_Audio after nextS is processed
     appState.nextS = 1;
     needRedraw = true;
   }
-  // Enter: request play selected
+  // Enter: request play selected, next/previous go through the whole library again
   if (M5Cardputer.Keyboard.isKeyPressed(KEY_ENTER)) {
     resetClock();
+    appState.playScope = "";
+    Playlist::stop();
     appState.isPlaying = false;
     appState.stopped = false;
     appState.nextS = 1;
@@ -127,13 +272,51 @@ bool processPlaybackAndList(AppState& appState) {
   return needRedraw;
 }
 
+bool processSeek(AppState& appState) {
+  bool needRedraw = false;
+  unsigned long now = millis();
+  int dir = 0;
+  if (M5Cardputer.Keyboard.isKeyPressed('/')) dir = 1;
+  else if (M5Cardputer.Keyboard.isKeyPressed(',')) dir = -1;
+
+  if (dir == 0) {
+    appState.seekHoldStart = 0;
+  } else if (appState.seekHoldStart == 0) {
+    // New press: one step
+    appState.seekHoldStart = now;
+    appState.seekLastStep = now;
+    appState.seekAccumSec += dir * SEEK_STEP_SEC;
+    appState.seekLastInput = now;
+    needRedraw = true;
+  } else if (now - appState.seekHoldStart >= SEEK_HOLD_DELAY_MS && now - appState.seekLastStep >= SEEK_REPEAT_MS) {
+    // Held: repeat, the step grows with the hold time
+    int step = SEEK_STEP_SEC * (1 + (int)((now - appState.seekHoldStart) / SEEK_ACCEL_MS));
+    if (step > SEEK_STEP_MAX_SEC) step = SEEK_STEP_MAX_SEC;
+    appState.seekLastStep = now;
+    appState.seekAccumSec += dir * step;
+    appState.seekLastInput = now;
+    needRedraw = true;
+  }
+
+  // Hand over once the key is released and no press followed for a moment
+  if (appState.seekAccumSec != 0 && dir == 0 && !appState.seekRequested &&
+      now - appState.seekLastInput >= SEEK_MERGE_MS) {
+    appState.seekRequestSec = appState.seekAccumSec;
+    appState.seekAccumSec = 0;
+    appState.seekRequested = true;
+    LOG_PRINTF("Seek requested: %+d s\n", appState.seekRequestSec);
+  }
+  return needRedraw;
+}
+
 bool processDeleteAndScreenshot(AppState& appState, const Actions& actions) {
   bool needRedraw = false;
-  // 'd' open dialog
-  if (M5Cardputer.Keyboard.isKeyPressed('d')) {
-    if (!appState.showDeleteDialog && appState.fileCount > 0 && appState.currentSelectedIndex < appState.fileCount) {
+  // 'd' open dialog (not over the browse or folder page, the selection there is not a list index)
+  if (M5Cardputer.Keyboard.isKeyPressed('d') && !appState.showBrowsePage && !appState.showFolderPage) {
+    if (!appState.showDeleteDialog && appState.tracks.count() > 0 && appState.currentSelectedIndex < appState.tracks.count() &&
+        !appState.tracks.deleted(appState.currentSelectedIndex)) {
       appState.showDeleteDialog = true;
-      LOG_PRINTF("Delete dialog shown for: %s\n", appState.audioFiles[appState.currentSelectedIndex].c_str());
+      LOG_PRINTF("Delete dialog shown for: %s\n", appState.tracks.path(appState.currentSelectedIndex).c_str());
       needRedraw = true;
     }
   }
@@ -0,0 +1,152 @@
+#include "../include/jpeg_thumb.hpp"
+#include "../include/config.hpp"
+#include "../include/memory_budget.hpp"
+#include <lgfx/utility/lgfx_tjpgd.h>
+
+namespace JpegThumb {
+
+static constexpr uint32_t MAX_BOX = 16;  // Box side limit, keeps the 16-bit channel sums from overflowing
+
+struct Context {
+  lgfx::DataWrapper* src;
+  uint16_t* dst;
+  int stride;
+  int srcW, srcH;        // Decoded (DCT scaled) size
+  int outW, outH;
+  uint16_t* mapX;        // Decoded column -> output column
+  uint16_t* cntX;        // Decoded columns per output column
+  uint16_t* cntY;
+  uint16_t* acc;         // ringRows x outW x RGB sums
+  int ringRows;
+  int nextRow;           // First output row not written yet
+};
+
+static inline int mapY(const Context& c, int sy) {
+  return sy * c.outH / c.srcH;
+}
+
+static uint32_t readInput(lgfxJdec* jd, uint8_t* buf, uint32_t len) {
+  Context* c = (Context*)jd->device;
+  if (buf) return c->src->read(buf, len);
+  c->src->skip(len);
+  return len;
+}
+
+// Average the accumulated row into the output and clear it for reuse
+static void flushRow(Context& c, int dy) {
+  uint16_t* row = c.acc + (dy % c.ringRows) * c.outW * 3;
+  uint16_t* out = c.dst + dy * c.stride;
+  for (int dx = 0; dx < c.outW; dx++) {
+    uint32_t n = (uint32_t)c.cntX[dx] * c.cntY[dy];
+    uint16_t* a = row + dx * 3;
+    uint32_t r = n ? a[0] / n : 0, g = n ? a[1] / n : 0, b = n ? a[2] / n : 0;
+    uint16_t rgb = ((r & 0xF8) << 8) | ((g & 0xFC) << 3) | (b >> 3);
+    out[dx] = (rgb >> 8) | (rgb << 8);  // Canvas buffers hold RGB565 big-endian
+    a[0] = a[1] = a[2] = 0;
+  }
+}
+
+// TJpgDec hands over MCUs left to right, MCU row by MCU row (RGB888)
+static uint32_t writeOutput(lgfxJdec* jd, void* bitmap, JRECT* rect) {
+  Context& c = *(Context*)jd->device;
+  // Output rows above this MCU row got all their pixels
+  int firstRow = mapY(c, rect->top);
+  while (c.nextRow < firstRow && c.nextRow < c.outH) flushRow(c, c.nextRow++);
+
+  const uint8_t* px = (const uint8_t*)bitmap;
+  int w = rect->right - rect->left + 1;
+  for (int sy = rect->top; sy <= rect->bottom; sy++) {
+    if (sy >= c.srcH) break;
+    int dy = mapY(c, sy);
+    uint16_t* row = c.acc + (dy % c.ringRows) * c.outW * 3;
+    const uint8_t* p = px + (sy - rect->top) * w * 3;
+    for (int sx = rect->left; sx <= rect->right && sx < c.srcW; sx++, p += 3) {
+      uint16_t* a = row + c.mapX[sx] * 3;
+      a[0] += p[0];
+      a[1] += p[1];
+      a[2] += p[2];
+    }
+  }
+  return 1;
+}
+
+bool decode(lgfx::DataWrapper& src, uint16_t* dst, int dstW, int dstH, Stats* stats) {
+  uint32_t t0 = millis();
+  lgfxJdec jd;
+  Context c = {};
+  c.src = &src;
+  c.dst = dst;
+  c.stride = dstW;
+
+  // Work area and accumulators are charged to the cover art pool like the thumbnails themselves
+  const MemoryBudget::Pool budget = MemoryBudget::Pool::CoverArt;
+  uint8_t* pool = (uint8_t*)MemoryBudget::allocate(budget, JPEG_THUMB_WORKSPACE);
+  if (!pool) return false;
+  if (lgfx_jd_prepare(&jd, readInput, pool, JPEG_THUMB_WORKSPACE, &c) != JDR_OK) {
+    MemoryBudget::deallocate(budget, pool, JPEG_THUMB_WORKSPACE);
+    return false;
+  }
+
+  // Output size: fit into dst keeping the aspect ratio, never enlarge
+  int w = jd.width, h = jd.height;
+  c.outW = w;
+  c.outH = h;
+  if (w > dstW || h > dstH) {
+    if ((uint32_t)w * dstH >= (uint32_t)h * dstW) {
+      c.outW = dstW;
+      c.outH = max(1, (int)((uint32_t)h * dstW / w));
+    } else {
+      c.outH = dstH;
+      c.outW = max(1, (int)((uint32_t)w * dstH / h));
+    }
+  }
+  // Largest DCT scale that still decodes at least the output size
+  uint8_t scale = 0;
+  while (scale < 3 && (w >> (scale + 1)) >= c.outW && (h >> (scale + 1)) >= c.outH) scale++;
+  c.srcW = w >> scale;  // TJpgDec drops the partial pixels of the last MCU column/row
+  c.srcH = h >> scale;
+  if ((uint32_t)c.srcW > c.outW * MAX_BOX || (uint32_t)c.srcH > c.outH * MAX_BOX) {
+    MemoryBudget::deallocate(budget, pool, JPEG_THUMB_WORKSPACE);
+    return false;  // Too large even at 1/8, leave it to the generic decoder
+  }
+
+  int mcuH = max(1, (jd.msy * 8) >> scale);
+  c.ringRows = min(c.outH, (mcuH * c.outH + c.srcH - 1) / c.srcH + 2);
+  size_t tableBytes = (c.srcW + c.outW + c.outH) * sizeof(uint16_t);
+  size_t accBytes = (size_t)c.ringRows * c.outW * 3 * sizeof(uint16_t);
+  uint8_t* work = (uint8_t*)MemoryBudget::allocate(budget, tableBytes + accBytes);
+  if (!work) {
+    MemoryBudget::deallocate(budget, pool, JPEG_THUMB_WORKSPACE);
+    return false;
+  }
+  memset(work, 0, tableBytes + accBytes);
+  c.acc = (uint16_t*)work;
+  c.mapX = c.acc + c.ringRows * c.outW * 3;
+  c.cntX = c.mapX + c.srcW;
+  c.cntY = c.cntX + c.outW;
+  for (int sx = 0; sx < c.srcW; sx++) {
+    c.mapX[sx] = sx * c.outW / c.srcW;
+    c.cntX[c.mapX[sx]]++;
+  }
+  for (int sy = 0; sy < c.srcH; sy++) c.cntY[mapY(c, sy)]++;
+
+  bool ok = lgfx_jd_decomp(&jd, writeOutput, scale) == JDR_OK;
+  if (ok) {
+    while (c.nextRow < c.outH) flushRow(c, c.nextRow++);
+  }
+  MemoryBudget::deallocate(budget, work, tableBytes + accBytes);
+  MemoryBudget::deallocate(budget, pool, JPEG_THUMB_WORKSPACE);
+
+  if (stats) {
+    stats->srcW = w;
+    stats->srcH = h;
+    stats->dctScale = scale;
+    stats->outW = c.outW;
+    stats->outH = c.outH;
+    stats->decodeMs = millis() - t0;
+    stats->heapBytes = JPEG_THUMB_WORKSPACE + tableBytes + accBytes;
+  }
+  return ok;
+}
+
+}  // namespace JpegThumb
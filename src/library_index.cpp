@@ -0,0 +1,535 @@
+#include "../include/library_index.hpp"
+#include "../include/config.hpp"
+#include "../include/cover_cache.hpp"
+#include "../include/folder_art.hpp"
+#include "../include/memory_budget.hpp"
+#include "../include/metadata_db.hpp"
+#include "../include/shuffle.hpp"
+#include <esp_rom_crc.h>
+#include <vector>
+#include <dirent.h>
+
+namespace LibraryIndex {
+
+// File layout: FileHeader, dirCount x (DirHeader, path, art name, trackCount x (uint16 length, name)),
+// then a CRC-32 of everything before it. Paths and names are not terminated.
+struct FileHeader {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t reserved;
+  uint32_t dirCount;
+  uint32_t trackCount;
+};
+struct DirHeader {
+  uint32_t fingerprint;   // FNV-1a over the entry names and types
+  uint32_t entryCount;    // All entries, not only tracks
+  uint32_t trackCount;
+  uint16_t pathLen;
+  uint8_t artLen;         // Folder image name, 0 = none
+  uint8_t depth;          // Levels below the scan root
+};
+static constexpr uint32_t INDEX_MAGIC = 0x5844494C;  // "LIDX"
+static constexpr uint16_t INDEX_VERSION = 1;
+static constexpr const char* INDEX_TMP_FILE = "/.mp3adv/library.tmp";
+static constexpr size_t NAME_MAX_BYTES = 768;  // 255 UTF-16 units of a FAT long name as UTF-8
+
+// A listed directory: its fingerprint and the range of its tracks in the library being built
+struct DirRecord {
+  String path;
+  String art;
+  uint32_t fingerprint = 0;
+  uint32_t entryCount = 0;
+  int firstTrack = 0;
+  int trackCount = 0;
+  uint8_t depth = 0;
+};
+
+// Directories of the loaded index, checked by the validation task
+struct IndexedDir {
+  String path;
+  uint32_t fingerprint;
+  uint32_t entryCount;
+};
+
+struct Scan {
+  fs::FS& fs;
+  TrackLibrary& lib;
+  AppState* live;     // Set when lib is the library in use: the first track found is played
+  std::vector<DirRecord> dirs;
+  bool full = false;  // Memory budget or MAX_FILES reached, the rest is not listed
+};
+
+static std::vector<IndexedDir> s_indexed;
+static TaskHandle_t s_task = nullptr;
+static fs::FS* s_fs = nullptr;
+static AppState* s_appState = nullptr;
+static Progress s_progress;
+static uint32_t s_entriesListed = 0;
+
+// Called per directory entry: every LIBRARY_SCAN_BATCH entries the card is left to the other tasks
+static void pace() {
+  if (++s_entriesListed % LIBRARY_SCAN_BATCH == 0) vTaskDelay(pdMS_TO_TICKS(LIBRARY_SCAN_YIELD_MS));
+}
+
+static uint32_t fnv(uint32_t h, const char* s, bool isDir) {
+  while (*s) {
+    h ^= (uint8_t)*s++;
+    h *= 16777619u;
+  }
+  h ^= isDir ? 1 : 2;  // Also separates the names
+  h *= 16777619u;
+  return h;
+}
+
+// Calls fn(name, isDir) for every entry of dir; false if dir can't be opened
+template <typename Fn>
+static bool forEachEntry(fs::FS& fs, const String& dir, Fn fn, bool paced = true) {
+  // readdir only reads the directory, openNextFile() would open every entry
+  (void)fs;
+  String vfsPath = String(SD_MOUNT_POINT) + dir;
+  DIR* d = opendir(vfsPath.c_str());
+  if (!d) return false;
+  while (struct dirent* e = readdir(d)) {
+    if (strcmp(e->d_name, ".") == 0 || strcmp(e->d_name, "..") == 0) continue;
+    fn(e->d_name, e->d_type == DT_DIR);
+    if (paced) pace();
+  }
+  closedir(d);
+  return true;
+}
+
+static bool fingerprint(fs::FS& fs, const String& dir, uint32_t& hash, uint32_t& count) {
+  hash = 2166136261u;
+  count = 0;
+  return forEachEntry(fs, dir, [&](const char* name, bool isDir) {
+    hash = fnv(hash, name, isDir);
+    count++;
+  });
+}
+
+static String childPath(const String& dir, const char* name) {
+  return (dir.endsWith("/") ? dir : dir + "/") + name;
+}
+
+bool listDirectory(fs::FS& fs, const String& dir, const std::function<void(const char* name, bool isDir)>& fn) {
+  return forEachEntry(fs, dir, fn, false);
+}
+
+bool isAudioFile(const char* name) {
+  const char* dot = strrchr(name, '.');
+  return dot && (strcasecmp(dot, ".mp3") == 0 || strcasecmp(dot, ".wav") == 0);
+}
+
+static bool addTrack(Scan& scan, const String& path) {
+  if (scan.full) return false;
+  if (scan.lib.count() >= MAX_FILES || !scan.lib.add(path.c_str())) {
+    LOG_PRINTF("Track list memory budget exhausted, %s and following files not listed\n", path.c_str());
+    scan.full = true;
+    return false;
+  }
+  DEBUG_PRINTF("FILE: %s\n", path.c_str());
+  if (scan.live && scan.lib.count() == 1) {
+    // Same as a track change from the keyboard, Task_Audio opens it
+    scan.live->currentSelectedIndex = 0;
+    scan.live->nextS = 1;
+  }
+  return true;
+}
+
+// List one directory: tracks go to the library, folder art to FolderArt, subdirectories to subdirs
+static bool scanDir(Scan& scan, const String& dir, DirRecord& rec, std::vector<String>& subdirs) {
+  rec.path = dir;
+  rec.art = "";
+  rec.firstTrack = scan.lib.count();
+  uint32_t hash = 2166136261u;
+  uint32_t count = 0;
+  bool ok = forEachEntry(scan.fs, dir, [&](const char* name, bool isDir) {
+    hash = fnv(hash, name, isDir);
+    count++;
+    String path = childPath(dir, name);
+    if (isDir) {
+      if (path != APP_DATA_DIR) subdirs.push_back(path);
+    } else if (isAudioFile(name)) {
+      addTrack(scan, path);
+    } else if (FolderArt::note(dir, name)) {
+      rec.art = name;
+    }
+  });
+  rec.fingerprint = hash;
+  rec.entryCount = count;
+  rec.trackCount = scan.lib.count() - rec.firstTrack;
+  s_progress.dirs++;
+  return ok;
+}
+
+static void scanTree(Scan& scan, const String& dir, uint8_t depth) {
+  DirRecord rec;
+  rec.depth = depth;
+  std::vector<String> subdirs;
+  if (!scanDir(scan, dir, rec, subdirs)) {
+    LOG_PRINTF("Failed to open directory %s\n", dir.c_str());
+    return;
+  }
+  LOG_PRINTF("DIR : %s, %d tracks\n", dir.c_str(), rec.trackCount);
+  scan.dirs.push_back(rec);
+  if (depth >= MAX_DIR_DEPTH) return;
+  for (const String& sub : subdirs) {
+    if (scan.full) break;
+    scanTree(scan, sub, depth + 1);
+  }
+}
+
+static bool save(fs::FS& fs, const TrackLibrary& lib, const std::vector<DirRecord>& dirs) {
+  if (!fs.exists(APP_DATA_DIR)) fs.mkdir(APP_DATA_DIR);
+  File f = fs.open(INDEX_TMP_FILE, FILE_WRITE);
+  if (!f) return false;
+  uint32_t crc = 0;
+  bool ok = true;
+  auto put = [&](const void* p, size_t n) {
+    if (ok && n) ok = f.write((const uint8_t*)p, n) == n;
+    crc = esp_rom_crc32_le(crc, (const uint8_t*)p, n);
+  };
+  FileHeader hdr = {INDEX_MAGIC, INDEX_VERSION, 0, (uint32_t)dirs.size(), (uint32_t)(lib.count() - lib.deletedCount())};
+  put(&hdr, sizeof(hdr));
+  for (const DirRecord& rec : dirs) {
+    // Tracks deleted while the list was built are left out (the directory's fingerprint then no longer matches)
+    uint32_t live = 0;
+    for (int i = rec.firstTrack; i < rec.firstTrack + rec.trackCount; i++) live += !lib.deleted(i);
+    uint8_t artLen = rec.art.length() <= UINT8_MAX ? rec.art.length() : 0;
+    DirHeader dh = {rec.fingerprint, rec.entryCount, live, (uint16_t)rec.path.length(), artLen, rec.depth};
+    put(&dh, sizeof(dh));
+    put(rec.path.c_str(), dh.pathLen);
+    put(rec.art.c_str(), dh.artLen);
+    for (int i = rec.firstTrack; i < rec.firstTrack + rec.trackCount; i++) {
+      if (lib.deleted(i)) continue;
+      String name = lib.name(i);
+      uint16_t len = name.length();
+      put(&len, sizeof(len));
+      put(name.c_str(), len);
+    }
+  }
+  ok = ok && f.write((const uint8_t*)&crc, sizeof(crc)) == sizeof(crc);
+  f.close();
+  if (!ok) {
+    fs.remove(INDEX_TMP_FILE);
+    LOG_PRINTLN("LibraryIndex: write failed");
+    return false;
+  }
+  fs.remove(LIBRARY_INDEX_FILE);
+  fs.rename(INDEX_TMP_FILE, LIBRARY_INDEX_FILE);
+  return true;
+}
+
+// Sequential reader of the index file that keeps the CRC of what was read
+struct Reader {
+  File& f;
+  uint32_t crc = 0;
+  bool ok = true;
+  bool read(void* p, size_t n) {
+    if (ok && n) ok = f.read((uint8_t*)p, n) == n;
+    if (ok) crc = esp_rom_crc32_le(crc, (const uint8_t*)p, n);
+    return ok;
+  }
+  bool readString(String& s, size_t n) {
+    char buf[NAME_MAX_BYTES + 1];
+    if (n > NAME_MAX_BYTES || !read(buf, n)) return ok = false;
+    buf[n] = '\0';
+    s = buf;
+    return true;
+  }
+  bool readDir(DirHeader& dh, String& path, String& art) {
+    return read(&dh, sizeof(dh)) && readString(path, dh.pathLen) && readString(art, dh.artLen);
+  }
+  bool readName(String& name) {
+    uint16_t len;
+    return read(&len, sizeof(len)) && readString(name, len);
+  }
+};
+
+bool load(fs::FS& fs, AppState& appState) {
+  File f = fs.open(LIBRARY_INDEX_FILE);
+  if (!f) return false;
+  unsigned long t0 = millis();
+  Reader r{f};
+  FileHeader hdr;
+  bool ok = r.read(&hdr, sizeof(hdr)) && hdr.magic == INDEX_MAGIC && hdr.version == INDEX_VERSION;
+  s_indexed.clear();
+  for (uint32_t d = 0; ok && d < hdr.dirCount; d++) {
+    DirHeader dh;
+    String dir, art, name;
+    ok = r.readDir(dh, dir, art);
+    if (ok && dh.artLen) FolderArt::note(dir, art);
+    if (ok) s_indexed.push_back({dir, dh.fingerprint, dh.entryCount});
+    for (uint32_t i = 0; ok && i < dh.trackCount; i++) {
+      ok = r.readName(name) && appState.tracks.add(childPath(dir, name.c_str()).c_str());
+    }
+  }
+  uint32_t crc = r.crc;
+  uint32_t stored = 0;
+  ok = ok && f.read((uint8_t*)&stored, sizeof(stored)) == sizeof(stored) && stored == crc;
+  f.close();
+  if (!ok) {
+    LOG_PRINTLN("LibraryIndex: index invalid, scanning the card");
+    appState.tracks.clear();
+    FolderArt::clear();
+    s_indexed.clear();
+    return false;
+  }
+  LOG_PRINTF("LibraryIndex: %d tracks in %u directories loaded in %lu ms\n", appState.tracks.count(),
+             (unsigned)s_indexed.size(), (unsigned long)(millis() - t0));
+  return true;
+}
+
+// MUSIC_DIR, or the whole card if it has no tracks
+static void scanLibrary(Scan& scan) {
+  scanTree(scan, MUSIC_DIR, 0);
+  if (scan.lib.count() == 0) {
+    LOG_PRINTLN("No files found in /music, scanning root as fallback");
+    scan.dirs.clear();
+    scanTree(scan, "/", 0);
+  }
+}
+
+static void scanTask(void* pvParameters) {
+  (void)pvParameters;
+  unsigned long t0 = millis();
+  AppState& appState = *s_appState;
+  Scan scan{*s_fs, appState.tracks, &appState, {}};
+  scanLibrary(scan);
+  LOG_PRINTF("LibraryIndex: %d tracks in %u directories scanned in %lu ms\n", appState.tracks.count(),
+             (unsigned)scan.dirs.size(), (unsigned long)(millis() - t0));
+  // Written only if the list was not compacted meanwhile, the record ranges would not match anymore
+  int listed = 0;
+  for (const DirRecord& rec : scan.dirs) listed += rec.trackCount;
+  if (listed == appState.tracks.count()) save(*s_fs, appState.tracks, scan.dirs);
+  CoverCache::prefill(appState.tracks);  // The list was still growing when setup() started it
+  MetadataDb::startUpdate(*s_fs, appState.tracks);
+  s_progress.scanning = false;
+  s_task = nullptr;
+  vTaskDelete(NULL);
+}
+
+static bool isIndexed(const String& dir) {
+  for (const IndexedDir& d : s_indexed) {
+    if (d.path == dir) return true;
+  }
+  return false;
+}
+
+static int clampIndex(int index, int count) {
+  return index < 0 || count == 0 ? 0 : (index >= count ? count - 1 : index);
+}
+
+// A changed directory of the index listed again, with its subdirectories that are not in the index
+static void rescanDir(Scan& scan, const String& dir, uint8_t depth) {
+  DirRecord rec;
+  rec.depth = depth;
+  std::vector<String> subdirs;
+  if (!scanDir(scan, dir, rec, subdirs)) {
+    LOG_PRINTF("LibraryIndex: %s is gone\n", dir.c_str());
+    return;
+  }
+  LOG_PRINTF("LibraryIndex: %s rescanned, %d tracks\n", dir.c_str(), rec.trackCount);
+  scan.dirs.push_back(rec);
+  for (const String& sub : subdirs) {
+    if (depth < MAX_DIR_DEPTH && !isIndexed(sub)) scanTree(scan, sub, depth + 1);
+  }
+}
+
+// The changed directories of an in-place rebuild, listed before the list in use is dropped
+struct Prescan {
+  TrackLibrary lib;
+  std::vector<DirRecord> dirs;   // Ranges in lib
+  std::vector<uint32_t> dirsOf;  // Records each changed directory left in dirs, in index order (0 = gone)
+  size_t nextChanged = 0;        // Read position of rebuildInto()
+  size_t nextDir = 0;
+};
+
+// List the changed directories of the index into pre; false if the index could not be read or they do not fit
+static bool prescan(fs::FS& fs, const std::vector<bool>& changed, Prescan& pre) {
+  File f = fs.open(LIBRARY_INDEX_FILE);
+  if (!f) return false;
+  Reader r{f};
+  FileHeader hdr;
+  Scan scan{fs, pre.lib, nullptr, {}};
+  bool ok = r.read(&hdr, sizeof(hdr)) && hdr.dirCount == changed.size();
+  for (uint32_t d = 0; ok && d < hdr.dirCount && !scan.full; d++) {
+    DirHeader dh;
+    String dir, art, name;
+    ok = r.readDir(dh, dir, art);
+    for (uint32_t i = 0; ok && i < dh.trackCount; i++) ok = r.readName(name);
+    if (!ok || !changed[d]) continue;
+    const size_t before = scan.dirs.size();
+    rescanDir(scan, dir, dh.depth);
+    pre.dirsOf.push_back(scan.dirs.size() - before);
+  }
+  f.close();
+  pre.dirs.swap(scan.dirs);
+  return ok && !scan.full;
+}
+
+// Fill scan.lib again: unchanged directories from the index, changed ones from the card or from pre;
+// false if the index could not be read
+static bool rebuildInto(Scan& scan, const std::vector<bool>& changed, Prescan* pre = nullptr) {
+  File f = scan.fs.open(LIBRARY_INDEX_FILE);
+  if (!f) return false;
+  Reader r{f};
+  FileHeader hdr;
+  bool ok = r.read(&hdr, sizeof(hdr)) && hdr.dirCount == changed.size();
+  for (uint32_t d = 0; ok && d < hdr.dirCount && !scan.full; d++) {
+    DirHeader dh;
+    String dir, art, name;
+    ok = r.readDir(dh, dir, art);
+    if (!ok) break;
+    if (!changed[d]) {
+      DirRecord rec;
+      rec.path = dir;
+      rec.art = art;
+      rec.fingerprint = dh.fingerprint;
+      rec.entryCount = dh.entryCount;
+      rec.depth = dh.depth;
+      rec.firstTrack = scan.lib.count();
+      for (uint32_t i = 0; ok && i < dh.trackCount; i++) {
+        ok = r.readName(name);
+        if (ok) addTrack(scan, childPath(dir, name.c_str()));
+      }
+      rec.trackCount = scan.lib.count() - rec.firstTrack;
+      scan.dirs.push_back(rec);
+      continue;
+    }
+    for (uint32_t i = 0; ok && i < dh.trackCount; i++) ok = r.readName(name);  // Replaced by the rescan
+    if (!pre) {
+      rescanDir(scan, dir, dh.depth);
+      continue;
+    }
+    for (uint32_t k = pre->dirsOf[pre->nextChanged++]; k > 0; k--) {
+      DirRecord rec = pre->dirs[pre->nextDir++];
+      const int first = rec.firstTrack;
+      rec.firstTrack = scan.lib.count();
+      for (int i = first; i < first + rec.trackCount; i++) addTrack(scan, pre->lib.path(i));
+      rec.trackCount = scan.lib.count() - rec.firstTrack;
+      scan.dirs.push_back(rec);
+    }
+  }
+  f.close();
+  return ok;
+}
+
+// Under lockIndexes(), after the library changed: find playing and selected track by path again. A playing
+// track that is gone stops playback, its old index would name another track now.
+static void relocate(AppState& appState, const String& playing, const String& selected) {
+  Shuffle::reset();  // Indexes now mean other tracks
+  const int count = appState.tracks.count();
+  const int p = playing.length() ? appState.tracks.find(playing) : -1;
+  const int s = appState.tracks.find(selected);
+  if (p < 0 && appState.isPlaying && !appState.stopped) {
+    LOG_PRINTF("LibraryIndex: %s is gone, playback stopped\n", playing.c_str());
+    appState.isPlaying = false;
+    appState.stopped = true;
+  }
+  appState.currentPlayingIndex = p;
+  appState.currentSelectedIndex = clampIndex(s >= 0 ? s : appState.currentSelectedIndex, count);
+  LOG_PRINTF("LibraryIndex: track list updated, %d tracks\n", count);
+}
+
+// Build the library again. A second list is built next to the one in use and swapped in when the TrackList
+// pool has room for both. Otherwise only the changed directories are listed next to it, then the list in use is
+// refilled in place from them and the index file; the next track change waits for the refill only.
+static void rebuild(fs::FS& fs, AppState& appState, const std::vector<bool>& changed) {
+  const MemoryBudget::PoolStats pool = MemoryBudget::getStats(MemoryBudget::Pool::TrackList);
+  if (pool.limit - pool.used >= appState.tracks.memoryUsed()) {
+    TrackLibrary* fresh = new TrackLibrary();
+    Scan scan{fs, *fresh, nullptr, {}};
+    const bool ok = rebuildInto(scan, changed);
+    if (!ok) LOG_PRINTLN("LibraryIndex: rebuild incomplete, keeping the current track list");
+    if (ok && !scan.full) {
+      save(fs, *fresh, scan.dirs);
+      appState.lockIndexes();
+      const String playing = appState.tracks.path(appState.currentPlayingIndex);
+      const String selected = appState.tracks.path(appState.currentSelectedIndex);
+      appState.tracks.swap(*fresh);
+      relocate(appState, playing, selected);
+      appState.unlockIndexes();
+    }
+    delete fresh;  // Now holds the previous list
+    if (!ok || !scan.full) return;
+  }
+
+  // The card is listed while the list in use stays valid; under the lock only the index file is read
+  LOG_PRINTLN("LibraryIndex: no room for a second track list, rebuilding in place");
+  Prescan pre;
+  const bool listed = prescan(fs, changed, pre);
+  if (!listed) {
+    LOG_PRINTLN("LibraryIndex: changed directories do not fit next to the list, listing them under the lock");
+    pre.lib.clear();
+  }
+  appState.lockIndexes();
+  const String playing = appState.tracks.path(appState.currentPlayingIndex);
+  const String selected = appState.tracks.path(appState.currentSelectedIndex);
+  appState.tracks.clear();
+  Scan scan{fs, appState.tracks, nullptr, {}};
+  if (!rebuildInto(scan, changed, listed ? &pre : nullptr)) {
+    LOG_PRINTLN("LibraryIndex: index unreadable, scanning the card");
+    appState.tracks.clear();
+    FolderArt::clear();
+    scan.dirs.clear();
+    scan.full = false;
+    scanLibrary(scan);
+  }
+  save(fs, appState.tracks, scan.dirs);  // With scan.full the tracks that fit, as a first scan keeps them
+  relocate(appState, playing, selected);
+  appState.unlockIndexes();
+}
+
+static void validateTask(void* pvParameters) {
+  (void)pvParameters;
+  unsigned long t0 = millis();
+  std::vector<bool> changed(s_indexed.size());
+  size_t changedCount = 0;
+  for (size_t i = 0; i < s_indexed.size(); i++) {
+    uint32_t hash, count;
+    bool ok = fingerprint(*s_fs, s_indexed[i].path, hash, count);
+    s_progress.dirs++;
+    changed[i] = !ok || hash != s_indexed[i].fingerprint || count != s_indexed[i].entryCount;
+    if (changed[i]) changedCount++;
+  }
+  LOG_PRINTF("LibraryIndex: %u directories checked in %lu ms, %u changed\n", (unsigned)s_indexed.size(),
+             (unsigned long)(millis() - t0), (unsigned)changedCount);
+  if (changedCount) rebuild(*s_fs, *s_appState, changed);
+  MetadataDb::startUpdate(*s_fs, s_appState->tracks);  // Only new or changed tracks are parsed
+  s_indexed.clear();
+  s_indexed.shrink_to_fit();
+  s_progress.validating = false;
+  s_task = nullptr;
+  vTaskDelete(NULL);
+}
+
+static bool startTask(TaskFunction_t fn, fs::FS& fs, AppState& appState) {
+  s_fs = &fs;
+  s_appState = &appState;
+  s_progress.dirs = 0;
+  return xTaskCreatePinnedToCore(fn, "LibraryIndex", LIBRARY_TASK_STACK, NULL, LIBRARY_TASK_PRIORITY, &s_task, 0) ==
+         pdPASS;
+}
+
+bool startScan(fs::FS& fs, AppState& appState) {
+  if (s_task) return false;
+  s_progress.scanning = true;
+  if (startTask(scanTask, fs, appState)) return true;
+  s_progress.scanning = false;
+  return false;
+}
+
+bool startValidation(fs::FS& fs, AppState& appState) {
+  if (s_task || s_indexed.empty()) return false;
+  s_progress.validating = true;
+  if (startTask(validateTask, fs, appState)) return true;
+  s_progress.validating = false;
+  return false;
+}
+
+Progress getProgress() {
+  return s_progress;
+}
+
+}  // namespace LibraryIndex
@@ -0,0 +1,127 @@
+#include "../include/memory_budget.hpp"
+#include "../include/config.hpp"
+
+namespace MemoryBudget {
+
+static constexpr size_t POOL_COUNT = static_cast<size_t>(Pool::Count);
+static const MemPoolLimits* const POOL_LIMITS[POOL_COUNT] = {&MEM_POOL_INPUT, &MEM_POOL_READ_AHEAD,
+                                                             &MEM_POOL_COVER_ART, &MEM_POOL_TRACK_LIST};
+static const char* const POOL_NAMES[POOL_COUNT] = {"input", "read-ahead", "cover", "tracks"};
+
+static PoolStats s_pools[POOL_COUNT];
+static bool s_psram = false;
+static portMUX_TYPE s_mux = portMUX_INITIALIZER_UNLOCKED;
+
+// Pool indexes sorted by priority (stable, so equal priorities keep the enum order)
+static void byPriority(size_t* order) {
+  for (size_t i = 0; i < POOL_COUNT; i++) order[i] = i;
+  for (size_t i = 1; i < POOL_COUNT; i++) {
+    for (size_t j = i; j > 0 && POOL_LIMITS[order[j]]->priority < POOL_LIMITS[order[j - 1]]->priority; j--) {
+      size_t t = order[j];
+      order[j] = order[j - 1];
+      order[j - 1] = t;
+    }
+  }
+}
+
+void begin() {
+  s_psram = psramFound() && heap_caps_get_free_size(MALLOC_CAP_SPIRAM) > 0;
+  uint32_t freeBytes = s_psram ? heap_caps_get_free_size(MALLOC_CAP_SPIRAM)
+                          : heap_caps_get_free_size(MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+  uint32_t reserve = s_psram ? MEM_RESERVE_PSRAM : MEM_RESERVE_RAM;
+  uint32_t budget = freeBytes > reserve ? freeBytes - reserve : 0;
+
+  size_t order[POOL_COUNT];
+  byPriority(order);
+  // Minimums first, so a low priority pool is not starved by a big maximum above it
+  for (size_t i : order) {
+    uint32_t want = POOL_LIMITS[i]->minBytes;
+    s_pools[i] = PoolStats();
+    s_pools[i].limit = min(want, budget);
+    budget -= s_pools[i].limit;
+  }
+  for (size_t i : order) {
+    uint32_t cap = s_psram ? POOL_LIMITS[i]->maxPsram : POOL_LIMITS[i]->maxRam;
+    uint32_t extra = cap > s_pools[i].limit ? min(cap - s_pools[i].limit, budget) : 0;
+    s_pools[i].limit += extra;
+    budget -= extra;
+  }
+  LOG_PRINTF("Memory budget from %s: %lu bytes free, %lu reserved, %lu unassigned\n", s_psram ? "PSRAM" : "internal RAM",
+             (unsigned long)freeBytes, (unsigned long)reserve, (unsigned long)budget);
+  logReport("budget");
+}
+
+bool havePsram() {
+  return s_psram;
+}
+
+uint32_t limit(Pool pool) {
+  return s_pools[static_cast<size_t>(pool)].limit;
+}
+
+bool charge(Pool pool, uint32_t bytes) {
+  PoolStats& p = s_pools[static_cast<size_t>(pool)];
+  bool ok;
+  portENTER_CRITICAL(&s_mux);
+  ok = p.used + bytes <= p.limit;
+  if (ok) {
+    p.used += bytes;
+    if (p.used > p.peak) p.peak = p.used;
+  } else {
+    p.denied++;
+  }
+  portEXIT_CRITICAL(&s_mux);
+  if (!ok) DEBUG_PRINTF("MemoryBudget: %s pool full, %lu bytes denied\n", POOL_NAMES[static_cast<size_t>(pool)],
+                        (unsigned long)bytes);
+  return ok;
+}
+
+void release(Pool pool, uint32_t bytes) {
+  PoolStats& p = s_pools[static_cast<size_t>(pool)];
+  portENTER_CRITICAL(&s_mux);
+  p.used = p.used > bytes ? p.used - bytes : 0;
+  portEXIT_CRITICAL(&s_mux);
+}
+
+void* allocate(Pool pool, size_t bytes) {
+  if (!charge(pool, bytes)) return nullptr;
+  void* ptr = s_psram ? heap_caps_malloc(bytes, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT)
+                      : heap_caps_malloc(bytes, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+  if (!ptr) release(pool, bytes);
+  return ptr;
+}
+
+void* reallocate(Pool pool, void* ptr, size_t oldBytes, size_t newBytes) {
+  if (newBytes > oldBytes && !charge(pool, newBytes - oldBytes)) return nullptr;
+  void* p = s_psram ? heap_caps_realloc(ptr, newBytes, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT)
+                    : heap_caps_realloc(ptr, newBytes, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+  if (!p) {
+    if (newBytes > oldBytes) release(pool, newBytes - oldBytes);
+    return nullptr;
+  }
+  if (newBytes < oldBytes) release(pool, oldBytes - newBytes);
+  return p;
+}
+
+void deallocate(Pool pool, void* ptr, size_t bytes) {
+  if (!ptr) return;
+  heap_caps_free(ptr);
+  release(pool, bytes);
+}
+
+PoolStats getStats(Pool pool) {
+  portENTER_CRITICAL(&s_mux);
+  PoolStats st = s_pools[static_cast<size_t>(pool)];
+  portEXIT_CRITICAL(&s_mux);
+  return st;
+}
+
+void logReport(const char* context) {
+  for (size_t i = 0; i < POOL_COUNT; i++) {
+    PoolStats st = getStats(static_cast<Pool>(i));
+    LOG_PRINTF("Memory [%s] %-10s limit=%lu used=%lu peak=%lu denied=%lu\n", context, POOL_NAMES[i],
+               (unsigned long)st.limit, (unsigned long)st.used, (unsigned long)st.peak, (unsigned long)st.denied);
+  }
+}
+
+}  // namespace MemoryBudget
@@ -0,0 +1,911 @@
+#include "../include/metadata_db.hpp"
+#include "../include/browse_index.hpp"
+#include "../include/search_index.hpp"
+#include "../include/config.hpp"
+#include "../include/memory_budget.hpp"
+#include "../include/seek_index.hpp"
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+namespace MetadataDb {
+
+static constexpr size_t FIELD_COUNT = 4;    // title, artist, album, genre
+static constexpr size_t FIELD_MAX = 255;    // Longer texts are cut at a character boundary
+
+// Store layout: StoreHeader, then appended records (RecordHeader + the fields as UTF-8 without terminators).
+// A later record for the same path supersedes an earlier one. Records are keyed by two independent 32-bit path
+// hashes, 32 bits alone collide somewhere in a large library and would show one track's tags for another.
+struct StoreHeader {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t reserved;
+};
+struct RecordHeader {
+  uint32_t pathHash;
+  uint32_t pathCheck;
+  uint32_t fileSize;
+  uint32_t mtime;
+  uint32_t durationMs;
+  uint16_t year;
+  uint8_t lens[FIELD_COUNT];
+  uint16_t reserved;
+};
+static constexpr uint32_t STORE_MAGIC = 0x3142444D;  // "MDB1"
+static constexpr uint16_t STORE_VERSION = 2;
+static constexpr const char* STORE_TMP_FILE = "/.mp3adv/meta.tmp";
+
+// In-memory directory of the live records: [0, s_sorted) sorted by key, newer entries appended unsorted
+struct DirEntry {
+  uint32_t pathHash;
+  uint32_t pathCheck;
+  uint32_t fileKey;     // Hash of size and modification time, a changed file is parsed again
+  uint32_t recordPos;
+  uint16_t recordSize;
+  uint16_t pass;        // Last update pass that found the track in the library
+};
+static std::vector<DirEntry> s_dir;
+static size_t s_sorted = 0;
+static bool s_dirLoaded = false;
+static uint32_t s_staleBytes = 0;
+
+struct CacheEntry {
+  uint32_t pathHash = 0;
+  uint32_t pathCheck = 0;
+  uint32_t lastUse = 0;
+  bool valid = false;
+  bool found = false;
+  Info info;
+};
+static CacheEntry s_cache[META_DB_CACHE_ENTRIES];
+static uint32_t s_cacheTick = 0;
+
+// Background update state
+struct Pending {
+  RecordHeader hdr;
+  String text;
+};
+static TaskHandle_t s_task = nullptr;
+static fs::FS* s_fs = nullptr;
+static const TrackLibrary* s_tracks = nullptr;
+static volatile bool s_restart = false;
+static uint16_t s_pass = 0;
+static SemaphoreHandle_t s_mutex = nullptr;  // Guards the directory, the cache and s_reader; held for memory work and
+                                             // short appends only, the card is read and rewritten outside it
+static File s_reader;                        // META_DB_FILE open for lookup(), closed when the store is written
+
+static const char* const ID3V1_GENRES[] = {
+    "Blues", "Classic Rock", "Country", "Dance", "Disco", "Funk", "Grunge", "Hip-Hop", "Jazz", "Metal",
+    "New Age", "Oldies", "Other", "Pop", "R&B", "Rap", "Reggae", "Rock", "Techno", "Industrial",
+    "Alternative", "Ska", "Death Metal", "Pranks", "Soundtrack", "Euro-Techno", "Ambient", "Trip-Hop", "Vocal",
+    "Jazz+Funk", "Fusion", "Trance", "Classical", "Instrumental", "Acid", "House", "Game", "Sound Clip", "Gospel",
+    "Noise", "AlternRock", "Bass", "Soul", "Punk", "Space", "Meditative", "Instrumental Pop", "Instrumental Rock",
+    "Ethnic", "Gothic", "Darkwave", "Techno-Industrial", "Electronic", "Pop-Folk", "Eurodance", "Dream",
+    "Southern Rock", "Comedy", "Cult", "Gangsta", "Top 40", "Christian Rap", "Pop/Funk", "Jungle",
+    "Native American", "Cabaret", "New Wave", "Psychadelic", "Rave", "Showtunes", "Trailer", "Lo-Fi", "Tribal",
+    "Acid Punk", "Acid Jazz", "Polka", "Retro", "Musical", "Rock & Roll", "Hard Rock"};
+static constexpr size_t ID3V1_GENRE_COUNT = sizeof(ID3V1_GENRES) / sizeof(ID3V1_GENRES[0]);
+
+static uint32_t fnv(uint32_t h, const uint8_t* p, size_t n) {
+  while (n--) {
+    h ^= *p++;
+    h *= 16777619u;
+  }
+  return h;
+}
+
+uint32_t hashPath(const char* path) {
+  return fnv(2166136261u, (const uint8_t*)path, strlen(path));
+}
+
+// Second half of the record key: upper word of the 64-bit FNV-1a of the path
+static uint32_t checkPath(const char* path) {
+  uint64_t h = 14695981039346656037ull;
+  for (const uint8_t* p = (const uint8_t*)path; *p; p++) {
+    h ^= *p;
+    h *= 1099511628211ull;
+  }
+  return (uint32_t)(h >> 32);
+}
+
+static uint32_t hashFileKey(uint32_t size, uint32_t mtime) {
+  uint32_t key[2] = {size, mtime};
+  return fnv(2166136261u, (const uint8_t*)key, sizeof(key));
+}
+
+static void lock() {
+  if (!s_mutex) s_mutex = xSemaphoreCreateMutex();
+  xSemaphoreTake(s_mutex, portMAX_DELAY);
+}
+
+static void unlock() {
+  xSemaphoreGive(s_mutex);
+}
+
+// The store is about to change on the card: the read handle would see the old size or the replaced file
+static void closeReader() {
+  if (s_reader) s_reader.close();
+}
+
+// ---- Text decoding ----
+
+static uint32_t be32(const uint8_t* p) {
+  return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static uint32_t le32(const uint8_t* p) {
+  return (uint32_t)p[3] << 24 | (uint32_t)p[2] << 16 | (uint32_t)p[1] << 8 | p[0];
+}
+
+static uint32_t synchsafe(const uint8_t* p) {
+  return (uint32_t)(p[0] & 0x7F) << 21 | (uint32_t)(p[1] & 0x7F) << 14 | (uint32_t)(p[2] & 0x7F) << 7 | (p[3] & 0x7F);
+}
+
+static void appendCodepoint(String& out, uint32_t cp) {
+  if (cp < 0x80) {
+    out += (char)cp;
+  } else if (cp < 0x800) {
+    out += (char)(0xC0 | cp >> 6);
+    out += (char)(0x80 | (cp & 0x3F));
+  } else if (cp < 0x10000) {
+    out += (char)(0xE0 | cp >> 12);
+    out += (char)(0x80 | (cp >> 6 & 0x3F));
+    out += (char)(0x80 | (cp & 0x3F));
+  } else {
+    out += (char)(0xF0 | cp >> 18);
+    out += (char)(0x80 | (cp >> 12 & 0x3F));
+    out += (char)(0x80 | (cp >> 6 & 0x3F));
+    out += (char)(0x80 | (cp & 0x3F));
+  }
+}
+
+static bool isUtf8(const uint8_t* p, size_t n) {
+  for (size_t i = 0; i < n;) {
+    uint8_t c = p[i];
+    if (c < 0x80) {
+      i++;
+      continue;
+    }
+    size_t follow = (c & 0xE0) == 0xC0 ? 1 : (c & 0xF0) == 0xE0 ? 2 : (c & 0xF8) == 0xF0 ? 3 : 0;
+    if (follow == 0 || i + follow >= n) return false;
+    for (size_t k = 1; k <= follow; k++) {
+      if ((p[i + k] & 0xC0) != 0x80) return false;
+    }
+    i += follow + 1;
+  }
+  return true;
+}
+
+// Text in ID3v2 encoding enc (0 Latin-1, 1 UTF-16 with BOM, 2 UTF-16BE, 3 UTF-8) up to the first terminator.
+// Latin-1 text that is valid UTF-8 is taken as UTF-8, many taggers write it that way.
+static String decodeText(uint8_t enc, const uint8_t* p, size_t n) {
+  String out;
+  out.reserve(n);
+  if (enc == 1 || enc == 2) {
+    bool bigEndian = enc == 2;
+    size_t i = 0;
+    if (n >= 2 && p[0] == 0xFF && p[1] == 0xFE) {
+      bigEndian = false;
+      i = 2;
+    } else if (n >= 2 && p[0] == 0xFE && p[1] == 0xFF) {
+      bigEndian = true;
+      i = 2;
+    }
+    for (; i + 1 < n; i += 2) {
+      uint32_t u = bigEndian ? (p[i] << 8 | p[i + 1]) : (p[i + 1] << 8 | p[i]);
+      if (u == 0) break;
+      if (u >= 0xD800 && u < 0xDC00 && i + 3 < n) {
+        uint32_t lo = bigEndian ? (p[i + 2] << 8 | p[i + 3]) : (p[i + 3] << 8 | p[i + 2]);
+        if (lo >= 0xDC00 && lo < 0xE000) {
+          u = 0x10000 + ((u - 0xD800) << 10) + (lo - 0xDC00);
+          i += 2;
+        }
+      }
+      appendCodepoint(out, u);
+    }
+  } else {
+    size_t len = 0;
+    while (len < n && p[len]) len++;
+    bool utf8 = enc == 3 || isUtf8(p, len);
+    for (size_t i = 0; i < len; i++) {
+      if (utf8) {
+        out += (char)p[i];
+      } else {
+        appendCodepoint(out, p[i]);
+      }
+    }
+  }
+  out.trim();
+  return out;
+}
+
+// Cut to FIELD_MAX bytes without splitting a UTF-8 sequence
+static void clampField(String& s) {
+  if (s.length() <= FIELD_MAX) return;
+  size_t cut = FIELD_MAX;
+  while (cut > 0 && ((uint8_t)s[cut] & 0xC0) == 0x80) cut--;
+  s.remove(cut);
+}
+
+static uint16_t parseYear(const String& s) {
+  if (s.length() < 4) return 0;
+  uint16_t year = 0;
+  for (int i = 0; i < 4; i++) {
+    if (!isdigit((uint8_t)s[i])) return 0;
+    year = year * 10 + (s[i] - '0');
+  }
+  return year;
+}
+
+// "(17)", "17" and "(17)Rock" refer to ID3v1 genres, a refinement after the reference wins
+static String genreName(const String& tcon) {
+  String num = tcon;
+  if (tcon.startsWith("(")) {
+    int close = tcon.indexOf(')');
+    if (close < 0) return tcon;
+    String rest = tcon.substring(close + 1);
+    if (rest.length() > 0) return rest;
+    num = tcon.substring(1, close);
+  }
+  if (num.length() == 0 || num.length() > 3) return tcon;
+  for (size_t i = 0; i < num.length(); i++) {
+    if (!isdigit((uint8_t)num[i])) return tcon;
+  }
+  int index = num.toInt();
+  return index < (int)ID3V1_GENRE_COUNT ? String(ID3V1_GENRES[index]) : tcon;
+}
+
+// ---- Tag parsing ----
+
+static bool readAt(File& f, uint32_t pos, uint8_t* buf, size_t n) {
+  return f.seek(pos) && f.read(buf, n) == n;
+}
+
+enum Target : uint8_t { TITLE, ARTIST, ALBUM, GENRE, YEAR, LENGTH, BAND, TARGET_COUNT };
+
+struct FrameMap {
+  const char* id22;  // ID3v2.2 frame id
+  const char* id;    // ID3v2.3/2.4 frame id
+  Target target;
+};
+static const FrameMap FRAMES[] = {{"TT2", "TIT2", TITLE}, {"TP1", "TPE1", ARTIST}, {"TP2", "TPE2", BAND},
+                                  {"TAL", "TALB", ALBUM}, {"TCO", "TCON", GENRE},  {"TYE", "TYER", YEAR},
+                                  {nullptr, "TDRC", YEAR},  {"TLE", "TLEN", LENGTH}};
+
+// Texts found so far, the first frame of a kind wins
+struct Tags {
+  String text[TARGET_COUNT];
+};
+
+static int frameTarget(const uint8_t* id, uint8_t version) {
+  for (const FrameMap& m : FRAMES) {
+    const char* want = version == 2 ? m.id22 : m.id;
+    if (want && memcmp(id, want, version == 2 ? 3 : 4) == 0) return m.target;
+  }
+  return -1;
+}
+
+// Reverse the unsynchronisation (0xFF 0x00 -> 0xFF), returns the new length
+static size_t resync(uint8_t* p, size_t n) {
+  size_t out = 0;
+  for (size_t i = 0; i < n; i++) {
+    p[out++] = p[i];
+    if (p[i] == 0xFF && i + 1 < n && p[i + 1] == 0x00) i++;
+  }
+  return out;
+}
+
+// Sequential reader over an ID3v2 tag. With tag-level unsynchronisation in v2.2/2.3 the frame headers and sizes
+// describe the resynchronised bytes, so the stream drops the stuffed 0x00s as it reads and is never seeked.
+struct TagStream {
+  File& f;
+  uint32_t filePos;
+  uint32_t fileEnd;
+  bool unsync;
+  bool afterFF = false;
+  uint8_t buf[64];
+  size_t len = 0;
+  size_t pos = 0;
+
+  TagStream(File& file, uint32_t from, uint32_t to, bool resync)
+      : f(file), filePos(from), fileEnd(to), unsync(resync) {}
+
+  bool fill() {
+    if (filePos >= fileEnd) return false;
+    len = min((uint32_t)sizeof(buf), fileEnd - filePos);
+    pos = 0;
+    if (!readAt(f, filePos, buf, len)) len = 0;
+    filePos += len;
+    return len > 0;
+  }
+
+  bool read(uint8_t* out, size_t n) {
+    while (n > 0) {
+      if (pos == len && !fill()) return false;
+      uint8_t c = buf[pos++];
+      if (unsync && afterFF && c == 0x00) {
+        afterFF = false;
+        continue;
+      }
+      afterFF = c == 0xFF;
+      if (out) *out++ = c;
+      n--;
+    }
+    return true;
+  }
+
+  bool skip(uint32_t n) {
+    if (unsync) return read(nullptr, n);
+    if (n <= len - pos) {
+      pos += n;
+      return true;
+    }
+    const uint32_t rest = n - (len - pos);
+    pos = len;
+    if (rest > fileEnd - filePos) {
+      filePos = fileEnd;
+      return false;
+    }
+    filePos += rest;
+    return true;
+  }
+};
+
+// Text frames of the ID3v2 tag at pos; returns the size of the tag (0 if there is none)
+static uint32_t parseId3v2(File& f, uint32_t pos, Tags& tags) {
+  uint8_t h[10];
+  if (!readAt(f, pos, h, sizeof(h)) || memcmp(h, "ID3", 3) != 0 || h[3] < 2 || h[3] > 4) return 0;
+  const uint8_t version = h[3];
+  const uint8_t flags = h[5];
+  const uint32_t tagEnd = pos + 10 + synchsafe(h + 6);
+  const uint32_t total = tagEnd - pos + ((flags & 0x10) ? 10 : 0);  // Footer
+  const size_t headerLen = version == 2 ? 6 : 10;
+  // v2.4 unsynchronises frame by frame (the tag flag only says all of them are), sizes count the stored bytes
+  TagStream s(f, pos + 10, tagEnd, (flags & 0x80) && version < 4);
+  if ((flags & 0x40) && version >= 3) {
+    uint8_t x[4];
+    if (!s.read(x, sizeof(x)) || !s.skip(version == 4 ? synchsafe(x) - 4 : be32(x))) return total;
+  }
+
+  uint8_t* buf = (uint8_t*)malloc(META_DB_FRAME_MAX);
+  if (!buf) return total;
+  uint8_t fh[10];
+  while (s.read(fh, headerLen) && fh[0] != 0) {  // Padding
+    uint32_t len = version == 2 ? (fh[3] << 16 | fh[4] << 8 | fh[5]) : version == 4 ? synchsafe(fh + 4) : be32(fh + 4);
+    int target = frameTarget(fh, version);
+    uint8_t fmt = version == 2 ? 0 : fh[9];
+    bool unsync = false;
+    uint32_t skip = 0;
+    bool wanted = target >= 0 && tags.text[target].length() == 0;
+    if (version == 3) {
+      if (fmt & 0xC0) wanted = false;  // Compressed or encrypted
+      if (fmt & 0x20) skip = 1;        // Group id
+    } else if (version == 4) {
+      if (fmt & 0x0C) wanted = false;
+      if (fmt & 0x40) skip += 1;
+      if (fmt & 0x01) skip += 4;  // Data length indicator
+      unsync = (flags & 0x80) || (fmt & 0x02);
+    }
+    if (!wanted || len <= skip + 1) {
+      if (!s.skip(len)) break;
+      continue;
+    }
+    size_t n = min((uint32_t)META_DB_FRAME_MAX, len - skip);
+    if (!s.skip(skip) || !s.read(buf, n) || !s.skip(len - skip - n)) break;
+    if (unsync) n = resync(buf, n);
+    tags.text[target] = decodeText(buf[0], buf + 1, n - 1);
+  }
+  free(buf);
+  return total;
+}
+
+// ID3v1 tag in the last 128 bytes, fills only what the ID3v2 tag left empty; returns true if present
+static bool parseId3v1(File& f, uint32_t fileSize, Tags& tags) {
+  uint8_t t[128];
+  if (fileSize < sizeof(t) || !readAt(f, fileSize - sizeof(t), t, sizeof(t)) || memcmp(t, "TAG", 3) != 0) return false;
+  const struct {
+    Target target;
+    uint8_t off;
+    uint8_t len;
+  } fields[] = {{TITLE, 3, 30}, {ARTIST, 33, 30}, {ALBUM, 63, 30}, {YEAR, 93, 4}};
+  for (const auto& fl : fields) {
+    if (tags.text[fl.target].length() == 0) tags.text[fl.target] = decodeText(0, t + fl.off, fl.len);
+  }
+  if (tags.text[GENRE].length() == 0 && t[127] < ID3V1_GENRE_COUNT) tags.text[GENRE] = ID3V1_GENRES[t[127]];
+  return true;
+}
+
+// Duration from the first frame: Xing/Info or VBRI frame count, else the bitrate of a CBR stream
+static uint32_t mp3Duration(File& f, uint32_t audioStart, uint32_t audioEnd) {
+  uint8_t* buf = (uint8_t*)malloc(META_DB_SYNC_SCAN);
+  if (!buf) return 0;
+  uint32_t durationMs = 0;
+  size_t rd = f.seek(audioStart) ? f.read(buf, META_DB_SYNC_SCAN) : 0;
+  for (size_t i = 0; i + 4 <= rd; i++) {
+    uint16_t spf = 0;
+    uint32_t rate = 0;
+    uint32_t frameLen = SeekIndex::parseFrameHeader(buf + i, spf, rate);
+    if (frameLen == 0) continue;
+    bool mpeg1 = ((buf[i + 1] >> 3) & 3) == 3;
+    bool mono = (buf[i + 3] >> 6) == 3;
+    size_t xing = i + 4 + (mpeg1 ? (mono ? 17 : 32) : (mono ? 9 : 17));
+    size_t vbri = i + 4 + 32;
+    uint32_t frames = 0;
+    if (xing + 12 <= rd && (memcmp(buf + xing, "Xing", 4) == 0 || memcmp(buf + xing, "Info", 4) == 0) &&
+        (be32(buf + xing + 4) & 1)) {
+      frames = be32(buf + xing + 8);
+    } else if (vbri + 18 <= rd && memcmp(buf + vbri, "VBRI", 4) == 0) {
+      frames = be32(buf + vbri + 14);
+    }
+    if (frames) {
+      durationMs = (uint32_t)((uint64_t)frames * spf * 1000 / rate);
+    } else if (audioEnd > audioStart + i) {
+      durationMs = (uint32_t)((uint64_t)(audioEnd - audioStart - i) * spf * 1000 / ((uint64_t)frameLen * rate));
+    }
+    break;
+  }
+  free(buf);
+  return durationMs;
+}
+
+// RIFF/WAVE: duration from the fmt and data chunks, tags from LIST/INFO or an embedded ID3v2 chunk
+static void parseRiff(File& f, uint32_t fileSize, Tags& tags, uint32_t& durationMs) {
+  static const struct {
+    const char* id;
+    Target target;
+  } INFO_FIELDS[] = {{"INAM", TITLE}, {"IART", ARTIST}, {"IPRD", ALBUM}, {"IGNR", GENRE}, {"ICRD", YEAR}};
+  uint8_t h[12];
+  if (!readAt(f, 0, h, sizeof(h)) || memcmp(h + 8, "WAVE", 4) != 0) return;
+  const uint32_t end = min(fileSize, le32(h + 4) + 8);
+  uint32_t byteRate = 0;
+  uint32_t dataLen = 0;
+  uint8_t text[META_DB_FRAME_MAX / 4];
+  uint32_t pos = 12;
+  for (int n = 0; n < 64 && pos + 8 <= end; n++) {
+    uint8_t c[12];
+    if (!readAt(f, pos, c, 8)) break;
+    const uint32_t len = le32(c + 4);
+    const uint32_t body = pos + 8;
+    if (memcmp(c, "fmt ", 4) == 0 && len >= 12 && readAt(f, body, c, 12)) {
+      byteRate = le32(c + 8);
+    } else if (memcmp(c, "data", 4) == 0) {
+      dataLen = min(len, end - body);
+    } else if (memcmp(c, "id3 ", 4) == 0 || memcmp(c, "ID3 ", 4) == 0) {
+      parseId3v2(f, body, tags);
+    } else if (memcmp(c, "LIST", 4) == 0 && readAt(f, body, c, 4) && memcmp(c, "INFO", 4) == 0) {
+      const uint32_t listEnd = min(end, body + len);
+      for (uint32_t sub = body + 4; sub + 8 <= listEnd;) {
+        if (!readAt(f, sub, c, 8)) break;
+        const uint32_t subLen = le32(c + 4);
+        for (const auto& fl : INFO_FIELDS) {
+          if (memcmp(c, fl.id, 4) != 0 || tags.text[fl.target].length() > 0) continue;
+          size_t tn = min((uint32_t)sizeof(text), subLen);
+          if (readAt(f, sub + 8, text, tn)) tags.text[fl.target] = decodeText(0, text, tn);
+        }
+        sub += 8 + subLen + (subLen & 1);
+      }
+    }
+    pos = body + len + (len & 1);
+  }
+  if (byteRate) durationMs = (uint32_t)((uint64_t)dataLen * 1000 / byteRate);
+}
+
+static void extractFrom(File& f, Info& out) {
+  out = Info();
+  const uint32_t fileSize = f.size();
+  Tags tags;
+  uint32_t durationMs = 0;
+  uint8_t magic[4];
+  if (readAt(f, 0, magic, sizeof(magic)) && memcmp(magic, "RIFF", 4) == 0) {
+    parseRiff(f, fileSize, tags, durationMs);
+  } else {
+    uint32_t audioStart = parseId3v2(f, 0, tags);
+    uint32_t audioEnd = parseId3v1(f, fileSize, tags) ? fileSize - 128 : fileSize;
+    durationMs = tags.text[LENGTH].length() > 0 ? (uint32_t)tags.text[LENGTH].toInt() : 0;
+    if (durationMs == 0) durationMs = mp3Duration(f, audioStart, audioEnd);
+  }
+  out.title = tags.text[TITLE];
+  out.artist = tags.text[ARTIST].length() > 0 ? tags.text[ARTIST] : tags.text[BAND];
+  out.album = tags.text[ALBUM];
+  out.genre = genreName(tags.text[GENRE]);
+  out.year = parseYear(tags.text[YEAR]);
+  out.durationMs = durationMs;
+}
+
+bool extract(fs::FS& fs, const char* path, Info& out) {
+  File f = fs.open(path);
+  if (!f) return false;
+  extractFrom(f, out);
+  f.close();
+  return true;
+}
+
+// ---- Store ----
+
+static String* fieldsOf(Info& info, size_t i) {
+  String* fields[FIELD_COUNT] = {&info.title, &info.artist, &info.album, &info.genre};
+  return fields[i];
+}
+
+static bool lessKey(const DirEntry& a, const DirEntry& b) {
+  return a.pathHash != b.pathHash ? a.pathHash < b.pathHash : a.pathCheck < b.pathCheck;
+}
+
+static bool sameKey(const DirEntry& a, const DirEntry& b) {
+  return a.pathHash == b.pathHash && a.pathCheck == b.pathCheck;
+}
+
+static DirEntry* findEntry(uint32_t pathHash, uint32_t pathCheck) {
+  DirEntry key = {pathHash, pathCheck, 0, 0, 0, 0};
+  auto it = std::lower_bound(s_dir.begin(), s_dir.begin() + s_sorted, key, lessKey);
+  if (it != s_dir.begin() + s_sorted && sameKey(*it, key)) return &*it;
+  for (size_t i = s_sorted; i < s_dir.size(); i++) {
+    if (sameKey(s_dir[i], key)) return &s_dir[i];
+  }
+  return nullptr;
+}
+
+static void sortDirectory() {
+  std::sort(s_dir.begin(), s_dir.end(), lessKey);
+  s_sorted = s_dir.size();
+}
+
+static void addEntry(const DirEntry& entry) {
+  DirEntry* old = findEntry(entry.pathHash, entry.pathCheck);
+  if (old) {
+    s_staleBytes += old->recordSize;
+    *old = entry;
+    return;
+  }
+  if (!MemoryBudget::charge(MemoryBudget::Pool::TrackList, sizeof(DirEntry))) {
+    s_staleBytes += entry.recordSize;  // Not reachable, dropped by the next compaction
+    return;
+  }
+  s_dir.push_back(entry);
+  if (s_dir.size() - s_sorted > META_DB_UNSORTED_MAX) sortDirectory();
+}
+
+static void dropCached(uint32_t pathHash, uint32_t pathCheck) {
+  for (CacheEntry& c : s_cache) {
+    if (c.valid && c.pathHash == pathHash && c.pathCheck == pathCheck) c.valid = false;
+  }
+}
+
+// Directory of the store, read without the lock (only the update task writes the directory) and swapped in under it
+static void loadDirectory(fs::FS& fs) {
+  if (s_dirLoaded) return;
+  std::vector<DirEntry> dir;
+  uint32_t stale = 0;
+  File f = fs.exists(META_DB_FILE) ? fs.open(META_DB_FILE) : File();
+  if (f) {
+    const uint32_t size = f.size();
+    StoreHeader hdr;
+    if (f.read((uint8_t*)&hdr, sizeof(hdr)) != sizeof(hdr) || hdr.magic != STORE_MAGIC ||
+        hdr.version != STORE_VERSION) {
+      f.close();
+      LOG_PRINTLN("MetadataDb: store has an unknown format, recreating");
+      fs.remove(META_DB_FILE);
+    } else {
+      uint32_t pos = sizeof(hdr);
+      while (pos + sizeof(RecordHeader) <= size) {
+        RecordHeader rec;
+        f.seek(pos);
+        if (f.read((uint8_t*)&rec, sizeof(rec)) != sizeof(rec)) break;
+        uint32_t recordSize = sizeof(rec);
+        for (uint8_t len : rec.lens) recordSize += len;
+        if (pos + recordSize > size) break;
+        if (!MemoryBudget::charge(MemoryBudget::Pool::TrackList, sizeof(DirEntry))) {
+          LOG_PRINTLN("MetadataDb: track list memory budget exhausted, remaining records not loaded");
+          break;
+        }
+        const uint32_t fileKey = hashFileKey(rec.fileSize, rec.mtime);
+        dir.push_back({rec.pathHash, rec.pathCheck, fileKey, pos, (uint16_t)recordSize, 0});
+        pos += recordSize;
+      }
+      stale += size - pos;  // Truncated tail (power loss while appending) or not loaded
+      f.close();
+    }
+  }
+
+  // Keep the last record of every path
+  std::stable_sort(dir.begin(), dir.end(), lessKey);
+  size_t live = 0;
+  for (size_t i = 0; i < dir.size(); i++) {
+    if (i + 1 < dir.size() && sameKey(dir[i + 1], dir[i])) {
+      stale += dir[i].recordSize;
+      continue;
+    }
+    dir[live++] = dir[i];
+  }
+  MemoryBudget::release(MemoryBudget::Pool::TrackList, (dir.size() - live) * sizeof(DirEntry));
+  dir.resize(live);
+
+  lock();
+  MemoryBudget::release(MemoryBudget::Pool::TrackList, s_dir.size() * sizeof(DirEntry));
+  s_dir.swap(dir);
+  s_sorted = s_dir.size();
+  s_staleBytes = stale;
+  s_dirLoaded = true;
+  closeReader();
+  for (CacheEntry& c : s_cache) c.valid = false;
+  unlock();
+  LOG_PRINTF("MetadataDb: %u records, %lu bytes stale\n", (unsigned)live, (unsigned long)stale);
+}
+
+static void decodeFields(const RecordHeader& rec, const char* text, Info& out) {
+  for (size_t i = 0; i < FIELD_COUNT; i++) {
+    char field[FIELD_MAX + 1];
+    memcpy(field, text, rec.lens[i]);
+    field[rec.lens[i]] = '\0';
+    *fieldsOf(out, i) = field;
+    text += rec.lens[i];
+  }
+  out.year = rec.year;
+  out.durationMs = rec.durationMs;
+}
+
+// Under the lock
+static bool readRecord(fs::FS& fs, const DirEntry& e, Info& out) {
+  if (!s_reader) s_reader = fs.open(META_DB_FILE);
+  if (!s_reader) return false;
+  File& f = s_reader;
+  RecordHeader rec;
+  char text[FIELD_COUNT * FIELD_MAX];
+  const size_t textLen = e.recordSize - sizeof(rec);
+  bool ok = f.seek(e.recordPos) && f.read((uint8_t*)&rec, sizeof(rec)) == sizeof(rec) && rec.pathHash == e.pathHash &&
+            rec.pathCheck == e.pathCheck && f.read((uint8_t*)text, textLen) == textLen;
+  if (ok) decodeFields(rec, text, out);
+  return ok;
+}
+
+void forEach(fs::FS& fs, const std::function<void(uint32_t pathHash, const Info& info)>& fn) {
+  loadDirectory(fs);
+  File f = fs.open(META_DB_FILE);
+  if (!f) return;
+  const uint32_t size = f.size();
+  uint32_t pos = sizeof(StoreHeader);
+  char text[FIELD_COUNT * FIELD_MAX];
+  Info info;
+  while (pos + sizeof(RecordHeader) <= size) {
+    RecordHeader rec;
+    if (!f.seek(pos) || f.read((uint8_t*)&rec, sizeof(rec)) != sizeof(rec)) break;
+    uint32_t textLen = 0;
+    for (uint8_t len : rec.lens) textLen += len;
+    if (f.read((uint8_t*)text, textLen) != textLen) break;
+    lock();
+    const DirEntry* e = findEntry(rec.pathHash, rec.pathCheck);
+    bool live = e && e->recordPos == pos;  // Not superseded or dropped
+    unlock();
+    if (live) {
+      decodeFields(rec, text, info);
+      fn(rec.pathHash, info);
+    }
+    pos += sizeof(rec) + textLen;
+  }
+  f.close();
+}
+
+// Rewrite the store with the live records only. Called from the update task, the only writer of the directory,
+// so the copy reads it without the lock; only the file swap and the new positions are done under it.
+static void compact(fs::FS& fs) {
+  File src = fs.open(META_DB_FILE);
+  File dst = fs.open(STORE_TMP_FILE, FILE_WRITE);
+  if (!src || !dst) {
+    if (src) src.close();
+    if (dst) dst.close();
+    return;
+  }
+  StoreHeader hdr = {STORE_MAGIC, STORE_VERSION, 0};
+  dst.write((const uint8_t*)&hdr, sizeof(hdr));
+  uint8_t buf[sizeof(RecordHeader) + FIELD_COUNT * FIELD_MAX];
+  bool ok = true;
+  for (const DirEntry& e : s_dir) {
+    ok = ok && src.seek(e.recordPos) && src.read(buf, e.recordSize) == e.recordSize &&
+         dst.write(buf, e.recordSize) == e.recordSize;
+  }
+  src.close();
+  dst.close();
+  if (!ok) {
+    fs.remove(STORE_TMP_FILE);
+    return;
+  }
+  lock();
+  closeReader();
+  fs.remove(META_DB_FILE);
+  fs.rename(STORE_TMP_FILE, META_DB_FILE);
+  uint32_t pos = sizeof(hdr);
+  for (DirEntry& e : s_dir) {
+    e.recordPos = pos;
+    pos += e.recordSize;
+  }
+  LOG_PRINTF("MetadataDb: store compacted, %lu bytes dropped\n", (unsigned long)s_staleBytes);
+  s_staleBytes = 0;
+  unlock();
+}
+
+static bool appendRecords(fs::FS& fs, std::vector<Pending>& batch) {
+  if (batch.empty()) return true;
+  if (!fs.exists(APP_DATA_DIR)) fs.mkdir(APP_DATA_DIR);
+  bool created = !fs.exists(META_DB_FILE);
+  File f = fs.open(META_DB_FILE, FILE_APPEND);
+  if (!f) {
+    LOG_PRINTF("MetadataDb: failed to open %s\n", META_DB_FILE);
+    batch.clear();
+    return false;
+  }
+  if (created) {
+    StoreHeader hdr = {STORE_MAGIC, STORE_VERSION, 0};
+    f.write((const uint8_t*)&hdr, sizeof(hdr));
+  }
+  closeReader();
+  uint32_t pos = f.size();
+  bool ok = true;
+  for (const Pending& p : batch) {
+    uint32_t recordSize = sizeof(p.hdr) + p.text.length();
+    ok = f.write((const uint8_t*)&p.hdr, sizeof(p.hdr)) == sizeof(p.hdr) &&
+         f.write((const uint8_t*)p.text.c_str(), p.text.length()) == p.text.length();
+    if (!ok) break;
+    addEntry({p.hdr.pathHash, p.hdr.pathCheck, hashFileKey(p.hdr.fileSize, p.hdr.mtime), pos, (uint16_t)recordSize,
+              s_pass});
+    dropCached(p.hdr.pathHash, p.hdr.pathCheck);
+    pos += recordSize;
+  }
+  f.close();
+  if (!ok) s_dirLoaded = false;  // Re-read, the partial record is counted as stale
+  batch.clear();
+  return ok;
+}
+
+bool lookup(fs::FS& fs, const String& path, Info& out) {
+  if (!s_mutex || path.length() == 0) return false;
+  const uint32_t pathHash = hashPath(path.c_str());
+  const uint32_t pathCheck = checkPath(path.c_str());
+  // The list falls back to the file name rather than wait for an append of the update task
+  if (xSemaphoreTake(s_mutex, pdMS_TO_TICKS(META_DB_LOOKUP_WAIT_MS)) != pdTRUE) return false;
+  if (!s_dirLoaded) {
+    unlock();
+    return false;
+  }
+  s_cacheTick++;
+  CacheEntry* victim = &s_cache[0];
+  for (CacheEntry& c : s_cache) {
+    if (c.valid && c.pathHash == pathHash && c.pathCheck == pathCheck) {
+      c.lastUse = s_cacheTick;
+      if (c.found) out = c.info;
+      unlock();
+      return c.found;
+    }
+    if (!c.valid || (victim->valid && c.lastUse < victim->lastUse)) victim = &c;
+  }
+  DirEntry* e = findEntry(pathHash, pathCheck);
+  victim->found = e && readRecord(fs, *e, victim->info);
+  victim->pathHash = pathHash;
+  victim->pathCheck = pathCheck;
+  victim->lastUse = s_cacheTick;
+  victim->valid = true;
+  if (victim->found) out = victim->info;
+  bool found = victim->found;
+  unlock();
+  return found;
+}
+
+// Check one track against the store and queue a record if it is new or changed
+static void updateTrack(fs::FS& fs, const String& path, std::vector<Pending>& batch) {
+  File f = fs.open(path.c_str());
+  if (!f) return;
+  const uint32_t pathHash = hashPath(path.c_str());
+  const uint32_t pathCheck = checkPath(path.c_str());
+  const uint32_t fileSize = f.size();
+  const uint32_t mtime = (uint32_t)f.getLastWrite();
+  lock();
+  DirEntry* e = findEntry(pathHash, pathCheck);
+  bool current = e && e->fileKey == hashFileKey(fileSize, mtime);
+  if (e) e->pass = s_pass;
+  unlock();
+  if (current) {
+    f.close();
+    return;
+  }
+
+  Info info;
+  extractFrom(f, info);
+  f.close();
+  Pending p;
+  p.hdr = {pathHash, pathCheck, fileSize, mtime, info.durationMs, info.year, {}, 0};
+  for (size_t i = 0; i < FIELD_COUNT; i++) {
+    String& field = *fieldsOf(info, i);
+    clampField(field);
+    p.hdr.lens[i] = field.length();
+    p.text += field;
+  }
+  DEBUG_PRINTF("MetadataDb: %s -> %s / %s (%lu ms)\n", path.c_str(), info.artist.c_str(), info.title.c_str(),
+               (unsigned long)info.durationMs);
+  batch.push_back(p);
+}
+
+// One update: passes over the library until no restart is requested, then prune, compaction and index builds
+static void runUpdate(fs::FS& fs) {
+  unsigned long t0 = millis();
+  loadDirectory(fs);
+  std::vector<Pending> batch;
+  uint32_t parsed = 0;
+  do {
+    s_restart = false;
+    s_pass = s_pass == UINT16_MAX ? 1 : s_pass + 1;  // Entries loaded from the store have pass 0
+    for (int i = 0; i < s_tracks->count() && !s_restart; i++) {
+      if (s_tracks->deleted(i)) continue;
+      size_t queued = batch.size();
+      updateTrack(fs, s_tracks->path(i), batch);
+      parsed += batch.size() - queued;
+      if (batch.size() >= META_DB_BATCH) {
+        lock();
+        appendRecords(fs, batch);
+        unlock();
+      }
+      vTaskDelay(pdMS_TO_TICKS(META_DB_INTERVAL_MS));
+    }
+    lock();
+    appendRecords(fs, batch);
+    unlock();
+  } while (s_restart);
+
+  // Drop the tracks no longer in the library
+  lock();
+  size_t live = 0;
+  for (size_t i = 0; i < s_dir.size(); i++) {
+    if (s_dir[i].pass != s_pass) {
+      s_staleBytes += s_dir[i].recordSize;
+      continue;
+    }
+    s_dir[live++] = s_dir[i];
+  }
+  const size_t dropped = s_dir.size() - live;
+  MemoryBudget::release(MemoryBudget::Pool::TrackList, dropped * sizeof(DirEntry));
+  s_dir.resize(live);
+  sortDirectory();
+  for (CacheEntry& c : s_cache) c.valid = false;
+  const bool compactStore = s_staleBytes >= META_DB_COMPACT_BYTES;
+  unlock();
+  if (compactStore) compact(fs);
+  LOG_PRINTF("MetadataDb: %u records, %lu parsed in %lu ms\n", (unsigned)s_dir.size(), (unsigned long)parsed,
+             (unsigned long)(millis() - t0));
+  BrowseIndex::build(fs, *s_tracks, parsed > 0 || dropped > 0);
+  SearchIndex::build(fs, *s_tracks, parsed > 0 || dropped > 0);
+}
+
+static void updateTask(void* pvParameters) {
+  bool again = true;
+  while (again) {
+    runUpdate(*s_fs);
+    // A startUpdate() after the last pass ended is not lost: it is seen here, under the same lock it set it
+    lock();
+    again = s_restart;
+    if (!again) s_task = nullptr;
+    unlock();
+  }
+  vTaskDelete(NULL);
+}
+
+bool startUpdate(fs::FS& fs, const TrackLibrary& tracks) {
+  lock();
+  if (s_task) {
+    s_restart = true;
+    unlock();
+    return true;
+  }
+  s_fs = &fs;
+  s_tracks = &tracks;
+  s_restart = false;
+  // The task waits for the lock, so s_task is set before it can clear it
+  bool ok = xTaskCreatePinnedToCore(updateTask, "MetadataDb", META_DB_TASK_STACK, NULL, META_DB_TASK_PRIORITY,
+                                    &s_task, 0) == pdPASS;
+  if (!ok) s_task = nullptr;
+  unlock();
+  return ok;
+}
+
+bool isUpdating() {
+  return s_task != nullptr;
+}
+
+}  // namespace MetadataDb
@@ -0,0 +1,523 @@
+#include "../include/playlist.hpp"
+#include "../include/config.hpp"
+#include "../include/memory_budget.hpp"
+#include <algorithm>
+#include <vector>
+
+namespace Playlist {
+
+static constexpr int16_t UNRESOLVED = -2;
+static constexpr size_t GROW = 256;                                  // Entries charged at a time
+static constexpr uint32_t ENTRY_BYTES = sizeof(uint32_t) + sizeof(int16_t) + sizeof(uint16_t);
+static_assert(PLAYLIST_MAX_ENTRIES <= 0xFFFF, "The shuffle order holds an entry in 16 bits");
+
+static fs::FS* s_fs = nullptr;
+static String s_path;
+static String s_dir;                    // Folder of the playlist, relative entries start there
+static bool s_latin1 = false;           // .m3u: lines that are not valid UTF-8 are Latin-1
+static std::vector<uint32_t> s_offs;    // File offset of each entry line
+static std::vector<int16_t> s_tracks;   // Library index of each entry, UNRESOLVED until looked up
+static std::vector<uint16_t> s_order;   // Shuffle order of the entries found: played up to s_cursor, then the rest
+static int s_cursor = -1;               // Position of the playing entry in s_order, -1 = none yet
+static uint32_t s_charged = 0;          // Bytes charged to the TrackList pool
+static uint32_t s_size = 0;
+static uint32_t s_readPos = 0;          // Offsets collected up to here
+static bool s_inLine = false;           // s_readPos is past the start of a line
+static bool s_complete = false;
+static int s_libraryCount = -1;         // tracks.count() the resolved indexes belong to
+static uint32_t s_libraryGeneration = 0;  // and tracks.generation()
+static int s_selected = 0;
+static int s_position = 0;
+static bool s_active = false;
+static uint8_t s_buf[PLAYLIST_READ_CHUNK];
+
+static String s_rowNames[BROWSE_VISIBLE_ROWS];
+static int s_rowsFirst = -1;
+static int s_rowsCount = 0;
+
+static SemaphoreHandle_t s_mutex = xSemaphoreCreateMutex();  // Task_Audio picks the next entry at the end of a track
+
+static void lock() {
+  xSemaphoreTake(s_mutex, portMAX_DELAY);
+}
+
+static void unlock() {
+  xSemaphoreGive(s_mutex);
+}
+
+bool isPlaylistFile(const char* name) {
+  const char* dot = strrchr(name, '.');
+  return dot && (strcasecmp(dot, ".m3u") == 0 || strcasecmp(dot, ".m3u8") == 0);
+}
+
+static void reset() {
+  MemoryBudget::release(MemoryBudget::Pool::TrackList, s_charged);
+  std::vector<uint32_t>().swap(s_offs);
+  std::vector<int16_t>().swap(s_tracks);
+  std::vector<uint16_t>().swap(s_order);
+  s_cursor = -1;
+  s_charged = 0;
+  s_path = "";
+  s_dir = "";
+  s_size = 0;
+  s_readPos = 0;
+  s_inLine = false;
+  s_complete = false;
+  s_libraryCount = -1;
+  s_selected = 0;
+  s_position = 0;
+  s_active = false;
+  s_rowsFirst = -1;
+}
+
+static bool addEntry(uint32_t off) {
+  if (s_offs.size() >= PLAYLIST_MAX_ENTRIES) {
+    LOG_PRINTF("Playlist: %s has more than %u entries, the rest is ignored\n", s_path.c_str(),
+               (unsigned)PLAYLIST_MAX_ENTRIES);
+    return false;
+  }
+  if (s_offs.size() == s_offs.capacity()) {
+    if (!MemoryBudget::charge(MemoryBudget::Pool::TrackList, GROW * ENTRY_BYTES)) {
+      LOG_PRINTF("Playlist: no memory for more than %u entries\n", (unsigned)s_offs.size());
+      return false;
+    }
+    s_charged += GROW * ENTRY_BYTES;
+    s_offs.reserve(s_offs.size() + GROW);
+    s_tracks.reserve(s_offs.size() + GROW);
+    s_order.reserve(s_offs.size() + GROW);
+  }
+  s_offs.push_back(off);
+  s_tracks.push_back(UNRESOLVED);
+  return true;
+}
+
+// Collect the entry lines of the next chunk: the first non-blank character of a line that is not a comment
+static void indexChunk(File& f) {
+  if (s_complete) return;
+  int n = f.seek(s_readPos) ? f.read(s_buf, sizeof(s_buf)) : 0;
+  if (n <= 0) {
+    s_complete = true;
+    return;
+  }
+  for (int i = 0; i < n; i++) {
+    const uint8_t c = s_buf[i];
+    if (c == '\n') {
+      s_inLine = false;
+      continue;
+    }
+    if (s_inLine || c == ' ' || c == '\t' || c == '\r') continue;
+    s_inLine = true;
+    if (c != '#' && !addEntry(s_readPos + i)) {
+      s_complete = true;
+      return;
+    }
+  }
+  s_readPos += n;
+  if (s_readPos >= s_size) s_complete = true;
+}
+
+static void indexUpTo(File& f, int entry) {
+  while (entry >= (int)s_offs.size() && !s_complete) indexChunk(f);
+}
+
+static bool validUtf8(const String& s) {
+  const uint8_t* p = (const uint8_t*)s.c_str();
+  while (*p) {
+    int follow = *p < 0x80 ? 0 : (*p & 0xE0) == 0xC0 ? 1 : (*p & 0xF0) == 0xE0 ? 2 : (*p & 0xF8) == 0xF0 ? 3 : -1;
+    if (follow < 0) return false;
+    p++;
+    for (int i = 0; i < follow; i++, p++) {
+      if ((*p & 0xC0) != 0x80) return false;
+    }
+  }
+  return true;
+}
+
+static String latin1ToUtf8(const String& s) {
+  String out;
+  out.reserve(s.length() + 8);
+  for (size_t i = 0; i < s.length(); i++) {
+    const uint8_t c = s[i];
+    if (c < 0x80) {
+      out += (char)c;
+    } else {
+      out += (char)(0xC0 | (c >> 6));
+      out += (char)(0x80 | (c & 0x3F));
+    }
+  }
+  return out;
+}
+
+static int hexValue(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+static String percentDecode(const String& s) {
+  String out;
+  out.reserve(s.length());
+  for (size_t i = 0; i < s.length(); i++) {
+    int hi, lo;
+    if (s[i] == '%' && i + 2 < s.length() && (hi = hexValue(s[i + 1])) >= 0 && (lo = hexValue(s[i + 2])) >= 0) {
+      out += (char)(hi * 16 + lo);
+      i += 2;
+    } else {
+      out += s[i];
+    }
+  }
+  return out;
+}
+
+// Entry line at off, without the line end
+static String readLine(File& f, uint32_t off) {
+  char line[PLAYLIST_LINE_MAX + 1];
+  int n = f.seek(off) ? f.read((uint8_t*)line, PLAYLIST_LINE_MAX) : 0;
+  if (n < 0) n = 0;
+  int len = 0;
+  while (len < n && line[len] != '\n' && line[len] != '\r') len++;
+  line[len] = '\0';
+  return String(line);
+}
+
+// Card path of an entry line, "" for a stream URL
+static String cardPath(String line) {
+  line.trim();
+  if (line.indexOf("://") >= 0) {
+    if (!line.startsWith("file://")) return "";
+    line = percentDecode(line.substring(7));  // file:///music/a%20b.mp3
+  }
+  if (s_latin1 && !validUtf8(line)) line = latin1ToUtf8(line);
+  line.replace('\\', '/');
+  if (line.length() >= 2 && isalpha((uint8_t)line[0]) && line[1] == ':') line = line.substring(2);  // C:/music/...
+  if (!line.startsWith("/")) line = s_dir + "/" + line;
+
+  // Drop empty and "." segments, ".." removes the one before
+  String out;
+  int start = 0;
+  while (start <= (int)line.length()) {
+    int end = line.indexOf('/', start);
+    if (end < 0) end = line.length();
+    const String seg = line.substring(start, end);
+    if (seg == "..") {
+      int slash = out.lastIndexOf('/');
+      out = slash >= 0 ? out.substring(0, slash) : String();
+    } else if (seg.length() && seg != ".") {
+      out += "/" + seg;
+    }
+    start = end + 1;
+  }
+  return out;
+}
+
+static String nameOf(const String& path) {
+  return path.substring(path.lastIndexOf('/') + 1);
+}
+
+// Resolved indexes are dropped when the library changes (tracks deleted, rescanned)
+static void checkLibrary(const TrackLibrary& tracks) {
+  if (s_libraryCount == tracks.count() && s_libraryGeneration == tracks.generation()) return;
+  s_libraryCount = tracks.count();
+  s_libraryGeneration = tracks.generation();
+  for (int16_t& t : s_tracks) t = UNRESOLVED;
+  s_rowsFirst = -1;
+}
+
+static int resolve(File& f, const TrackLibrary& tracks, int entry, String* name = nullptr) {
+  if (name == nullptr && s_tracks[entry] != UNRESOLVED) return s_tracks[entry];
+  const String line = readLine(f, s_offs[entry]);
+  const String path = cardPath(line);
+  if (name) *name = path.length() ? nameOf(path) : line;
+  if (s_tracks[entry] == UNRESOLVED) {
+    s_tracks[entry] = path.length() ? tracks.find(path) : -1;
+    if (s_tracks[entry] < 0) DEBUG_PRINTF("Playlist: not in the library: %s\n", line.c_str());
+  }
+  return s_tracks[entry];
+}
+
+// As resolve(), but an entry not looked up yet costs one of budget; UNRESOLVED once it is used up
+static int resolveWithin(File& f, const TrackLibrary& tracks, int entry, int& budget) {
+  if (s_tracks[entry] == UNRESOLVED) {
+    if (budget == 0) return UNRESOLVED;
+    budget--;
+  }
+  return resolve(f, tracks, entry);
+}
+
+// ---- Shuffle order, as Shuffle keeps it for the library ----
+
+// Fisher-Yates over positions [from, to)
+static void shuffleOrder(int from, int to) {
+  for (int i = to - 1; i > from; i--) {
+    const int j = random(from, i + 1);
+    std::swap(s_order[i], s_order[j]);
+  }
+}
+
+// Entries found since the last call are shuffled into the part still to come
+static void syncOrder() {
+  const size_t n = s_offs.size();
+  if (s_order.size() == n) return;
+  for (size_t entry = s_order.size(); entry < n; entry++) s_order.push_back(entry);
+  shuffleOrder(s_cursor + 1, n);
+}
+
+// Make entry the one at the cursor: an entry picked by hand (or played in order) not played yet in this cycle
+// is next in line, one played before moves to the end of the history
+static void placeInOrder(int entry) {
+  syncOrder();
+  if (s_cursor >= 0 && s_order[s_cursor] == entry) return;
+  const int pos = std::find(s_order.begin(), s_order.end(), entry) - s_order.begin();
+  if (pos >= (int)s_order.size()) return;
+  if (pos > s_cursor) {
+    s_cursor++;
+    s_order[pos] = s_order[s_cursor];
+  } else {
+    memmove(s_order.data() + pos, s_order.data() + pos + 1, (s_cursor - pos) * sizeof(uint16_t));
+  }
+  s_order[s_cursor] = entry;
+}
+
+// Library index of the entry step places from the playing one in the shuffle order, UNRESOLVED if the lookup
+// budget ran out first (the cursor stays). Once every entry played a new cycle starts.
+static int shuffleStep(File& f, const TrackLibrary& tracks, int step, int& budget) {
+  placeInOrder(s_position);
+  int found = -1;
+  int track = -1;
+  auto visit = [&](int pos) {
+    track = resolveWithin(f, tracks, s_order[pos], budget);
+    if (track >= 0) found = pos;
+    return track >= 0 || track == UNRESOLVED;
+  };
+  bool done = false;
+  if (step < 0) {
+    for (int pos = s_cursor - 1; pos >= 0 && !done; pos--) done = visit(pos);
+    if (!done && s_cursor >= 0) done = visit(s_cursor);  // Nothing played before it: the entry starts again
+  }
+  for (int pos = s_cursor + 1; !done; pos++) {
+    if (pos >= (int)s_order.size()) {
+      indexUpTo(f, pos);  // The entries not found yet are still to come
+      syncOrder();
+      if (pos >= (int)s_order.size()) break;
+    }
+    done = visit(pos);
+  }
+  if (!done) {
+    // Cycle done: a new order, starting with the entry playing so it does not come again right away
+    shuffleOrder(0, s_order.size());
+    s_cursor = -1;
+    placeInOrder(s_position);
+    for (int pos = 1; pos < (int)s_order.size() && !done; pos++) done = visit(pos);
+    if (!done && s_cursor == 0) done = visit(0);  // The only entry in the library
+    DEBUG_PRINTF("Playlist: new shuffle cycle of %u entries\n", (unsigned)s_order.size());
+  }
+  if (found < 0) return track == UNRESOLVED ? UNRESOLVED : -1;
+  s_cursor = found;
+  s_position = s_order[found];
+  return track;
+}
+
+bool open(fs::FS& fs, const String& path) {
+  lock();
+  reset();
+  File f = fs.open(path.c_str());
+  bool ok = f && !f.isDirectory();
+  if (ok) {
+    s_fs = &fs;
+    s_path = path;
+    const int slash = path.lastIndexOf('/');
+    s_dir = slash > 0 ? path.substring(0, slash) : String();
+    s_latin1 = !path.endsWith("8");  // .m3u8 is UTF-8 by definition
+    s_size = f.size();
+    uint8_t bom[3] = {0, 0, 0};
+    if (f.read(bom, 3) == 3 && bom[0] == 0xEF && bom[1] == 0xBB && bom[2] == 0xBF) s_readPos = 3;
+    indexChunk(f);
+    LOG_PRINTF("Playlist: %s, %u bytes, %u entries in the first chunk\n", path.c_str(), (unsigned)s_size,
+               (unsigned)s_offs.size());
+  } else {
+    LOG_PRINTF("Playlist: cannot open %s\n", path.c_str());
+  }
+  if (f) f.close();
+  unlock();
+  return ok;
+}
+
+void close() {
+  lock();
+  reset();
+  unlock();
+}
+
+const String& path() {
+  return s_path;
+}
+
+int count() {
+  return s_offs.size();
+}
+
+bool complete() {
+  return s_complete;
+}
+
+int selected() {
+  return s_selected;
+}
+
+void move(int delta) {
+  lock();
+  if (s_path.length()) {
+    int target = s_selected + delta;
+    if ((target < 0 || target >= (int)s_offs.size()) && !s_complete) {
+      File f = s_fs->open(s_path.c_str());
+      if (f) {
+        indexUpTo(f, target < 0 ? PLAYLIST_MAX_ENTRIES : target);  // Wrapping back needs the last entry
+        f.close();
+      }
+    }
+    const int n = s_offs.size();
+    if (n > 0) s_selected = (target % n + n) % n;
+  }
+  unlock();
+}
+
+int rows(const TrackLibrary& tracks, int first, int count, Row* out) {
+  if (count > BROWSE_VISIBLE_ROWS) count = BROWSE_VISIBLE_ROWS;
+  lock();
+  int n = 0;
+  if (s_path.length() && first >= 0) {
+    checkLibrary(tracks);
+    if (s_rowsFirst != first || s_rowsCount != count) {
+      File f = s_fs->open(s_path.c_str());
+      s_rowsFirst = first;
+      s_rowsCount = 0;
+      if (f) {
+        indexUpTo(f, first + count - 1);
+        while (s_rowsCount < count && first + s_rowsCount < (int)s_offs.size()) {
+          resolve(f, tracks, first + s_rowsCount, &s_rowNames[s_rowsCount]);
+          s_rowsCount++;
+        }
+        f.close();
+      }
+    }
+    for (; n < s_rowsCount; n++) {
+      out[n].name = s_rowNames[n];
+      out[n].track = s_tracks[first + n];
+    }
+  }
+  unlock();
+  return n;
+}
+
+int play(const TrackLibrary& tracks) {
+  lock();
+  int track = -1;
+  if (s_path.length() && s_selected < (int)s_offs.size()) {
+    checkLibrary(tracks);
+    File f = s_fs->open(s_path.c_str());
+    if (f) {
+      track = resolve(f, tracks, s_selected);
+      f.close();
+    }
+    if (track >= 0) {
+      s_active = true;
+      s_position = s_selected;
+    }
+  }
+  unlock();
+  return track;
+}
+
+void stop() {
+  s_active = false;
+}
+
+bool active() {
+  return s_active;
+}
+
+int position() {
+  return s_position;
+}
+
+int next(const TrackLibrary& tracks, int step, bool shuffle) {
+  lock();
+  int track = -1;
+  File f;
+  if (s_active) f = s_fs->open(s_path.c_str());
+  if (f) {
+    checkLibrary(tracks);
+    // Runs at the end of a track on Task_Audio: at most PLAYLIST_RESOLVE_PER_CALL library lookups, pump() has
+    // usually resolved the entry already. If the budget runs out the position stays, the next call goes on.
+    int budget = PLAYLIST_RESOLVE_PER_CALL;
+    if (shuffle) {
+      const int t = shuffleStep(f, tracks, step, budget);
+      if (t >= 0) track = t;
+    } else {
+      int entry = s_position;
+      for (int tries = 0; tries < (int)s_offs.size() && track < 0; tries++) {
+        entry += step;
+        if (entry < 0) {
+          indexUpTo(f, PLAYLIST_MAX_ENTRIES);  // Wrapping back needs the last entry
+          entry = s_offs.size() - 1;
+        }
+        indexUpTo(f, entry);
+        if (entry >= (int)s_offs.size()) entry = 0;
+        const int t = resolveWithin(f, tracks, entry, budget);
+        if (t == UNRESOLVED) break;
+        if (t >= 0) {
+          track = t;
+          s_position = entry;
+        }
+      }
+    }
+    f.close();
+  }
+  unlock();
+  return track;
+}
+
+// Entry whose library lookup is due: the first unresolved one before the next entry in the library, in the
+// shuffle order if shuffle. -1 if none.
+static int dueEntry(bool shuffle) {
+  const int n = s_offs.size();
+  if (!s_active || n == 0) return -1;
+  if (shuffle) {
+    placeInOrder(s_position);
+    for (int pos = s_cursor + 1; pos < n; pos++) {
+      if (s_tracks[s_order[pos]] == UNRESOLVED) return s_order[pos];
+      if (s_tracks[s_order[pos]] >= 0) break;
+    }
+    return -1;
+  }
+  for (int i = 1; i < n; i++) {
+    int entry = s_position + i;
+    if (entry >= n) {
+      if (!s_complete) break;
+      entry -= n;
+    }
+    if (s_tracks[entry] == UNRESOLVED) return entry;
+    if (s_tracks[entry] >= 0) break;
+  }
+  return -1;
+}
+
+void pump(const TrackLibrary& tracks, bool shuffle) {
+  lock();
+  if (s_path.length()) {
+    checkLibrary(tracks);
+    const int due = dueEntry(shuffle);
+    if (due >= 0 || !s_complete) {
+      File f = s_fs->open(s_path.c_str());
+      if (f) {
+        if (due >= 0) resolve(f, tracks, due);
+        else indexChunk(f);
+        f.close();
+      }
+    }
+  }
+  unlock();
+}
+
+}  // namespace Playlist
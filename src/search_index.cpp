@@ -0,0 +1,510 @@
+#include "../include/search_index.hpp"
+#include "../include/browse_index.hpp"
+#include "../include/config.hpp"
+#include "../include/memory_budget.hpp"
+#include "../include/metadata_db.hpp"
+#include <algorithm>
+#include <new>
+#include <vector>
+
+namespace SearchIndex {
+
+// File layout: path hash of every track (u32), postings (u16 track indexes, sorted per key), the key table
+// (KEY_SLOTS + 1 u32 offsets into the postings) and the Trailer. Keys are dense slots: letters and digits
+// map to 1..36 (0 = none), so no key needs hashing or searching.
+struct Trailer {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t reserved;
+  uint32_t fingerprint;   // Of the library the index was built from
+  uint32_t trackCount;
+  uint32_t postOff;
+  uint32_t postCount;
+  uint32_t tableOff;
+};
+static constexpr uint32_t FILE_MAGIC = 0x48435253;  // "SRCH"
+static constexpr uint16_t FILE_VERSION = 1;
+static constexpr const char* TMP_FILE = "/.mp3adv/search.tmp";
+static constexpr const char* TABLE_TMP_FILE = "/.mp3adv/search.tbl";
+static constexpr const char* TEXT_TMP_FILE = "/.mp3adv/search.txt";
+
+static constexpr uint32_t SYMBOLS = 37;
+static constexpr uint32_t PREFIX_SLOTS = SYMBOLS * SYMBOLS;        // First one or two letters of a word
+static constexpr uint32_t KEY_SLOTS = PREFIX_SLOTS + SYMBOLS * SYMBOLS * SYMBOLS;  // Then the trigrams
+static constexpr uint32_t COUNT_BUCKET = 64;                       // Key slots per counter of the pass planning
+static constexpr size_t TEXT_MAX = 255;                            // Folded bytes kept of title + artist
+static constexpr size_t CHUNK = 256;                               // Postings read per SD access
+
+// ---- Text and keys ----
+
+static uint8_t symbol(char c) {
+  if (c >= 'a' && c <= 'z') return c - 'a' + 1;
+  if (c >= '0' && c <= '9') return c - '0' + 27;
+  return 0;
+}
+
+static uint32_t prefixKey(uint8_t a, uint8_t b) {
+  return a * SYMBOLS + b;
+}
+
+static uint32_t trigramKey(uint8_t a, uint8_t b, uint8_t c) {
+  return PREFIX_SLOTS + (a * SYMBOLS + b) * SYMBOLS + c;
+}
+
+// Lower case ASCII words separated by single spaces; other characters end a word
+static void foldText(const char* text, String& out) {
+  const uint8_t* p = (const uint8_t*)text;
+  while (*p && out.length() < TEXT_MAX) {
+    uint32_t cp = BrowseIndex::foldCodepoint(BrowseIndex::nextCodepoint(p));
+    if (cp < 0x80 && symbol((char)cp)) {
+      out += (char)cp;
+    } else if (out.length() && out[out.length() - 1] != ' ') {
+      out += ' ';
+    }
+  }
+}
+
+// Keys of every word in folded text (repeats included)
+template <typename Fn>
+static void forEachKey(const char* text, Fn fn) {
+  const char* w = text;
+  while (*w) {
+    while (*w == ' ') w++;
+    const char* end = w;
+    while (*end && *end != ' ') end++;
+    const int n = end - w;
+    if (n > 0) {
+      fn(prefixKey(symbol(w[0]), 0));
+      if (n > 1) fn(prefixKey(symbol(w[0]), symbol(w[1])));
+      for (int i = 0; i + 2 < n; i++) fn(trigramKey(symbol(w[i]), symbol(w[i + 1]), symbol(w[i + 2])));
+    }
+    w = end;
+  }
+}
+
+// File name without extension, folded
+static String fileText(const TrackLibrary& tracks, int index) {
+  String name = tracks.name(index);
+  int dot = name.lastIndexOf('.');
+  if (dot > 0) name = name.substring(0, dot);
+  String out;
+  foldText(name.c_str(), out);
+  return out;
+}
+
+// Keys of every track: the tag text from TEXT_TMP_FILE, then the file names
+template <typename Fn>
+static void forEachTrackKey(fs::FS& fs, const TrackLibrary& tracks, Fn fn) {
+  File f = fs.open(TEXT_TMP_FILE);
+  if (f) {
+    char text[TEXT_MAX + 1];
+    uint8_t hdr[3];
+    while (f.read(hdr, sizeof(hdr)) == sizeof(hdr)) {
+      const uint16_t track = hdr[0] | hdr[1] << 8;
+      if (f.read((uint8_t*)text, hdr[2]) != hdr[2]) break;
+      text[hdr[2]] = '\0';
+      forEachKey(text, [&](uint32_t key) { fn(key, track); });
+    }
+    f.close();
+  }
+  for (int i = 0; i < tracks.count(); i++) {
+    const String text = fileText(tracks, i);
+    forEachKey(text.c_str(), [&](uint32_t key) { fn(key, (uint16_t)i); });
+  }
+}
+
+// ---- Build ----
+
+static bool readTrailer(fs::FS& fs, Trailer& t) {
+  if (!fs.exists(SEARCH_INDEX_FILE)) return false;
+  File f = fs.open(SEARCH_INDEX_FILE);
+  if (!f) return false;
+  const uint32_t size = f.size();
+  bool ok = size >= sizeof(t) && f.seek(size - sizeof(t)) && f.read((uint8_t*)&t, sizeof(t)) == sizeof(t) &&
+            t.magic == FILE_MAGIC && t.version == FILE_VERSION &&
+            t.tableOff + (KEY_SLOTS + 1) * sizeof(uint32_t) + sizeof(t) == size;
+  f.close();
+  return ok;
+}
+
+// Build data grows with the library: charged to the TrackList pool, a build that does not fit gives up
+template <typename T>
+using BuildVector = MemoryBudget::Vector<T, MemoryBudget::Pool::TrackList>;
+
+// Title and artist of the tracks with a record, folded, as {u16 track, u8 length, text}
+static bool writeTagText(fs::FS& fs, const BuildVector<uint32_t>& pathHashes) {
+  BuildVector<uint32_t> byHash(pathHashes.size());
+  for (uint32_t i = 0; i < byHash.size(); i++) byHash[i] = i;
+  std::sort(byHash.begin(), byHash.end(), [&](uint32_t a, uint32_t b) { return pathHashes[a] < pathHashes[b]; });
+  File f = fs.open(TEXT_TMP_FILE, FILE_WRITE);
+  if (!f) return false;
+  bool ok = true;
+  MetadataDb::forEach(fs, [&](uint32_t pathHash, const MetadataDb::Info& info) {
+    auto it = std::lower_bound(byHash.begin(), byHash.end(), pathHash,
+                               [&](uint32_t track, uint32_t h) { return pathHashes[track] < h; });
+    if (it == byHash.end() || pathHashes[*it] != pathHash) return;
+    String text;
+    foldText(info.title.c_str(), text);
+    if (text.length() && text.length() < TEXT_MAX && text[text.length() - 1] != ' ') text += ' ';
+    foldText(info.artist.c_str(), text);
+    for (; it != byHash.end() && pathHashes[*it] == pathHash; ++it) {
+      const uint8_t hdr[3] = {(uint8_t)*it, (uint8_t)(*it >> 8), (uint8_t)text.length()};
+      ok = ok && f.write(hdr, sizeof(hdr)) == sizeof(hdr) &&
+           f.write((const uint8_t*)text.c_str(), hdr[2]) == hdr[2];
+    }
+  });
+  f.close();
+  return ok;
+}
+
+static bool copyFile(fs::FS& fs, const char* from, File& to) {
+  File f = fs.open(from);
+  if (!f) return false;
+  uint8_t buf[512];
+  bool ok = true;
+  int n;
+  while (ok && (n = f.read(buf, sizeof(buf))) > 0) ok = to.write(buf, n) == (size_t)n;
+  f.close();
+  return ok;
+}
+
+static SemaphoreHandle_t s_mutex = xSemaphoreCreateMutex();  // The build replaces the file while the page reads it
+static uint32_t s_generation = 0;                              // Incremented on every rebuild
+
+static void lock() {
+  xSemaphoreTake(s_mutex, portMAX_DELAY);
+}
+
+static void unlock() {
+  xSemaphoreGive(s_mutex);
+}
+
+static bool buildIndex(fs::FS& fs, const TrackLibrary& tracks, bool force) {
+  unsigned long t0 = millis();
+  if (tracks.count() > UINT16_MAX) {
+    LOG_PRINTLN("SearchIndex: too many tracks");
+    return false;
+  }
+  BuildVector<uint32_t> pathHashes(tracks.count());
+  uint32_t fingerprint = 2166136261u;
+  for (int i = 0; i < tracks.count(); i++) {
+    pathHashes[i] = MetadataDb::hashPath(tracks.path(i).c_str());
+    for (int k = 0; k < 4; k++) {
+      fingerprint ^= (uint8_t)(pathHashes[i] >> (8 * k));
+      fingerprint *= 16777619u;
+    }
+  }
+  Trailer old;
+  if (!force && readTrailer(fs, old) && old.fingerprint == fingerprint && old.trackCount == pathHashes.size()) {
+    DEBUG_PRINTF("SearchIndex: up to date\n");
+    return true;
+  }
+
+  if (!fs.exists(APP_DATA_DIR)) fs.mkdir(APP_DATA_DIR);
+  if (!writeTagText(fs, pathHashes)) {
+    LOG_PRINTF("SearchIndex: cannot write %s\n", TEXT_TMP_FILE);
+    return false;
+  }
+
+  // Plan the passes: consecutive key ranges holding at most SEARCH_BUILD_PAIRS pairs each
+  BuildVector<uint32_t> bucketPairs((KEY_SLOTS + COUNT_BUCKET - 1) / COUNT_BUCKET, 0);
+  forEachTrackKey(fs, tracks, [&](uint32_t key, uint16_t) { bucketPairs[key / COUNT_BUCKET]++; });
+  const size_t passPairs = MemoryBudget::havePsram() ? SEARCH_BUILD_PAIRS_PSRAM : SEARCH_BUILD_PAIRS;
+
+  File out = fs.open(TMP_FILE, FILE_WRITE);
+  File table = fs.open(TABLE_TMP_FILE, FILE_WRITE);
+  Trailer t = {};
+  t.magic = FILE_MAGIC;
+  t.version = FILE_VERSION;
+  t.fingerprint = fingerprint;
+  t.trackCount = pathHashes.size();
+  t.postOff = pathHashes.size() * sizeof(uint32_t);
+  bool ok = out && table && out.write((const uint8_t*)pathHashes.data(), t.postOff) == t.postOff;
+  BuildVector<uint32_t>().swap(pathHashes);
+
+  // Each pass collects (key << 16 | track) of its key range, sorts them and writes the postings in key order
+  BuildVector<uint32_t> pairs;
+  int passes = 0;
+  for (uint32_t bucket = 0; ok && bucket < bucketPairs.size(); passes++) {
+    size_t expected = bucketPairs[bucket];
+    uint32_t end = bucket + 1;
+    while (end < bucketPairs.size() && expected + bucketPairs[end] <= passPairs) expected += bucketPairs[end++];
+    const uint32_t lo = bucket * COUNT_BUCKET;
+    const uint32_t hi = std::min(end * COUNT_BUCKET, KEY_SLOTS);
+    pairs.clear();
+    pairs.reserve(expected);
+    forEachTrackKey(fs, tracks, [&](uint32_t key, uint16_t track) {
+      if (key >= lo && key < hi) pairs.push_back(key << 16 | track);
+    });
+    std::sort(pairs.begin(), pairs.end());
+    pairs.erase(std::unique(pairs.begin(), pairs.end()), pairs.end());
+
+    size_t p = 0;
+    for (uint32_t key = lo; ok && key < hi; key++) {
+      ok = table.write((const uint8_t*)&t.postCount, sizeof(t.postCount)) == sizeof(t.postCount);
+      uint16_t chunk[CHUNK];
+      size_t n = 0;
+      for (; ok && p < pairs.size() && pairs[p] >> 16 == key; p++) {
+        chunk[n++] = (uint16_t)pairs[p];
+        t.postCount++;
+        if (n == CHUNK || p + 1 == pairs.size() || pairs[p + 1] >> 16 != key) {
+          ok = out.write((const uint8_t*)chunk, n * sizeof(uint16_t)) == n * sizeof(uint16_t);
+          n = 0;
+        }
+      }
+    }
+    bucket = end;
+    vTaskDelay(1);
+  }
+  BuildVector<uint32_t>().swap(pairs);
+  ok = ok && table.write((const uint8_t*)&t.postCount, sizeof(t.postCount)) == sizeof(t.postCount);
+  if (table) table.close();
+  t.tableOff = t.postOff + t.postCount * sizeof(uint16_t);
+  ok = ok && copyFile(fs, TABLE_TMP_FILE, out) && out.write((const uint8_t*)&t, sizeof(t)) == sizeof(t);
+  if (out) out.close();
+  fs.remove(TABLE_TMP_FILE);
+  fs.remove(TEXT_TMP_FILE);
+  if (!ok) {
+    fs.remove(TMP_FILE);
+    LOG_PRINTLN("SearchIndex: write failed");
+    return false;
+  }
+  lock();
+  fs.remove(SEARCH_INDEX_FILE);
+  fs.rename(TMP_FILE, SEARCH_INDEX_FILE);
+  s_generation++;
+  unlock();
+  LOG_PRINTF("SearchIndex: %lu postings, %d passes, %lu bytes in %lu ms\n", (unsigned long)t.postCount, passes,
+             (unsigned long)(t.tableOff + (KEY_SLOTS + 1) * sizeof(uint32_t) + sizeof(t)),
+             (unsigned long)(millis() - t0));
+  return true;
+}
+
+bool build(fs::FS& fs, const TrackLibrary& tracks, bool force) {
+  try {
+    return buildIndex(fs, tracks, force);
+  } catch (const std::bad_alloc&) {
+    // The files were closed while unwinding, the index in use stays
+    fs.remove(TMP_FILE);
+    fs.remove(TABLE_TMP_FILE);
+    fs.remove(TEXT_TMP_FILE);
+    LOG_PRINTF("SearchIndex: not enough memory for %d tracks, index not updated\n", tracks.count());
+    return false;
+  }
+}
+
+// ---- Query (Task_TFT) ----
+
+static Trailer s_trailer;
+static bool s_trailerValid = false;
+static uint32_t s_viewGeneration = UINT32_MAX;
+static String s_query;
+static std::vector<uint16_t> s_results;
+static bool s_truncated = false;
+static int s_selected = 0;
+
+// Rows resolved last, valid while the results and window stay the same
+static int s_rowTracks[BROWSE_VISIBLE_ROWS];
+static int s_rowsFirst = -1;
+static int s_rowsCount = 0;
+static uint32_t s_rowsLibrary = 0;  // TrackLibrary::generation() the track indexes belong to
+
+struct Range {
+  uint32_t start;
+  uint32_t end;
+};
+
+static bool keyRange(File& f, uint32_t key, Range& r) {
+  uint32_t offs[2];
+  if (!f.seek(s_trailer.tableOff + key * sizeof(uint32_t)) || f.read((uint8_t*)offs, sizeof(offs)) != sizeof(offs)) {
+    return false;
+  }
+  r.start = offs[0];
+  r.end = offs[1];
+  return r.start <= r.end && r.end <= s_trailer.postCount;
+}
+
+// Keep the results that are also in the postings of r (both sorted)
+static bool intersect(File& f, const Range& r) {
+  if (!f.seek(s_trailer.postOff + r.start * sizeof(uint16_t))) return false;
+  uint16_t chunk[CHUNK];
+  size_t kept = 0;
+  size_t i = 0;
+  for (uint32_t pos = r.start; pos < r.end && i < s_results.size();) {
+    const size_t n = std::min((size_t)(r.end - pos), CHUNK);
+    if (f.read((uint8_t*)chunk, n * sizeof(uint16_t)) != n * sizeof(uint16_t)) return false;
+    pos += n;
+    for (size_t k = 0; k < n && i < s_results.size(); k++) {
+      while (i < s_results.size() && s_results[i] < chunk[k]) i++;
+      if (i < s_results.size() && s_results[i] == chunk[k]) s_results[kept++] = s_results[i++];
+    }
+  }
+  s_results.resize(kept);
+  return true;
+}
+
+// Key added by the last character of the query; false if it adds none (space, first letter after a space)
+static bool lastKey(const String& q, uint32_t& key) {
+  const int n = q.length();
+  int start = q.lastIndexOf(' ') + 1;
+  const int len = n - start;
+  if (len <= 0) return false;
+  const char* w = q.c_str() + start;
+  if (len == 1) key = prefixKey(symbol(w[0]), 0);
+  else if (len == 2) key = prefixKey(symbol(w[0]), symbol(w[1]));
+  else key = trigramKey(symbol(w[len - 3]), symbol(w[len - 2]), symbol(w[len - 1]));
+  return true;
+}
+
+// Run the whole query: the shortest postings list first, then the others merged against it
+static void evaluate(fs::FS& fs) {
+  s_results.clear();
+  s_truncated = false;
+  std::vector<uint32_t> keys;
+  forEachKey(s_query.c_str(), [&](uint32_t key) {
+    if (key >= PREFIX_SLOTS || key % SYMBOLS != 0) keys.push_back(key);  // A two letter prefix covers the one letter one
+  });
+  for (int start = 0; start < (int)s_query.length();) {  // Single letter terms only have the one letter prefix
+    int end = s_query.indexOf(' ', start);
+    if (end < 0) end = s_query.length();
+    if (end - start == 1) keys.push_back(prefixKey(symbol(s_query[start]), 0));
+    start = end + 1;
+  }
+  if (!s_trailerValid || keys.empty()) return;
+  std::sort(keys.begin(), keys.end());
+  keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+  lock();
+  File f = fs.open(SEARCH_INDEX_FILE);
+  std::vector<Range> ranges(keys.size());
+  bool ok = (bool)f;
+  for (size_t i = 0; ok && i < keys.size(); i++) ok = keyRange(f, keys[i], ranges[i]);
+  if (ok) {
+    std::sort(ranges.begin(), ranges.end(),
+              [](const Range& a, const Range& b) { return a.end - a.start < b.end - b.start; });
+    const uint32_t n = std::min(ranges[0].end - ranges[0].start, (uint32_t)SEARCH_MAX_RESULTS);
+    s_truncated = ranges[0].end - ranges[0].start > n;
+    s_results.resize(n);
+    ok = f.seek(s_trailer.postOff + ranges[0].start * sizeof(uint16_t)) &&
+         f.read((uint8_t*)s_results.data(), n * sizeof(uint16_t)) == n * sizeof(uint16_t);
+    for (size_t i = 1; ok && i < ranges.size() && !s_results.empty(); i++) ok = intersect(f, ranges[i]);
+  }
+  if (f) f.close();
+  unlock();
+  if (!ok) s_results.clear();
+}
+
+static void resultsChanged() {
+  s_selected = 0;
+  s_rowsFirst = -1;
+}
+
+void refresh(fs::FS& fs) {
+  if (s_viewGeneration == s_generation) return;
+  lock();
+  s_viewGeneration = s_generation;
+  s_trailerValid = readTrailer(fs, s_trailer);
+  unlock();
+  evaluate(fs);
+  resultsChanged();
+}
+
+bool ready() {
+  return s_trailerValid;
+}
+
+void clear() {
+  s_query = "";
+  s_results.clear();
+  s_truncated = false;
+  resultsChanged();
+}
+
+void type(fs::FS& fs, char c) {
+  if (c >= 'A' && c <= 'Z') c += 'a' - 'A';
+  if (!symbol(c) && c != ' ') return;
+  if (c == ' ' && (s_query.length() == 0 || s_query[s_query.length() - 1] == ' ')) return;
+  if (s_query.length() >= SEARCH_QUERY_MAX) return;
+  unsigned long t0 = millis();
+  const bool first = s_query.length() == 0;
+  s_query += c;
+  uint32_t key;
+  if (!lastKey(s_query, key)) return;
+  if (first || s_truncated) {
+    evaluate(fs);  // A truncated list is not a complete candidate set
+  } else {
+    // Each letter only narrows the results: merge them with the postings of its key
+    Range r;
+    lock();
+    File f = fs.open(SEARCH_INDEX_FILE);
+    bool ok = s_trailerValid && f && keyRange(f, key, r) && intersect(f, r);
+    if (f) f.close();
+    unlock();
+    if (!ok) s_results.clear();
+  }
+  resultsChanged();
+  DEBUG_PRINTF("SearchIndex: '%s' %u results in %lu ms\n", s_query.c_str(), (unsigned)s_results.size(),
+               (unsigned long)(millis() - t0));
+}
+
+void erase(fs::FS& fs) {
+  if (s_query.length() == 0) return;
+  s_query.remove(s_query.length() - 1);
+  evaluate(fs);
+  resultsChanged();
+}
+
+const String& query() {
+  return s_query;
+}
+
+int resultCount() {
+  return s_results.size();
+}
+
+bool truncated() {
+  return s_truncated;
+}
+
+int selected() {
+  return s_selected;
+}
+
+void move(int delta) {
+  const int n = s_results.size();
+  if (n == 0) return;
+  s_selected = ((s_selected + delta) % n + n) % n;
+}
+
+// Library index of a result; tracks deleted since the build move the following ones down
+static int resolve(File& f, const TrackLibrary& tracks, uint16_t track) {
+  uint32_t pathHash;
+  if (!f.seek(track * sizeof(uint32_t)) || f.read((uint8_t*)&pathHash, sizeof(pathHash)) != sizeof(pathHash)) {
+    return -1;
+  }
+  for (int k = 0; k <= BROWSE_RESOLVE_WINDOW && (int)track - k >= 0; k++) {
+    int i = (int)track - k;
+    if (i < tracks.count() && MetadataDb::hashPath(tracks.path(i).c_str()) == pathHash) return i;
+  }
+  return -1;
+}
+
+int rows(fs::FS& fs, const TrackLibrary& tracks, int first, int count, int* out) {
+  refresh(fs);
+  count = std::min(count, std::min((int)BROWSE_VISIBLE_ROWS, (int)s_results.size() - first));
+  if (first < 0 || count <= 0) return 0;
+  if (s_rowsFirst != first || s_rowsCount != count || s_rowsLibrary != tracks.generation()) {
+    s_rowsFirst = first;
+    s_rowsLibrary = tracks.generation();
+    s_rowsCount = count;
+    lock();
+    File f = fs.open(SEARCH_INDEX_FILE);
+    for (int i = 0; i < count; i++) s_rowTracks[i] = f ? resolve(f, tracks, s_results[first + i]) : -1;
+    if (f) f.close();
+    unlock();
+  }
+  for (int i = 0; i < count; i++) out[i] = s_rowTracks[i];
+  return count;
+}
+
+}  // namespace SearchIndex
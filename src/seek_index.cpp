@@ -0,0 +1,380 @@
+#include "../include/seek_index.hpp"
+#include "../include/config.hpp"
+#include <cstdio>
+#include <cstring>
+
+namespace SeekIndex {
+
+// Store layout: StoreHeader, then appended records (RecordHeader + `count` little-endian uint32 offsets).
+// A later record for the same path supersedes an earlier one.
+struct StoreHeader {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t reserved;
+};
+struct RecordHeader {
+  uint32_t pathHash;
+  uint32_t fileSize;
+  uint32_t mtime;
+  uint32_t durationMs;
+  uint32_t audioDataStart;
+  uint32_t intervalUs;
+  uint16_t encoderDelay;
+  uint16_t encoderPadding;
+  uint16_t count;
+  uint16_t reserved;
+};
+static constexpr uint32_t STORE_MAGIC = 0x58444953;  // "SIDX"
+static constexpr uint16_t STORE_VERSION = 2;
+static constexpr const char* STORE_TMP_FILE = "/.mp3adv/index.tmp";
+
+// In-memory directory of the live records, read once from the store
+struct DirEntry {
+  uint32_t pathHash;
+  uint32_t fileSize;
+  uint32_t mtime;
+  uint32_t audioDataStart;  // A record built for another tag size is replaced, see save()
+  uint32_t recordPos;
+  uint32_t recordSize;
+};
+static std::vector<DirEntry> s_dir;
+static bool s_dirLoaded = false;
+static uint32_t s_staleBytes = 0;     // Superseded or unreadable records in the store
+
+// Background build state
+static TaskHandle_t s_task = nullptr;
+static volatile bool s_cancel = false;
+static fs::FS* s_fs = nullptr;
+static char s_path[256];
+static FileKey s_key;
+static uint32_t s_audioDataStart = 0;
+static SemaphoreHandle_t s_mutex = nullptr;  // Guards the store and the result, both tasks use them
+static bool s_resultReady = false;
+static char s_resultPath[256];
+static Index s_result;
+
+static uint32_t hashPath(const char* path) {
+  // FNV-1a
+  uint32_t h = 2166136261u;
+  while (*path) {
+    h ^= (uint8_t)*path++;
+    h *= 16777619u;
+  }
+  return h;
+}
+
+static void lock() {
+  if (!s_mutex) s_mutex = xSemaphoreCreateMutex();
+  xSemaphoreTake(s_mutex, portMAX_DELAY);
+}
+
+static void unlock() {
+  xSemaphoreGive(s_mutex);
+}
+
+static DirEntry* findEntry(uint32_t pathHash) {
+  for (auto& e : s_dir) {
+    if (e.pathHash == pathHash) return &e;
+  }
+  return nullptr;
+}
+
+static void addEntry(const DirEntry& entry) {
+  DirEntry* old = findEntry(entry.pathHash);
+  if (old) {
+    s_staleBytes += old->recordSize;
+    *old = entry;
+  } else {
+    s_dir.push_back(entry);
+  }
+}
+
+static void loadDirectory(fs::FS& fs) {
+  if (s_dirLoaded) return;
+  s_dirLoaded = true;
+  s_dir.clear();
+  s_staleBytes = 0;
+  if (!fs.exists(SEEK_INDEX_FILE)) return;
+  File f = fs.open(SEEK_INDEX_FILE);
+  if (!f) return;
+
+  const uint32_t size = f.size();
+  StoreHeader hdr;
+  if (f.read((uint8_t*)&hdr, sizeof(hdr)) != sizeof(hdr) || hdr.magic != STORE_MAGIC || hdr.version != STORE_VERSION) {
+    f.close();
+    LOG_PRINTLN("SeekIndex: store has an unknown format, recreating");
+    fs.remove(SEEK_INDEX_FILE);
+    return;
+  }
+  uint32_t pos = sizeof(hdr);
+  while (pos + sizeof(RecordHeader) <= size) {
+    RecordHeader rec;
+    f.seek(pos);
+    if (f.read((uint8_t*)&rec, sizeof(rec)) != sizeof(rec)) break;
+    uint32_t recordSize = sizeof(rec) + rec.count * sizeof(uint32_t);
+    if (rec.count == 0 || rec.count > SEEK_INDEX_MAX_POINTS || pos + recordSize > size) break;
+    addEntry({rec.pathHash, rec.fileSize, rec.mtime, rec.audioDataStart, pos, recordSize});
+    pos += recordSize;
+  }
+  s_staleBytes += size - pos;  // Truncated tail (power loss while appending)
+  f.close();
+  DEBUG_PRINTF("SeekIndex: %u records, %lu bytes stale\n", (unsigned)s_dir.size(), (unsigned long)s_staleBytes);
+}
+
+// Rewrite the store with the live records only
+static void compact(fs::FS& fs) {
+  File src = fs.open(SEEK_INDEX_FILE);
+  File dst = fs.open(STORE_TMP_FILE, FILE_WRITE);
+  if (!src || !dst) {
+    if (src) src.close();
+    if (dst) dst.close();
+    return;
+  }
+  StoreHeader hdr = {STORE_MAGIC, STORE_VERSION, 0};
+  dst.write((const uint8_t*)&hdr, sizeof(hdr));
+  uint32_t pos = sizeof(hdr);
+  uint8_t buf[512];
+  bool ok = true;
+  for (auto& e : s_dir) {
+    src.seek(e.recordPos);
+    uint32_t remaining = e.recordSize;
+    while (remaining && ok) {
+      size_t n = min((uint32_t)sizeof(buf), remaining);
+      ok = src.read(buf, n) == n && dst.write(buf, n) == n;
+      remaining -= n;
+    }
+    e.recordPos = pos;
+    pos += e.recordSize;
+  }
+  src.close();
+  dst.close();
+  if (!ok) {
+    fs.remove(STORE_TMP_FILE);
+    s_dirLoaded = false;  // Positions were updated, read the old store again
+    return;
+  }
+  fs.remove(SEEK_INDEX_FILE);
+  fs.rename(STORE_TMP_FILE, SEEK_INDEX_FILE);
+  LOG_PRINTF("SeekIndex: store compacted, %lu bytes dropped\n", (unsigned long)s_staleBytes);
+  s_staleBytes = 0;
+}
+
+bool stat(fs::FS& fs, const char* path, FileKey& key) {
+  File f = fs.open(path);
+  if (!f) return false;
+  key.size = f.size();
+  key.mtime = (uint32_t)f.getLastWrite();
+  f.close();
+  return true;
+}
+
+uint32_t parseFrameHeader(const uint8_t* h, uint16_t& samplesPerFrame, uint32_t& sampleRate) {
+  static const uint16_t bitratesV1[15] = {0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320};
+  static const uint16_t bitratesV2[15] = {0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160};
+  static const uint16_t sampleRates[4][3] = {{11025, 12000, 8000}, {0, 0, 0}, {22050, 24000, 16000}, {44100, 48000, 32000}};
+
+  if (h[0] != 0xFF || (h[1] & 0xE0) != 0xE0) return 0;
+  uint8_t version = (h[1] >> 3) & 3;
+  uint8_t layer = (h[1] >> 1) & 3;
+  uint8_t brIdx = h[2] >> 4;
+  uint8_t srIdx = (h[2] >> 2) & 3;
+  uint8_t padding = (h[2] >> 1) & 1;
+  if (version == 1 || layer != 1 || brIdx == 0 || brIdx == 15 || srIdx == 3) return 0;  // Layer III only, no free format
+
+  sampleRate = sampleRates[version][srIdx];
+  uint32_t bitrate = (version == 3 ? bitratesV1[brIdx] : bitratesV2[brIdx]) * 1000;
+  samplesPerFrame = (version == 3) ? 1152 : 576;
+  return (samplesPerFrame / 8) * bitrate / sampleRate + padding;
+}
+
+bool buildMp3(fs::FS& fs, const char* path, uint32_t audioDataStart, Index& out, volatile bool* cancel) {
+  out = Index();
+  out.audioDataStart = audioDataStart;
+  File f = fs.open(path);
+  if (!f) return false;
+  const uint32_t fileSize = f.size();
+
+  uint8_t* buf = (uint8_t*)malloc(SEEK_INDEX_READ_SIZE);
+  if (!buf) {
+    f.close();
+    return false;
+  }
+
+  uint32_t pos = audioDataStart;  // File position of the next header to parse
+  uint32_t firstRate = 0;
+  uint16_t spf = 0;
+  uint32_t framesPerPoint = 0;
+  uint32_t frame = 0;
+  bool ok = true;
+
+  while (pos + 4 <= fileSize) {
+    if (cancel && *cancel) { ok = false; break; }
+    f.seek(pos);
+    size_t rd = f.read(buf, SEEK_INDEX_READ_SIZE);
+    if (rd < 4) break;
+    if (rd >= 3 && buf[0] == 'T' && buf[1] == 'A' && buf[2] == 'G') break;  // ID3v1 tag at the end
+
+    size_t i = 0;
+    while (i + 4 <= rd) {
+      uint16_t frameSpf = 0;
+      uint32_t rate = 0;
+      uint32_t len = parseFrameHeader(buf + i, frameSpf, rate);
+      if (len == 0 || (firstRate && rate != firstRate)) {
+        i++;  // Resync: junk or a false sync inside audio data
+        continue;
+      }
+      if (!firstRate) {
+        firstRate = rate;
+        spf = frameSpf;
+        framesPerPoint = rate / spf;  // ~1 second
+        if (framesPerPoint == 0) framesPerPoint = 1;
+      }
+      if (frame % framesPerPoint == 0) {
+        if (out.offsets.size() >= SEEK_INDEX_MAX_POINTS) {
+          // Keep every second point and double the interval
+          for (size_t k = 0; k < out.offsets.size() / 2; k++) out.offsets[k] = out.offsets[2 * k];
+          out.offsets.resize(out.offsets.size() / 2);
+          framesPerPoint *= 2;
+        }
+        if (frame % framesPerPoint == 0) out.offsets.push_back(pos + i - audioDataStart);
+      }
+      frame++;
+      i += len;
+    }
+    pos += i;
+    vTaskDelay(1);  // Leave the SPI bus to the audio task between reads
+  }
+
+  free(buf);
+  f.close();
+  if (!ok || !firstRate || out.offsets.empty()) {
+    out = Index();
+    return false;
+  }
+  out.intervalUs = (uint32_t)((uint64_t)framesPerPoint * spf * 1000000 / firstRate);
+  out.durationMs = (uint32_t)((uint64_t)frame * spf * 1000 / firstRate);
+  LOG_PRINTF("SeekIndex: %s frames=%lu duration=%lums points=%u\n", path, (unsigned long)frame,
+             (unsigned long)out.durationMs, (unsigned)out.offsets.size());
+  return true;
+}
+
+bool load(fs::FS& fs, const char* path, const FileKey& key, Index& out) {
+  const uint32_t pathHash = hashPath(path);
+  lock();
+  loadDirectory(fs);
+  DirEntry* e = findEntry(pathHash);
+  bool ok = e && e->fileSize == key.size && e->mtime == key.mtime;
+  if (ok) {
+    File f = fs.open(SEEK_INDEX_FILE);
+    RecordHeader rec;
+    ok = f && f.seek(e->recordPos) && f.read((uint8_t*)&rec, sizeof(rec)) == sizeof(rec) &&
+         rec.pathHash == pathHash && rec.count > 0 && rec.intervalUs > 0;
+    if (ok) {
+      out.durationMs = rec.durationMs;
+      out.audioDataStart = rec.audioDataStart;
+      out.encoderDelay = rec.encoderDelay;
+      out.encoderPadding = rec.encoderPadding;
+      out.intervalUs = rec.intervalUs;
+      out.offsets.resize(rec.count);
+      size_t bytes = rec.count * sizeof(uint32_t);
+      ok = f.read((uint8_t*)out.offsets.data(), bytes) == bytes;
+    }
+    if (f) f.close();
+  }
+  unlock();
+  if (!ok) out = Index();
+  return ok;
+}
+
+bool save(fs::FS& fs, const char* path, const FileKey& key, const Index& index) {
+  if (index.offsets.empty() || index.offsets.size() > SEEK_INDEX_MAX_POINTS) return false;
+  const uint32_t pathHash = hashPath(path);
+  lock();
+  loadDirectory(fs);
+  DirEntry* e = findEntry(pathHash);
+  if (e && e->fileSize == key.size && e->mtime == key.mtime && e->audioDataStart == index.audioDataStart) {
+    unlock();
+    return true;  // Already stored
+  }
+
+  if (!fs.exists(APP_DATA_DIR)) fs.mkdir(APP_DATA_DIR);
+  bool created = !fs.exists(SEEK_INDEX_FILE);
+  File f = fs.open(SEEK_INDEX_FILE, FILE_APPEND);
+  if (!f) {
+    unlock();
+    LOG_PRINTF("SeekIndex: failed to open %s\n", SEEK_INDEX_FILE);
+    return false;
+  }
+  if (created) {
+    StoreHeader hdr = {STORE_MAGIC, STORE_VERSION, 0};
+    f.write((const uint8_t*)&hdr, sizeof(hdr));
+  }
+  RecordHeader rec = {pathHash, key.size, key.mtime, index.durationMs, index.audioDataStart, index.intervalUs,
+                      index.encoderDelay, index.encoderPadding, (uint16_t)index.offsets.size(), 0};
+  uint32_t pos = f.size();
+  uint32_t recordSize = sizeof(rec) + index.offsets.size() * sizeof(uint32_t);
+  bool ok = f.write((const uint8_t*)&rec, sizeof(rec)) == sizeof(rec);
+  ok = ok && f.write((const uint8_t*)index.offsets.data(), recordSize - sizeof(rec)) == recordSize - sizeof(rec);
+  f.close();
+  if (ok) {
+    addEntry({pathHash, key.size, key.mtime, index.audioDataStart, pos, recordSize});
+    if (s_staleBytes >= SEEK_INDEX_COMPACT_BYTES) compact(fs);
+  } else {
+    s_dirLoaded = false;  // Re-read, the partial record is counted as stale
+  }
+  unlock();
+  return ok;
+}
+
+static void buildTask(void* pvParameters) {
+  Index idx;
+  if (buildMp3(*s_fs, s_path, s_audioDataStart, idx, &s_cancel)) {
+    save(*s_fs, s_path, s_key, idx);
+    lock();
+    s_result = std::move(idx);
+    strcpy(s_resultPath, s_path);
+    s_resultReady = true;
+    unlock();
+  }
+  s_task = nullptr;
+  vTaskDelete(NULL);
+}
+
+bool startBuild(fs::FS& fs, const char* path, const FileKey& key, uint32_t audioDataStart) {
+  if (s_task) {
+    s_cancel = true;  // Finish the old build first, caller retries
+    return false;
+  }
+  if (strlen(path) >= sizeof(s_path)) return false;
+  if (!s_mutex) s_mutex = xSemaphoreCreateMutex();
+  s_fs = &fs;
+  strcpy(s_path, path);
+  s_key = key;
+  s_audioDataStart = audioDataStart;
+  s_cancel = false;
+  return xTaskCreatePinnedToCore(buildTask, "SeekIndex", SEEK_INDEX_TASK_STACK, NULL,
+                                 SEEK_INDEX_TASK_PRIORITY, &s_task, 0) == pdPASS;
+}
+
+void cancelBuild() {
+  if (s_task) s_cancel = true;
+}
+
+bool isBuilding() {
+  return s_task != nullptr;
+}
+
+bool takeResult(const char* path, Index& out) {
+  if (!s_mutex) return false;
+  bool ok = false;
+  lock();
+  if (s_resultReady && strcmp(s_resultPath, path) == 0) {
+    out = std::move(s_result);
+    ok = true;
+  }
+  s_resultReady = false;
+  unlock();
+  return ok;
+}
+
+}  // namespace SeekIndex
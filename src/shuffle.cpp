@@ -0,0 +1,293 @@
+#include "../include/shuffle.hpp"
+#include "../include/config.hpp"
+#include "../include/memory_budget.hpp"
+#include <esp_rom_crc.h>
+#include <algorithm>
+#include <vector>
+
+namespace Shuffle {
+
+// File layout: FileHeader, count x Slot, CRC-32 of everything before it
+struct FileHeader {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t reserved;
+  uint32_t count;
+  uint32_t slots;   // Library slots (tombstones included) the order was made for
+};
+static constexpr uint32_t SHUFFLE_MAGIC = 0x46554853;  // "SHUF"
+static constexpr uint16_t SHUFFLE_VERSION = 2;
+static constexpr const char* TMP_FILE = "/.mp3adv/shuffle.tmp";
+
+using Slot = uint16_t;
+static_assert(MAX_FILES <= 0xFFFF, "Shuffle slots hold a track index in 16 bits");
+
+static constexpr int NONE = -1;     // Nothing played from this order yet
+static constexpr int RESTORE = -2;  // Loaded from the card: the cursor is where the resumed track is
+
+static fs::FS* s_fs = nullptr;
+static Slot* s_order = nullptr;     // Played tracks up to s_cursor, then the tracks still to come
+static int s_count = 0;
+static int s_cap = 0;               // Entries allocated (and charged to the TrackList pool)
+static int s_slots = 0;             // tracks.count() followed so far; deleted tracks have no entry
+static int s_cursor = NONE;
+static bool s_loaded = false;       // SHUFFLE_FILE was read (or there was none)
+static bool s_dirty = false;
+static unsigned long s_lastSave = 0;
+static SemaphoreHandle_t s_mutex = xSemaphoreCreateMutex();  // Task_TFT, Task_Audio and the main loop
+
+static void lock() {
+  xSemaphoreTake(s_mutex, portMAX_DELAY);
+}
+
+static void unlock() {
+  xSemaphoreGive(s_mutex);
+}
+
+static bool reserve(int count) {
+  if (count <= s_cap) return true;
+  Slot* p = (Slot*)MemoryBudget::reallocate(MemoryBudget::Pool::TrackList, s_order, s_cap * sizeof(Slot),
+                                            count * sizeof(Slot));
+  if (!p) {
+    LOG_PRINTF("Shuffle: no memory for %d tracks\n", count);
+    return false;
+  }
+  s_order = p;
+  s_cap = count;
+  return true;
+}
+
+static void drop() {
+  MemoryBudget::deallocate(MemoryBudget::Pool::TrackList, s_order, s_cap * sizeof(Slot));
+  s_order = nullptr;
+  s_count = 0;
+  s_cap = 0;
+  s_slots = 0;
+  s_cursor = NONE;
+}
+
+// Fisher-Yates over positions [from, to)
+static void shuffleRange(int from, int to) {
+  for (int i = to - 1; i > from; i--) {
+    int j = random(from, i + 1);
+    Slot t = s_order[i];
+    s_order[i] = s_order[j];
+    s_order[j] = t;
+  }
+}
+
+static int find(int track) {
+  for (int i = 0; i < s_count; i++) {
+    if (s_order[i] == track) return i;
+  }
+  return -1;
+}
+
+static void load() {
+  File f = s_fs->open(SHUFFLE_FILE);
+  if (!f) return;
+  FileHeader hdr;
+  bool ok = f.read((uint8_t*)&hdr, sizeof(hdr)) == sizeof(hdr) && hdr.magic == SHUFFLE_MAGIC &&
+            hdr.version == SHUFFLE_VERSION && hdr.count > 0 && hdr.count <= hdr.slots &&
+            hdr.slots <= (uint32_t)MAX_FILES;
+  ok = ok && reserve(hdr.count);
+  if (ok) {
+    const size_t bytes = hdr.count * sizeof(Slot);
+    uint32_t stored = 0;
+    ok = f.read((uint8_t*)s_order, bytes) == bytes && f.read((uint8_t*)&stored, sizeof(stored)) == sizeof(stored);
+    uint32_t crc = esp_rom_crc32_le(0, (const uint8_t*)&hdr, sizeof(hdr));
+    crc = esp_rom_crc32_le(crc, (const uint8_t*)s_order, bytes);
+    ok = ok && stored == crc;
+    // Every track exactly once
+    std::vector<bool> seen(hdr.slots);
+    for (uint32_t i = 0; ok && i < hdr.count; i++) {
+      ok = s_order[i] < hdr.slots && !seen[s_order[i]];
+      if (ok) seen[s_order[i]] = true;
+    }
+    s_count = hdr.count;
+    s_slots = hdr.slots;
+  }
+  f.close();
+  if (ok) {
+    s_cursor = RESTORE;
+    LOG_PRINTF("Shuffle: order of %d tracks loaded\n", s_count);
+  } else {
+    drop();
+    LOG_PRINTLN("Shuffle: saved order invalid, shuffling again");
+  }
+}
+
+// Follow the library: new tracks are shuffled into the part still to come, a shorter library (rebuilt
+// outside remove()) gets a new order
+static void sync(const TrackLibrary& tracks) {
+  const int n = tracks.count();
+  if (n == s_slots) return;
+  if (n < s_slots) drop();
+  if (!reserve(s_count + n - s_slots)) {
+    drop();
+    return;
+  }
+  for (int i = s_slots; i < n; i++) {
+    if (!tracks.deleted(i)) s_order[s_count++] = i;
+  }
+  s_slots = n;
+  shuffleRange(s_cursor >= 0 ? s_cursor + 1 : 0, s_count);
+  s_dirty = true;
+}
+
+// Make current the track at the cursor: the cursor after a restore, a track picked by hand is moved there
+static void place(int current) {
+  if (s_cursor >= 0 && s_order[s_cursor] == current) return;
+  const int pos = find(current);
+  if (pos < 0) return;
+  if (s_cursor == RESTORE) {
+    s_cursor = pos;
+    return;
+  }
+  if (pos > s_cursor) {
+    // Not played yet in this cycle: next in line
+    s_cursor++;
+    s_order[pos] = s_order[s_cursor];
+  } else {
+    // Played before: moved to the end of the history
+    memmove(s_order + pos, s_order + pos + 1, (s_cursor - pos) * sizeof(Slot));
+  }
+  s_order[s_cursor] = current;
+  s_dirty = true;
+}
+
+void begin(fs::FS& fs) {
+  lock();
+  s_fs = &fs;
+  unlock();
+}
+
+int step(const TrackLibrary& tracks, int current, int step, int first, int count) {
+  lock();
+  if (!s_loaded && s_fs) load();
+  s_loaded = true;
+  if (s_cursor == RESTORE && current >= 0 && current < s_slots) place(current);
+  sync(tracks);
+  if (s_count == 0) {
+    unlock();
+    return -1;
+  }
+  if (current >= 0 && current < s_slots) place(current);  // Slots, s_count is smaller after deletes
+  auto inScope = [&](int pos) {
+    return s_order[pos] >= first && s_order[pos] < first + count && !tracks.deleted(s_order[pos]);
+  };
+
+  int found = -1;
+  if (step < 0) {
+    for (int pos = s_cursor - 1; pos >= 0 && found < 0; pos--) {
+      if (inScope(pos)) found = pos;
+    }
+    // Nothing played before it: the track starts again
+    if (found < 0 && s_cursor >= 0 && inScope(s_cursor)) found = s_cursor;
+  }
+  for (int pos = s_cursor + 1; pos < s_count && found < 0; pos++) {
+    if (inScope(pos)) found = pos;
+  }
+  if (found < 0) {
+    // Cycle done: a new order, starting with the track playing so it does not come again right away
+    shuffleRange(0, s_count);
+    const int pos = find(current);
+    if (pos > 0) {
+      s_order[pos] = s_order[0];
+      s_order[0] = current;
+    }
+    s_cursor = pos >= 0 ? 0 : NONE;
+    for (int p = s_cursor + 1; p < s_count && found < 0; p++) {
+      if (inScope(p)) found = p;
+    }
+    if (found < 0 && s_cursor >= 0 && inScope(s_cursor)) found = s_cursor;  // The only track of the scope
+    s_dirty = true;
+    DEBUG_PRINTF("Shuffle: new cycle of %d tracks\n", s_count);
+  }
+  int track = -1;
+  if (found >= 0) {
+    s_cursor = found;
+    track = s_order[found];
+  }
+  unlock();
+  return track;
+}
+
+void remove(int index) {
+  lock();
+  const int pos = index >= 0 && index < s_slots ? find(index) : -1;
+  if (pos >= 0) {
+    memmove(s_order + pos, s_order + pos + 1, (s_count - pos - 1) * sizeof(Slot));
+    s_count--;
+    if (s_cursor >= pos) s_cursor--;  // Deleted while playing: 'n' continues with the track after it
+    if (s_cursor < 0 && s_cursor != RESTORE) s_cursor = NONE;
+    s_dirty = true;
+  }
+  unlock();
+}
+
+void compact(const std::vector<int>& removed) {
+  lock();
+  const int cursor = s_cursor;
+  int to = 0;
+  for (int i = 0; i < s_count; i++) {
+    const int track = s_order[i];
+    if (std::binary_search(removed.begin(), removed.end(), track)) {
+      if (i <= cursor) s_cursor--;  // Not taken out by remove() (the order was loaded after the delete)
+      continue;
+    }
+    s_order[to++] = TrackLibrary::compactedIndex(removed, track);
+  }
+  s_count = to;
+  // Only slots the order already followed; tracks added (and deleted) after the last sync() are not in it
+  s_slots -= std::lower_bound(removed.begin(), removed.end(), s_slots) - removed.begin();
+  if (s_cursor < 0 && s_cursor != RESTORE) s_cursor = NONE;
+  s_dirty = true;
+  unlock();
+}
+
+void reset() {
+  lock();
+  drop();
+  s_loaded = true;  // The saved order belongs to the old library
+  s_dirty = true;
+  unlock();
+}
+
+void save() {
+  lock();
+  if (!s_dirty || !s_fs || millis() - s_lastSave < SHUFFLE_SAVE_INTERVAL) {
+    unlock();
+    return;
+  }
+  s_dirty = false;
+  s_lastSave = millis();
+  if (s_count == 0) {
+    s_fs->remove(SHUFFLE_FILE);
+    unlock();
+    return;
+  }
+  if (!s_fs->exists(APP_DATA_DIR)) s_fs->mkdir(APP_DATA_DIR);
+  File f = s_fs->open(TMP_FILE, FILE_WRITE);
+  bool ok = (bool)f;
+  if (ok) {
+    const FileHeader hdr = {SHUFFLE_MAGIC, SHUFFLE_VERSION, 0, (uint32_t)s_count, (uint32_t)s_slots};
+    const size_t bytes = s_count * sizeof(Slot);
+    uint32_t crc = esp_rom_crc32_le(0, (const uint8_t*)&hdr, sizeof(hdr));
+    crc = esp_rom_crc32_le(crc, (const uint8_t*)s_order, bytes);
+    ok = f.write((const uint8_t*)&hdr, sizeof(hdr)) == sizeof(hdr) && f.write((const uint8_t*)s_order, bytes) == bytes &&
+         f.write((const uint8_t*)&crc, sizeof(crc)) == sizeof(crc);
+    f.close();
+  }
+  if (ok) {
+    s_fs->remove(SHUFFLE_FILE);
+    s_fs->rename(TMP_FILE, SHUFFLE_FILE);
+    DEBUG_PRINTF("Shuffle: order of %d tracks saved\n", s_count);
+  } else {
+    s_fs->remove(TMP_FILE);
+    LOG_PRINTLN("Shuffle: write failed");
+  }
+  unlock();
+}
+
+}  // namespace Shuffle
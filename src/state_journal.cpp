@@ -0,0 +1,185 @@
+#include "../include/state_journal.hpp"
+#include "../include/config.hpp"
+#include <Preferences.h>
+#include <esp_rom_crc.h>
+
+namespace StateJournal {
+
+// Slot layout: SlotHeader followed by pathLen bytes of the path (no terminator)
+struct SlotHeader {
+  uint32_t magic;
+  uint32_t seq;
+  uint32_t filePos;
+  uint32_t playTimeSec;
+  uint8_t volume;
+  uint8_t brightnessIndex;
+  uint8_t playMode;
+  uint8_t stopped;
+  uint16_t pathLen;
+  uint16_t reserved;
+  uint32_t crc;  // Over header (crc = 0) and path
+};
+static constexpr uint32_t SLOT_MAGIC = 0x4C4E524A;  // "JRNL"
+static constexpr size_t PATH_MAX_LEN = 255;
+
+static Preferences s_prefs;
+static bool s_open = false;
+static uint32_t s_seq = 0;          // Sequence number of the newest slot
+static uint8_t s_nextSlot = 0;
+
+// Last written snapshot and change tracking for update()
+static Snapshot s_saved;
+static bool s_hasSaved = false;
+static Snapshot s_prev;
+static unsigned long s_lastSaveTime = 0;
+static unsigned long s_lastChangeTime = 0;
+static bool s_lowBatterySaved = false;
+
+static bool open() {
+  if (!s_open) s_open = s_prefs.begin(STATE_NVS_NAMESPACE, false);
+  return s_open;
+}
+
+static void slotKey(uint8_t slot, char* key, size_t size) {
+  snprintf(key, size, "slot%u", (unsigned)slot);
+}
+
+static uint32_t slotCrc(const SlotHeader& hdr, const char* path) {
+  SlotHeader tmp = hdr;
+  tmp.crc = 0;
+  uint32_t crc = esp_rom_crc32_le(0, (const uint8_t*)&tmp, sizeof(tmp));
+  return esp_rom_crc32_le(crc, (const uint8_t*)path, hdr.pathLen);
+}
+
+static bool sameSettings(const Snapshot& a, const Snapshot& b) {
+  return a.volume == b.volume && a.brightnessIndex == b.brightnessIndex && a.playMode == b.playMode &&
+         a.stopped == b.stopped && a.path == b.path;
+}
+
+static void capture(const AppState& appState, Snapshot& snap) {
+  snap.filePos = appState.playFilePos;
+  snap.playTimeSec = appState.playTimeSec;
+  snap.volume = appState.volume;
+  snap.brightnessIndex = appState.brightnessIndex;
+  snap.playMode = static_cast<uint8_t>(appState.playMode);
+  snap.stopped = appState.stopped;
+  snap.path = appState.tracks.path(appState.currentPlayingIndex);  // "" if out of range
+}
+
+static bool write(const Snapshot& snap) {
+  if (!open()) return false;
+  uint8_t buf[sizeof(SlotHeader) + PATH_MAX_LEN];
+  SlotHeader hdr = {};
+  hdr.magic = SLOT_MAGIC;
+  hdr.seq = s_seq + 1;
+  hdr.filePos = snap.filePos;
+  hdr.playTimeSec = snap.playTimeSec;
+  hdr.volume = snap.volume;
+  hdr.brightnessIndex = snap.brightnessIndex;
+  hdr.playMode = snap.playMode;
+  hdr.stopped = snap.stopped ? 1 : 0;
+  hdr.pathLen = min((size_t)snap.path.length(), PATH_MAX_LEN);
+  hdr.crc = slotCrc(hdr, snap.path.c_str());
+  memcpy(buf, &hdr, sizeof(hdr));
+  memcpy(buf + sizeof(hdr), snap.path.c_str(), hdr.pathLen);
+
+  char key[8];
+  slotKey(s_nextSlot, key, sizeof(key));
+  size_t len = sizeof(hdr) + hdr.pathLen;
+  if (s_prefs.putBytes(key, buf, len) != len) {
+    LOG_PRINTLN("StateJournal: write failed");
+    return false;
+  }
+  s_seq = hdr.seq;
+  s_nextSlot = (s_nextSlot + 1) % STATE_SLOT_COUNT;
+  s_saved = snap;
+  s_hasSaved = true;
+  s_lastSaveTime = millis();
+  DEBUG_PRINTF("StateJournal: saved #%lu pos=%lu %s\n", (unsigned long)hdr.seq, (unsigned long)hdr.filePos,
+               snap.path.c_str());
+  return true;
+}
+
+bool load(Snapshot& out) {
+  if (!open()) return false;
+  uint8_t buf[sizeof(SlotHeader) + PATH_MAX_LEN + 1];
+  bool found = false;
+  for (uint8_t slot = 0; slot < STATE_SLOT_COUNT; slot++) {
+    char key[8];
+    slotKey(slot, key, sizeof(key));
+    size_t len = s_prefs.isKey(key) ? s_prefs.getBytesLength(key) : 0;
+    if (len < sizeof(SlotHeader) || len > sizeof(SlotHeader) + PATH_MAX_LEN) continue;
+    s_prefs.getBytes(key, buf, len);
+    SlotHeader hdr;
+    memcpy(&hdr, buf, sizeof(hdr));
+    char* path = (char*)buf + sizeof(hdr);
+    if (hdr.magic != SLOT_MAGIC || sizeof(hdr) + hdr.pathLen != len || hdr.crc != slotCrc(hdr, path)) {
+      LOG_PRINTF("StateJournal: slot %u invalid, ignored\n", (unsigned)slot);
+      continue;
+    }
+    if (found && hdr.seq <= s_seq) continue;
+    path[hdr.pathLen] = '\0';
+    out.filePos = hdr.filePos;
+    out.playTimeSec = hdr.playTimeSec;
+    out.volume = hdr.volume;
+    out.brightnessIndex = hdr.brightnessIndex;
+    out.playMode = hdr.playMode;
+    out.stopped = hdr.stopped != 0;
+    out.path = path;
+    s_seq = hdr.seq;
+    s_nextSlot = (slot + 1) % STATE_SLOT_COUNT;
+    found = true;
+  }
+  if (found) {
+    s_saved = out;
+    s_hasSaved = true;
+    LOG_PRINTF("StateJournal: resume #%lu %s @%lu\n", (unsigned long)s_seq, out.path.c_str(),
+               (unsigned long)out.filePos);
+  }
+  return found;
+}
+
+void applySettings(const Snapshot& snap, AppState& appState) {
+  appState.volume = constrain((int)snap.volume, VOLUME_MIN, VOLUME_MAX);
+  appState.brightnessIndex = snap.brightnessIndex < BRIGHTNESS_LEVELS ? snap.brightnessIndex : appState.brightnessIndex;
+  appState.savedBrightness = appState.brightnessIndex;
+  if (snap.playMode <= static_cast<uint8_t>(PlaybackMode::SingleRepeat)) {
+    appState.playMode = static_cast<PlaybackMode>(snap.playMode);
+  }
+}
+
+bool saveNow(const AppState& appState) {
+  Snapshot snap;
+  capture(appState, snap);
+  return write(snap);
+}
+
+void update(const AppState& appState) {
+  unsigned long now = millis();
+  Snapshot cur;
+  capture(appState, cur);
+  if (!sameSettings(cur, s_prev)) s_lastChangeTime = now;
+  s_prev = cur;
+
+  bool settingsChanged = !s_hasSaved || !sameSettings(cur, s_saved);
+  bool posChanged = cur.filePos != s_saved.filePos;
+
+  if (settingsChanged && now - s_lastChangeTime >= STATE_SETTINGS_DEBOUNCE) {
+    write(cur);
+  } else if (posChanged && !cur.stopped && now - s_lastSaveTime >= STATE_SAVE_INTERVAL) {
+    write(cur);
+  }
+
+  // Power may go away any moment, keep the exact position
+  if (appState.batteryPercent > 0 && appState.batteryPercent <= STATE_LOW_BATTERY_PERCENT) {
+    if (!s_lowBatterySaved && (settingsChanged || posChanged)) {
+      write(cur);
+      s_lowBatterySaved = true;
+      LOG_PRINTLN("StateJournal: low battery, state saved");
+    }
+  } else {
+    s_lowBatterySaved = false;
+  }
+}
+
+}  // namespace StateJournal
@@ -0,0 +1,81 @@
+#include "../include/storage.hpp"
+#include "../include/config.hpp"
+#include <SPI.h>
+#include <SD.h>
+
+namespace Storage {
+
+static uint32_t s_clockHz = 0;
+
+static bool mountAt(uint32_t hz) {
+  return SD.begin(SD_SPI_CS, SPI, hz, SD_MOUNT_POINT, SD_MAX_OPEN_FILES);
+}
+
+bool begin() {
+  SPI.begin(SD_SPI_SCK, SD_SPI_MISO, SD_SPI_MOSI);
+  for (uint32_t hz : SD_SPI_CLOCKS_HZ) {
+    if (mountAt(hz)) {
+      s_clockHz = hz;
+      LOG_PRINTF("SD mounted at %lu kHz, type %d, %llu MB\n", (unsigned long)(hz / 1000), (int)SD.cardType(),
+                 SD.cardSize() / (1024 * 1024));
+      return true;
+    }
+    LOG_PRINTF("SD mount failed at %lu kHz\n", (unsigned long)(hz / 1000));
+    SD.end();
+  }
+  s_clockHz = 0;
+  return false;
+}
+
+uint32_t getClockHz() {
+  return s_clockHz;
+}
+
+bool benchmark(fs::FS& fs, const char* path, BenchResult& out) {
+  out = BenchResult();
+  File f = fs.open(path);
+  if (!f) return false;
+  const uint32_t size = f.size();
+  uint8_t* buf = (uint8_t*)malloc(STORAGE_BENCH_SEQ_CHUNK);
+  if (!buf || size < STORAGE_BENCH_RANDOM_SIZE) {
+    free(buf);
+    f.close();
+    return false;
+  }
+
+  // Sequential: large aligned chunks from the start of the file
+  uint32_t seqBytes = 0;
+  uint32_t t0 = micros();
+  f.seek(0);
+  while (seqBytes < STORAGE_BENCH_SEQ_BYTES && seqBytes < size) {
+    size_t rd = f.read(buf, STORAGE_BENCH_SEQ_CHUNK);
+    if (rd == 0) break;
+    seqBytes += rd;
+  }
+  uint32_t seqUs = micros() - t0;
+  if (seqUs) out.seqKBps = (uint64_t)seqBytes * 1000000 / 1024 / seqUs;
+
+  // Random: sector aligned small reads spread over the file (like cover art and index lookups)
+  uint32_t randUs = 0;
+  uint32_t sectors = (size - STORAGE_BENCH_RANDOM_SIZE) / 512;
+  for (int i = 0; i < STORAGE_BENCH_RANDOM_READS; i++) {
+    uint32_t pos = (uint32_t)random(0, sectors + 1) * 512;
+    t0 = micros();
+    f.seek(pos);
+    f.read(buf, STORAGE_BENCH_RANDOM_SIZE);
+    uint32_t dt = micros() - t0;
+    randUs += dt;
+    if (dt > out.randMaxUs) out.randMaxUs = dt;
+  }
+  out.randAvgUs = randUs / STORAGE_BENCH_RANDOM_READS;
+  if (randUs) out.randKBps = (uint64_t)STORAGE_BENCH_RANDOM_READS * STORAGE_BENCH_RANDOM_SIZE * 1000000 / 1024 / randUs;
+
+  free(buf);
+  f.close();
+  LOG_PRINTF("SD benchmark @%lu kHz: sequential %lu KB/s, random %lu KB/s (avg %lu us, max %lu us)\n",
+             (unsigned long)(s_clockHz / 1000), (unsigned long)out.seqKBps, (unsigned long)out.randKBps,
+             (unsigned long)out.randAvgUs, (unsigned long)out.randMaxUs);
+  return true;
+}
+
+}  // namespace Storage
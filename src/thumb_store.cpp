@@ -0,0 +1,101 @@
+#include "../include/thumb_store.hpp"
+#include "../include/config.hpp"
+
+namespace ThumbStore {
+
+struct Header {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t width;      // 0 = no cover
+  uint16_t height;
+  uint16_t reserved;
+  Key key;
+};
+static constexpr uint32_t THUMB_MAGIC = 0x424D4854;  // "THMB"
+static constexpr uint16_t THUMB_VERSION = 1;
+static constexpr size_t PIXEL_BYTES = COVER_WIDTH * COVER_HEIGHT * sizeof(uint16_t);
+
+static void thumbPath(const Key& key, char* out, size_t size) {
+  snprintf(out, size, "%s/%08lx.565", THUMB_DIR, (unsigned long)key.pathHash);
+}
+
+static bool sameKey(const Key& a, const Key& b) {
+  return a.pathHash == b.pathHash && a.fileSize == b.fileSize && a.mtime == b.mtime && a.coverPos == b.coverPos &&
+         a.coverLen == b.coverLen;
+}
+
+// Opens the entry and checks its header; f stays open on success
+static bool openEntry(fs::FS& fs, const Key& key, File& f, Header& hdr) {
+  char path[48];
+  thumbPath(key, path, sizeof(path));
+  if (!fs.exists(path)) return false;
+  f = fs.open(path);
+  if (!f) return false;
+  if (f.read((uint8_t*)&hdr, sizeof(hdr)) != sizeof(hdr) || hdr.magic != THUMB_MAGIC || hdr.version != THUMB_VERSION ||
+      !sameKey(hdr.key, key) || f.size() != sizeof(hdr) + (hdr.width ? PIXEL_BYTES : 0)) {
+    f.close();
+    return false;  // Stale (track replaced or retagged) or torn by a power loss, rewritten on the next save
+  }
+  return true;
+}
+
+Key makeKey(const char* path, uint32_t fileSize, uint32_t mtime, uint32_t coverPos, uint32_t coverLen) {
+  Key key;
+  uint32_t h = 2166136261u;  // FNV-1a
+  for (const char* p = path; *p; p++) {
+    h ^= (uint8_t)*p;
+    h *= 16777619u;
+  }
+  key.pathHash = h;
+  key.fileSize = fileSize;
+  key.mtime = mtime;
+  key.coverPos = coverPos;
+  key.coverLen = coverLen;
+  return key;
+}
+
+Result load(fs::FS& fs, const Key& key, uint16_t* pixels) {
+  File f;
+  Header hdr;
+  if (!openEntry(fs, key, f, hdr)) return Result::Missing;
+  Result res = Result::NoCover;
+  if (hdr.width) {
+    res = f.read((uint8_t*)pixels, PIXEL_BYTES) == PIXEL_BYTES ? Result::Image : Result::Missing;
+  }
+  f.close();
+  return res;
+}
+
+bool contains(fs::FS& fs, const Key& key) {
+  File f;
+  Header hdr;
+  if (!openEntry(fs, key, f, hdr)) return false;
+  f.close();
+  return true;
+}
+
+bool save(fs::FS& fs, const Key& key, const uint16_t* pixels) {
+  if (!fs.exists(APP_DATA_DIR)) fs.mkdir(APP_DATA_DIR);
+  if (!fs.exists(THUMB_DIR)) fs.mkdir(THUMB_DIR);
+  char path[48];
+  thumbPath(key, path, sizeof(path));
+  File f = fs.open(path, FILE_WRITE);
+  if (!f) {
+    LOG_PRINTF("ThumbStore: cannot write %s\n", path);
+    return false;
+  }
+  Header hdr = {};
+  hdr.magic = THUMB_MAGIC;
+  hdr.version = THUMB_VERSION;
+  hdr.width = pixels ? COVER_WIDTH : 0;
+  hdr.height = pixels ? COVER_HEIGHT : 0;
+  hdr.key = key;
+  bool ok = f.write((const uint8_t*)&hdr, sizeof(hdr)) == sizeof(hdr);
+  if (ok && pixels) ok = f.write((const uint8_t*)pixels, PIXEL_BYTES) == PIXEL_BYTES;
+  f.close();
+  if (!ok) fs.remove(path);
+  DEBUG_PRINTF("ThumbStore: saved %s (%s)\n", path, pixels ? "image" : "no cover");
+  return ok;
+}
+
+}  // namespace ThumbStore
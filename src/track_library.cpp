@@ -0,0 +1,238 @@
+#include "../include/track_library.hpp"
+#include "../include/config.hpp"
+#include "../include/memory_budget.hpp"
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+static constexpr int TRACKS_INITIAL = 64;
+static constexpr int DIRS_INITIAL = 8;
+static constexpr uint32_t TEXT_INITIAL = 2048;
+
+// Grow arr to at least need elements, by half its size if the budget allows (need exactly otherwise)
+template <typename T, typename N>
+static bool reserve(T*& arr, N& cap, N need, N initial) {
+  if (need <= cap) return true;
+  const N grown = max(max(need, initial), (N)(cap + cap / 2));
+  for (N n : {grown, need}) {
+    T* p = (T*)MemoryBudget::reallocate(MemoryBudget::Pool::TrackList, arr, cap * sizeof(T), n * sizeof(T));
+    if (p) {
+      arr = p;
+      cap = n;
+      return true;
+    }
+  }
+  return false;
+}
+
+TrackLibrary::TrackLibrary() {
+  m_mutex = xSemaphoreCreateMutex();
+}
+
+TrackLibrary::~TrackLibrary() {
+  clear();
+  if (m_mutex) vSemaphoreDelete(m_mutex);
+}
+
+void TrackLibrary::lock() const {
+  xSemaphoreTake(m_mutex, portMAX_DELAY);
+}
+
+void TrackLibrary::unlock() const {
+  xSemaphoreGive(m_mutex);
+}
+
+// Copy s into the text arena; UINT32_MAX if it does not fit the budget
+uint32_t TrackLibrary::appendText(const char* s, size_t len) {
+  if (!reserve(m_text, m_textCap, (uint32_t)(m_textUsed + len + 1), TEXT_INITIAL)) return UINT32_MAX;
+  uint32_t off = m_textUsed;
+  memcpy(m_text + off, s, len);
+  m_text[off + len] = '\0';
+  m_textUsed += len + 1;
+  return off;
+}
+
+int TrackLibrary::internDir(const char* dir, size_t len) {
+  auto same = [&](int i) { return m_dirs[i].len == len && memcmp(m_text + m_dirs[i].off, dir, len) == 0; };
+  if (m_lastDir >= 0 && same(m_lastDir)) return m_lastDir;
+  for (int i = 0; i < m_dirCount; i++) {
+    if (same(i)) return m_lastDir = i;
+  }
+  if (m_dirCount >= DELETED_DIR || !reserve(m_dirs, m_dirCap, m_dirCount + 1, DIRS_INITIAL)) return -1;
+  uint32_t off = appendText(dir, len);
+  if (off == UINT32_MAX) return -1;
+  m_dirs[m_dirCount] = {off, (uint16_t)len};
+  return m_lastDir = m_dirCount++;
+}
+
+bool TrackLibrary::add(const char* path) {
+  const char* slash = strrchr(path, '/');
+  size_t dirLen = slash ? slash - path : 0;
+  const char* name = slash ? slash + 1 : path;
+  size_t nameLen = strlen(name);
+  if (dirLen > UINT16_MAX || nameLen > UINT16_MAX) return false;
+
+  lock();
+  bool ok = false;
+  int dir = internDir(path, dirLen);
+  if (dir >= 0 && reserve(m_tracks, m_trackCap, m_count + 1, TRACKS_INITIAL)) {
+    uint32_t off = appendText(name, nameLen);
+    if (off != UINT32_MAX) {
+      m_tracks[m_count++] = {off, (uint16_t)dir, (uint16_t)nameLen};
+      ok = true;
+    }
+  }
+  unlock();
+  return ok;
+}
+
+void TrackLibrary::remove(int index) {
+  lock();
+  if (index >= 0 && index < m_count && m_tracks[index].dir != DELETED_DIR) {
+    // The name stays in the arena until the library is cleared; deletes are rare
+    m_tracks[index].dir = DELETED_DIR;
+    m_deleted++;
+    m_generation++;
+  }
+  unlock();
+}
+
+std::vector<int> TrackLibrary::compact() {
+  std::vector<int> removed;
+  lock();
+  if (m_deleted > 0) {
+    removed.reserve(m_deleted);
+    int to = 0;
+    for (int i = 0; i < m_count; i++) {
+      if (m_tracks[i].dir == DELETED_DIR) removed.push_back(i);
+      else m_tracks[to++] = m_tracks[i];
+    }
+    m_count = to;
+    m_deleted = 0;
+    m_generation++;
+  }
+  unlock();
+  return removed;
+}
+
+int TrackLibrary::compactedIndex(const std::vector<int>& removed, int index) {
+  return index - (std::lower_bound(removed.begin(), removed.end(), index) - removed.begin());
+}
+
+bool TrackLibrary::deleted(int index) const {
+  lock();
+  bool gone = index >= 0 && index < m_count && m_tracks[index].dir == DELETED_DIR;
+  unlock();
+  return gone;
+}
+
+void TrackLibrary::clear() {
+  lock();
+  MemoryBudget::deallocate(MemoryBudget::Pool::TrackList, m_text, m_textCap);
+  MemoryBudget::deallocate(MemoryBudget::Pool::TrackList, m_tracks, m_trackCap * sizeof(Track));
+  MemoryBudget::deallocate(MemoryBudget::Pool::TrackList, m_dirs, m_dirCap * sizeof(Dir));
+  m_text = nullptr;
+  m_tracks = nullptr;
+  m_dirs = nullptr;
+  m_textUsed = m_textCap = 0;
+  m_count = m_trackCap = 0;
+  m_deleted = 0;
+  m_generation++;
+  m_dirCount = m_dirCap = 0;
+  m_lastDir = -1;
+  unlock();
+}
+
+void TrackLibrary::swap(TrackLibrary& other) {
+  if (&other == this) return;
+  lock();
+  other.lock();
+  std::swap(m_text, other.m_text);
+  std::swap(m_textUsed, other.m_textUsed);
+  std::swap(m_textCap, other.m_textCap);
+  std::swap(m_tracks, other.m_tracks);
+  std::swap(m_count, other.m_count);
+  std::swap(m_deleted, other.m_deleted);
+  m_generation++;
+  other.m_generation++;
+  std::swap(m_trackCap, other.m_trackCap);
+  std::swap(m_dirs, other.m_dirs);
+  std::swap(m_dirCount, other.m_dirCount);
+  std::swap(m_dirCap, other.m_dirCap);
+  std::swap(m_lastDir, other.m_lastDir);
+  other.unlock();
+  unlock();
+}
+
+String TrackLibrary::path(int index) const {
+  String out;
+  lock();
+  if (index >= 0 && index < m_count && m_tracks[index].dir != DELETED_DIR) {
+    const Track& t = m_tracks[index];
+    const Dir& d = m_dirs[t.dir];
+    out.reserve(d.len + 1 + t.nameLen);
+    out.concat(m_text + d.off, d.len);
+    out.concat('/');
+    out.concat(m_text + t.nameOff, t.nameLen);
+  }
+  unlock();
+  return out;
+}
+
+String TrackLibrary::name(int index) const {
+  String out;
+  lock();
+  if (index >= 0 && index < m_count && m_tracks[index].dir != DELETED_DIR) out = m_text + m_tracks[index].nameOff;
+  unlock();
+  return out;
+}
+
+int TrackLibrary::find(const String& path) const {
+  int slash = path.lastIndexOf('/');
+  size_t dirLen = slash >= 0 ? slash : 0;
+  const char* name = path.c_str() + (slash >= 0 ? slash + 1 : 0);
+  size_t nameLen = path.length() - (name - path.c_str());
+  int found = -1;
+  lock();
+  for (int i = 0; i < m_count && found < 0; i++) {
+    const Track& t = m_tracks[i];
+    if (t.dir == DELETED_DIR) continue;
+    const Dir& d = m_dirs[t.dir];
+    if (t.nameLen == nameLen && d.len == dirLen && memcmp(m_text + t.nameOff, name, nameLen) == 0 &&
+        memcmp(m_text + d.off, path.c_str(), dirLen) == 0) {
+      found = i;
+    }
+  }
+  unlock();
+  return found;
+}
+
+void TrackLibrary::dirRange(const String& dir, int& first, int& count) const {
+  size_t len = dir.length();
+  while (len > 0 && dir[len - 1] == '/') len--;  // "/" is the whole card, "/music/" is "/music"
+  first = 0;
+  count = 0;
+  lock();
+  // Directories are few: decide once per directory, then find the tracks
+  std::vector<bool> inside(m_dirCount);
+  for (int i = 0; i < m_dirCount; i++) {
+    const Dir& d = m_dirs[i];
+    inside[i] = d.len >= len && memcmp(m_text + d.off, dir.c_str(), len) == 0 &&
+                (d.len == len || m_text[d.off + len] == '/');
+  }
+  int last = -1;
+  for (int i = 0; i < m_count; i++) {
+    if (m_tracks[i].dir == DELETED_DIR || !inside[m_tracks[i].dir]) continue;
+    if (last < 0) first = i;
+    last = i;
+  }
+  if (last >= 0) count = last - first + 1;
+  unlock();
+}
+
+size_t TrackLibrary::memoryUsed() const {
+  lock();
+  size_t bytes = m_textCap + m_trackCap * sizeof(Track) + m_dirCap * sizeof(Dir);
+  unlock();
+  return bytes;
+}
@@ -5,6 +5,13 @@
 #include "../include/config.hpp"
 #include "../include/image_utils.hpp"
 #include "../include/audio_manager.hpp"
+#include "../include/browse_index.hpp"
+#include "../include/cover_cache.hpp"
+#include "../include/folder_browser.hpp"
+#include "../include/library_index.hpp"
+#include "../include/metadata_db.hpp"
+#include "../include/playlist.hpp"
+#include "../include/search_index.hpp"
 #include <ESP32Time.h>
 #include "font.h"
 
@@ -24,6 +31,22 @@ static String extractDisplayName(const String& fullPath) {
   return fileName;
 }
 
+// List row of a track: its title from the metadata database, the file name until it has been parsed
+static String listName(const TrackLibrary& tracks, int index) {
+  MetadataDb::Info info;
+  if (MetadataDb::lookup(SD, tracks.path(index), info) && info.title.length() > 0) return info.title;
+  return extractDisplayName(tracks.name(index));
+}
+
+// Playback time including a seek that is still being scrubbed / not applied yet
+static uint32_t previewTime(const AppState& appState) {
+  int32_t t = (int32_t)AudioManager::getCurrentTime() + appState.pendingSeekSec();
+  int32_t duration = (int32_t)AudioManager::getFileDuration();
+  if (t < 0) t = 0;
+  if (duration > 0 && t > duration) t = duration;
+  return (uint32_t)t;
+}
+
 void drawId3Page(M5Canvas& sprite,
                  AppState& appState,
                  const unsigned short* grays,
@@ -80,72 +103,48 @@ void drawId3Page(M5Canvas& sprite,
       sprite.setTextDatum(0);
     }
   } else if (localCoverSize == 0 && localCoverPos > 0) {
-    // Check if playing index is valid before accessing audioFiles array
+    // Check if playing index is valid before accessing the track list
     // Also verify index hasn't changed (race condition protection)
-    if (localPlayingIndex < 0 || localPlayingIndex >= appState.fileCount || 
+    if (localPlayingIndex < 0 || localPlayingIndex >= appState.tracks.count() || 
         appState.currentPlayingIndex != localPlayingIndex) {
       sprite.fillRect(coverX, coverY, coverW, coverH, grays[4]);
       sprite.drawRect(coverX, coverY, coverW, coverH, grays[10]);
       return;  // Early return to avoid array out of bounds or stale data
     }
     
-    File f = SD.open(appState.audioFiles[localPlayingIndex]);
-    if (f) {
-      if (f.seek(localCoverPos)) {
-        const size_t scanMax = (localCoverLen > 0 && localCoverLen < COVER_SCAN_MAX) ? localCoverLen : (size_t)COVER_SCAN_MAX;
-        size_t startOff = 0;
-        ImageFormat fmt = ImageFormat::Unknown;
-        findImageStart(f, scanMax, startOff, fmt);
-        uint32_t imgW = 0, imgH = 0;
-        bool gotSize = getImageSize(f, localCoverPos + startOff, fmt, imgW, imgH);
-        f.seek(localCoverPos + startOff);
-        if (fmt != ImageFormat::Unknown) {
-          float scaleX = 1.0f;
-          float scaleY = 0.0f;  // 0.0 means follow scaleX (maintain aspect ratio)
-          
-          if (gotSize && imgW > 0 && imgH > 0) {
-            float sx = (float)coverW / (float)imgW;
-            float sy = (float)coverH / (float)imgH;
-            scaleX = sx < sy ? sx : sy;  // Use smaller scale to fit both dimensions
-            if (scaleX <= 0.0f || scaleX > 1.0f) scaleX = 1.0f;
-          } else {
-            // If we can't get dimensions, use fit-to-size mode (scale = 0 means fit)
-            scaleX = 0.0f;
-          }
-          
-          if (fmt == ImageFormat::JPEG) {
-            sprite.drawJpg(&f, coverX, coverY, coverW, coverH, 0, 0, scaleX, scaleY);
-          } else if (fmt == ImageFormat::PNG) {
-            sprite.drawPng(&f, coverX, coverY, coverW, coverH, 0, 0, scaleX, scaleY);
-          } else if (fmt == ImageFormat::BMP) {
-            sprite.drawBmp(&f, coverX, coverY, coverW, coverH, 0, 0, scaleX, scaleY);
-          } else if (fmt == ImageFormat::QOI) {
-            sprite.drawQoi(&f, coverX, coverY, coverW, coverH, 0, 0, scaleX, scaleY);
-          }
-        } else {
-          sprite.fillRect(coverX, coverY, coverW, coverH, grays[4]);
-          sprite.drawRect(coverX, coverY, coverW, coverH, grays[10]);
-          sprite.setTextColor(grays[14], grays[4]);
-          sprite.setTextDatum(4);
-          sprite.drawString(PLACEHOLDER_NO_COVER, coverX + coverW/2, coverY + coverH/2);
-          sprite.setTextDatum(0);
-        }
-      } else {
-        sprite.fillRect(coverX, coverY, coverW, coverH, grays[4]);
-        sprite.drawRect(coverX, coverY, coverW, coverH, grays[10]);
-      }
-      f.close();
-    } else {
+    // Decoded once per track by the cover cache, here it is only copied
+    CoverCache::request(appState.tracks.path(localPlayingIndex), localCoverPos, localCoverLen);
+    CoverCache::State coverState = CoverCache::draw(sprite, coverX, coverY);
+    if (coverState == CoverCache::State::NoCover) {
+      sprite.fillRect(coverX, coverY, coverW, coverH, grays[4]);
+      sprite.drawRect(coverX, coverY, coverW, coverH, grays[10]);
+      sprite.setTextColor(grays[14], grays[4]);
+      sprite.setTextDatum(4);
+      sprite.drawString(PLACEHOLDER_NO_COVER, coverX + coverW/2, coverY + coverH/2);
+      sprite.setTextDatum(0);
+    } else if (coverState != CoverCache::State::Ready) {
       sprite.fillRect(coverX, coverY, coverW, coverH, grays[4]);
       sprite.drawRect(coverX, coverY, coverW, coverH, grays[10]);
     }
   } else {
-    sprite.fillRect(coverX, coverY, coverW, coverH, grays[4]);
-    sprite.drawRect(coverX, coverY, coverW, coverH, grays[10]);
-    sprite.setTextColor(grays[14], grays[4]);
-    sprite.setTextDatum(4);
-    sprite.drawString(PLACEHOLDER_NO_COVER, coverX + coverW/2, coverY + coverH/2);
-    sprite.setTextDatum(0);
+    // No embedded cover: the image in the track's folder (cover.jpg, ...), shared by all its tracks
+    CoverCache::State coverState = CoverCache::State::None;
+    if (localPlayingIndex >= 0 && localPlayingIndex < appState.tracks.count() &&
+        appState.currentPlayingIndex == localPlayingIndex) {
+      CoverCache::requestFolderArt(appState.tracks.path(localPlayingIndex));
+      coverState = CoverCache::draw(sprite, coverX, coverY);
+    }
+    if (coverState == CoverCache::State::Pending) {
+      sprite.fillRect(coverX, coverY, coverW, coverH, grays[4]);
+      sprite.drawRect(coverX, coverY, coverW, coverH, grays[10]);
+    } else if (coverState != CoverCache::State::Ready) {
+      sprite.fillRect(coverX, coverY, coverW, coverH, grays[4]);
+      sprite.drawRect(coverX, coverY, coverW, coverH, grays[10]);
+      sprite.setTextColor(grays[14], grays[4]);
+      sprite.setTextDatum(4);
+      sprite.drawString(PLACEHOLDER_NO_COVER, coverX + coverW/2, coverY + coverH/2);
+      sprite.setTextDatum(0);
+    }
   }
 
   // Album text: ensure it's below cover and handle scrolling properly
@@ -223,7 +222,7 @@ void drawId3Page(M5Canvas& sprite,
   
   // Display current playback time (smaller font, centered in right area, above icons)
   if (appState.isPlaying && !appState.stopped) {
-    uint32_t currentTime = AudioManager::getCurrentTime();
+    uint32_t currentTime = previewTime(appState);
     uint32_t minutes = currentTime / 60;
     uint32_t seconds = currentTime % 60;
     char timeStr[6];
@@ -294,7 +293,7 @@ void drawId3Page(M5Canvas& sprite,
   
   // Draw progress bar at bottom of screen
   if (appState.isPlaying && !appState.stopped) {
-    uint32_t currentTime = AudioManager::getCurrentTime();
+    uint32_t currentTime = previewTime(appState);
     uint32_t duration = AudioManager::getFileDuration();
     if (duration > 0) {
       int progressWidth = (int)((float)currentTime / (float)duration * SCREEN_WIDTH);
@@ -308,6 +307,274 @@ void drawId3Page(M5Canvas& sprite,
   sprite.pushSprite(0, 0);
 }
 
+void drawBrowsePage(M5Canvas& sprite,
+                    AppState& appState,
+                    const unsigned short* grays,
+                    const lgfx::U8g2font* (*detectAndGetFont)(const String&)) {
+  sprite.fillRect(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT, BLACK);
+  BrowseIndex::refresh(SD);
+
+  // Title: category / group name, position in the list on the right
+  const int count = BrowseIndex::rowCount();
+  const int selected = BrowseIndex::selected();
+  String title = BrowseIndex::title();
+  const lgfx::U8g2font* titleFont = detectAndGetFont(title);
+  if (titleFont) sprite.setFont(titleFont); else sprite.setTextFont(0);
+  sprite.setTextDatum(0);
+  sprite.setTextColor(grays[2], BLACK);
+  sprite.setClipRect(0, 0, BROWSE_COUNT_X - 40, BROWSE_ROWS_Y);
+  sprite.drawString(title, BROWSE_TEXT_X, BROWSE_TITLE_Y);
+  sprite.clearClipRect();
+  sprite.setTextFont(0);
+  sprite.setTextColor(grays[6], BLACK);
+  sprite.setTextDatum(2);
+  sprite.drawString(String(count ? selected + 1 : 0) + "/" + String(count), BROWSE_COUNT_X, BROWSE_TITLE_Y);
+  sprite.drawFastHLine(0, BROWSE_ROWS_Y - 2, SCREEN_WIDTH, grays[4]);
+
+  if (count == 0) {
+    sprite.setTextDatum(4);
+    sprite.setTextColor(grays[8], BLACK);
+    const char* msg = MetadataDb::isUpdating() || LibraryIndex::getProgress().scanning ? "Reading tags..." : "Empty";
+    sprite.drawString(msg, SCREEN_WIDTH / 2, BROWSE_ROWS_Y + BROWSE_VISIBLE_ROWS * BROWSE_ROW_HEIGHT / 2);
+    sprite.setTextDatum(0);
+    sprite.pushSprite(0, 0);
+    return;
+  }
+
+  // Window that keeps the selection visible
+  int first = selected - BROWSE_VISIBLE_ROWS / 2;
+  if (first > count - BROWSE_VISIBLE_ROWS) first = count - BROWSE_VISIBLE_ROWS;
+  if (first < 0) first = 0;
+  BrowseIndex::Row rows[BROWSE_VISIBLE_ROWS];
+  const int n = BrowseIndex::rows(SD, appState.tracks, first, BROWSE_VISIBLE_ROWS, rows);
+  for (int i = 0; i < n; i++) {
+    const BrowseIndex::Row& row = rows[i];
+    const int y = BROWSE_ROWS_Y + i * BROWSE_ROW_HEIGHT;
+    if (first + i == selected) {
+      sprite.fillRect(0, y, SCREEN_WIDTH, BROWSE_ROW_HEIGHT, grays[3]);
+      sprite.setTextColor(WHITE, grays[3]);
+    } else if (row.isTrack && row.track == appState.currentPlayingIndex) {
+      sprite.setTextColor(RED, BLACK);
+    } else if (row.isTrack && row.track < 0) {
+      sprite.setTextColor(grays[8], BLACK);  // Gone from the library since the index was built
+    } else {
+      sprite.setTextColor(GREEN, BLACK);
+    }
+    const lgfx::U8g2font* font = detectAndGetFont(row.label);
+    if (font) sprite.setFont(font); else sprite.setTextFont(0);
+    sprite.setTextDatum(0);
+    sprite.setClipRect(BROWSE_TEXT_X, y, BROWSE_TEXT_WIDTH, BROWSE_ROW_HEIGHT);
+    sprite.drawString(row.label, BROWSE_TEXT_X, y + 2);
+    sprite.clearClipRect();
+    if (!row.isTrack) {
+      sprite.setTextFont(0);
+      sprite.setTextDatum(2);
+      sprite.drawString(String(row.count), BROWSE_COUNT_X, y + 4);
+    }
+  }
+  sprite.setTextDatum(0);
+  sprite.setTextFont(0);
+  sprite.pushSprite(0, 0);
+}
+
+void drawFolderPage(M5Canvas& sprite,
+                    AppState& appState,
+                    const unsigned short* grays,
+                    const lgfx::U8g2font* (*detectAndGetFont)(const String&)) {
+  sprite.fillRect(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT, BLACK);
+
+  // Folder path (its end if too long), position in the folder on the right
+  const int count = FolderBrowser::rowCount();
+  const int selected = FolderBrowser::selected();
+  String title = FolderBrowser::path();
+  const lgfx::U8g2font* titleFont = detectAndGetFont(title);
+  if (titleFont) sprite.setFont(titleFont); else sprite.setTextFont(0);
+  sprite.setTextDatum(0);
+  sprite.setTextColor(grays[2], BLACK);
+  const int titleW = BROWSE_COUNT_X - 48 - BROWSE_TEXT_X;
+  const int overflow = sprite.textWidth(title) - titleW;
+  sprite.setClipRect(BROWSE_TEXT_X, 0, titleW, BROWSE_ROWS_Y);
+  sprite.drawString(title, BROWSE_TEXT_X - (overflow > 0 ? overflow : 0), BROWSE_TITLE_Y);
+  sprite.clearClipRect();
+  sprite.setTextFont(0);
+  sprite.setTextColor(grays[6], BLACK);
+  sprite.setTextDatum(2);
+  sprite.drawString(String(count ? selected + 1 : 0) + "/" + String(count) + (FolderBrowser::truncated() ? "+" : ""),
+                    BROWSE_COUNT_X, BROWSE_TITLE_Y);
+  sprite.drawFastHLine(0, BROWSE_ROWS_Y - 2, SCREEN_WIDTH, grays[4]);
+
+  if (count == 0) {
+    sprite.setTextDatum(4);
+    sprite.setTextColor(grays[8], BLACK);
+    sprite.drawString("Empty", SCREEN_WIDTH / 2, BROWSE_ROWS_Y + BROWSE_VISIBLE_ROWS * BROWSE_ROW_HEIGHT / 2);
+    sprite.setTextDatum(0);
+    sprite.pushSprite(0, 0);
+    return;
+  }
+
+  // The playing track is red if it is in this folder
+  const String playing = appState.tracks.path(appState.currentPlayingIndex);
+  const int slash = playing.lastIndexOf('/');
+  const String playingDir = slash > 0 ? playing.substring(0, slash) : String("/");
+  const bool playingHere = playing.length() > 0 && playingDir == FolderBrowser::path();
+  const String playingName = playing.substring(slash + 1);
+
+  int first = selected - BROWSE_VISIBLE_ROWS / 2;
+  if (first > count - BROWSE_VISIBLE_ROWS) first = count - BROWSE_VISIBLE_ROWS;
+  if (first < 0) first = 0;
+  FolderBrowser::Row rows[BROWSE_VISIBLE_ROWS];
+  const int n = FolderBrowser::rows(first, BROWSE_VISIBLE_ROWS, rows);
+  for (int i = 0; i < n; i++) {
+    const FolderBrowser::Row& row = rows[i];
+    const int y = BROWSE_ROWS_Y + i * BROWSE_ROW_HEIGHT;
+    if (first + i == selected) {
+      sprite.fillRect(0, y, SCREEN_WIDTH, BROWSE_ROW_HEIGHT, grays[3]);
+      sprite.setTextColor(WHITE, grays[3]);
+    } else if (row.isDir) {
+      sprite.setTextColor(grays[1], BLACK);
+    } else if (playingHere && row.name == playingName) {
+      sprite.setTextColor(RED, BLACK);
+    } else if (Playlist::isPlaylistFile(row.name.c_str())) {
+      sprite.setTextColor(CYAN, BLACK);
+    } else {
+      sprite.setTextColor(GREEN, BLACK);
+    }
+    String label = row.isDir || Playlist::isPlaylistFile(row.name.c_str()) ? row.name + (row.isDir ? "/" : "")
+                                                                            : extractDisplayName(row.name);
+    const lgfx::U8g2font* font = detectAndGetFont(label);
+    if (font) sprite.setFont(font); else sprite.setTextFont(0);
+    sprite.setTextDatum(0);
+    sprite.setClipRect(BROWSE_TEXT_X, y, SCREEN_WIDTH - 2 * BROWSE_TEXT_X, BROWSE_ROW_HEIGHT);
+    sprite.drawString(label, BROWSE_TEXT_X, y + 2);
+    sprite.clearClipRect();
+  }
+  sprite.setTextFont(0);
+  sprite.pushSprite(0, 0);
+}
+
+void drawPlaylistPage(M5Canvas& sprite,
+                      AppState& appState,
+                      const unsigned short* grays,
+                      const lgfx::U8g2font* (*detectAndGetFont)(const String&)) {
+  sprite.fillRect(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT, BLACK);
+
+  // Playlist name, position on the right ("+" while more entries are being found)
+  const int count = Playlist::count();
+  const int selected = Playlist::selected();
+  const String& path = Playlist::path();
+  String title = path.substring(path.lastIndexOf('/') + 1);
+  const lgfx::U8g2font* titleFont = detectAndGetFont(title);
+  if (titleFont) sprite.setFont(titleFont); else sprite.setTextFont(0);
+  sprite.setTextDatum(0);
+  sprite.setTextColor(CYAN, BLACK);
+  sprite.setClipRect(BROWSE_TEXT_X, 0, BROWSE_COUNT_X - 48 - BROWSE_TEXT_X, BROWSE_ROWS_Y);
+  sprite.drawString(title, BROWSE_TEXT_X, BROWSE_TITLE_Y);
+  sprite.clearClipRect();
+  sprite.setTextFont(0);
+  sprite.setTextColor(grays[6], BLACK);
+  sprite.setTextDatum(2);
+  sprite.drawString(String(count ? selected + 1 : 0) + "/" + String(count) + (Playlist::complete() ? "" : "+"),
+                    BROWSE_COUNT_X, BROWSE_TITLE_Y);
+  sprite.drawFastHLine(0, BROWSE_ROWS_Y - 2, SCREEN_WIDTH, grays[4]);
+
+  if (count == 0) {
+    sprite.setTextDatum(4);
+    sprite.setTextColor(grays[8], BLACK);
+    sprite.drawString("Empty", SCREEN_WIDTH / 2, BROWSE_ROWS_Y + BROWSE_VISIBLE_ROWS * BROWSE_ROW_HEIGHT / 2);
+    sprite.setTextDatum(0);
+    sprite.pushSprite(0, 0);
+    return;
+  }
+
+  // Entries: the playing one red, those not in the library gray
+  int first = selected - BROWSE_VISIBLE_ROWS / 2;
+  if (first > count - BROWSE_VISIBLE_ROWS) first = count - BROWSE_VISIBLE_ROWS;
+  if (first < 0) first = 0;
+  Playlist::Row rows[BROWSE_VISIBLE_ROWS];
+  const int n = Playlist::rows(appState.tracks, first, BROWSE_VISIBLE_ROWS, rows);
+  for (int i = 0; i < n; i++) {
+    const Playlist::Row& row = rows[i];
+    const int y = BROWSE_ROWS_Y + i * BROWSE_ROW_HEIGHT;
+    if (first + i == selected) {
+      sprite.fillRect(0, y, SCREEN_WIDTH, BROWSE_ROW_HEIGHT, grays[3]);
+      sprite.setTextColor(row.track >= 0 ? WHITE : grays[7], grays[3]);
+    } else if (row.track < 0) {
+      sprite.setTextColor(grays[7], BLACK);
+    } else if (Playlist::active() && Playlist::position() == first + i) {
+      sprite.setTextColor(RED, BLACK);
+    } else {
+      sprite.setTextColor(GREEN, BLACK);
+    }
+    String label = row.track >= 0 ? listName(appState.tracks, row.track) : extractDisplayName(row.name);
+    const lgfx::U8g2font* font = detectAndGetFont(label);
+    if (font) sprite.setFont(font); else sprite.setTextFont(0);
+    sprite.setTextDatum(0);
+    sprite.setClipRect(BROWSE_TEXT_X, y, SCREEN_WIDTH - 2 * BROWSE_TEXT_X, BROWSE_ROW_HEIGHT);
+    sprite.drawString(label, BROWSE_TEXT_X, y + 2);
+    sprite.clearClipRect();
+  }
+  sprite.setTextFont(0);
+  sprite.pushSprite(0, 0);
+}
+
+void drawSearchPage(M5Canvas& sprite,
+                    AppState& appState,
+                    const unsigned short* grays,
+                    const lgfx::U8g2font* (*detectAndGetFont)(const String&)) {
+  sprite.fillRect(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT, BLACK);
+  SearchIndex::refresh(SD);
+
+  // Query line (same layout as the browse page), match count on the right
+  const int count = SearchIndex::resultCount();
+  sprite.setTextFont(0);
+  sprite.setTextDatum(0);
+  sprite.setTextColor(WHITE, BLACK);
+  sprite.drawString(String("> ") + SearchIndex::query() + "_", BROWSE_TEXT_X, BROWSE_TITLE_Y);
+  sprite.setTextColor(grays[6], BLACK);
+  sprite.setTextDatum(2);
+  sprite.drawString(String(count) + (SearchIndex::truncated() ? "+" : ""), BROWSE_COUNT_X, BROWSE_TITLE_Y);
+  sprite.drawFastHLine(0, BROWSE_ROWS_Y - 2, SCREEN_WIDTH, grays[4]);
+
+  if (count == 0) {
+    const char* msg = !SearchIndex::ready()                ? "Index not ready"
+                      : SearchIndex::query().length() == 0 ? "Type a title, artist or file name"
+                                                           : "No match";
+    sprite.setTextDatum(4);
+    sprite.setTextColor(grays[8], BLACK);
+    sprite.drawString(msg, SCREEN_WIDTH / 2, BROWSE_ROWS_Y + BROWSE_VISIBLE_ROWS * BROWSE_ROW_HEIGHT / 2);
+    sprite.setTextDatum(0);
+    sprite.pushSprite(0, 0);
+    return;
+  }
+
+  const int selected = SearchIndex::selected();
+  int first = selected - BROWSE_VISIBLE_ROWS / 2;
+  if (first > count - BROWSE_VISIBLE_ROWS) first = count - BROWSE_VISIBLE_ROWS;
+  if (first < 0) first = 0;
+  int tracks[BROWSE_VISIBLE_ROWS];
+  const int n = SearchIndex::rows(SD, appState.tracks, first, BROWSE_VISIBLE_ROWS, tracks);
+  for (int i = 0; i < n; i++) {
+    const int y = BROWSE_ROWS_Y + i * BROWSE_ROW_HEIGHT;
+    if (first + i == selected) {
+      sprite.fillRect(0, y, SCREEN_WIDTH, BROWSE_ROW_HEIGHT, grays[3]);
+      sprite.setTextColor(WHITE, grays[3]);
+    } else if (tracks[i] >= 0 && tracks[i] == appState.currentPlayingIndex) {
+      sprite.setTextColor(RED, BLACK);
+    } else {
+      sprite.setTextColor(tracks[i] >= 0 ? GREEN : grays[8], BLACK);
+    }
+    String label = tracks[i] >= 0 ? listName(appState.tracks, tracks[i]) : String("-");
+    const lgfx::U8g2font* font = detectAndGetFont(label);
+    if (font) sprite.setFont(font); else sprite.setTextFont(0);
+    sprite.setTextDatum(0);
+    sprite.setClipRect(BROWSE_TEXT_X, y, SCREEN_WIDTH - 2 * BROWSE_TEXT_X, BROWSE_ROW_HEIGHT);
+    sprite.drawString(label, BROWSE_TEXT_X, y + 2);
+    sprite.clearClipRect();
+  }
+  sprite.setTextFont(0);
+  sprite.pushSprite(0, 0);
+}
+
 void drawMainView(M5Canvas& sprite,
                   AppState& appState,
                   const unsigned short* grays,
@@ -323,7 +590,8 @@ void drawMainView(M5Canvas& sprite,
     sprite.fillRect(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT, gray);
     sprite.fillRect(LIST_BOX_X, LIST_BOX_Y, LIST_BOX_WIDTH, LIST_BOX_HEIGHT, BLACK);
     sprite.fillRect(SCROLLBAR_X, SCROLLBAR_Y, SCROLLBAR_WIDTH, SCROLLBAR_HEIGHT, SCROLLBAR_COLOR);
-    sliderPos = map(appState.currentSelectedIndex, 0, appState.fileCount, SCROLLBAR_Y, SCROLLBAR_Y + SCROLLBAR_HEIGHT - SCROLLBAR_THUMB_HEIGHT);
+    const int trackCount = appState.tracks.count();  // Grows while the library is scanned
+    sliderPos = trackCount > 0 ? map(appState.currentSelectedIndex, 0, trackCount, SCROLLBAR_Y, SCROLLBAR_Y + SCROLLBAR_HEIGHT - SCROLLBAR_THUMB_HEIGHT) : SCROLLBAR_Y;
     sprite.fillRect(SCROLLBAR_X, sliderPos, SCROLLBAR_WIDTH, SCROLLBAR_THUMB_HEIGHT, grays[2]);
     sprite.fillRect(SCROLLBAR_X + SCROLLBAR_THUMB_INDICATOR_OFFSET, sliderPos + SCROLLBAR_THUMB_INDICATOR_OFFSET, SCROLLBAR_THUMB_INDICATOR_WIDTH, SCROLLBAR_THUMB_INDICATOR_HEIGHT, grays[16]);
     sprite.fillRect(STATUS_BAR_ORANGE_LINE1_X, STATUS_BAR_ORANGE_LINE1_Y, STATUS_BAR_ORANGE_LINE1_WIDTH, 2, ORANGE);
@@ -386,7 +654,7 @@ void drawMainView(M5Canvas& sprite,
     sprite.setTextDatum(0);
     if (appState.currentSelectedIndex < LIST_SCROLL_THRESHOLD)
       for (int i = 0; i < LIST_VISIBLE_LINES; i++) {
-        if (i < appState.fileCount) {
+        if (i < appState.tracks.count() && !appState.tracks.deleted(i)) {  // A deleted track stays blank until compaction
           if (i == appState.currentPlayingIndex) {
             sprite.setTextColor(RED, BLACK);
           } else if (i == appState.currentSelectedIndex) {
@@ -394,7 +662,7 @@ void drawMainView(M5Canvas& sprite,
           } else {
             sprite.setTextColor(GREEN, BLACK);
           }
-          String fileName = extractDisplayName(appState.audioFiles[i]);
+          String fileName = listName(appState.tracks, i);
           const lgfx::U8g2font* detectedFont = detectAndGetFont(fileName);
           if (detectedFont) {
             sprite.setFont(detectedFont);
@@ -427,7 +695,7 @@ void drawMainView(M5Canvas& sprite,
     int yos = 0;
     if (appState.currentSelectedIndex >= 3)
       for (int i = appState.currentSelectedIndex - 3; i < appState.currentSelectedIndex - 3 + 7; i++) {
-        if (i < appState.fileCount) {
+        if (i < appState.tracks.count() && !appState.tracks.deleted(i)) {
           if (i == appState.currentPlayingIndex) {
             sprite.setTextColor(RED, BLACK);
           } else if (i == appState.currentSelectedIndex) {
@@ -435,7 +703,7 @@ void drawMainView(M5Canvas& sprite,
           } else {
             sprite.setTextColor(GREEN, BLACK);
           }
-          String fileName = extractDisplayName(appState.audioFiles[i]);
+          String fileName = listName(appState.tracks, i);
           const lgfx::U8g2font* detectedFont = detectAndGetFont(fileName);
           if (detectedFont) {
             sprite.setFont(detectedFont);
@@ -471,6 +739,17 @@ void drawMainView(M5Canvas& sprite,
     sprite.drawString("WINAMP", 150, 4);
     sprite.setTextColor(grays[2], gray);
     sprite.drawString("LIST", 58, 0);
+    const LibraryIndex::Progress scan = LibraryIndex::getProgress();
+    if (scan.scanning || scan.validating) {
+      char progressStr[24];
+      snprintf(progressStr, sizeof(progressStr), "%s %d", scan.scanning ? "SCAN" : "CHECK", scan.dirs);
+      sprite.setTextColor(grays[6], gray);
+      sprite.drawString(progressStr, 86, 0);
+      if (trackCount == 0) {
+        sprite.setTextColor(grays[8], BLACK);
+        sprite.drawString("Scanning...", LIST_TEXT_START_X, LIST_TEXT_START_Y);
+      }
+    }
     sprite.setTextColor(grays[4], gray);
     sprite.drawString("VOL", 150, 80);
     sprite.drawString("LIG", 150, 122);
@@ -560,8 +839,8 @@ void drawMainView(M5Canvas& sprite,
       sprite.setTextColor(WHITE, BLACK);
       sprite.setTextDatum(0);
       sprite.drawString("Delete song?", 30, 45);
-      if (appState.currentSelectedIndex < appState.fileCount) {
-        String fileName = extractDisplayName(appState.audioFiles[appState.currentSelectedIndex]);
+      if (appState.currentSelectedIndex < appState.tracks.count()) {
+        String fileName = extractDisplayName(appState.tracks.name(appState.currentSelectedIndex));
         if (fileName.length() > FILENAME_DISPLAY_MAX_LENGTH) {
           fileName = fileName.substring(0, FILENAME_DISPLAY_MAX_LENGTH);
         }
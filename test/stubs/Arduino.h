@@ -0,0 +1,250 @@
+#pragma once
+
+// Host stand-in for the Arduino core and the FreeRTOS calls the tested modules make (native test env only)
+// Tasks run to completion inside xTaskCreate*(), mutexes are always free, heap_caps_* is malloc.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <strings.h>
+
+using std::max;
+using std::min;
+
+#define F(s) s
+#define IRAM_ATTR
+
+// Time
+inline unsigned long micros() {
+  static const auto start = std::chrono::steady_clock::now();
+  return (unsigned long)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start)
+      .count();
+}
+inline unsigned long millis() {
+  return micros() / 1000;
+}
+inline void delay(unsigned long) {}
+
+// Random numbers (rand() keeps runs repeatable unless randomSeed() is called)
+inline void randomSeed(unsigned long seed) {
+  srand((unsigned)seed);
+}
+inline long random(long howBig) {
+  return howBig > 0 ? rand() % howBig : 0;
+}
+inline long random(long howSmall, long howBig) {
+  return howSmall >= howBig ? howSmall : howSmall + random(howBig - howSmall);
+}
+
+// Heap
+#define MALLOC_CAP_SPIRAM (1 << 10)
+#define MALLOC_CAP_INTERNAL (1 << 11)
+#define MALLOC_CAP_8BIT (1 << 2)
+inline void* heap_caps_malloc(size_t size, uint32_t) {
+  return malloc(size);
+}
+inline void* heap_caps_realloc(void* ptr, size_t size, uint32_t) {
+  return realloc(ptr, size);
+}
+inline void heap_caps_free(void* ptr) {
+  free(ptr);
+}
+inline size_t heap_caps_get_free_size(uint32_t) {
+  return 320 * 1024;  // Every MemoryBudget pool gets its internal RAM maximum
+}
+inline size_t heap_caps_get_largest_free_block(uint32_t) {
+  return 128 * 1024;
+}
+inline bool psramFound() {
+  return false;
+}
+inline bool psramInit() {
+  return false;
+}
+inline void* ps_calloc(size_t n, size_t size) {
+  return calloc(n, size);
+}
+
+struct EspClass {
+  uint32_t getFreeHeap() { return 256 * 1024; }
+  uint32_t getMaxAllocHeap() { return 128 * 1024; }
+  uint32_t getPsramSize() { return 0; }
+  uint32_t getFreePsram() { return 0; }
+};
+static EspClass ESP __attribute__((unused));
+
+// FreeRTOS
+typedef int BaseType_t;
+typedef unsigned UBaseType_t;
+typedef uint32_t TickType_t;
+typedef void* TaskHandle_t;
+typedef void* SemaphoreHandle_t;
+typedef void (*TaskFunction_t)(void*);
+#define pdPASS 1
+#define pdTRUE 1
+#define pdFALSE 0
+#define portMAX_DELAY 0xFFFFFFFFu
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+typedef int portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED 0
+#define portENTER_CRITICAL(mux) ((void)(mux))
+#define portEXIT_CRITICAL(mux) ((void)(mux))
+
+inline BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char*, uint32_t, void* arg, UBaseType_t,
+                                          TaskHandle_t* handle, int) {
+  static int dummy;
+  if (handle) *handle = &dummy;  // Set before the task runs, as on the device
+  fn(arg);
+  return pdPASS;
+}
+inline BaseType_t xTaskCreate(TaskFunction_t fn, const char* name, uint32_t stack, void* arg, UBaseType_t prio,
+                              TaskHandle_t* handle) {
+  return xTaskCreatePinnedToCore(fn, name, stack, arg, prio, handle, 0);
+}
+inline void vTaskDelete(TaskHandle_t) {}
+// Called where a task lets the others run, so a test can act as another task meanwhile
+inline std::function<void()>& hostYield() {
+  static std::function<void()> fn;
+  return fn;
+}
+inline void vTaskDelay(TickType_t) {
+  if (hostYield()) hostYield()();
+}
+inline void xTaskNotifyGive(TaskHandle_t) {}
+inline uint32_t ulTaskNotifyTake(BaseType_t, TickType_t) {
+  return 0;
+}
+inline SemaphoreHandle_t xSemaphoreCreateMutex() {
+  static int dummy;
+  return &dummy;
+}
+inline void vSemaphoreDelete(SemaphoreHandle_t) {}
+inline BaseType_t xSemaphoreTake(SemaphoreHandle_t, TickType_t) {
+  return pdTRUE;
+}
+inline BaseType_t xSemaphoreGive(SemaphoreHandle_t) {
+  return pdTRUE;
+}
+
+// Arduino String, the members the modules use
+class String {
+public:
+  String() = default;
+  String(const char* s) : m_s(s ? s : "") {}
+  String(const std::string& s) : m_s(s) {}
+  explicit String(char c) : m_s(1, c) {}
+  explicit String(int v) : m_s(std::to_string(v)) {}
+  explicit String(unsigned v) : m_s(std::to_string(v)) {}
+  explicit String(long v) : m_s(std::to_string(v)) {}
+  explicit String(unsigned long v) : m_s(std::to_string(v)) {}
+
+  const char* c_str() const { return m_s.c_str(); }
+  unsigned int length() const { return m_s.size(); }
+  bool isEmpty() const { return m_s.empty(); }
+  bool reserve(unsigned int n) {
+    m_s.reserve(n);
+    return true;
+  }
+  char operator[](unsigned int i) const { return i < m_s.size() ? m_s[i] : '\0'; }
+  char& operator[](unsigned int i) { return m_s[i]; }
+  char charAt(unsigned int i) const { return (*this)[i]; }
+
+  bool equals(const String& o) const { return m_s == o.m_s; }
+  bool equalsIgnoreCase(const String& o) const { return strcasecmp(c_str(), o.c_str()) == 0; }
+  int compareTo(const String& o) const { return m_s.compare(o.m_s); }
+  bool startsWith(const String& p) const { return m_s.compare(0, p.m_s.size(), p.m_s) == 0; }
+  bool endsWith(const String& p) const {
+    return m_s.size() >= p.m_s.size() && m_s.compare(m_s.size() - p.m_s.size(), p.m_s.size(), p.m_s) == 0;
+  }
+  int indexOf(char c, unsigned int from = 0) const { return pos(m_s.find(c, from)); }
+  int indexOf(const String& s, unsigned int from = 0) const { return pos(m_s.find(s.m_s, from)); }
+  int lastIndexOf(char c) const { return pos(m_s.rfind(c)); }
+  int lastIndexOf(const String& s) const { return pos(m_s.rfind(s.m_s)); }
+  String substring(unsigned int from) const { return from < m_s.size() ? String(m_s.substr(from)) : String(); }
+  String substring(unsigned int from, unsigned int to) const {
+    return from < m_s.size() && to > from ? String(m_s.substr(from, to - from)) : String();
+  }
+
+  void toLowerCase() {
+    for (char& c : m_s) c = tolower((unsigned char)c);
+  }
+  void toUpperCase() {
+    for (char& c : m_s) c = toupper((unsigned char)c);
+  }
+  void trim() {
+    size_t a = m_s.find_first_not_of(" \t\r\n");
+    size_t b = m_s.find_last_not_of(" \t\r\n");
+    m_s = a == std::string::npos ? std::string() : m_s.substr(a, b - a + 1);
+  }
+  void replace(char from, char to) { std::replace(m_s.begin(), m_s.end(), from, to); }
+  void replace(const String& from, const String& to) {
+    if (from.m_s.empty()) return;
+    for (size_t i = m_s.find(from.m_s); i != std::string::npos; i = m_s.find(from.m_s, i + to.m_s.size())) {
+      m_s.replace(i, from.m_s.size(), to.m_s);
+    }
+  }
+  void remove(unsigned int index) {
+    if (index < m_s.size()) m_s.erase(index);
+  }
+  void remove(unsigned int index, unsigned int count) {
+    if (index < m_s.size()) m_s.erase(index, count);
+  }
+  long toInt() const { return atol(m_s.c_str()); }
+
+  bool concat(const char* s, unsigned int n) {
+    m_s.append(s, n);
+    return true;
+  }
+  bool concat(char c) {
+    m_s += c;
+    return true;
+  }
+  String& operator+=(const String& o) {
+    m_s += o.m_s;
+    return *this;
+  }
+  String& operator+=(const char* o) {
+    m_s += o;
+    return *this;
+  }
+  String& operator+=(char c) {
+    m_s += c;
+    return *this;
+  }
+  friend String operator+(const String& a, const String& b) { return String(a.m_s + b.m_s); }
+  friend String operator+(const String& a, const char* b) { return String(a.m_s + b); }
+  friend String operator+(const char* a, const String& b) { return String(a + b.m_s); }
+  bool operator==(const String& o) const { return m_s == o.m_s; }
+  bool operator==(const char* o) const { return m_s == o; }
+  bool operator!=(const String& o) const { return m_s != o.m_s; }
+  bool operator!=(const char* o) const { return m_s != o; }
+  bool operator<(const String& o) const { return m_s < o.m_s; }
+
+private:
+  static int pos(size_t p) { return p == std::string::npos ? -1 : (int)p; }
+  std::string m_s;
+};
+
+// Serial goes to stdout
+struct HardwareSerial {
+  void begin(unsigned long) {}
+  void printf(const char* fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    vprintf(fmt, ap);
+    va_end(ap);
+  }
+  void print(const char* s) { fputs(s, stdout); }
+  void print(const String& s) { print(s.c_str()); }
+  void print(long v) { ::printf("%ld", v); }
+  void println(const char* s = "") { ::printf("%s\n", s); }
+  void println(const String& s) { println(s.c_str()); }
+  void println(long v) { ::printf("%ld\n", v); }
+};
+static HardwareSerial Serial __attribute__((unused));
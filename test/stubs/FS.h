@@ -0,0 +1,114 @@
+#pragma once
+
+// Host stand-in for the Arduino FS API: paths are relative to hostRoot(), a directory the test fills
+// the way the card would look.
+
+#include <Arduino.h>
+#include <dirent.h>
+#include "host_fs.h"
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstdio>
+#include <ctime>
+#include <memory>
+#include <string>
+
+#define FILE_READ "r"
+#define FILE_WRITE "w"
+#define FILE_APPEND "a"
+
+namespace fs {
+
+enum SeekMode { SeekSet = 0, SeekCur = 1, SeekEnd = 2 };
+
+class File {
+public:
+  File() = default;
+  File(const std::string& path, const char* mode) : m_path(path) {
+    struct stat st;
+    std::string host = hostRoot() + path;
+    if (mode[0] == 'r' && stat(host.c_str(), &st) == 0 && S_ISDIR(st.st_mode)) {
+      m_dir = std::shared_ptr<DIR>(opendir(host.c_str()), [](DIR* d) { if (d) closedir(d); });
+      return;
+    }
+    FILE* fp = fopen(host.c_str(), mode[0] == 'w' ? "wb" : mode[0] == 'a' ? "ab" : "rb");
+    if (fp) m_fp = std::shared_ptr<FILE>(fp, [](FILE* f) { fclose(f); });
+  }
+
+  explicit operator bool() const { return m_fp || m_dir; }
+  void close() {
+    m_fp.reset();
+    m_dir.reset();
+  }
+  bool isDirectory() const { return (bool)m_dir; }
+  const char* path() const { return m_path.c_str(); }
+  const char* name() const { return m_path.c_str() + m_path.rfind('/') + 1; }
+
+  size_t read(uint8_t* buf, size_t n) { return m_fp ? fread(buf, 1, n, m_fp.get()) : 0; }
+  int read() {
+    uint8_t c;
+    return read(&c, 1) == 1 ? c : -1;
+  }
+  size_t write(const uint8_t* buf, size_t n) { return m_fp ? fwrite(buf, 1, n, m_fp.get()) : 0; }
+  size_t write(uint8_t c) { return write(&c, 1); }
+  void flush() {
+    if (m_fp) fflush(m_fp.get());
+  }
+  bool seek(uint32_t pos, SeekMode mode = SeekSet) {
+    return m_fp && fseek(m_fp.get(), (long)pos, mode == SeekSet ? SEEK_SET : mode == SeekCur ? SEEK_CUR : SEEK_END) == 0;
+  }
+  size_t position() const { return m_fp ? (size_t)ftell(m_fp.get()) : 0; }
+  size_t size() const {
+    if (!m_fp) return 0;
+    long cur = ftell(m_fp.get());
+    fseek(m_fp.get(), 0, SEEK_END);
+    long end = ftell(m_fp.get());
+    fseek(m_fp.get(), cur, SEEK_SET);
+    return (size_t)end;
+  }
+  int available() const { return (int)(size() - position()); }
+  time_t getLastWrite() const {
+    struct stat st;
+    return stat((hostRoot() + m_path).c_str(), &st) == 0 ? st.st_mtime : 0;
+  }
+
+  File openNextFile(const char* mode = FILE_READ) {
+    if (!m_dir) return File();
+    while (struct dirent* e = readdir(m_dir.get())) {
+      if (strcmp(e->d_name, ".") == 0 || strcmp(e->d_name, "..") == 0) continue;
+      return File((m_path == "/" ? "" : m_path) + "/" + e->d_name, mode);
+    }
+    return File();
+  }
+
+private:
+  std::string m_path;
+  std::shared_ptr<FILE> m_fp;
+  std::shared_ptr<DIR> m_dir;
+};
+
+class FS {
+public:
+  File open(const char* path, const char* mode = FILE_READ, bool = false) { return File(path, mode); }
+  File open(const String& path, const char* mode = FILE_READ, bool = false) { return open(path.c_str(), mode); }
+  bool exists(const char* path) {
+    struct stat st;
+    return stat(host(path).c_str(), &st) == 0;
+  }
+  bool exists(const String& path) { return exists(path.c_str()); }
+  bool remove(const char* path) { return ::remove(host(path).c_str()) == 0; }
+  bool remove(const String& path) { return remove(path.c_str()); }
+  bool rename(const char* from, const char* to) { return ::rename(host(from).c_str(), host(to).c_str()) == 0; }
+  bool rename(const String& from, const String& to) { return rename(from.c_str(), to.c_str()); }
+  bool mkdir(const char* path) { return ::mkdir(host(path).c_str(), 0777) == 0; }
+  bool mkdir(const String& path) { return mkdir(path.c_str()); }
+  bool rmdir(const char* path) { return ::rmdir(host(path).c_str()) == 0; }
+
+private:
+  static std::string host(const char* path) { return hostRoot() + path; }
+};
+
+}  // namespace fs
+
+using fs::File;
+using fs::FS;
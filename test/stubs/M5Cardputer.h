@@ -0,0 +1,22 @@
+#pragma once
+
+// Host stand-in for M5Cardputer.h: lgfx::DataWrapper, the interface FileRange and JpegThumb read through,
+// and M5Canvas as an incomplete type for the headers that mention it
+
+#include <Arduino.h>
+
+namespace lgfx {
+
+struct DataWrapper {
+  virtual ~DataWrapper() = default;
+  virtual int read(uint8_t* buf, uint32_t len) = 0;
+  virtual void skip(int32_t offset) = 0;
+  virtual bool seek(uint32_t offset) = 0;
+  virtual void close() = 0;
+  virtual int32_t tell() = 0;
+  bool need_transaction = false;
+};
+
+}  // namespace lgfx
+
+class M5Canvas;
@@ -0,0 +1,18 @@
+#pragma once
+
+// The modules list directories through the VFS (opendir on SD_MOUNT_POINT + path); on the host the
+// mount point is hostRoot(). Other paths are passed through.
+
+#include_next <dirent.h>
+#include <cstring>
+#include "host_fs.h"
+
+inline DIR* hostOpendir(const char* path) {
+  static const char MOUNT[] = "/sd";  // SD_MOUNT_POINT
+  const size_t n = sizeof(MOUNT) - 1;
+  if (strncmp(path, MOUNT, n) == 0 && (path[n] == '/' || path[n] == '\0')) {
+    return opendir((hostRoot() + (path[n] ? path + n : "/")).c_str());
+  }
+  return opendir(path);
+}
+#define opendir(path) hostOpendir(path)
@@ -0,0 +1,10 @@
+#pragma once
+
+// Host directory that stands in for the card; each test points it at its own fixture tree
+
+#include <string>
+
+inline std::string& hostRoot() {
+  static std::string root;
+  return root;
+}
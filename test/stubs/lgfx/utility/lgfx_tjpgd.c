@@ -0,0 +1,384 @@
+// Host stand-in for M5GFX's TJpgDec (lgfx_tjpgd.c), baseline JPEG only
+// Works like TJpgDec: headers and tables go into the caller's work area, MCUs are decoded one by one and handed
+// to the output function as RGB888. Every coefficient is Huffman decoded at any scale; 1/2 and 1/4 keep every
+// 2nd/4th pixel of the inverse DCT, 1/8 uses the DC coefficient alone.
+
+#include "lgfx_tjpgd.h"
+#include <math.h>
+#include <string.h>
+
+#define INBUF_SIZE 512
+
+static const uint8_t ZIGZAG[64] = {0,  1,  8,  16, 9,  2,  3,  10, 17, 24, 32, 25, 18, 11, 4,  5,
+                                   12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13, 6,  7,  14, 21, 28,
+                                   35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+                                   58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63};
+
+static void* alloc(lgfxJdec* jd, uint32_t bytes) {
+  bytes = (bytes + sizeof(void*) - 1) & ~(uint32_t)(sizeof(void*) - 1);  // Keeps the tables aligned
+  if (bytes > jd->poolLeft) return NULL;
+  void* p = jd->pool;
+  jd->pool += bytes;
+  jd->poolLeft -= bytes;
+  return p;
+}
+
+// ---- Input ----
+
+static int fill(lgfxJdec* jd) {
+  jd->inPos = 0;
+  jd->inLen = jd->infunc(jd, jd->inbuf, INBUF_SIZE);
+  return jd->inLen > 0;
+}
+
+static int readByte(lgfxJdec* jd) {
+  if (jd->inPos >= jd->inLen && !fill(jd)) {
+    jd->inputError = 1;
+    return -1;
+  }
+  return jd->inbuf[jd->inPos++];
+}
+
+static int readWord(lgfxJdec* jd) {
+  int hi = readByte(jd);
+  int lo = readByte(jd);
+  return hi < 0 || lo < 0 ? -1 : hi << 8 | lo;
+}
+
+static int skipBytes(lgfxJdec* jd, int n) {
+  while (n-- > 0) {
+    if (readByte(jd) < 0) return 0;
+  }
+  return 1;
+}
+
+// Next bit of the entropy data; a marker ends it (zeros from there on)
+static int readBit(lgfxJdec* jd) {
+  if (jd->bitCount == 0) {
+    int b = 0;
+    if (!jd->marker) {
+      b = readByte(jd);
+      if (b < 0) return 0;
+      if (b == 0xFF) {
+        int next = readByte(jd);
+        if (next < 0) return 0;
+        if (next != 0) {
+          jd->marker = next;
+          b = 0;
+        }
+      }
+    }
+    jd->bitBuf = b;
+    jd->bitCount = 8;
+  }
+  jd->bitCount--;
+  return (jd->bitBuf >> jd->bitCount) & 1;
+}
+
+static int readBits(lgfxJdec* jd, int n) {
+  int v = 0;
+  while (n--) v = v << 1 | readBit(jd);
+  return v;
+}
+
+static int extend(int v, int n) {
+  return n && v < (1 << (n - 1)) ? v - (1 << n) + 1 : v;
+}
+
+static int decodeHuff(lgfxJdec* jd, const lgfxJhuff* h) {
+  int code = 0;
+  for (int len = 0; len < 16; len++) {
+    code = code << 1 | readBit(jd);
+    if (h->bits[len] && code <= h->maxcode[len]) return h->vals[h->valptr[len] + code - h->mincode[len]];
+  }
+  return -1;
+}
+
+// ---- Headers ----
+
+static JRESULT readDqt(lgfxJdec* jd, int len) {
+  while (len > 0) {
+    int pq = readByte(jd);
+    if (pq < 0) return JDR_INP;
+    if (pq >> 4) return JDR_FMT3;  // 16 bit tables
+    int id = pq & 3;
+    if (!jd->qt[id] && !(jd->qt[id] = (int16_t*)alloc(jd, 64 * sizeof(int16_t)))) return JDR_MEM1;
+    for (int i = 0; i < 64; i++) {
+      int q = readByte(jd);
+      if (q < 0) return JDR_INP;
+      jd->qt[id][i] = q;  // Zigzag order
+    }
+    len -= 65;
+  }
+  return JDR_OK;
+}
+
+static JRESULT readDht(lgfxJdec* jd, int len) {
+  while (len > 0) {
+    int tc = readByte(jd);
+    if (tc < 0) return JDR_INP;
+    int cls = tc >> 4, id = tc & 15;
+    if (cls > 1 || id > 1) return JDR_FMT1;
+    lgfxJhuff* h = jd->huff[cls][id];
+    if (!h && !(h = jd->huff[cls][id] = (lgfxJhuff*)alloc(jd, sizeof(lgfxJhuff)))) return JDR_MEM1;
+    int n = 0;
+    for (int i = 0; i < 16; i++) {
+      int b = readByte(jd);
+      if (b < 0) return JDR_INP;
+      h->bits[i] = b;
+      n += b;
+    }
+    if (n > 256 || !(h->vals = (uint8_t*)alloc(jd, n))) return n > 256 ? JDR_FMT1 : JDR_MEM1;
+    for (int i = 0; i < n; i++) {
+      int v = readByte(jd);
+      if (v < 0) return JDR_INP;
+      h->vals[i] = v;
+    }
+    // Canonical codes: the first code and symbol of each length
+    int code = 0, k = 0;
+    for (int i = 0; i < 16; i++) {
+      h->valptr[i] = k;
+      h->mincode[i] = code;
+      code += h->bits[i];
+      k += h->bits[i];
+      h->maxcode[i] = h->bits[i] ? code - 1 : -1;
+      code <<= 1;
+    }
+    len -= 17 + n;
+  }
+  return JDR_OK;
+}
+
+static JRESULT readSof(lgfxJdec* jd, int len) {
+  int precision = readByte(jd);
+  int h = readWord(jd), w = readWord(jd), nc = readByte(jd);
+  if (nc < 0) return JDR_INP;
+  if (precision != 8) return JDR_FMT3;
+  if ((nc != 1 && nc != 3) || w <= 0 || h <= 0 || len != 6 + 3 * nc) return JDR_FMT3;
+  jd->width = w;
+  jd->height = h;
+  jd->ncomp = nc;
+  for (int c = 0; c < nc; c++) {
+    readByte(jd);  // Component id
+    int samp = readByte(jd), tq = readByte(jd);
+    if (tq < 0) return JDR_INP;
+    jd->qtid[c] = tq & 3;
+    if (c == 0) {
+      jd->msx = samp >> 4;
+      jd->msy = samp & 15;
+      if (nc == 1) jd->msx = jd->msy = 1;
+      if (jd->msx < 1 || jd->msx > 2 || jd->msy < 1 || jd->msy > 2) return JDR_FMT3;
+    } else if (samp != 0x11) {
+      return JDR_FMT3;  // Chroma at the lowest sampling only
+    }
+  }
+  return JDR_OK;
+}
+
+static JRESULT readSos(lgfxJdec* jd, int len) {
+  int nc = readByte(jd);
+  if (nc != jd->ncomp || len != 4 + 2 * nc) return JDR_FMT3;
+  for (int c = 0; c < nc; c++) {
+    readByte(jd);
+    int t = readByte(jd);
+    if (t < 0) return JDR_INP;
+    jd->hdc[c] = (t >> 4) & 1;
+    jd->hac[c] = t & 1;
+    if (!jd->huff[0][jd->hdc[c]] || !jd->huff[1][jd->hac[c]] || !jd->qt[jd->qtid[c]]) return JDR_FMT1;
+  }
+  return skipBytes(jd, 3) ? JDR_OK : JDR_INP;  // Spectral selection and approximation of a baseline scan
+}
+
+JRESULT lgfx_jd_prepare(lgfxJdec* jd, uint32_t (*infunc)(lgfxJdec*, uint8_t*, uint32_t), void* pool,
+                        uint32_t sz_pool, void* dev) {
+  if (!pool) return JDR_PAR;
+  memset(jd, 0, sizeof(*jd));
+  jd->infunc = infunc;
+  jd->device = dev;
+  jd->pool = (uint8_t*)pool;
+  jd->poolLeft = sz_pool;
+  if (!(jd->inbuf = (uint8_t*)alloc(jd, INBUF_SIZE))) return JDR_MEM1;
+  if (readWord(jd) != 0xFFD8) return jd->inputError ? JDR_INP : JDR_FMT1;
+  for (;;) {
+    int marker = readWord(jd);
+    int len = readWord(jd);
+    if (len < 0) return JDR_INP;
+    if ((marker >> 8) != 0xFF || len < 2) return JDR_FMT1;
+    len -= 2;
+    JRESULT rc = JDR_OK;
+    switch (marker & 0xFF) {
+      case 0xC0:
+        rc = readSof(jd, len);
+        break;
+      case 0xC4:
+        rc = readDht(jd, len);
+        break;
+      case 0xDB:
+        rc = readDqt(jd, len);
+        break;
+      case 0xDD:
+        jd->nrst = readWord(jd);
+        rc = jd->inputError ? JDR_INP : JDR_OK;
+        break;
+      case 0xDA:
+        if (!jd->width) return JDR_FMT1;
+        rc = readSos(jd, len);
+        if (rc != JDR_OK) return rc;
+        // MCU coefficients and samples, the scaled RGB output
+        jd->mcubuf = (int16_t*)alloc(jd, (jd->msx * jd->msy + 2) * 64 * sizeof(int16_t));
+        jd->rgb = (uint8_t*)alloc(jd, jd->msx * jd->msy * 64 * 3);
+        return jd->mcubuf && jd->rgb ? JDR_OK : JDR_MEM2;
+      case 0xC1: case 0xC2: case 0xC3: case 0xC5: case 0xC6: case 0xC7:
+      case 0xC9: case 0xCA: case 0xCB: case 0xCD: case 0xCE: case 0xCF:
+        return JDR_FMT3;  // Not baseline
+      default:
+        rc = skipBytes(jd, len) ? JDR_OK : JDR_INP;
+        break;
+    }
+    if (rc != JDR_OK) return rc;
+  }
+}
+
+// ---- Decoding ----
+
+static float s_cos[8][8];  // C(u) / 2 * cos((2x + 1) u pi / 16)
+
+static void initCos(void) {
+  if (s_cos[0][0] != 0) return;
+  for (int x = 0; x < 8; x++) {
+    for (int u = 0; u < 8; u++) s_cos[x][u] = (u ? 0.5f : 0.35355339f) * cosf((2 * x + 1) * u * 3.14159265f / 16);
+  }
+}
+
+// Dequantized coefficients in natural order to samples (level shifted, clipped)
+static void idct(int16_t* blk) {
+  float tmp[64];
+  for (int y = 0; y < 8; y++) {
+    for (int u = 0; u < 8; u++) {
+      float s = 0;
+      for (int v = 0; v < 8; v++) s += s_cos[y][v] * blk[v * 8 + u];
+      tmp[y * 8 + u] = s;
+    }
+  }
+  for (int y = 0; y < 8; y++) {
+    for (int x = 0; x < 8; x++) {
+      float s = 128;
+      for (int u = 0; u < 8; u++) s += s_cos[x][u] * tmp[y * 8 + u];
+      int v = (int)lrintf(s);
+      blk[y * 8 + x] = v < 0 ? 0 : v > 255 ? 255 : v;
+    }
+  }
+}
+
+static JRESULT decodeBlock(lgfxJdec* jd, int c, int16_t* blk) {
+  const int16_t* q = jd->qt[jd->qtid[c]];
+  memset(blk, 0, 64 * sizeof(int16_t));
+  int s = decodeHuff(jd, jd->huff[0][jd->hdc[c]]);
+  if (s < 0 || s > 11) return jd->inputError ? JDR_INP : JDR_FMT1;
+  jd->dcv[c] += extend(readBits(jd, s), s);
+  blk[0] = jd->dcv[c] * q[0];
+  for (int k = 1; k < 64;) {
+    int rs = decodeHuff(jd, jd->huff[1][jd->hac[c]]);
+    if (rs < 0) return jd->inputError ? JDR_INP : JDR_FMT1;
+    int r = rs >> 4;
+    s = rs & 15;
+    if (!s) {
+      if (r != 15) break;  // End of block
+      k += 16;
+      continue;
+    }
+    k += r;
+    if (k > 63) return JDR_FMT1;
+    blk[ZIGZAG[k]] = extend(readBits(jd, s), s) * q[k];
+    k++;
+  }
+  if (jd->inputError) return JDR_INP;
+  if (jd->scale == 3) {
+    int v = 128 + (blk[0] + 4) / 8;  // DC only: the mean of the block
+    blk[0] = v < 0 ? 0 : v > 255 ? 255 : v;
+  } else {
+    idct(blk);
+  }
+  return JDR_OK;
+}
+
+// RSTn marker: byte aligned, the DC predictions start over
+static JRESULT restart(lgfxJdec* jd) {
+  jd->bitCount = 0;
+  if (!jd->marker) {
+    int b;
+    do {
+      b = readByte(jd);
+    } while (b >= 0 && b != 0xFF);
+    while (b == 0xFF) b = readByte(jd);
+    if (b < 0) return JDR_INP;
+    jd->marker = b;
+  }
+  if (jd->marker < 0xD0 || jd->marker > 0xD7) return JDR_FMT1;
+  jd->marker = 0;
+  jd->dcv[0] = jd->dcv[1] = jd->dcv[2] = 0;
+  return JDR_OK;
+}
+
+static uint8_t clip(float v) {
+  return v < 0 ? 0 : v > 255 ? 255 : (uint8_t)lrintf(v);
+}
+
+JRESULT lgfx_jd_decomp(lgfxJdec* jd, uint32_t (*outfunc)(lgfxJdec*, void*, JRECT*), uint8_t scale) {
+  if (scale > 3) return JDR_PAR;
+  initCos();
+  jd->scale = scale;
+  const int mcuW = jd->msx * 8, mcuH = jd->msy * 8;
+  const int nY = jd->msx * jd->msy;
+  uint16_t rst = 0;
+  for (int my = 0; my < jd->height; my += mcuH) {
+    for (int mx = 0; mx < jd->width; mx += mcuW) {
+      if (jd->nrst && rst++ == jd->nrst) {
+        JRESULT rc = restart(jd);
+        if (rc != JDR_OK) return rc;
+        rst = 1;
+      }
+      for (int b = 0; b < nY + (jd->ncomp == 3 ? 2 : 0); b++) {
+        JRESULT rc = decodeBlock(jd, b < nY ? 0 : b - nY + 1, jd->mcubuf + b * 64);
+        if (rc != JDR_OK) return rc;
+      }
+
+      // Scaled MCU clipped to the image (TJpgDec drops the partial pixels of the last column and row)
+      JRECT rect;
+      rect.left = mx >> scale;
+      rect.top = my >> scale;
+      int right = ((mx + mcuW < jd->width ? mx + mcuW : jd->width) >> scale) - 1;
+      int bottom = ((my + mcuH < jd->height ? my + mcuH : jd->height) >> scale) - 1;
+      if (right < rect.left || bottom < rect.top) continue;
+      rect.right = right;
+      rect.bottom = bottom;
+      const int w = right - rect.left + 1, h = bottom - rect.top + 1;
+      const int16_t* cb = jd->mcubuf + nY * 64;
+      const int16_t* cr = cb + 64;
+      uint8_t* out = jd->rgb;
+      for (int oy = 0; oy < h; oy++) {
+        for (int ox = 0; ox < w; ox++) {
+          // Sample of the output pixel in the MCU; at 1/8 every block is one pixel
+          int sx = ox << scale, sy = oy << scale;
+          int yIdx = (oy * jd->msx + ox) * 64, cIdx = 0;
+          if (scale < 3) {
+            yIdx = ((sy >> 3) * jd->msx + (sx >> 3)) * 64 + (sy & 7) * 8 + (sx & 7);
+            cIdx = (sy / jd->msy) * 8 + sx / jd->msx;
+          }
+          float y = jd->mcubuf[yIdx];
+          if (jd->ncomp == 1) {
+            out[0] = out[1] = out[2] = (uint8_t)y;
+          } else {
+            float u = cb[cIdx] - 128.0f, v = cr[cIdx] - 128.0f;
+            out[0] = clip(y + 1.402f * v);
+            out[1] = clip(y - 0.344136f * u - 0.714136f * v);
+            out[2] = clip(y + 1.772f * u);
+          }
+          out += 3;
+        }
+      }
+      if (!outfunc(jd, jd->rgb, &rect)) return JDR_INTR;
+    }
+  }
+  return JDR_OK;
+}
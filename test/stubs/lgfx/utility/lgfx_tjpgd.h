@@ -0,0 +1,70 @@
+#pragma once
+
+// Host stand-in for M5GFX's TJpgDec (lgfx_tjpgd.h): the calls and fields JpegThumb uses, same meaning.
+// The decoder is lgfx_tjpgd.c next to this header (baseline JPEG only).
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+  JDR_OK = 0,  // Succeeded
+  JDR_INTR,    // Interrupted by the output function
+  JDR_INP,     // Input stream ended or failed
+  JDR_MEM1,    // Work area too small
+  JDR_MEM2,    // Work area too small for the MCU buffers
+  JDR_PAR,     // Wrong parameter
+  JDR_FMT1,    // Broken data
+  JDR_FMT2,    // Right format but not supported
+  JDR_FMT3     // Not supported (progressive, arithmetic coding, 12 bit)
+} JRESULT;
+
+typedef struct {
+  uint16_t left, right, top, bottom;
+} JRECT;
+
+typedef struct {
+  uint8_t bits[16];   // Codes of each length
+  uint8_t* vals;      // Symbols in code order
+  int32_t maxcode[17];
+  uint16_t mincode[16];
+  int16_t valptr[16];
+} lgfxJhuff;
+
+typedef struct lgfxJdec lgfxJdec;
+struct lgfxJdec {
+  uint16_t width, height;  // Image size
+  uint8_t msx, msy;        // MCU size in blocks
+  uint8_t scale;           // 0..3 = 1/1 .. 1/8
+  uint8_t ncomp;           // 1 (gray) or 3 (YCbCr)
+  void* device;            // The dev argument of lgfx_jd_prepare()
+
+  // Decoder state
+  uint32_t (*infunc)(lgfxJdec*, uint8_t*, uint32_t);
+  uint8_t* pool;
+  uint32_t poolLeft;
+  uint8_t* inbuf;
+  uint32_t inLen, inPos;
+  uint32_t bitBuf;
+  int bitCount;
+  int marker;              // Marker met in the entropy data, 0 = none
+  int inputError;
+  int16_t* qt[4];
+  uint8_t qtid[3];
+  uint8_t hdc[3], hac[3];  // Huffman table ids of each component
+  lgfxJhuff* huff[2][2];   // [DC/AC][id]
+  int16_t dcv[3];
+  uint16_t nrst;           // Restart interval, 0 = none
+  int16_t* mcubuf;         // Coefficients, then samples of the blocks of one MCU
+  uint8_t* rgb;            // Scaled MCU as RGB888
+};
+
+JRESULT lgfx_jd_prepare(lgfxJdec* jd, uint32_t (*infunc)(lgfxJdec*, uint8_t*, uint32_t), void* pool,
+                        uint32_t sz_pool, void* dev);
+JRESULT lgfx_jd_decomp(lgfxJdec* jd, uint32_t (*outfunc)(lgfxJdec*, void*, JRECT*), uint8_t scale);
+
+#ifdef __cplusplus
+}
+#endif
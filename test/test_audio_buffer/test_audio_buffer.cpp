@@ -0,0 +1,151 @@
+// AudioBuffer: frames that straddle the end of the ring are read in one piece through the mirrored head
+#include <unity.h>
+#include "../../lib/ESP32-audioI2S/AudioBuffer.cpp"
+
+static constexpr size_t BLOCK = 64;        // Max frame size, also the reserve behind m_endPtr
+static constexpr size_t RING = 4 * BLOCK;  // m_buffSize
+
+// Stream byte n, the period is prime so no frame repeats at the ring size
+static uint8_t streamByte(uint32_t n) {
+  return (uint8_t)(n % 251);
+}
+
+// Writer and reader as Audio::processLocalFile drives them: the reader only takes a frame while more
+// than that is buffered, so the ring is never drained completely
+struct Stream {
+  AudioBuffer buf{BLOCK};
+  uint32_t written = 0;
+  uint32_t read = 0;
+
+  Stream() {
+    buf.setBufsize(RING + BLOCK, 0);
+    TEST_ASSERT_EQUAL(RING, buf.init());
+  }
+  void write(size_t n) {
+    TEST_ASSERT_LESS_OR_EQUAL(buf.writeSpace(), n);
+    uint8_t* p = buf.getWritePtr();
+    for (size_t i = 0; i < n; i++) p[i] = streamByte(written++);
+    buf.bytesWritten(n);
+  }
+  // Fill up to the read position (as much as writeSpace() allows, in two steps at the wrap)
+  void fill() {
+    while (size_t n = buf.writeSpace()) {
+      if (buf.freeSpace() == 0) break;
+      write(min(n, buf.freeSpace()));
+    }
+  }
+  // Check the next n bytes at getReadPtr() and consume them
+  void frame(size_t n) {
+    TEST_ASSERT_GREATER_THAN(n, buf.bufferFilled());
+    const uint8_t* p = buf.getReadPtr();
+    for (size_t i = 0; i < n; i++) {
+      if (p[i] != streamByte(read + i)) {
+        char msg[96];
+        snprintf(msg, sizeof(msg), "frame of %u at ring offset %u: byte %u wrong", (unsigned)n,
+                 (unsigned)buf.getReadPos(), (unsigned)i);
+        TEST_FAIL_MESSAGE(msg);
+      }
+    }
+    read += n;
+    buf.bytesWasRead(n);
+  }
+  // Read (without checking) until the read position is at pos
+  void skipTo(size_t pos) {
+    while (buf.getReadPos() != pos) {
+      size_t step = (pos + RING - buf.getReadPos()) % RING;
+      step = min(step, min(BLOCK, buf.bufferFilled() - 1));
+      if (step == 0) fill();
+      read += step;
+      buf.bytesWasRead(step);
+    }
+  }
+};
+
+void setUp() {}
+void tearDown() {}
+
+static void test_frame_ending_at_the_end() {
+  Stream s;
+  s.fill();
+  s.skipTo(RING - BLOCK);
+  s.fill();
+  s.frame(BLOCK);
+  TEST_ASSERT_EQUAL(0, s.buf.getReadPos());
+}
+
+// Every split of a full frame between the tail and the head of the ring
+static void test_frame_straddling_the_end() {
+  for (size_t tail = 1; tail < BLOCK; tail++) {
+    Stream s;
+    s.fill();
+    s.skipTo(RING - tail);
+    s.fill();
+    s.frame(BLOCK);
+    TEST_ASSERT_EQUAL(BLOCK - tail, s.buf.getReadPos());
+  }
+}
+
+// The head is written in pieces, some of them across the end of the mirrored part
+static void test_head_written_in_pieces() {
+  const size_t pieces[] = {1, 7, 40, 30, 50};
+  Stream s;
+  s.fill();
+  s.skipTo(RING - 10);
+  s.write(s.buf.writeSpace());  // Up to the end
+  TEST_ASSERT_EQUAL(0, s.buf.getWritePos());
+  size_t head = 0;
+  for (size_t n : pieces) {
+    s.write(n);
+    head += n;
+  }
+  TEST_ASSERT_EQUAL(head, s.buf.getWritePos());
+  s.frame(BLOCK);
+}
+
+// A larger max block size (FLAC) mirrors the part of the head that was written before
+static void test_max_block_size_raised() {
+  Stream s;
+  s.buf.changeMaxBlockSize(16);
+  s.fill();
+  s.skipTo(RING - 8);
+  s.fill();  // Head written while only 16 bytes were mirrored
+  s.buf.changeMaxBlockSize(BLOCK);
+  s.frame(BLOCK);
+}
+
+// Writer and reader at random sizes for many laps of the ring
+static void test_random_laps() {
+  randomSeed(1);
+  Stream s;
+  while (s.read < 200 * RING) {
+    if (random(2)) {
+      size_t space = min(s.buf.writeSpace(), s.buf.freeSpace());
+      if (space) s.write(1 + random(space));
+    } else if (s.buf.bufferFilled() > 1) {
+      s.frame(1 + random(min(BLOCK, s.buf.bufferFilled() - 1)));
+    }
+  }
+}
+
+static void test_reset() {
+  Stream s;
+  s.fill();
+  s.skipTo(RING - 5);
+  s.buf.resetBuffer();
+  TEST_ASSERT_EQUAL(0, s.buf.bufferFilled());
+  TEST_ASSERT_EQUAL(RING - 1, s.buf.writeSpace());
+  s.read = s.written;
+  s.write(BLOCK + 1);
+  s.frame(BLOCK);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_frame_ending_at_the_end);
+  RUN_TEST(test_frame_straddling_the_end);
+  RUN_TEST(test_head_written_in_pieces);
+  RUN_TEST(test_max_block_size_raised);
+  RUN_TEST(test_random_laps);
+  RUN_TEST(test_reset);
+  return UNITY_END();
+}
@@ -0,0 +1,263 @@
+// Cover scanner: signatures across read boundaries and the picture frame header parser, on synthetic blobs
+#include <unity.h>
+#include <SD.h>
+#include <vector>
+#include "../../src/memory_budget.cpp"
+#include "../../src/file_range.cpp"
+#include "../../src/image_utils.cpp"
+
+typedef std::vector<uint8_t> Blob;
+
+// Source for the scanner templates that hands out at most chunk bytes per read
+class MemorySource {
+public:
+  MemorySource(const Blob& data, size_t chunk = SIZE_MAX) : m_data(data), m_chunk(chunk) {}
+  size_t read(uint8_t* buf, size_t len) {
+    len = min(min(len, m_chunk), m_data.size() - m_pos);
+    memcpy(buf, m_data.data() + m_pos, len);
+    m_pos += len;
+    return len;
+  }
+  int read() { return m_pos < m_data.size() ? m_data[m_pos++] : -1; }
+  bool seek(size_t pos) {
+    m_pos = min(pos, m_data.size());
+    return m_pos == pos;
+  }
+  size_t position() const { return m_pos; }
+
+private:
+  const Blob& m_data;
+  size_t m_chunk;
+  size_t m_pos = 0;
+};
+
+struct Case {
+  ImageFormat format;
+  Blob magic;
+};
+static const Case IMAGES[] = {
+    {ImageFormat::JPEG, {0xFF, 0xD8, 0xFF, 0xE0}},
+    {ImageFormat::PNG, {0x89, 'P', 'N', 'G', 0x0D, 0x0A, 0x1A, 0x0A}},
+    {ImageFormat::BMP, {'B', 'M'}},
+    {ImageFormat::GIF, {'G', 'I', 'F', '8', '9', 'a'}},
+    {ImageFormat::GIF, {'G', 'I', 'F', '8', '7', 'a'}},
+    {ImageFormat::QOI, {'q', 'o', 'i', 'f'}},
+};
+
+// Filler that contains no signature (not even a first byte of one)
+static Blob noise(size_t n) {
+  Blob b(n);
+  for (size_t i = 0; i < n; i++) b[i] = 0x20 + i % 31;
+  return b;
+}
+
+static Blob withImageAt(size_t at, const Blob& magic, size_t total) {
+  Blob b = noise(total);
+  std::copy(magic.begin(), magic.end(), b.begin() + at);
+  return b;
+}
+
+static void expectFound(const Blob& data, size_t chunk, size_t maxToScan, size_t at, ImageFormat format) {
+  MemorySource src(data, chunk);
+  size_t off = 0;
+  ImageFormat got = ImageFormat::Unknown;
+  char msg[80];
+  snprintf(msg, sizeof(msg), "image at %u, reads of %u", (unsigned)at, (unsigned)chunk);
+  TEST_ASSERT_TRUE_MESSAGE(findImageStartIn(src, maxToScan, off, got), msg);
+  TEST_ASSERT_EQUAL_INT_MESSAGE(at, off, msg);
+  TEST_ASSERT_EQUAL_INT_MESSAGE((int)format, (int)got, msg);
+}
+
+void setUp() {}
+void tearDown() {}
+
+// Every signature at every position around the end of the first read block
+static void test_signature_across_read_blocks() {
+  const size_t total = 3 * COVER_SCAN_READ_SIZE;
+  for (const Case& c : IMAGES) {
+    for (size_t at = COVER_SCAN_READ_SIZE - SIGNATURE_MAX - 1; at <= COVER_SCAN_READ_SIZE + 1; at++) {
+      expectFound(withImageAt(at, c.magic, total), COVER_SCAN_READ_SIZE, total, at, c.format);
+    }
+  }
+}
+
+// Short reads (a slow card, the end of a FileRange block) move the block edges around
+static void test_signature_across_short_reads() {
+  const size_t chunks[] = {1, 3, 7, 100, 1000};
+  for (size_t chunk : chunks) {
+    for (const Case& c : IMAGES) {
+      for (size_t at = 0; at < 20; at++) {
+        expectFound(withImageAt(at + 190, c.magic, 600), chunk, 600, at + 190, c.format);
+      }
+    }
+  }
+}
+
+static void test_signature_at_the_scan_limit() {
+  const Blob jpeg = withImageAt(998, IMAGES[0].magic, 1100);
+  expectFound(jpeg, COVER_SCAN_READ_SIZE, 1000, 998, ImageFormat::JPEG);  // Both bytes inside the limit
+  const Blob png = withImageAt(996, IMAGES[1].magic, 1100);
+  MemorySource src(png);
+  size_t off;
+  ImageFormat format;
+  TEST_ASSERT_FALSE(findImageStartIn(src, 1000, off, format));  // Cut by the limit
+  TEST_ASSERT_EQUAL((int)ImageFormat::Unknown, (int)format);
+}
+
+// Partial signatures are skipped, the first complete one counts
+static void test_near_misses() {
+  Blob data = noise(200);
+  const Blob misses[] = {{'G', 'I', 'F', '8', '8', 'a'}, {'B', 'X'}, {0x89, 'P', 'N', 'G', 0x0D, 0x0A, 0x1A, 0x00},
+                         {'q', 'o', 'i', 'x'}, {0xFF, 0xD9}};
+  size_t at = 10;
+  for (const Blob& m : misses) {
+    std::copy(m.begin(), m.end(), data.begin() + at);
+    at += m.size() + 3;
+  }
+  std::copy(IMAGES[5].magic.begin(), IMAGES[5].magic.end(), data.begin() + 150);
+  expectFound(data, 5, data.size(), 150, ImageFormat::QOI);
+}
+
+static void test_nothing_found() {
+  const Blob data = noise(5000);
+  MemorySource src(data, 333);
+  size_t off;
+  ImageFormat format;
+  TEST_ASSERT_FALSE(findImageStartIn(src, data.size(), off, format));
+  TEST_ASSERT_EQUAL(data.size(), src.position());
+}
+
+// Picture frame bodies: text encoding, MIME type (PIC: 3 characters), picture type, description, image
+static Blob apic(uint8_t encoding, const char* mime, const Blob& description, const Blob& image) {
+  Blob b = {encoding};
+  b.insert(b.end(), mime, mime + strlen(mime));
+  b.push_back(0);
+  b.push_back(3);  // Front cover
+  b.insert(b.end(), description.begin(), description.end());
+  b.insert(b.end(), image.begin(), image.end());
+  return b;
+}
+
+static void expectOffset(const Blob& frame, bool id3v22, size_t expect) {
+  MemorySource src(frame);
+  size_t off = 0;
+  TEST_ASSERT_TRUE(pictureDataOffset(src, frame.size(), id3v22, off));
+  TEST_ASSERT_EQUAL(expect, off);
+}
+
+static void test_picture_offset_latin1() {
+  const Blob image = IMAGES[0].magic;
+  expectOffset(apic(0, "image/jpeg", {'C', 'o', 'v', 'e', 'r', 0}, image), false, 1 + 11 + 1 + 6);
+  expectOffset(apic(3, "image/png", {0}, image), false, 1 + 10 + 1 + 1);  // UTF-8, empty description
+}
+
+// UTF-16 descriptions end with 00 00 on a character boundary, not at the 00 of "A\0"
+static void test_picture_offset_utf16() {
+  const Blob image = IMAGES[1].magic;
+  const Blob bomDesc = {0xFF, 0xFE, 'A', 0, 'B', 0, 0, 0};
+  expectOffset(apic(1, "image/png", bomDesc, image), false, 1 + 10 + 1 + bomDesc.size());
+  const Blob beDesc = {0, 'A', 0, 0};
+  expectOffset(apic(2, "image/png", beDesc, image), false, 1 + 10 + 1 + beDesc.size());
+}
+
+static void test_picture_offset_id3v22() {
+  Blob pic = {0, 'J', 'P', 'G', 3, 'x', 0};
+  pic.insert(pic.end(), IMAGES[0].magic.begin(), IMAGES[0].magic.end());
+  expectOffset(pic, true, 7);
+}
+
+// Headers that don't end within COVER_APIC_HEADER_MAX or the frame are left to the scanner
+static void test_picture_offset_unterminated() {
+  Blob longDesc(COVER_APIC_HEADER_MAX, 'd');
+  Blob frame = apic(0, "image/jpeg", longDesc, IMAGES[0].magic);
+  MemorySource src(frame);
+  size_t off = 0;
+  TEST_ASSERT_FALSE(pictureDataOffset(src, frame.size(), false, off));
+  Blob cut = {0, 'i', 'm'};
+  MemorySource src2(cut);
+  TEST_ASSERT_FALSE(pictureDataOffset(src2, cut.size(), false, off));
+}
+
+// ID3v2.3 tag with a text frame and an APIC frame, through FileRange from a file as on the card
+static Blob id3Tag(const Blob& apicBody) {
+  Blob frames;
+  auto frame = [&](const char* id, const Blob& body) {
+    frames.insert(frames.end(), id, id + 4);
+    uint32_t n = body.size();
+    Blob size = {(uint8_t)(n >> 24), (uint8_t)(n >> 16), (uint8_t)(n >> 8), (uint8_t)n, 0, 0};
+    frames.insert(frames.end(), size.begin(), size.end());
+    frames.insert(frames.end(), body.begin(), body.end());
+  };
+  frame("TIT2", {0, 'S', 'o', 'n', 'g'});
+  frame("APIC", apicBody);
+  uint32_t n = frames.size();
+  Blob tag = {'I', 'D', '3', 3, 0, 0, (uint8_t)((n >> 21) & 0x7F), (uint8_t)((n >> 14) & 0x7F),
+              (uint8_t)((n >> 7) & 0x7F), (uint8_t)(n & 0x7F)};
+  tag.insert(tag.end(), frames.begin(), frames.end());
+  Blob audio(3000, 0x55);
+  tag.insert(tag.end(), audio.begin(), audio.end());
+  return tag;
+}
+
+static void writeFile(const char* path, const Blob& data) {
+  File f = SD.open(path, FILE_WRITE);
+  TEST_ASSERT_TRUE((bool)f);
+  TEST_ASSERT_EQUAL(data.size(), f.write(data.data(), data.size()));
+  f.close();
+}
+
+static void test_picture_in_file() {
+  char root[] = "/tmp/image_utils_XXXXXX";
+  TEST_ASSERT_NOT_NULL(mkdtemp(root));
+  hostRoot() = root;
+  const Blob body = apic(0, "image/png", {'F', 'r', 'o', 'n', 't', 0}, IMAGES[1].magic);
+  writeFile("/song.mp3", id3Tag(body));
+
+  FileRange r;
+  TEST_ASSERT_TRUE(r.open(SD, "/song.mp3", 0, 0));
+  uint32_t pos = 0, len = 0;
+  bool v22 = true;
+  TEST_ASSERT_TRUE(findId3Picture(r, pos, len, &v22));
+  TEST_ASSERT_FALSE(v22);
+  TEST_ASSERT_EQUAL(10 + 15 + 10, pos);
+  TEST_ASSERT_EQUAL(body.size(), len);
+
+  r.setWindow(pos, len);
+  size_t start = 0;
+  ImageFormat format = ImageFormat::Unknown;
+  TEST_ASSERT_TRUE(findPictureImage(r, len, false, start, format));
+  TEST_ASSERT_EQUAL(1 + 10 + 1 + 6, start);
+  TEST_ASSERT_EQUAL((int)ImageFormat::PNG, (int)format);
+
+  // MIME type without its terminator: the header can't be parsed, the scanner still finds the image
+  Blob broken = body;
+  broken[10] = 'x';
+  writeFile("/broken.mp3", id3Tag(broken));
+  TEST_ASSERT_TRUE(r.open(SD, "/broken.mp3", 0, 0));
+  TEST_ASSERT_TRUE(findId3Picture(r, pos, len));
+  r.setWindow(pos, len);
+  TEST_ASSERT_TRUE(findPictureImage(r, len, false, start, format));
+  TEST_ASSERT_EQUAL(1 + 10 + 1 + 6, start);
+  TEST_ASSERT_EQUAL((int)ImageFormat::PNG, (int)format);
+
+  r.release();
+  SD.remove("/song.mp3");
+  SD.remove("/broken.mp3");
+  rmdir(root);
+}
+
+int main() {
+  MemoryBudget::begin();
+  UNITY_BEGIN();
+  RUN_TEST(test_signature_across_read_blocks);
+  RUN_TEST(test_signature_across_short_reads);
+  RUN_TEST(test_signature_at_the_scan_limit);
+  RUN_TEST(test_near_misses);
+  RUN_TEST(test_nothing_found);
+  RUN_TEST(test_picture_offset_latin1);
+  RUN_TEST(test_picture_offset_utf16);
+  RUN_TEST(test_picture_offset_id3v22);
+  RUN_TEST(test_picture_offset_unterminated);
+  RUN_TEST(test_picture_in_file);
+  return UNITY_END();
+}
@@ -0,0 +1,222 @@
+// JpegThumb: decode time and memory of cover sized JPEGs against a full size decode (benchmark)
+// TJpgDec is the baseline decoder in test/stubs, so the times compare the two paths on the host, not on the device.
+#include <unity.h>
+#include <vector>
+#include "../../src/memory_budget.cpp"
+#include "../../src/jpeg_thumb.cpp"
+
+static constexpr int THUMB = 96;
+
+// Baseline JPEG, 4:4:4, every 8x8 block flat (DC only): a gray ramp, lighter to the right and bottom
+class JpegWriter {
+public:
+  static uint8_t gray(int bx, int by, int blocksX, int blocksY) {
+    return (uint8_t)(16 + 160 * bx / max(1, blocksX - 1) + 64 * by / max(1, blocksY - 1));
+  }
+
+  std::vector<uint8_t> encode(int w, int h) {
+    m_out.clear();
+    marker(0xD8);
+    segment(0xDB, {0x00});  // Quantization table 0, all 1
+    m_out.insert(m_out.end(), 64, 1);
+    patchLength();
+    segment(0xC0, {8, (uint8_t)(h >> 8), (uint8_t)h, (uint8_t)(w >> 8), (uint8_t)w, 3, 1, 0x11, 0, 2, 0x11, 0, 3,
+                   0x11, 0});
+    patchLength();
+    // DC: the standard luminance table; AC: a single 1 bit code for end of block
+    segment(0xC4, {0x00, 0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11});
+    patchLength();
+    segment(0xC4, {0x10, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x00});
+    patchLength();
+    segment(0xDA, {3, 1, 0x00, 2, 0x00, 3, 0x00, 0, 63, 0});
+    patchLength();
+
+    const int blocksX = (w + 7) / 8, blocksY = (h + 7) / 8;
+    int pred[3] = {0, 0, 0};
+    for (int by = 0; by < blocksY; by++) {
+      for (int bx = 0; bx < blocksX; bx++) {
+        const int dc[3] = {8 * (gray(bx, by, blocksX, blocksY) - 128), 0, 0};  // Y, Cb, Cr
+        for (int c = 0; c < 3; c++) {
+          block(dc[c] - pred[c]);
+          pred[c] = dc[c];
+        }
+      }
+    }
+    while (m_bitCount) bits(1, 1);  // Pad with ones
+    marker(0xD9);
+    return m_out;
+  }
+
+private:
+  void marker(uint8_t m) {
+    m_out.push_back(0xFF);
+    m_out.push_back(m);
+  }
+  void segment(uint8_t m, std::initializer_list<uint8_t> body) {
+    marker(m);
+    m_lengthAt = m_out.size();
+    m_out.push_back(0);
+    m_out.push_back(0);
+    m_out.insert(m_out.end(), body);
+  }
+  void patchLength() {
+    size_t len = m_out.size() - m_lengthAt;
+    m_out[m_lengthAt] = len >> 8;
+    m_out[m_lengthAt + 1] = len & 0xFF;
+  }
+  void bits(uint32_t value, int count) {
+    while (count--) {
+      m_bits = (m_bits << 1) | ((value >> count) & 1);
+      if (++m_bitCount == 8) {
+        m_out.push_back(m_bits);
+        if (m_bits == 0xFF) m_out.push_back(0x00);  // Byte stuffing
+        m_bits = m_bitCount = 0;
+      }
+    }
+  }
+  void block(int diff) {
+    int size = 0;
+    for (int a = abs(diff); a; a >>= 1) size++;
+    // Codes of the standard luminance DC table
+    if (size == 0) {
+      bits(0, 2);
+    } else if (size <= 5) {
+      bits(size + 1, 3);
+    } else {
+      bits((1u << (size - 2)) - 2, size - 2);
+    }
+    if (size) bits(diff >= 0 ? diff : diff + (1 << size) - 1, size);
+    bits(0, 1);  // End of block
+  }
+
+  std::vector<uint8_t> m_out;
+  size_t m_lengthAt = 0;
+  uint8_t m_bits = 0;
+  int m_bitCount = 0;
+};
+
+class MemoryData : public lgfx::DataWrapper {
+public:
+  explicit MemoryData(const std::vector<uint8_t>& data) : m_data(data) {}
+  int read(uint8_t* buf, uint32_t len) override {
+    len = min<uint32_t>(len, m_data.size() - m_pos);
+    memcpy(buf, m_data.data() + m_pos, len);
+    m_pos += len;
+    return len;
+  }
+  void skip(int32_t offset) override { m_pos = min<uint32_t>(m_pos + offset, m_data.size()); }
+  bool seek(uint32_t offset) override {
+    m_pos = min<uint32_t>(offset, m_data.size());
+    return true;
+  }
+  void close() override {}
+  int32_t tell() override { return m_pos; }
+
+private:
+  const std::vector<uint8_t>& m_data;
+  uint32_t m_pos = 0;
+};
+
+// What a decode at full size costs before any scaling: TJpgDec at 1/1, the pixels only counted
+static uint32_t countPixels(lgfxJdec*, void*, JRECT* rect) {
+  return rect ? 1 : 0;
+}
+static uint32_t fullDecodeUs(const std::vector<uint8_t>& jpeg) {
+  MemoryData src(jpeg);
+  JpegThumb::Context c = {};
+  c.src = &src;
+  lgfxJdec jd;
+  std::vector<uint8_t> pool(JPEG_THUMB_WORKSPACE);
+  uint32_t t0 = micros();
+  bool ok = lgfx_jd_prepare(&jd, JpegThumb::readInput, pool.data(), pool.size(), &c) == JDR_OK &&
+            lgfx_jd_decomp(&jd, countPixels, 0) == JDR_OK;
+  TEST_ASSERT_TRUE(ok);
+  return micros() - t0;
+}
+
+static uint8_t thumbGray(uint16_t px) {
+  uint16_t rgb = (px >> 8) | (px << 8);
+  return ((rgb >> 5) & 0x3F) << 2;  // Green has the most bits
+}
+
+static void checkCover(int w, int h, uint8_t expectScale) {
+  const std::vector<uint8_t> jpeg = JpegWriter().encode(w, h);
+  std::vector<uint16_t> dst(THUMB * THUMB, 0);
+  MemoryData src(jpeg);
+  JpegThumb::Stats st;
+  uint32_t t0 = micros();
+  TEST_ASSERT_TRUE(JpegThumb::decode(src, dst.data(), THUMB, THUMB, &st));
+  uint32_t thumbUs = micros() - t0;
+  uint32_t fullUs = fullDecodeUs(jpeg);
+
+  TEST_ASSERT_EQUAL(expectScale, st.dctScale);
+  TEST_ASSERT_EQUAL(THUMB, st.outW);
+  TEST_ASSERT_EQUAL(THUMB * h / w, st.outH);
+  TEST_ASSERT_LESS_THAN(16 * 1024, st.heapBytes);  // Work area and a few accumulator rows, not the image
+  TEST_ASSERT_EQUAL(0, MemoryBudget::getStats(MemoryBudget::Pool::CoverArt).used);
+
+  // The ramp survives the scaling: each pixel near the block under its centre
+  const int blocksX = (w + 7) / 8, blocksY = (h + 7) / 8;
+  for (int dy = 0; dy < st.outH; dy += 7) {
+    for (int dx = 0; dx < st.outW; dx += 7) {
+      int bx = ((2 * dx + 1) * w / (2 * st.outW)) / 8, by = ((2 * dy + 1) * h / (2 * st.outH)) / 8;
+      int want = JpegWriter::gray(bx, by, blocksX, blocksY);
+      int got = thumbGray(dst[dy * THUMB + dx]);
+      TEST_ASSERT_LESS_OR_EQUAL(12, abs(got - want));
+    }
+  }
+
+  char msg[160];
+  snprintf(msg, sizeof(msg), "%dx%d (%u bytes): 1/%d scale %u us, %u bytes; full size decode %u us", w, h,
+           (unsigned)jpeg.size(), 1 << st.dctScale, (unsigned)thumbUs, (unsigned)st.heapBytes, (unsigned)fullUs);
+  TEST_MESSAGE(msg);
+}
+
+void setUp() {}
+void tearDown() {}
+
+static void test_cover_500() {
+  checkCover(500, 500, 2);
+}
+static void test_cover_1000() {
+  checkCover(1000, 1000, 3);
+}
+static void test_cover_1500() {
+  checkCover(1500, 1500, 3);
+}
+static void test_cover_wide() {
+  checkCover(1200, 600, 3);
+}
+
+// Already small: decoded 1:1, never enlarged
+static void test_small_cover() {
+  const std::vector<uint8_t> jpeg = JpegWriter().encode(64, 48);
+  std::vector<uint16_t> dst(THUMB * THUMB, 0);
+  MemoryData src(jpeg);
+  JpegThumb::Stats st;
+  TEST_ASSERT_TRUE(JpegThumb::decode(src, dst.data(), THUMB, THUMB, &st));
+  TEST_ASSERT_EQUAL(0, st.dctScale);
+  TEST_ASSERT_EQUAL(64, st.outW);
+  TEST_ASSERT_EQUAL(48, st.outH);
+}
+
+static void test_truncated() {
+  std::vector<uint8_t> jpeg = JpegWriter().encode(500, 500);
+  jpeg.resize(100);
+  std::vector<uint16_t> dst(THUMB * THUMB, 0);
+  MemoryData src(jpeg);
+  TEST_ASSERT_FALSE(JpegThumb::decode(src, dst.data(), THUMB, THUMB));
+  TEST_ASSERT_EQUAL(0, MemoryBudget::getStats(MemoryBudget::Pool::CoverArt).used);
+}
+
+int main() {
+  MemoryBudget::begin();
+  UNITY_BEGIN();
+  RUN_TEST(test_cover_500);
+  RUN_TEST(test_cover_1000);
+  RUN_TEST(test_cover_1500);
+  RUN_TEST(test_cover_wide);
+  RUN_TEST(test_small_cover);
+  RUN_TEST(test_truncated);
+  return UNITY_END();
+}
@@ -0,0 +1,2 @@
+// TJpgDec stand-in from test/stubs, built as C like the decoder in the firmware
+#include <lgfx/utility/lgfx_tjpgd.c>
@@ -0,0 +1,347 @@
+// LibraryIndex on a host directory tree standing in for the card: scan order, the index file and rebuilds
+#include <unity.h>
+#include <SD.h>
+#include <set>
+#include <string>
+#include "../../src/memory_budget.cpp"
+#include "../../src/track_library.cpp"
+#include "../../src/folder_art.cpp"
+#include "../../src/shuffle.cpp"
+#include "../../src/library_index.cpp"
+
+// The scan hands the finished library to these two
+static int s_prefills = 0;
+static int s_dbUpdates = 0;
+namespace CoverCache {
+void prefill(const TrackLibrary&) {
+  s_prefills++;
+}
+}  // namespace CoverCache
+namespace MetadataDb {
+bool startUpdate(fs::FS&, const TrackLibrary&) {
+  s_dbUpdates++;
+  return true;
+}
+}  // namespace MetadataDb
+
+static char s_root[64];
+
+static void makeDir(const char* path) {
+  std::string p;
+  for (const char* s = path + 1; ; s++) {
+    if (*s == '/' || *s == '\0') {
+      p.assign(path, s - path);
+      SD.mkdir(p.c_str());
+    }
+    if (!*s) break;
+  }
+}
+
+static void makeFile(const char* path) {
+  String p(path);
+  makeDir(p.substring(0, p.lastIndexOf('/')).c_str());
+  File f = SD.open(path, FILE_WRITE);
+  f.write((const uint8_t*)path, strlen(path));
+}
+
+static const char* const TREE[] = {
+    "/music/a.mp3",
+    "/music/b.MP3",
+    "/music/notes.txt",
+    "/music/cover.jpg",
+    "/music/Album1/01.mp3",
+    "/music/Album1/02.wav",
+    "/music/Album1/folder.png",
+    "/music/Album1/CD2/x.mp3",
+    "/music/Album2/y.mp3",
+    "/music/Album2/z.mp3",
+    "/other/elsewhere.mp3",
+};
+
+static std::set<std::string> trackSet(const TrackLibrary& lib) {
+  std::set<std::string> s;
+  for (int i = 0; i < lib.count(); i++) {
+    if (!lib.deleted(i)) s.insert(lib.path(i).c_str());
+  }
+  return s;
+}
+
+// Every directory's tracks are one range that also holds its subdirectories, the directory's own first
+static void checkOrder(const TrackLibrary& lib) {
+  for (int i = 0; i < lib.count(); i++) {
+    String dir = lib.path(i).substring(0, lib.path(i).lastIndexOf('/'));
+    for (String d = dir; d.length() > 0; d = d.substring(0, d.lastIndexOf('/'))) {
+      int first, count;
+      lib.dirRange(d, first, count);
+      TEST_ASSERT_TRUE(i >= first && i < first + count);
+      for (int j = first; j < first + count; j++) {
+        TEST_ASSERT_TRUE(lib.path(j).startsWith(d + "/"));
+      }
+    }
+    if (i > 0) {
+      // A track of a subdirectory is never followed by one of the parent
+      String prev = lib.path(i - 1).substring(0, lib.path(i - 1).lastIndexOf('/'));
+      TEST_ASSERT_FALSE(prev.startsWith(dir + "/"));
+    }
+  }
+}
+
+static void scan(AppState& st) {
+  TEST_ASSERT_TRUE(LibraryIndex::startScan(SD, st));  // The task runs to completion on the host
+  TEST_ASSERT_FALSE(LibraryIndex::getProgress().scanning);
+}
+
+void setUp() {
+  strcpy(s_root, "/tmp/library_index_XXXXXX");
+  TEST_ASSERT_NOT_NULL(mkdtemp(s_root));
+  hostRoot() = s_root;
+  for (const char* p : TREE) makeFile(p);
+  s_prefills = s_dbUpdates = 0;
+}
+
+void tearDown() {
+  std::string cmd = std::string("rm -rf ") + s_root;
+  TEST_ASSERT_EQUAL(0, system(cmd.c_str()));
+  FolderArt::clear();
+}
+
+static void test_scan_order() {
+  AppState st;
+  st.currentSelectedIndex = 5;
+  scan(st);
+  const std::set<std::string> want = {"/music/a.mp3",        "/music/b.MP3",         "/music/Album1/01.mp3",
+                                      "/music/Album1/02.wav", "/music/Album1/CD2/x.mp3", "/music/Album2/y.mp3",
+                                      "/music/Album2/z.mp3"};
+  TEST_ASSERT_TRUE(trackSet(st.tracks) == want);
+  checkOrder(st.tracks);
+  TEST_ASSERT_EQUAL(0, st.currentSelectedIndex);  // The first track found is played right away
+  TEST_ASSERT_EQUAL(1, st.nextS);
+
+  String art;
+  TEST_ASSERT_TRUE(FolderArt::find("/music/Album1/01.mp3", art));
+  TEST_ASSERT_EQUAL_STRING("/music/Album1/folder.png", art.c_str());
+  TEST_ASSERT_TRUE(FolderArt::find("/music/a.mp3", art));
+  TEST_ASSERT_EQUAL_STRING("/music/cover.jpg", art.c_str());
+  TEST_ASSERT_FALSE(FolderArt::find("/music/Album2/y.mp3", art));
+
+  TEST_ASSERT_TRUE(SD.exists(LIBRARY_INDEX_FILE));
+  TEST_ASSERT_EQUAL(1, s_prefills);
+  TEST_ASSERT_EQUAL(1, s_dbUpdates);
+}
+
+// Directories deeper than MAX_DIR_DEPTH below /music are not listed
+static void test_depth_limit() {
+  String dir = "/music";
+  for (int depth = 1; depth <= MAX_DIR_DEPTH + 1; depth++) {
+    dir += "/d";
+    makeFile((dir + "/t.mp3").c_str());
+  }
+  AppState st;
+  scan(st);
+  TEST_ASSERT_EQUAL(7 + MAX_DIR_DEPTH, st.tracks.count());
+  TEST_ASSERT_EQUAL(-1, st.tracks.find(dir + "/t.mp3"));
+  checkOrder(st.tracks);
+}
+
+// Without tracks in /music the whole card is scanned, but not the player's own data directory
+static void test_root_fallback() {
+  for (const char* p : TREE) {
+    if (strncmp(p, "/music/", 7) == 0) SD.remove(p);
+  }
+  makeFile("/.mp3adv/stray.mp3");
+  AppState st;
+  scan(st);
+  TEST_ASSERT_EQUAL(1, st.tracks.count());
+  TEST_ASSERT_EQUAL_STRING("/other/elsewhere.mp3", st.tracks.path(0).c_str());
+}
+
+// A track deleted while the scan still runs is left out of the index, it does not come back as a nameless entry
+static void test_deleted_during_scan() {
+  for (uint32_t i = 0; i < 2 * LIBRARY_SCAN_BATCH; i++) {
+    char path[40];
+    snprintf(path, sizeof(path), "/music/Album2/%02u.mp3", (unsigned)i);
+    makeFile(path);
+  }
+  AppState st;
+  String deleted;
+  hostYield() = [&]() {
+    if (deleted.length() || st.tracks.count() < 2) return;
+    deleted = st.tracks.path(1);
+    SD.remove(deleted);
+    st.tracks.remove(1);  // As FileManager deletes the playing file
+  };
+  scan(st);
+  hostYield() = nullptr;
+  TEST_ASSERT_TRUE(deleted.length() > 0);
+  const int live = st.tracks.count() - st.tracks.deletedCount();
+
+  AppState loaded;
+  TEST_ASSERT_TRUE(LibraryIndex::load(SD, loaded));
+  TEST_ASSERT_EQUAL(live, loaded.tracks.count());
+  TEST_ASSERT_EQUAL(-1, loaded.tracks.find(deleted));
+  for (int i = 0; i < loaded.tracks.count(); i++) TEST_ASSERT_TRUE(loaded.tracks.name(i).length() > 0);
+  TEST_ASSERT_TRUE(trackSet(loaded.tracks) == trackSet(st.tracks));
+  checkOrder(loaded.tracks);
+}
+
+static void test_load() {
+  {
+    AppState scanned;
+    scan(scanned);
+  }
+  FolderArt::clear();
+  AppState st;
+  TEST_ASSERT_TRUE(LibraryIndex::load(SD, st));
+  TEST_ASSERT_EQUAL(7, st.tracks.count());
+  checkOrder(st.tracks);
+  String art;
+  TEST_ASSERT_TRUE(FolderArt::find("/music/Album1/02.wav", art));  // Folder art is kept in the index too
+  TEST_ASSERT_EQUAL_STRING("/music/Album1/folder.png", art.c_str());
+}
+
+static void test_corrupt_index() {
+  {
+    AppState scanned;
+    scan(scanned);
+  }
+  // Flip a bit in the first directory path
+  const std::string host = std::string(s_root) + LIBRARY_INDEX_FILE;
+  FILE* fp = fopen(host.c_str(), "r+b");
+  TEST_ASSERT_NOT_NULL(fp);
+  fseek(fp, sizeof(LibraryIndex::FileHeader) + sizeof(LibraryIndex::DirHeader), SEEK_SET);
+  const int c = fgetc(fp);
+  fseek(fp, -1, SEEK_CUR);
+  fputc(c ^ 0x20, fp);
+  fclose(fp);
+  AppState st;
+  TEST_ASSERT_FALSE(LibraryIndex::load(SD, st));
+  TEST_ASSERT_EQUAL(0, st.tracks.count());
+}
+
+// Loads the index, changes the card, validates: changed directories are rescanned, the rest comes from the index
+static void validateAfter(AppState& st, void (*change)(), bool expectChange) {
+  {
+    AppState scanned;
+    scan(scanned);
+  }
+  TEST_ASSERT_TRUE(LibraryIndex::load(SD, st));
+  const uint32_t generation = st.tracks.generation();
+  change();
+  TEST_ASSERT_TRUE(LibraryIndex::startValidation(SD, st));
+  TEST_ASSERT_FALSE(LibraryIndex::getProgress().validating);
+  TEST_ASSERT_EQUAL(expectChange, st.tracks.generation() != generation);
+  checkOrder(st.tracks);
+  // The rewritten index loads to the same list
+  AppState again;
+  TEST_ASSERT_TRUE(LibraryIndex::load(SD, again));
+  TEST_ASSERT_TRUE(trackSet(again.tracks) == trackSet(st.tracks));
+}
+
+static void noChange() {}
+
+static void test_validation_unchanged() {
+  AppState st;
+  validateAfter(st, noChange, false);
+  TEST_ASSERT_EQUAL(7, st.tracks.count());
+  TEST_ASSERT_EQUAL(2, s_dbUpdates);  // After the scan and after the validation
+}
+
+static void changeCard() {
+  SD.remove("/music/Album1/02.wav");
+  makeFile("/music/Album2/new.mp3");
+  makeFile("/music/Album3/w.mp3");  // New subdirectory of an indexed one
+  SD.remove("/music/Album1/CD2/x.mp3");
+  SD.rmdir("/music/Album1/CD2");    // Gone
+}
+
+static void test_validation_rescans_changed() {
+  AppState st;
+  st.currentPlayingIndex = -1;
+  validateAfter(st, changeCard, true);
+  const std::set<std::string> want = {"/music/a.mp3",        "/music/b.MP3",        "/music/Album1/01.mp3",
+                                      "/music/Album2/y.mp3", "/music/Album2/z.mp3", "/music/Album2/new.mp3",
+                                      "/music/Album3/w.mp3"};
+  TEST_ASSERT_TRUE(trackSet(st.tracks) == want);
+}
+
+static void removePlaying() {
+  SD.remove("/music/Album2/z.mp3");
+  makeFile("/music/0first.mp3");
+}
+
+// The playing and selected tracks keep their place; a playing track that is gone stops playback
+static void test_validation_relocates() {
+  AppState st;
+  st.isPlaying = true;
+  st.stopped = false;
+  {
+    AppState scanned;
+    scan(scanned);
+  }
+  TEST_ASSERT_TRUE(LibraryIndex::load(SD, st));
+  st.currentPlayingIndex = st.tracks.find("/music/Album2/z.mp3");
+  st.currentSelectedIndex = st.tracks.find("/music/Album1/01.mp3");
+  removePlaying();
+  TEST_ASSERT_TRUE(LibraryIndex::startValidation(SD, st));
+  TEST_ASSERT_EQUAL(-1, st.currentPlayingIndex);
+  TEST_ASSERT_FALSE(st.isPlaying);
+  TEST_ASSERT_TRUE(st.stopped);
+  TEST_ASSERT_EQUAL_STRING("/music/Album1/01.mp3", st.tracks.path(st.currentSelectedIndex).c_str());
+  TEST_ASSERT_NOT_EQUAL(-1, st.tracks.find("/music/0first.mp3"));
+  checkOrder(st.tracks);
+}
+
+// Without room for a second list next to the one in use the library is rebuilt in place, to the same result.
+// The card is listed before the list in use is dropped: other tasks see it whole whenever the scan yields.
+static void test_rebuild_in_place() {
+  {
+    AppState scanned;
+    scan(scanned);
+  }
+  AppState st;
+  TEST_ASSERT_TRUE(LibraryIndex::load(SD, st));
+  st.currentPlayingIndex = st.tracks.find("/music/Album2/y.mp3");
+  const uint32_t generation = st.tracks.generation();
+  changeCard();
+  for (int i = 0; i < (int)LIBRARY_SCAN_BATCH; i++) {
+    makeFile(("/music/Album1/notes" + std::to_string(i) + ".txt").c_str());  // Entries that are not tracks
+  }
+  const int listed = st.tracks.count();
+  int yields = 0;
+  int shrunk = 0;
+  hostYield() = [&]() {
+    yields++;
+    if (st.tracks.count() != listed) shrunk++;
+  };
+  const MemoryBudget::PoolStats pool = MemoryBudget::getStats(MemoryBudget::Pool::TrackList);
+  const uint32_t hog = pool.limit - pool.used - st.tracks.memoryUsed() / 2;
+  TEST_ASSERT_TRUE(MemoryBudget::charge(MemoryBudget::Pool::TrackList, hog));
+  TEST_ASSERT_TRUE(LibraryIndex::startValidation(SD, st));
+  MemoryBudget::release(MemoryBudget::Pool::TrackList, hog);
+  hostYield() = nullptr;
+  TEST_ASSERT_TRUE(yields > 0);
+  TEST_ASSERT_EQUAL(0, shrunk);
+  TEST_ASSERT_NOT_EQUAL(generation, st.tracks.generation());
+  TEST_ASSERT_EQUAL(7, st.tracks.count());
+  checkOrder(st.tracks);
+  TEST_ASSERT_EQUAL_STRING("/music/Album2/y.mp3", st.tracks.path(st.currentPlayingIndex).c_str());
+  AppState again;
+  TEST_ASSERT_TRUE(LibraryIndex::load(SD, again));
+  TEST_ASSERT_TRUE(trackSet(again.tracks) == trackSet(st.tracks));
+}
+
+int main() {
+  MemoryBudget::begin();
+  UNITY_BEGIN();
+  RUN_TEST(test_scan_order);
+  RUN_TEST(test_depth_limit);
+  RUN_TEST(test_root_fallback);
+  RUN_TEST(test_deleted_during_scan);
+  RUN_TEST(test_load);
+  RUN_TEST(test_corrupt_index);
+  RUN_TEST(test_validation_unchanged);
+  RUN_TEST(test_validation_rescans_changed);
+  RUN_TEST(test_validation_relocates);
+  RUN_TEST(test_rebuild_in_place);
+  return UNITY_END();
+}
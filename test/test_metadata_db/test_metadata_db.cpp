@@ -0,0 +1,255 @@
+// MetadataDb on a host directory standing in for the card: the tag parsers and the record key of the store
+#include <unity.h>
+#include <SD.h>
+#include <string>
+#include <vector>
+#include "../../src/memory_budget.cpp"
+#include "../../src/track_library.cpp"
+#include "../../src/seek_index.cpp"
+#include "../../src/metadata_db.cpp"
+
+// The update pass rebuilds these when records changed
+namespace BrowseIndex {
+bool build(fs::FS&, const TrackLibrary&, bool) {
+  return true;
+}
+}  // namespace BrowseIndex
+namespace SearchIndex {
+bool build(fs::FS&, const TrackLibrary&, bool) {
+  return true;
+}
+}  // namespace SearchIndex
+
+typedef std::vector<uint8_t> Bytes;
+
+static char s_root[64];
+
+static void append(Bytes& b, const Bytes& more) {
+  b.insert(b.end(), more.begin(), more.end());
+}
+
+static void append(Bytes& b, const std::string& s) {
+  b.insert(b.end(), s.begin(), s.end());
+}
+
+static void putBe32(Bytes& b, uint32_t v) {
+  for (int shift = 24; shift >= 0; shift -= 8) b.push_back((uint8_t)(v >> shift));
+}
+
+static void putLe32(Bytes& b, uint32_t v) {
+  for (int shift = 0; shift <= 24; shift += 8) b.push_back((uint8_t)(v >> shift));
+}
+
+static void putSynchsafe(Bytes& b, uint32_t v) {
+  for (int shift = 21; shift >= 0; shift -= 7) b.push_back((uint8_t)((v >> shift) & 0x7F));
+}
+
+static Bytes text(uint8_t enc, const std::string& s) {
+  Bytes b = {enc};
+  append(b, s);
+  return b;
+}
+
+// ID3v2.2 frames have 3-byte ids and sizes, v2.3 a plain and v2.4 a synchsafe 32-bit size
+static Bytes frame(uint8_t version, const char* id, const Bytes& body, uint8_t fmt = 0) {
+  Bytes b(id, id + (version == 2 ? 3 : 4));
+  if (version == 2) {
+    for (int shift = 16; shift >= 0; shift -= 8) b.push_back((uint8_t)(body.size() >> shift));
+  } else {
+    if (version == 4) {
+      putSynchsafe(b, body.size());
+    } else {
+      putBe32(b, body.size());
+    }
+    b.push_back(0);
+    b.push_back(fmt);
+  }
+  append(b, body);
+  return b;
+}
+
+static Bytes unsynchronise(const Bytes& in) {
+  Bytes out;
+  for (size_t i = 0; i < in.size(); i++) {
+    out.push_back(in[i]);
+    if (in[i] == 0xFF && (i + 1 == in.size() || in[i + 1] >= 0xE0 || in[i + 1] == 0x00)) out.push_back(0x00);
+  }
+  return out;
+}
+
+static Bytes tag(uint8_t version, uint8_t flags, const Bytes& body) {
+  Bytes b = {'I', 'D', '3', version, 0, flags};
+  putSynchsafe(b, body.size() + 16);
+  append(b, body);
+  b.resize(b.size() + 16);  // Padding
+  return b;
+}
+
+static void writeFile(const char* path, const Bytes& data) {
+  if (!SD.exists("/music")) SD.mkdir("/music");
+  File f = SD.open(path, FILE_WRITE);
+  TEST_ASSERT_TRUE((bool)f);
+  TEST_ASSERT_EQUAL(data.size(), f.write(data.data(), data.size()));
+}
+
+static MetadataDb::Info extract(const char* path, const Bytes& data) {
+  writeFile(path, data);
+  MetadataDb::Info info;
+  TEST_ASSERT_TRUE(MetadataDb::extract(SD, path, info));
+  return info;
+}
+
+void setUp() {
+  strcpy(s_root, "/tmp/metadata_db_XXXXXX");
+  TEST_ASSERT_NOT_NULL(mkdtemp(s_root));
+  hostRoot() = s_root;
+  MetadataDb::s_dirLoaded = false;  // Every test starts with the store of its own card
+  MetadataDb::closeReader();
+}
+
+void tearDown() {
+  MetadataDb::closeReader();
+  std::string cmd = std::string("rm -rf ") + s_root;
+  system(cmd.c_str());
+}
+
+static void test_id3v23() {
+  Bytes frames;
+  append(frames, frame(3, "TIT2", text(0, "Title")));
+  append(frames, frame(3, "TPE1", text(1, std::string("\xFF\xFEZ\0o\0\xEB\0\0\0", 10))));  // UTF-16 "Zoë"
+  append(frames, frame(3, "TALB", text(3, "Album \xC3\xA9t\xC3\xA9")));
+  append(frames, frame(3, "TCON", text(0, "(17)")));
+  append(frames, frame(3, "TYER", text(0, "2003")));
+  append(frames, frame(3, "TLEN", text(0, "123456")));
+  MetadataDb::Info info = extract("/music/v23.mp3", tag(3, 0, frames));
+  TEST_ASSERT_EQUAL_STRING("Title", info.title.c_str());
+  TEST_ASSERT_EQUAL_STRING("Zo\xC3\xAB", info.artist.c_str());
+  TEST_ASSERT_EQUAL_STRING("Album \xC3\xA9t\xC3\xA9", info.album.c_str());
+  TEST_ASSERT_EQUAL_STRING("Rock", info.genre.c_str());
+  TEST_ASSERT_EQUAL(2003, info.year);
+  TEST_ASSERT_EQUAL(123456, info.durationMs);
+}
+
+// Tag-level unsynchronisation in v2.3 also covers the frame headers: the 255-byte frame's size is followed
+// by a stuffed 0x00, and its 0xFF body doubles on the card
+static void test_id3v23_unsync() {
+  Bytes frames;
+  append(frames, frame(3, "PRIV", Bytes(255, 0xFF)));
+  append(frames, frame(3, "TIT2", text(0, "Caf\xFF\xE0")));
+  append(frames, frame(3, "TPE1", text(0, "Artist")));
+  Bytes stored = unsynchronise(frames);
+  TEST_ASSERT_TRUE(stored.size() > frames.size() + 255);
+  MetadataDb::Info info = extract("/music/unsync.mp3", tag(3, 0x80, stored));
+  TEST_ASSERT_EQUAL_STRING("Caf\xC3\xBF\xC3\xA0", info.title.c_str());
+  TEST_ASSERT_EQUAL_STRING("Artist", info.artist.c_str());
+}
+
+// v2.4 unsynchronises frame by frame, the size counts the stored bytes
+static void test_id3v24_frame_unsync() {
+  Bytes body;
+  Bytes plain = text(0, "\xFF\xE0x");
+  putSynchsafe(body, plain.size());  // Data length indicator
+  append(body, unsynchronise(plain));
+  Bytes frames;
+  append(frames, frame(4, "TIT2", body, 0x03));
+  append(frames, frame(4, "TPE2", text(3, "Band")));
+  append(frames, frame(4, "TDRC", text(3, "1987-05-01")));
+  MetadataDb::Info info = extract("/music/v24.mp3", tag(4, 0, frames));
+  TEST_ASSERT_EQUAL_STRING("\xC3\xBF\xC3\xA0x", info.title.c_str());
+  TEST_ASSERT_EQUAL_STRING("Band", info.artist.c_str());
+  TEST_ASSERT_EQUAL(1987, info.year);
+}
+
+// ID3v1 fills what the v2.2 tag left out; the CBR frame after the tag gives the duration
+static void test_id3v22_and_v1() {
+  Bytes frames;
+  append(frames, frame(2, "TT2", text(0, "Old Tag")));
+  append(frames, frame(2, "TCO", text(0, "(9)Thrash")));
+  Bytes file = tag(2, 0, frames);
+  Bytes audio(417 * 100, 0);  // 100 frames of MPEG-1 layer III, 128 kbit/s, 44.1 kHz
+  audio[0] = 0xFF;
+  audio[1] = 0xFB;
+  audio[2] = 0x90;
+  append(file, audio);
+  Bytes v1(128, 0);
+  memcpy(v1.data(), "TAG", 3);
+  memcpy(v1.data() + 3, "V1 Title", 8);
+  memcpy(v1.data() + 33, "V1 Artist", 9);
+  memcpy(v1.data() + 63, "V1 Album", 8);
+  memcpy(v1.data() + 93, "1999", 4);
+  v1[127] = 17;
+  append(file, v1);
+  MetadataDb::Info info = extract("/music/v22.mp3", file);
+  TEST_ASSERT_EQUAL_STRING("Old Tag", info.title.c_str());
+  TEST_ASSERT_EQUAL_STRING("V1 Artist", info.artist.c_str());
+  TEST_ASSERT_EQUAL_STRING("V1 Album", info.album.c_str());
+  TEST_ASSERT_EQUAL_STRING("Thrash", info.genre.c_str());
+  TEST_ASSERT_EQUAL(1999, info.year);
+  TEST_ASSERT_EQUAL(100 * 1152 * 1000 / 44100, info.durationMs);
+}
+
+static void test_riff_info() {
+  Bytes fmt;
+  putLe32(fmt, 0x00020001);  // PCM, stereo
+  putLe32(fmt, 8000);
+  putLe32(fmt, 32000);       // Byte rate
+  putLe32(fmt, 0x00100004);  // Block align 4, 16 bit
+  Bytes info = {'I', 'N', 'F', 'O'};
+  append(info, std::string("INAM\x0A\0\0\0Wave Title", 18));
+  append(info, std::string("IART\x05\0\0\0Maker\0", 14));  // Odd length, padded
+  Bytes chunks;
+  append(chunks, std::string("fmt "));
+  putLe32(chunks, fmt.size());
+  append(chunks, fmt);
+  append(chunks, std::string("LIST"));
+  putLe32(chunks, info.size());
+  append(chunks, info);
+  append(chunks, std::string("data"));
+  putLe32(chunks, 16000);
+  chunks.resize(chunks.size() + 16000);
+  Bytes file = {'R', 'I', 'F', 'F'};
+  putLe32(file, chunks.size() + 4);
+  append(file, std::string("WAVE"));
+  append(file, chunks);
+  MetadataDb::Info out = extract("/music/a.wav", file);
+  TEST_ASSERT_EQUAL_STRING("Wave Title", out.title.c_str());
+  TEST_ASSERT_EQUAL_STRING("Maker", out.artist.c_str());
+  TEST_ASSERT_EQUAL(500, out.durationMs);
+}
+
+// Two paths with the same 32-bit hash keep their own records, also after the store is loaded again
+static void test_colliding_paths() {
+  const char* first = "/music/091345.mp3";
+  const char* second = "/music/1605800.mp3";
+  TEST_ASSERT_EQUAL(MetadataDb::hashPath(first), MetadataDb::hashPath(second));
+  writeFile(first, tag(3, 0, frame(3, "TIT2", text(0, "First"))));
+  writeFile(second, tag(3, 0, frame(3, "TIT2", text(0, "Second"))));
+  TrackLibrary tracks;
+  TEST_ASSERT_TRUE(tracks.add(first));
+  TEST_ASSERT_TRUE(tracks.add(second));
+  TEST_ASSERT_TRUE(MetadataDb::startUpdate(SD, tracks));  // The task runs to completion on the host
+
+  for (int reload = 0; reload < 2; reload++) {
+    MetadataDb::Info info;
+    TEST_ASSERT_TRUE(MetadataDb::lookup(SD, first, info));
+    TEST_ASSERT_EQUAL_STRING("First", info.title.c_str());
+    TEST_ASSERT_TRUE(MetadataDb::lookup(SD, second, info));
+    TEST_ASSERT_EQUAL_STRING("Second", info.title.c_str());
+    TEST_ASSERT_FALSE(MetadataDb::lookup(SD, "/music/other.mp3", info));
+    MetadataDb::s_dirLoaded = false;
+    MetadataDb::loadDirectory(SD);
+  }
+  TEST_ASSERT_EQUAL(2, MetadataDb::s_dir.size());
+}
+
+int main() {
+  MemoryBudget::begin();
+  UNITY_BEGIN();
+  RUN_TEST(test_id3v23);
+  RUN_TEST(test_id3v23_unsync);
+  RUN_TEST(test_id3v24_frame_unsync);
+  RUN_TEST(test_id3v22_and_v1);
+  RUN_TEST(test_riff_info);
+  RUN_TEST(test_colliding_paths);
+  return UNITY_END();
+}
@@ -0,0 +1,188 @@
+// Playlist: entry lines written on a PC or another player become card paths of the library
+#include <unity.h>
+#include <SD.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "../../src/memory_budget.cpp"
+#include "../../src/track_library.cpp"
+#include "../../src/playlist.cpp"
+
+static char s_root[64];
+
+static void checkPath(const char* dir, const char* line, const char* expected) {
+  Playlist::s_dir = dir;
+  TEST_ASSERT_EQUAL_STRING(expected, Playlist::cardPath(line).c_str());
+}
+
+static void writeFile(const char* path, const std::string& text) {
+  File f = SD.open(path, FILE_WRITE);
+  TEST_ASSERT_TRUE((bool)f);
+  TEST_ASSERT_EQUAL(text.size(), f.write((const uint8_t*)text.data(), text.size()));
+}
+
+void setUp() {
+  strcpy(s_root, "/tmp/playlist_XXXXXX");
+  TEST_ASSERT_NOT_NULL(mkdtemp(s_root));
+  hostRoot() = s_root;
+  SD.mkdir("/music");
+  SD.mkdir("/music/lists");
+  Playlist::s_latin1 = false;
+}
+
+void tearDown() {
+  Playlist::close();
+  std::string cmd = std::string("rm -rf ") + s_root;
+  TEST_ASSERT_EQUAL(0, system(cmd.c_str()));
+}
+
+static void test_relative() {
+  checkPath("/music/lists", "a.mp3", "/music/lists/a.mp3");
+  checkPath("/music/lists", "./sub//a.mp3", "/music/lists/sub/a.mp3");
+  checkPath("/music/lists", "../Album/a.mp3", "/music/Album/a.mp3");
+  checkPath("/music/lists", "../../../../a.mp3", "/a.mp3");  // Not above the card root
+  checkPath("", "a.mp3", "/a.mp3");                          // Playlist in the root directory
+  checkPath("/music/lists", "/music/b.mp3", "/music/b.mp3");
+  checkPath("/music/lists", "/music/./x/../b.mp3", "/music/b.mp3");
+}
+
+// Lines are trimmed; the line end is cut by readLine()
+static void test_blanks() {
+  checkPath("/music", "  Album/a.mp3\t", "/music/Album/a.mp3");
+  checkPath("/music", "/music/a b.mp3", "/music/a b.mp3");
+}
+
+static void test_pc_paths() {
+  checkPath("/music/lists", "..\\Album\\a.mp3", "/music/Album/a.mp3");
+  checkPath("/music/lists", "C:\\music\\Album\\a.mp3", "/music/Album/a.mp3");
+  checkPath("/music/lists", "d:/music/a.mp3", "/music/a.mp3");
+  checkPath("/music/lists", "\\\\music\\a.mp3", "/music/a.mp3");
+}
+
+static void test_urls() {
+  checkPath("/music", "http://radio.example/stream.mp3", "");
+  checkPath("/music", "https://radio.example/a.mp3", "");
+  checkPath("/music", "file:///music/a%20b%2Fc.mp3", "/music/a b/c.mp3");
+  checkPath("/music", "file:///music/100%.mp3", "/music/100%.mp3");  // Not an escape, kept
+}
+
+static void test_encoding() {
+  Playlist::s_latin1 = true;  // .m3u: Latin-1 unless the line is valid UTF-8
+  checkPath("/music", "caf\xe9.mp3", "/music/caf\xc3\xa9.mp3");
+  checkPath("/music", "caf\xc3\xa9.mp3", "/music/caf\xc3\xa9.mp3");
+  Playlist::s_latin1 = false;  // .m3u8
+  checkPath("/music", "caf\xc3\xa9.mp3", "/music/caf\xc3\xa9.mp3");
+}
+
+// An .m3u8 as players write it: BOM, comments, CRLF, blank lines, a stream and a missing file
+static void test_open() {
+  TrackLibrary tracks;
+  tracks.add("/music/a.mp3");
+  tracks.add("/music/Album/b.mp3");
+  tracks.add("/music/lists/c.mp3");
+  tracks.add("/music/caf\xc3\xa9.mp3");
+  writeFile("/music/lists/mix.m3u8",
+            "\xEF\xBB\xBF#EXTM3U\r\n"
+            "#EXTINF:123,Artist - A\r\n"
+            "..\\a.mp3\r\n"
+            "\r\n"
+            "  http://radio.example/live\r\n"
+            "C:\\music\\Album\\b.mp3\r\n"
+            "gone.mp3\r\n"
+            "c.mp3\r\n"
+            "file:///music/caf%C3%A9.mp3");  // No line end at the end of the file
+  TEST_ASSERT_TRUE(Playlist::open(SD, "/music/lists/mix.m3u8"));
+  TEST_ASSERT_TRUE(Playlist::complete());
+  TEST_ASSERT_EQUAL(6, Playlist::count());
+
+  Playlist::Row rows[6];
+  TEST_ASSERT_EQUAL(6, Playlist::rows(tracks, 0, 6, rows));
+  const char* names[] = {"a.mp3", "http://radio.example/live", "b.mp3", "gone.mp3", "c.mp3", "caf\xc3\xa9.mp3"};
+  const int expected[] = {0, -1, 1, -1, 2, 3};
+  for (int i = 0; i < 6; i++) {
+    TEST_ASSERT_EQUAL_STRING(names[i], rows[i].name.c_str());
+    TEST_ASSERT_EQUAL(expected[i], rows[i].track);
+  }
+
+  // Next and previous step over the entries that are not in the library
+  TEST_ASSERT_EQUAL(0, Playlist::play(tracks));
+  TEST_ASSERT_EQUAL(1, Playlist::next(tracks, 1, false));
+  TEST_ASSERT_EQUAL(2, Playlist::next(tracks, 1, false));
+  TEST_ASSERT_EQUAL(3, Playlist::next(tracks, 1, false));
+  TEST_ASSERT_EQUAL(0, Playlist::next(tracks, 1, false));  // Wraps around
+  TEST_ASSERT_EQUAL(3, Playlist::next(tracks, -1, false));
+  TEST_ASSERT_EQUAL(5, Playlist::position());
+
+  // A deleted track is looked up again, its entry is skipped
+  tracks.remove(1);
+  TEST_ASSERT_EQUAL(2, Playlist::next(tracks, -1, false));
+  TEST_ASSERT_EQUAL(0, Playlist::next(tracks, -1, false));
+}
+
+// .m3u without a BOM is read as Latin-1 where it is not UTF-8
+static void test_open_latin1() {
+  TrackLibrary tracks;
+  tracks.add("/music/caf\xc3\xa9.mp3");
+  writeFile("/music/lists/old.m3u", "..\\caf\xe9.mp3\n");
+  TEST_ASSERT_TRUE(Playlist::open(SD, "/music/lists/old.m3u"));
+  TEST_ASSERT_EQUAL(1, Playlist::count());
+  TEST_ASSERT_EQUAL(0, Playlist::play(tracks));
+}
+
+// Shuffle keeps an order of the entries: each one in the library once per cycle, 'p' walks back through them
+static void test_shuffle() {
+  TrackLibrary tracks;
+  std::string text;
+  for (int i = 0; i < 10; i++) {
+    const std::string name = "/music/t" + std::to_string(i) + ".mp3";
+    if (i != 4) tracks.add(name.c_str());  // Entry 4 is not in the library
+    text += name + "\n";
+  }
+  writeFile("/music/lists/all.m3u", text);
+  TEST_ASSERT_TRUE(Playlist::open(SD, "/music/lists/all.m3u"));
+  Playlist::move(2);
+  const int first = Playlist::play(tracks);
+  TEST_ASSERT_EQUAL(2, first);
+
+  std::vector<int> played = {first};
+  for (int i = 1; i < 9; i++) {
+    const int track = Playlist::next(tracks, 1, true);
+    TEST_ASSERT_TRUE(track >= 0);
+    TEST_ASSERT_TRUE(std::find(played.begin(), played.end(), track) == played.end());
+    played.push_back(track);
+  }
+  for (int i = 7; i >= 0; i--) TEST_ASSERT_EQUAL(played[i], Playlist::next(tracks, -1, true));
+  TEST_ASSERT_EQUAL(played[0], Playlist::next(tracks, -1, true));  // Nothing before it: starts again
+  for (int i = 1; i < 9; i++) TEST_ASSERT_EQUAL(played[i], Playlist::next(tracks, 1, true));
+
+  // Cycle done: a new one, not starting with the last entry
+  const int last = played.back();
+  played = {last};
+  for (int i = 1; i < 9; i++) {
+    const int track = Playlist::next(tracks, 1, true);
+    TEST_ASSERT_TRUE(track >= 0);
+    TEST_ASSERT_TRUE(std::find(played.begin(), played.end(), track) == played.end());
+    played.push_back(track);
+  }
+
+  // An entry picked by hand is the one 'p' comes back to
+  Playlist::move(5 - Playlist::selected());  // Entry 5, track 4
+  TEST_ASSERT_EQUAL(4, Playlist::play(tracks));
+  TEST_ASSERT_TRUE(Playlist::next(tracks, 1, true) >= 0);
+  TEST_ASSERT_EQUAL(4, Playlist::next(tracks, -1, true));
+  TEST_ASSERT_EQUAL(5, Playlist::position());
+}
+
+int main() {
+  MemoryBudget::begin();
+  UNITY_BEGIN();
+  RUN_TEST(test_relative);
+  RUN_TEST(test_blanks);
+  RUN_TEST(test_pc_paths);
+  RUN_TEST(test_urls);
+  RUN_TEST(test_encoding);
+  RUN_TEST(test_open);
+  RUN_TEST(test_open_latin1);
+  RUN_TEST(test_shuffle);
+  return UNITY_END();
+}
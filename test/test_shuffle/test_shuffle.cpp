@@ -0,0 +1,315 @@
+// Shuffle: every track once per cycle, 'p' walks back through what played, the order follows the library
+#include <unity.h>
+#include <SD.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "../../src/memory_budget.cpp"
+#include "../../src/track_library.cpp"
+#include "../../src/shuffle.cpp"
+
+static void addTracks(TrackLibrary& tracks, int from, int to) {
+  for (int i = from; i < to; i++) {
+    char path[32];
+    snprintf(path, sizeof(path), "/music/t%03d.mp3", i);
+    TEST_ASSERT_TRUE(tracks.add(path));
+  }
+}
+
+static int next(const TrackLibrary& tracks, int current, int step = 1) {
+  const int track = Shuffle::step(tracks, current, step, 0, tracks.count());
+  TEST_ASSERT_TRUE(track >= 0 && track < tracks.count());
+  TEST_ASSERT_FALSE(tracks.deleted(track));
+  return track;
+}
+
+// The next n tracks from current; none of them played before in this cycle (played holds the ones that did)
+static std::vector<int> play(const TrackLibrary& tracks, int& current, int n, std::vector<bool>& played) {
+  played.resize(tracks.count());
+  played[current] = true;
+  std::vector<int> order;
+  for (int i = 0; i < n; i++) {
+    current = next(tracks, current);
+    TEST_ASSERT_FALSE(played[current]);
+    played[current] = true;
+    order.push_back(current);
+  }
+  return order;
+}
+
+static std::vector<int> play(const TrackLibrary& tracks, int& current, int n) {
+  std::vector<bool> played;
+  return play(tracks, current, n, played);
+}
+
+void setUp() {
+  Shuffle::reset();
+  srand(1);
+}
+
+void tearDown() {
+  Shuffle::reset();
+}
+
+// A cycle plays every track once; the next one starts from the track playing, in a new order
+static void test_cycles() {
+  TrackLibrary tracks;
+  addTracks(tracks, 0, 20);
+  int current = 7;
+  std::vector<int> first = play(tracks, current, 19);
+  std::vector<int> second = play(tracks, current, 19);
+  TEST_ASSERT_FALSE(first == second);
+}
+
+static void test_back() {
+  TrackLibrary tracks;
+  addTracks(tracks, 0, 10);
+  int current = 0;
+  std::vector<int> played{current};
+  for (int i = 0; i < 5; i++) played.push_back(current = next(tracks, current));
+  for (int i = 4; i >= 0; i--) TEST_ASSERT_EQUAL(played[i], current = next(tracks, current, -1));
+  TEST_ASSERT_EQUAL(played[0], next(tracks, current, -1));  // Nothing before the first: it starts again
+  // Forward again replays the same order
+  for (int i = 1; i <= 5; i++) TEST_ASSERT_EQUAL(played[i], current = next(tracks, current));
+}
+
+// A track picked by hand counts as played: from the history it moves to its end, from the tracks still to
+// come it is played next
+static void test_picked() {
+  TrackLibrary tracks;
+  addTracks(tracks, 0, 10);
+  int current = 0;
+  std::vector<bool> played;
+  std::vector<int> before = play(tracks, current, 3, played);
+  current = before[0];
+  TEST_ASSERT_EQUAL(before[2], current = next(tracks, current, -1));
+  TEST_ASSERT_EQUAL(before[0], current = next(tracks, current));
+
+  int picked = 0;
+  while (played[picked]) picked++;
+  TEST_ASSERT_EQUAL(before[0], next(tracks, picked, -1));
+  current = picked;
+  play(tracks, current, 10 - 5, played);  // 0, the three before and the pick played
+  for (bool p : played) TEST_ASSERT_TRUE(p);
+}
+
+// After deletes the order is shorter than the library: a track in a high slot picked by hand still counts
+static void test_picked_after_remove() {
+  TrackLibrary tracks;
+  addTracks(tracks, 0, 10);
+  int current = 0;
+  std::vector<bool> played;
+  play(tracks, current, 1, played);
+  for (int i : {2, 4}) {
+    if (played[i]) continue;
+    Shuffle::remove(i);
+    tracks.remove(i);
+    played[i] = true;
+  }
+  current = 9;
+  TEST_ASSERT_FALSE(played[9]);
+  const int live = tracks.count() - tracks.deletedCount();
+  int before = 0;
+  for (int i = 0; i < 10; i++) before += played[i] && !tracks.deleted(i);
+  play(tracks, current, live - before - 1, played);
+  for (bool p : played) TEST_ASSERT_TRUE(p);
+}
+
+// Tracks found by the scan meanwhile are shuffled into the part of the cycle still to come
+static void test_sync_added() {
+  TrackLibrary tracks;
+  addTracks(tracks, 0, 5);
+  int current = 0;
+  std::vector<bool> played;
+  play(tracks, current, 3, played);
+  addTracks(tracks, 5, 12);
+  play(tracks, current, 12 - 4, played);
+  for (int i = 0; i < 12; i++) TEST_ASSERT_TRUE(played[i]);
+}
+
+// A shorter library (rebuilt outside remove()) gets a new order of the tracks it has
+static void test_sync_shorter() {
+  TrackLibrary tracks;
+  addTracks(tracks, 0, 12);
+  int current = 11;
+  play(tracks, current, 4);
+  tracks.clear();
+  addTracks(tracks, 0, 6);
+  current = 2;
+  play(tracks, current, 5);
+}
+
+// Deleted tracks are taken out of the order, the cycle goes on with the others
+static void test_removed() {
+  TrackLibrary tracks;
+  addTracks(tracks, 0, 10);
+  int current = 0;
+  std::vector<bool> played;
+  play(tracks, current, 3, played);
+  const int removed = current;
+  Shuffle::remove(removed);
+  tracks.remove(removed);
+  current = next(tracks, current);
+  TEST_ASSERT_FALSE(played[current]);
+  played[current] = true;
+  // A tombstone still in the order (loaded after the delete) is stepped over
+  int tombstone = 0;
+  while (played[tombstone]) tombstone++;
+  tracks.remove(tombstone);
+  played[tombstone] = true;
+  play(tracks, current, 10 - 6, played);
+  for (bool p : played) TEST_ASSERT_TRUE(p);
+}
+
+// The order follows compact(): played tracks stay played under their new index, the rest still comes
+static void test_compact() {
+  TrackLibrary tracks;
+  addTracks(tracks, 0, 12);
+  int current = 0;
+  std::vector<bool> played;
+  std::vector<int> before = play(tracks, current, 4, played);
+  Shuffle::remove(before[1]);
+  tracks.remove(before[1]);
+  int unplayed = 0;
+  while (played[unplayed]) unplayed++;
+  Shuffle::remove(unplayed);
+  tracks.remove(unplayed);
+  const std::vector<int> removed = tracks.compact();
+  Shuffle::compact(removed);
+
+  std::vector<bool> compacted(tracks.count());
+  for (int i = 0; i < 12; i++) {
+    if (played[i] && !std::binary_search(removed.begin(), removed.end(), i)) {
+      compacted[TrackLibrary::compactedIndex(removed, i)] = true;
+    }
+  }
+  current = TrackLibrary::compactedIndex(removed, current);
+  TEST_ASSERT_EQUAL(TrackLibrary::compactedIndex(removed, before[2]), next(tracks, current, -1));
+  TEST_ASSERT_EQUAL(current, next(tracks, TrackLibrary::compactedIndex(removed, before[2])));
+  play(tracks, current, 10 - 4, compacted);
+}
+
+// A tombstone still in the order (the order was loaded after the delete) is taken out by compact()
+static void test_compact_tombstone() {
+  TrackLibrary tracks;
+  addTracks(tracks, 0, 8);
+  int current = 0;
+  std::vector<bool> played;
+  std::vector<int> before = play(tracks, current, 3, played);
+  tracks.remove(before[0]);  // Played, before the cursor
+  const std::vector<int> removed = tracks.compact();
+  Shuffle::compact(removed);
+  TEST_ASSERT_EQUAL(7, Shuffle::s_count);
+  current = TrackLibrary::compactedIndex(removed, current);
+  TEST_ASSERT_EQUAL(TrackLibrary::compactedIndex(removed, before[1]), next(tracks, current, -1));
+  current = next(tracks, TrackLibrary::compactedIndex(removed, before[1]));
+  TEST_ASSERT_EQUAL(TrackLibrary::compactedIndex(removed, before[2]), current);
+  std::vector<bool> compacted(tracks.count());
+  for (int i = 0; i < 8; i++) {
+    if (played[i] && i != before[0]) compacted[TrackLibrary::compactedIndex(removed, i)] = true;
+  }
+  play(tracks, current, 7 - 3, compacted);
+}
+
+// Tracks added (and one of them deleted) after the last step() are not in the order yet: compact() must
+// not count them, the next step() adds the others exactly once
+static void test_compact_unfollowed() {
+  TrackLibrary tracks;
+  addTracks(tracks, 0, 10);
+  int current = 0;
+  std::vector<bool> played;
+  play(tracks, current, 2, played);
+  addTracks(tracks, 10, 13);
+  Shuffle::remove(11);
+  tracks.remove(11);
+  int unplayed = 0;
+  while (played[unplayed]) unplayed++;
+  Shuffle::remove(unplayed);
+  tracks.remove(unplayed);
+  const std::vector<int> removed = tracks.compact();
+  Shuffle::compact(removed);
+  TEST_ASSERT_EQUAL(9, Shuffle::s_slots);
+
+  std::vector<bool> compacted(tracks.count());
+  for (int i = 0; i < (int)played.size(); i++) {  // The tracks added are not in it
+    if (played[i]) compacted[TrackLibrary::compactedIndex(removed, i)] = true;
+  }
+  current = TrackLibrary::compactedIndex(removed, current);
+  play(tracks, current, 11 - 3, compacted);
+  for (bool p : compacted) TEST_ASSERT_TRUE(p);
+  TEST_ASSERT_EQUAL(tracks.count(), Shuffle::s_count);  // Each track once
+}
+
+static void test_scope() {
+  TrackLibrary tracks;
+  addTracks(tracks, 0, 20);
+  int current = 5;
+  std::vector<bool> seen(20);
+  seen[current] = true;
+  for (int i = 0; i < 3; i++) {
+    current = Shuffle::step(tracks, current, 1, 4, 4);
+    TEST_ASSERT_TRUE(current >= 4 && current < 8);
+    TEST_ASSERT_FALSE(seen[current]);
+    seen[current] = true;
+  }
+  const int last = current;
+  current = Shuffle::step(tracks, current, 1, 4, 4);  // New cycle
+  TEST_ASSERT_TRUE(current >= 4 && current < 8 && current != last);
+  TEST_ASSERT_EQUAL(12, Shuffle::step(tracks, current, 1, 12, 1));  // The only track of its scope
+}
+
+// The order is saved to the card and continues where it was after a reboot
+static void test_saved() {
+  char root[] = "/tmp/shuffle_XXXXXX";
+  TEST_ASSERT_NOT_NULL(mkdtemp(root));
+  hostRoot() = root;
+  TrackLibrary tracks;
+  addTracks(tracks, 0, 30);
+  Shuffle::begin(SD);
+  int current = 3;
+  play(tracks, current, 10);
+  Shuffle::s_lastSave = millis() - SHUFFLE_SAVE_INTERVAL;
+  Shuffle::save();
+  TEST_ASSERT_TRUE(SD.exists(SHUFFLE_FILE));
+  int saved = current;
+  std::vector<int> coming = play(tracks, saved, 5);
+
+  Shuffle::drop();
+  Shuffle::s_loaded = false;
+  TEST_ASSERT_TRUE(play(tracks, current, 5) == coming);
+
+  // A damaged file is dropped, a new order is shuffled
+  const std::string host = std::string(root) + SHUFFLE_FILE;
+  FILE* fp = fopen(host.c_str(), "r+b");
+  TEST_ASSERT_NOT_NULL(fp);
+  fseek(fp, sizeof(Shuffle::FileHeader), SEEK_SET);
+  const int c = fgetc(fp);
+  fseek(fp, -1, SEEK_CUR);
+  fputc(c ^ 1, fp);
+  fclose(fp);
+  Shuffle::drop();
+  Shuffle::s_loaded = false;
+  play(tracks, current, 29);
+
+  Shuffle::s_fs = nullptr;
+  std::string cmd = std::string("rm -rf ") + root;
+  TEST_ASSERT_EQUAL(0, system(cmd.c_str()));
+}
+
+int main() {
+  MemoryBudget::begin();
+  UNITY_BEGIN();
+  RUN_TEST(test_cycles);
+  RUN_TEST(test_back);
+  RUN_TEST(test_picked);
+  RUN_TEST(test_picked_after_remove);
+  RUN_TEST(test_sync_added);
+  RUN_TEST(test_sync_shorter);
+  RUN_TEST(test_removed);
+  RUN_TEST(test_compact);
+  RUN_TEST(test_compact_tombstone);
+  RUN_TEST(test_compact_unfollowed);
+  RUN_TEST(test_scope);
+  RUN_TEST(test_saved);
+  return UNITY_END();
+}
@@ -0,0 +1,186 @@
+// TrackLibrary: a removed track leaves a tombstone so other indexes stay valid, compact() drops them
+#include <unity.h>
+#include "../../src/memory_budget.cpp"
+#include "../../src/track_library.cpp"
+
+static const char* const PATHS[] = {
+    "/music/a.mp3",     "/music/b.mp3",        "/music/A1/01.mp3", "/music/A1/02.mp3",
+    "/music/A1/03.mp3", "/music/A1/CD2/x.mp3", "/music/A2/y.mp3",  "/music/A2/z.mp3",
+};
+static constexpr int COUNT = sizeof(PATHS) / sizeof(PATHS[0]);
+
+static void fill(TrackLibrary& tracks) {
+  for (const char* p : PATHS) TEST_ASSERT_TRUE(tracks.add(p));
+  TEST_ASSERT_EQUAL(COUNT, tracks.count());
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+static void test_add() {
+  TrackLibrary tracks;
+  const uint32_t generation = tracks.generation();
+  fill(tracks);
+  TEST_ASSERT_EQUAL(generation, tracks.generation());  // Adding changes no index
+  for (int i = 0; i < COUNT; i++) {
+    TEST_ASSERT_EQUAL_STRING(PATHS[i], tracks.path(i).c_str());
+    TEST_ASSERT_EQUAL(i, tracks.find(PATHS[i]));
+  }
+  TEST_ASSERT_EQUAL_STRING("x.mp3", tracks.name(5).c_str());
+  TEST_ASSERT_EQUAL(-1, tracks.find("/music/A1/CD2"));
+  TEST_ASSERT_EQUAL_STRING("", tracks.path(COUNT).c_str());
+  TEST_ASSERT_EQUAL_STRING("", tracks.path(-1).c_str());
+}
+
+static void test_remove() {
+  TrackLibrary tracks;
+  fill(tracks);
+  const uint32_t generation = tracks.generation();
+  tracks.remove(3);
+  TEST_ASSERT_EQUAL(COUNT, tracks.count());
+  TEST_ASSERT_EQUAL(1, tracks.deletedCount());
+  TEST_ASSERT_TRUE(tracks.deleted(3));
+  TEST_ASSERT_EQUAL_STRING("", tracks.path(3).c_str());
+  TEST_ASSERT_EQUAL_STRING("", tracks.name(3).c_str());
+  TEST_ASSERT_EQUAL(-1, tracks.find(PATHS[3]));
+  TEST_ASSERT_NOT_EQUAL(generation, tracks.generation());
+  for (int i = 0; i < COUNT; i++) {
+    if (i != 3) TEST_ASSERT_EQUAL_STRING(PATHS[i], tracks.path(i).c_str());
+  }
+  // Removing it again or out of range changes nothing
+  const uint32_t after = tracks.generation();
+  tracks.remove(3);
+  tracks.remove(COUNT);
+  tracks.remove(-1);
+  TEST_ASSERT_EQUAL(1, tracks.deletedCount());
+  TEST_ASSERT_EQUAL(after, tracks.generation());
+  // The same file added again gets a new slot
+  TEST_ASSERT_TRUE(tracks.add(PATHS[3]));
+  TEST_ASSERT_EQUAL(COUNT, tracks.find(PATHS[3]));
+}
+
+// Tombstones inside a directory's range keep it one range; at its ends they are not part of it
+static void test_dir_range() {
+  TrackLibrary tracks;
+  fill(tracks);
+  int first, count;
+  tracks.dirRange("/music/A1", first, count);
+  TEST_ASSERT_EQUAL(2, first);
+  TEST_ASSERT_EQUAL(4, count);
+  tracks.remove(3);
+  tracks.remove(5);
+  tracks.dirRange("/music/A1/", first, count);
+  TEST_ASSERT_EQUAL(2, first);
+  TEST_ASSERT_EQUAL(3, count);
+  tracks.dirRange("/music/A1/CD2", first, count);
+  TEST_ASSERT_EQUAL(0, count);
+  tracks.dirRange("/music/A", first, count);  // Not a prefix of the directory names
+  TEST_ASSERT_EQUAL(0, count);
+  tracks.dirRange("/", first, count);
+  TEST_ASSERT_EQUAL(0, first);
+  TEST_ASSERT_EQUAL(COUNT, count);
+}
+
+static void test_compact() {
+  TrackLibrary tracks;
+  fill(tracks);
+  uint32_t generation = tracks.generation();
+  TEST_ASSERT_TRUE(tracks.compact().empty());  // No tombstones: nothing changes
+  TEST_ASSERT_EQUAL(generation, tracks.generation());
+
+  tracks.remove(7);
+  tracks.remove(0);
+  tracks.remove(4);
+  tracks.remove(5);
+  generation = tracks.generation();
+  const std::vector<int> removed = tracks.compact();
+  TEST_ASSERT_TRUE(removed == std::vector<int>({0, 4, 5, 7}));
+  TEST_ASSERT_EQUAL(COUNT - 4, tracks.count());
+  TEST_ASSERT_EQUAL(0, tracks.deletedCount());
+  TEST_ASSERT_NOT_EQUAL(generation, tracks.generation());
+  const char* const left[] = {"/music/b.mp3", "/music/A1/01.mp3", "/music/A1/02.mp3", "/music/A2/y.mp3"};
+  for (int i = 0; i < 4; i++) {
+    TEST_ASSERT_FALSE(tracks.deleted(i));
+    TEST_ASSERT_EQUAL_STRING(left[i], tracks.path(i).c_str());
+  }
+  int first, count;
+  tracks.dirRange("/music/A1", first, count);
+  TEST_ASSERT_EQUAL(1, first);
+  TEST_ASSERT_EQUAL(2, count);
+  // Adding goes on after the compacted tracks
+  TEST_ASSERT_TRUE(tracks.add("/music/A2/new.mp3"));
+  TEST_ASSERT_EQUAL_STRING("/music/A2/new.mp3", tracks.path(4).c_str());
+}
+
+// Every live track maps to its slot after compact(); a removed one to the track that followed it
+static void test_compacted_index() {
+  TrackLibrary tracks;
+  fill(tracks);
+  std::vector<String> before;
+  for (int i = 0; i < COUNT; i++) before.push_back(tracks.path(i));
+  for (int i : {1, 2, 3, 7}) tracks.remove(i);
+  const std::vector<int> removed = tracks.compact();
+  for (int i = 0; i < COUNT; i++) {
+    const int index = TrackLibrary::compactedIndex(removed, i);
+    if (!std::binary_search(removed.begin(), removed.end(), i)) {
+      TEST_ASSERT_EQUAL_STRING(before[i].c_str(), tracks.path(index).c_str());
+    } else {
+      int following = i + 1;
+      while (following < COUNT && std::binary_search(removed.begin(), removed.end(), following)) following++;
+      TEST_ASSERT_EQUAL(following < COUNT ? tracks.find(before[following]) : tracks.count(), index);
+    }
+  }
+  TEST_ASSERT_EQUAL(5, TrackLibrary::compactedIndex({}, 5));
+}
+
+static void test_swap() {
+  TrackLibrary tracks;
+  TrackLibrary fresh;
+  fill(tracks);
+  tracks.remove(2);
+  TEST_ASSERT_TRUE(fresh.add("/other/t.mp3"));
+  const uint32_t generation = tracks.generation();
+  tracks.swap(fresh);
+  TEST_ASSERT_NOT_EQUAL(generation, tracks.generation());
+  TEST_ASSERT_EQUAL(1, tracks.count());
+  TEST_ASSERT_EQUAL(0, tracks.deletedCount());
+  TEST_ASSERT_EQUAL(COUNT, fresh.count());
+  TEST_ASSERT_EQUAL(1, fresh.deletedCount());
+  TEST_ASSERT_EQUAL_STRING("/music/A1/CD2/x.mp3", fresh.path(5).c_str());
+}
+
+// A full pool refuses the track, the library stays as it was
+static void test_budget() {
+  TrackLibrary tracks;
+  fill(tracks);
+  const MemoryBudget::PoolStats pool = MemoryBudget::getStats(MemoryBudget::Pool::TrackList);
+  const uint32_t hog = pool.limit - pool.used;
+  TEST_ASSERT_TRUE(MemoryBudget::charge(MemoryBudget::Pool::TrackList, hog));
+  int added = 0;
+  char path[48];
+  for (; added < 1000; added++) {
+    snprintf(path, sizeof(path), "/music/A3/track %04d.mp3", added);
+    if (!tracks.add(path)) break;
+  }
+  TEST_ASSERT_TRUE(added < 1000);
+  TEST_ASSERT_EQUAL(COUNT + added, tracks.count());
+  TEST_ASSERT_EQUAL(-1, tracks.find(path));
+  TEST_ASSERT_EQUAL_STRING(PATHS[COUNT - 1], tracks.path(COUNT - 1).c_str());
+  MemoryBudget::release(MemoryBudget::Pool::TrackList, hog);
+  tracks.clear();
+  TEST_ASSERT_EQUAL(0, MemoryBudget::getStats(MemoryBudget::Pool::TrackList).used);
+}
+
+int main() {
+  MemoryBudget::begin();
+  UNITY_BEGIN();
+  RUN_TEST(test_add);
+  RUN_TEST(test_remove);
+  RUN_TEST(test_dir_range);
+  RUN_TEST(test_compact);
+  RUN_TEST(test_compacted_index);
+  RUN_TEST(test_swap);
+  RUN_TEST(test_budget);
+  return UNITY_END();
+}